@@ -0,0 +1,163 @@
+#version 450
+
+// Must match MAX_SHADOW_CASCADES (types.hpp)
+#define MAX_CASCADES 4
+
+// Must match items of "Render target" combo (gui.cpp)
+#define TARGET_POSITION 1
+#define TARGET_NORMAL 2
+#define TARGET_ALBEDO 3
+#define TARGET_SPECULAR 4
+#define TARGET_SHADOW 5
+#define TARGET_CASCADES 6
+
+// MSAA sample count of the G-buffer
+layout(constant_id = 0) const uint NUM_SAMPLES = 1;
+
+layout(location = 0) in vec2 inUV;
+
+layout(location = 0) out vec4 outFragColor;
+
+layout(set = 0, binding = 4) uniform sampler2D samplerAlbedo;
+layout(set = 0, binding = 5) uniform sampler2D samplerPosition;
+layout(set = 0, binding = 6) uniform sampler2D samplerNormal;
+
+// Must match UboComposition (deferred_pipeline.cpp)
+layout(set = 0, binding = 7) uniform UboComposition
+{
+   vec4 lightPosition;
+   vec4 lightTarget;
+   vec4 lightColor;
+   mat4 lightViewMatrix;
+   vec4 viewPos;
+   uint displayDebugTarget;
+   int pcfShadow;
+   float ambientLight;
+   float shadowFactor;
+   mat4 cascadeViewProjection[MAX_CASCADES];
+   // View space depth at which each cascade ends
+   vec4 cascadeSplits;
+   // Part of the layer each cascade is rendered to
+   vec4 cascadeScales;
+   vec4 viewDirection;
+   uint numCascades;
+}
+ubo;
+
+// One layer per cascade
+layout(set = 0, binding = 8) uniform sampler2DArray samplerShadowMap;
+
+uint
+selectCascade(float viewDepth)
+{
+   for (uint cascade = 0; cascade < ubo.numCascades; ++cascade)
+   {
+      if (viewDepth <= ubo.cascadeSplits[cascade])
+      {
+         return cascade;
+      }
+   }
+
+   return ubo.numCascades;
+}
+
+float
+shadowSample(vec3 coord, uint cascade, vec2 offset)
+{
+   const float depth = texture(samplerShadowMap, vec3(coord.xy + offset, float(cascade))).r;
+   return depth < coord.z ? ubo.shadowFactor : 1.0;
+}
+
+// 1.0 for lit fragments, ubo.shadowFactor for shadowed ones
+float
+shadow(vec3 worldPos, uint cascade)
+{
+   // Past the last cascade
+   if (cascade >= ubo.numCascades)
+   {
+      return 1.0;
+   }
+
+   const vec4 clip = ubo.cascadeViewProjection[cascade] * vec4(worldPos, 1.0);
+   vec3 coord = clip.xyz / clip.w;
+
+   // Depth was remapped to [0, 1] when rendering the shadow map (shadow_cascade.vert)
+   coord.xy = (coord.xy * 0.5 + 0.5) * ubo.cascadeScales[cascade];
+   coord.z = coord.z * 0.5 + 0.5;
+   if (coord.z > 1.0)
+   {
+      return 1.0;
+   }
+
+   if (ubo.pcfShadow == 0)
+   {
+      return shadowSample(coord, cascade, vec2(0.0));
+   }
+
+   const vec2 texelSize = 1.0 / vec2(textureSize(samplerShadowMap, 0).xy);
+
+   float sum = 0.0;
+   for (int x = -1; x <= 1; ++x)
+   {
+      for (int y = -1; y <= 1; ++y)
+      {
+         sum += shadowSample(coord, cascade, vec2(x, y) * texelSize);
+      }
+   }
+
+   return sum / 9.0;
+}
+
+const vec3 cascadeColors[MAX_CASCADES] = vec3[](vec3(1.0, 0.25, 0.25), vec3(0.25, 1.0, 0.25),
+                                                vec3(0.25, 0.25, 1.0), vec3(1.0, 1.0, 0.25));
+
+void
+main()
+{
+   const vec3 fragPos = texture(samplerPosition, inUV).rgb;
+   const vec3 normal = texture(samplerNormal, inUV).rgb;
+   const vec4 albedo = texture(samplerAlbedo, inUV);
+
+   const uint cascade = selectCascade(dot(fragPos - ubo.viewPos.xyz, ubo.viewDirection.xyz));
+
+   switch (ubo.displayDebugTarget)
+   {
+      case TARGET_POSITION:
+         outFragColor = vec4(fragPos, 1.0);
+         return;
+      case TARGET_NORMAL:
+         outFragColor = vec4(normal, 1.0);
+         return;
+      case TARGET_ALBEDO:
+         outFragColor = vec4(albedo.rgb, 1.0);
+         return;
+      case TARGET_SPECULAR:
+         outFragColor = vec4(albedo.aaa, 1.0);
+         return;
+      case TARGET_SHADOW:
+         outFragColor = vec4(vec3(shadow(fragPos, cascade)), 1.0);
+         return;
+      case TARGET_CASCADES:
+         outFragColor = vec4(cascade < ubo.numCascades ? cascadeColors[cascade] : vec3(1.0), 1.0)
+                        * vec4(albedo.rgb, 1.0);
+         return;
+   }
+
+   // Background (skybox) doesn't have a normal
+   if (dot(normal, normal) < 1e-6)
+   {
+      outFragColor = vec4(albedo.rgb, 1.0);
+      return;
+   }
+
+   const vec3 N = normalize(normal);
+   const vec3 L = normalize(ubo.lightPosition.xyz - ubo.lightTarget.xyz);
+   const vec3 V = normalize(ubo.viewPos.xyz - fragPos);
+   const vec3 H = normalize(L + V);
+
+   const float diffuse = max(dot(N, L), 0.0);
+   const float specular = pow(max(dot(N, H), 0.0), 32.0) * albedo.a;
+   const vec3 direct = (albedo.rgb * diffuse + vec3(specular)) * ubo.lightColor.rgb;
+
+   outFragColor = vec4(albedo.rgb * ubo.ambientLight + direct * shadow(fragPos, cascade), 1.0);
+}
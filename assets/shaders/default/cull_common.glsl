@@ -0,0 +1,202 @@
+// Shared by cull.comp and cluster_cull.comp, which use the same descriptor set
+
+// Must match MAX_SHADOW_CASCADES, MESH_FLAG_* (types.hpp), CullView and DrawList (culling.hpp)
+// and MAX_MESH_LODS (mesh_lod.hpp)
+#define MAX_CASCADES 4
+#define MAX_LODS 4
+#define NUM_VIEWS (1 + MAX_CASCADES)
+#define VIEW_CAMERA 0
+#define VIEW_SHADOW_CASCADE 1
+#define LIST_CAMERA_EARLY 0
+#define LIST_CAMERA_LATE 1
+#define LIST_SHADOW_CASCADE 2
+#define LIST_SHADOW_CASCADE_DYNAMIC (LIST_SHADOW_CASCADE + MAX_CASCADES)
+// Lists before this one hold numMeshes commands, the cluster ones numMeshlets
+#define LIST_CLUSTER_EARLY (LIST_SHADOW_CASCADE_DYNAMIC + MAX_CASCADES)
+#define LIST_CLUSTER_LATE (LIST_CLUSTER_EARLY + 1)
+#define NUM_LISTS (LIST_CLUSTER_LATE + 1)
+
+#define MESH_FLAG_DYNAMIC 1
+#define MESH_FLAG_MESHLETS 2
+
+#define PHASE_EARLY 0
+#define PHASE_LATE 1
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand
+{
+   uint indexCount;
+   uint instanceCount;
+   uint firstIndex;
+   int vertexOffset;
+   uint firstInstance;
+};
+
+struct MeshLod
+{
+   uint firstIndex;
+   uint indexCount;
+   // World space
+   float error;
+   uint padding;
+};
+
+layout(push_constant) uniform Phase
+{
+   uint phase;
+};
+
+layout(set = 0, binding = 0) uniform CullData
+{
+   // Six planes (xyz normal pointing inside, w distance) per view
+   vec4 planes[NUM_VIEWS * 6];
+   mat4 viewProjection;
+   vec4 cameraPosition;
+   uint numMeshes;
+   uint enabled;
+   uint occlusionEnabled;
+   uint numCascades;
+   // Bit per cascade, static caster lists are only written for cascades whose cached shadow map
+   // gets refreshed
+   uint staticCascades;
+   uint numMeshlets;
+   // Meshes with meshlets are drawn by the cluster lists instead of the camera ones (at full
+   // detail only)
+   uint clusterCulling;
+   // Pixels per unit of world space error at unit distance, and the largest error (in pixels) a
+   // level of detail may have. Zero threshold always selects full detail.
+   float lodScale;
+   float lodThreshold;
+}
+cullData;
+
+// World space bounding sphere per mesh, xyz center and w radius
+layout(std430, set = 0, binding = 1) readonly buffer Bounds
+{
+   vec4 bounds[];
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer Commands
+{
+   DrawCommand commands[];
+};
+
+layout(std430, set = 0, binding = 3) buffer Output
+{
+   // Draw count consumed by vkCmdDrawIndexedIndirectCount
+   uint drawCounts[NUM_LISTS];
+   uint meshCounts[NUM_LISTS];
+   uint triangleCounts[NUM_LISTS];
+   // numMeshes commands per mesh list, followed by numMeshlets per cluster list
+   DrawCommand draws[];
+};
+
+// Non zero when the mesh was visible to the camera in the last frame
+layout(std430, set = 0, binding = 4) buffer Visibility
+{
+   uint visibility[];
+};
+
+// Farthest depth of the area covered by each texel (see depth_pyramid.comp)
+layout(set = 0, binding = 5) uniform sampler2D depthPyramid;
+
+// MESH_FLAG_* bits of every mesh
+layout(std430, set = 0, binding = 6) readonly buffer MeshFlags
+{
+   uint meshFlags[];
+};
+
+// MAX_LODS levels per mesh, unused ones don't have any indices
+layout(std430, set = 0, binding = 9) readonly buffer MeshLods
+{
+   MeshLod meshLods[];
+};
+
+// Coarsest level of detail whose error, projected at the nearest point of the mesh's bounds,
+// stays below the threshold. The camera selects it for every view, so shadows match the mesh.
+uint
+selectLod(uint meshIdx)
+{
+   const vec4 sphere = bounds[meshIdx];
+   const float distance = max(length(sphere.xyz - cullData.cameraPosition.xyz) - sphere.w, 0.0);
+
+   uint lod = 0;
+   for (uint level = 1; level < MAX_LODS; ++level)
+   {
+      const MeshLod candidate = meshLods[meshIdx * MAX_LODS + level];
+      if (candidate.indexCount == 0
+          || candidate.error * cullData.lodScale >= cullData.lodThreshold * distance)
+      {
+         break;
+      }
+      lod = level;
+   }
+
+   return lod;
+}
+
+bool
+isInFrustum(vec4 sphere, uint view)
+{
+   for (uint i = 0; i < 6; ++i)
+   {
+      const vec4 plane = cullData.planes[view * 6 + i];
+      if (dot(plane.xyz, sphere.xyz) + plane.w < -sphere.w)
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+bool
+isOccluded(vec4 sphere)
+{
+   vec2 uvMin = vec2(1.0);
+   vec2 uvMax = vec2(0.0);
+   float nearestDepth = 1.0;
+
+   // Screen space bounds of the sphere's box
+   for (uint i = 0; i < 8; ++i)
+   {
+      const vec3 offset = vec3(float(i & 1), float((i >> 1) & 1), float((i >> 2) & 1));
+      const vec3 corner = sphere.xyz + sphere.w * (offset * 2.0 - 1.0);
+      const vec4 clip = cullData.viewProjection * vec4(corner, 1.0);
+
+      // Crosses the camera plane, bounds can't be projected
+      if (clip.w <= 0.0)
+      {
+         return false;
+      }
+
+      const vec3 ndc = clip.xyz / clip.w;
+      uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+      uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+      nearestDepth = min(nearestDepth, ndc.z);
+   }
+
+   uvMin = clamp(uvMin, 0.0, 1.0);
+   uvMax = clamp(uvMax, 0.0, 1.0);
+
+   // Level at which the bounds cover at most 2x2 texels
+   const vec2 extent = (uvMax - uvMin) * vec2(textureSize(depthPyramid, 0));
+   const int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0,
+                           textureQueryLevels(depthPyramid) - 1);
+
+   const ivec2 levelSize = textureSize(depthPyramid, level);
+   const ivec2 texelMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+   const ivec2 texelMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+   float farthestDepth = 0.0;
+   for (int y = texelMin.y; y <= texelMax.y; ++y)
+   {
+      for (int x = texelMin.x; x <= texelMax.x; ++x)
+      {
+         farthestDepth = max(farthestDepth, texelFetch(depthPyramid, ivec2(x, y), level).r);
+      }
+   }
+
+   return nearestDepth > farthestDepth;
+}
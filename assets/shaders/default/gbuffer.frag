@@ -0,0 +1,59 @@
+#version 450
+// Runtime sized texture array
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 0, binding = 2) uniform sampler textureSampler;
+// Bindless texture table (texture_table.hpp), indexed by PerInstanceBuffer::textures
+layout(set = 1, binding = 0) uniform texture2D textures[];
+
+layout(location = 0) in vec3 inWorldPos;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexCoords;
+layout(location = 3) in vec3 inTangent;
+layout(location = 4) flat in vec3 inTextures;
+
+// Read by composition.frag
+layout(location = 0) out vec4 outPosition;
+layout(location = 1) out vec4 outNormal;
+// rgb albedo, a specular intensity
+layout(location = 2) out vec4 outAlbedo;
+
+// Texture indices come from a single instance per draw, so they're dynamically uniform
+vec4
+sampleTexture(float index)
+{
+   return texture(sampler2D(textures[uint(index)], textureSampler), inTexCoords);
+}
+
+// Only X and Y are stored (BC5 normal maps), Z of a tangent space normal is always positive
+vec3
+decodeNormal(vec4 texel)
+{
+   const vec2 xy = texel.xy * 2.0 - 1.0;
+   return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
+
+void
+main()
+{
+   const vec4 albedo = inTextures.x >= 0.0 ? sampleTexture(inTextures.x) : vec4(1.0);
+   if (albedo.a < 0.5)
+   {
+      discard;
+   }
+
+   vec3 normal = normalize(inNormal);
+   if (inTextures.y >= 0.0 && dot(inTangent, inTangent) > 1e-6)
+   {
+      const vec3 tangent = normalize(inTangent - dot(inTangent, normal) * normal);
+      const mat3 TBN = mat3(tangent, cross(normal, tangent), normal);
+      normal = normalize(TBN * decodeNormal(sampleTexture(inTextures.y)));
+   }
+
+   // glTF metallic-roughness map, roughness is in the green channel
+   const float specular = inTextures.z >= 0.0 ? 1.0 - sampleTexture(inTextures.z).g : 0.0;
+
+   outPosition = vec4(inWorldPos, 1.0);
+   outNormal = vec4(normal, 1.0);
+   outAlbedo = vec4(albedo.rgb, specular);
+}
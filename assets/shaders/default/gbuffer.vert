@@ -0,0 +1,40 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Must match MAX_SHADOW_CASCADES (types.hpp)
+#define MAX_CASCADES 4
+
+#include "vertex_common.glsl"
+
+// Must match UniformBufferObject (types.hpp)
+layout(set = 0, binding = 0) uniform UniformBufferObject
+{
+   mat4 proj;
+   mat4 view;
+   mat4 lightView;
+   mat4 cascadeViewProjection[MAX_CASCADES];
+}
+ubo;
+
+layout(location = 0) out vec3 outWorldPos;
+layout(location = 1) out vec3 outNormal;
+layout(location = 2) out vec2 outTexCoords;
+layout(location = 3) out vec3 outTangent;
+layout(location = 4) flat out vec3 outTextures;
+
+void
+main()
+{
+   // Mesh draws and their meshlet draws both carry the mesh index as first instance
+   const PerInstance instance = instances[gl_InstanceIndex];
+   const vec4 worldPos = instance.model * vec4(decodePosition(instance), 1.0);
+   const mat3 normalMatrix = transpose(inverse(mat3(instance.model)));
+
+   outWorldPos = worldPos.xyz;
+   outNormal = normalMatrix * decodeDirection(inNormal);
+   outTexCoords = inTexCoords;
+   outTangent = mat3(instance.model) * decodeDirection(inTangent);
+   outTextures = instance.textures.xyz;
+
+   gl_Position = ubo.proj * ubo.view * worldPos;
+}
@@ -0,0 +1,35 @@
+#version 450
+#extension GL_ARB_shader_viewport_layer_array : require
+#extension GL_GOOGLE_include_directive : require
+
+// Must match MAX_SHADOW_CASCADES (types.hpp)
+#define MAX_CASCADES 4
+
+#include "vertex_common.glsl"
+
+layout(push_constant) uniform Cascade
+{
+   uint cascade;
+};
+
+// Must match UniformBufferObject (types.hpp)
+layout(set = 0, binding = 0) uniform UniformBufferObject
+{
+   mat4 proj;
+   mat4 view;
+   mat4 lightView;
+   mat4 cascadeViewProjection[MAX_CASCADES];
+}
+ubo;
+
+void
+main()
+{
+   const PerInstance instance = instances[gl_InstanceIndex];
+   const vec4 worldPos = instance.model * vec4(decodePosition(instance), 1.0);
+
+   gl_Position = ubo.cascadeViewProjection[cascade] * worldPos;
+   // Light matrices use OpenGL depth range, remap it to Vulkan's [0, 1]
+   gl_Position.z = (gl_Position.z + gl_Position.w) * 0.5;
+   gl_Layer = int(cascade);
+}
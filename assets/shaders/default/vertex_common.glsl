@@ -0,0 +1,60 @@
+// Shared by the vertex shaders drawing meshes (gbuffer.vert, shadow_cascade.vert)
+
+// Must match PerInstanceBuffer (types.hpp)
+struct PerInstance
+{
+   mat4 model;
+   // Diffuse, normal and specular texture index, negative when the mesh doesn't have one
+   vec4 textures;
+   // Model space bounds (xyz minimum and extent) packed positions are quantized within
+   vec4 positionOffset;
+   vec4 positionScale;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances
+{
+   PerInstance instances[];
+};
+
+#ifdef PACKED_VERTICES
+// Must match PackedVertex (vertex.hpp)
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNormal;
+layout(location = 2) in vec2 inTexCoords;
+layout(location = 3) in vec2 inTangent;
+
+vec3
+decodePosition(PerInstance instance)
+{
+   return instance.positionOffset.xyz + inPosition.xyz * instance.positionScale.xyz;
+}
+
+// Octahedral encoding (see packDirection in vertex.cpp)
+vec3
+decodeDirection(vec2 encoded)
+{
+   vec3 direction = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+   const float fold = max(-direction.z, 0.0);
+   direction.x += direction.x >= 0.0 ? -fold : fold;
+   direction.y += direction.y >= 0.0 ? -fold : fold;
+   return normalize(direction);
+}
+#else
+// Must match Vertex (vertex.hpp)
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexCoords;
+layout(location = 3) in vec3 inTangent;
+
+vec3
+decodePosition(PerInstance instance)
+{
+   return inPosition;
+}
+
+vec3
+decodeDirection(vec3 direction)
+{
+   return direction;
+}
+#endif
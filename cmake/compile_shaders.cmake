@@ -1,7 +1,9 @@
+# Adds a build step compiling SOURCE_FILE with glslc, re-run whenever the source or any of the
+# files it includes (DEPENDS) changes. Output is appended to SHADER_OUTPUTS in the caller's scope.
 function(compile_shader)
     set(options "")
-    set(oneValueArgs SOURCE_FILE OUTPUT_FILE_NAME)
-    set(multiValueArgs DEFINES)
+    set(oneValueArgs SOURCE_FILE OUTPUT_FILE_NAME TARGET_ENV)
+    set(multiValueArgs DEFINES DEPENDS)
     cmake_parse_arguments(params "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
 
     if (NOT params_SOURCE_FILE)
@@ -12,6 +14,24 @@ function(compile_shader)
         message(FATAL_ERROR "compile_shader: OUTPUT_FILE_NAME argument missing")
     endif()
 
-    execute_process(COMMAND ${Vulkan_GLSLC_EXECUTABLE} "${params_SOURCE_FILE}" -o "${params_OUTPUT_FILE_NAME}")
+    set(target_env "")
+    if (params_TARGET_ENV)
+        set(target_env "--target-env=${params_TARGET_ENV}")
+    endif()
+
+    set(defines "")
+    foreach(define ${params_DEFINES})
+        list(APPEND defines "-D${define}")
+    endforeach()
+
+    get_filename_component(shader_name "${params_SOURCE_FILE}" NAME)
+    add_custom_command(
+        OUTPUT "${params_OUTPUT_FILE_NAME}"
+        COMMAND ${Vulkan_GLSLC_EXECUTABLE} ${target_env} ${defines} "${params_SOURCE_FILE}" -o "${params_OUTPUT_FILE_NAME}"
+        DEPENDS "${params_SOURCE_FILE}" ${params_DEPENDS}
+        COMMENT "Compiling shader ${shader_name}"
+        VERBATIM)
+
+    set(SHADER_OUTPUTS ${SHADER_OUTPUTS} "${params_OUTPUT_FILE_NAME}" PARENT_SCOPE)
 
 endfunction()
@@ -1,7 +1,16 @@
 #include "gui.hpp"
 #include "app/input/input_manager.hpp"
 #include "buffer.hpp"
+#include "command.hpp"
 #include "render/common.hpp"
+#include "render/culling.hpp"
+#include "render/deferred_pipeline.hpp"
+#include "render/frame_stats.hpp"
+#include "render/memory_allocator.hpp"
+#include "render/pipeline_cache.hpp"
+#include "render/sampler_cache.hpp"
+#include "render/shader_reloader.hpp"
+#include "render/texture_streamer.hpp"
 #include "renderer.hpp"
 #include "scene/scene.hpp"
 #include "shader.hpp"
@@ -11,12 +20,48 @@
 #include <GLFW/glfw3.h>
 #include <fmt/format.h>
 #include <imgui.h>
+#include <algorithm>
 #include <array>
+#include <initializer_list>
+#include <utility>
 
 namespace shady::app::gui {
 
 using namespace shady::render;
 
+// Hash of everything that ends up baked into the recorded UI commands (draw ranges, scissors and
+// the display size). Vertex/index data itself is read by GPU, so it can change freely.
+static inline uint64_t
+HashDrawCommands(const ImDrawData* drawData)
+{
+   // FNV-1a
+   uint64_t hash = 14695981039346656037ULL;
+   const auto combine = [&hash](const void* data, size_t size) {
+      const auto* bytes = static_cast< const uint8_t* >(data);
+      for (size_t i = 0; i < size; ++i)
+      {
+         hash = (hash ^ bytes[i]) * 1099511628211ULL;
+      }
+   };
+
+   combine(&drawData->DisplaySize, sizeof(drawData->DisplaySize));
+   combine(&drawData->CmdListsCount, sizeof(drawData->CmdListsCount));
+
+   for (int32_t i = 0; i < drawData->CmdListsCount; i++)
+   {
+      const ImDrawList* cmd_list = drawData->CmdLists[i];
+      combine(&cmd_list->VtxBuffer.Size, sizeof(cmd_list->VtxBuffer.Size));
+
+      for (const auto& cmd : cmd_list->CmdBuffer)
+      {
+         combine(&cmd.ClipRect, sizeof(cmd.ClipRect));
+         combine(&cmd.ElemCount, sizeof(cmd.ElemCount));
+      }
+   }
+
+   return hash;
+}
+
 static inline void
 SetStyle()
 {
@@ -135,7 +180,7 @@ Gui::Shutdown()
 }
 
 bool
-Gui::UpdateBuffers()
+Gui::UpdateBuffers(uint32_t frame)
 {
    ImDrawData* imDrawData = ImGui::GetDrawData();
    bool updateCmdBuffers = false;
@@ -145,6 +190,8 @@ Gui::UpdateBuffers()
       return false;
    };
 
+   auto& drawCommandsHash = m_drawCommandsHashes.at(frame);
+
    // Note: Alignment is done inside buffer creation
    const VkDeviceSize vertexBufferSize =
       static_cast< uint32_t >(imDrawData->TotalVtxCount) * sizeof(ImDrawVert);
@@ -154,40 +201,56 @@ Gui::UpdateBuffers()
    // Update buffers only if vertex or index count has been changed compared to current buffer size
    if ((vertexBufferSize == 0) || (indexBufferSize == 0))
    {
-      return false;
+      // Nothing to draw, previously recorded UI commands have to go away
+      const auto wasEmpty = drawCommandsHash == 0;
+      drawCommandsHash = 0;
+      return !wasEmpty;
+   }
+
+   const auto newHash = HashDrawCommands(imDrawData);
+   if (newHash != drawCommandsHash)
+   {
+      drawCommandsHash = newHash;
+      updateCmdBuffers = true;
    }
 
+   // Buffers of the previous frames may still be in use by the GPU, only touch the ones for 'frame'
+   auto& vertexBuffer = m_vertexBuffers.at(frame);
+   auto& indexBuffer = m_indexBuffers.at(frame);
+   auto& vertexCount = m_vertexCounts.at(frame);
+   auto& indexCount = m_indexCounts.at(frame);
+
    // Vertex buffer
-   if ((m_vertexBuffer.GetBuffer() == VK_NULL_HANDLE) || (m_vertexCount != imDrawData->TotalVtxCount))
+   if ((vertexBuffer.GetBuffer() == VK_NULL_HANDLE) || (vertexCount != imDrawData->TotalVtxCount))
    {
-      m_vertexBuffer.Unmap();
-      m_vertexBuffer.Destroy();
+      vertexBuffer.Unmap();
+      vertexBuffer.Destroy();
 
-      m_vertexBuffer = Buffer::CreateBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-      m_vertexCount = imDrawData->TotalVtxCount;
-      m_vertexBuffer.Map();
+      vertexBuffer = Buffer::CreateBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+      vertexCount = imDrawData->TotalVtxCount;
+      vertexBuffer.Map();
 
       updateCmdBuffers = true;
    }
 
    // Index buffer
-   if ((m_indexBuffer.GetBuffer() == VK_NULL_HANDLE) || (m_indexCount < imDrawData->TotalIdxCount))
+   if ((indexBuffer.GetBuffer() == VK_NULL_HANDLE) || (indexCount < imDrawData->TotalIdxCount))
    {
-      m_indexBuffer.Unmap();
-      m_indexBuffer.Destroy();
+      indexBuffer.Unmap();
+      indexBuffer.Destroy();
 
-      m_indexBuffer = Buffer::CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-      m_indexCount = imDrawData->TotalIdxCount;
-      m_indexBuffer.Map();
+      indexBuffer = Buffer::CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+      indexCount = imDrawData->TotalIdxCount;
+      indexBuffer.Map();
 
       updateCmdBuffers = true;
    }
 
    // Upload data
-   auto* vtxDst = static_cast< ImDrawVert* >(m_vertexBuffer.GetMappedMemory());
-   auto* idxDst = static_cast< ImDrawIdx* >(m_indexBuffer.GetMappedMemory());
+   auto* vtxDst = static_cast< ImDrawVert* >(vertexBuffer.GetMappedMemory());
+   auto* idxDst = static_cast< ImDrawIdx* >(indexBuffer.GetMappedMemory());
 
    for (int cmd_idx = 0; cmd_idx < imDrawData->CmdListsCount; cmd_idx++)
    {
@@ -201,8 +264,8 @@ Gui::UpdateBuffers()
    }
 
    // Flush to make writes visible to GPU
-   m_vertexBuffer.Flush();
-   m_indexBuffer.Flush();
+   vertexBuffer.Flush();
+   indexBuffer.Flush();
 
    return updateCmdBuffers;
 }
@@ -233,7 +296,8 @@ Gui::UpdateUI(const glm::ivec2& windowSize, scene::Scene& scene)
    if (ImGui::CollapsingHeader("Scene"))
    {
       const auto items =
-         std::to_array({"Full scene", "Position", "Normal", "Albedo", "Specular", "ShadowMap"});
+         std::to_array({"Full scene", "Position", "Normal", "Albedo", "Specular", "ShadowMap",
+                        "Cascades"});
 
       // Label to preview before opening the combo
       const auto* combo_label = items.at(Data::m_debugData.displayDebugTarget);
@@ -283,6 +347,37 @@ Gui::UpdateUI(const glm::ivec2& windowSize, scene::Scene& scene)
       if (ImGui::SliderFloat("Shadow Factor", &Data::m_debugData.shadowFactor, 0.0f, 1.0f))
       {
       }
+
+      auto& light = scene.GetLight();
+      auto numCascades = static_cast< int32_t >(light.GetNumCascades());
+      auto splitLambda = light.GetSplitLambda();
+      ImGui::SliderInt("Cascades", &numCascades, 1, static_cast< int32_t >(MAX_SHADOW_CASCADES));
+      ImGui::SliderFloat("Split lambda", &splitLambda, 0.0f, 1.0f);
+      light.SetCascades(static_cast< uint32_t >(numCascades), splitLambda);
+
+      const auto& cascades = light.GetCascades();
+      for (uint32_t cascade = 0; cascade < light.GetNumCascades(); ++cascade)
+      {
+         ImGui::TextUnformatted(fmt::format("  cascade {} up to {:.1f}, {}x{}", cascade,
+                                            cascades.at(cascade).splitDepth,
+                                            Data::m_shadowCascadeResolutions.at(cascade),
+                                            Data::m_shadowCascadeResolutions.at(cascade))
+                                   .c_str());
+      }
+
+      auto shadowCacheEnabled = DeferredPipeline::IsShadowCacheEnabled();
+      ImGui::Checkbox("Cache static shadows", &shadowCacheEnabled);
+      DeferredPipeline::SetShadowCacheEnabled(shadowCacheEnabled);
+
+      const auto& cacheStats = DeferredPipeline::GetShadowCacheStats();
+      for (uint32_t cascade = 0; cascade < light.GetNumCascades(); ++cascade)
+      {
+         ImGui::TextUnformatted(fmt::format("  cascade {} cache {} ({} hits, {} misses)", cascade,
+                                            cacheStats.hit.at(cascade) ? "hit" : "miss",
+                                            cacheStats.hits.at(cascade),
+                                            cacheStats.misses.at(cascade))
+                                   .c_str());
+      }
    }
 
    if (ImGui::CollapsingHeader("Lights"))
@@ -299,6 +394,150 @@ Gui::UpdateUI(const glm::ivec2& windowSize, scene::Scene& scene)
       light.SetColor(light_color);
    }
 
+   if (ImGui::CollapsingHeader("Performance"))
+   {
+      const auto& timings = FrameStats::GetLastFrame();
+
+      ImGui::Text("CPU (ms)");
+      for (uint32_t stage = 0; stage < NUM_CPU_STAGES; ++stage)
+      {
+         ImGui::TextUnformatted(fmt::format("  {:<12} {:.3f}",
+                                            ToString(static_cast< CpuStage >(stage)),
+                                            timings.cpu.at(stage))
+                                   .c_str());
+      }
+
+      ImGui::Text(" ");
+      if (timings.gpuValid)
+      {
+         ImGui::Text("GPU (ms)");
+         for (uint32_t pass = 0; pass < NUM_GPU_PASSES; ++pass)
+         {
+            ImGui::TextUnformatted(fmt::format("  {:<12} {:.3f}",
+                                               ToString(static_cast< GpuPass >(pass)),
+                                               timings.gpu.at(pass))
+                                      .c_str());
+         }
+
+         ImGui::Text(" ");
+         ImGui::TextUnformatted(fmt::format("CPU/GPU overlap {:.3f} ms ({:.0f}%)",
+                                            timings.overlap, timings.overlapRatio * 100.0)
+                                   .c_str());
+      }
+      else
+      {
+         ImGui::Text("GPU timings not available");
+      }
+   }
+
+   if (ImGui::CollapsingHeader("Culling"))
+   {
+      auto cullingEnabled = GpuCulling::IsEnabled();
+      ImGui::Checkbox("Frustum culling", &cullingEnabled);
+      GpuCulling::SetEnabled(cullingEnabled);
+
+      auto occlusionEnabled = GpuCulling::IsOcclusionEnabled();
+      ImGui::Checkbox("Occlusion culling", &occlusionEnabled);
+      GpuCulling::SetOcclusionEnabled(occlusionEnabled);
+
+      auto clusterCullingEnabled = GpuCulling::IsClusterCullingEnabled();
+      ImGui::Checkbox("Cluster culling", &clusterCullingEnabled);
+      GpuCulling::SetClusterCullingEnabled(clusterCullingEnabled);
+
+      auto lodThreshold = GpuCulling::GetLodThreshold();
+      ImGui::SliderFloat("LOD threshold (px)", &lodThreshold, 0.0f, 8.0f);
+      GpuCulling::SetLodThreshold(lodThreshold);
+
+      const auto& stats = GpuCulling::GetStats();
+      const auto printLists = [&stats](const std::string& name,
+                                       std::initializer_list< DrawList > lists) {
+         uint32_t meshes = 0;
+         uint32_t triangles = 0;
+         for (const auto list : lists)
+         {
+            meshes += stats.meshes.at(static_cast< size_t >(list));
+            triangles += stats.triangles.at(static_cast< size_t >(list));
+         }
+
+         ImGui::TextUnformatted(fmt::format("  {:<8} {} visible, {} culled, {} triangles", name,
+                                            meshes, stats.total - std::min(meshes, stats.total),
+                                            triangles)
+                                   .c_str());
+      };
+
+      ImGui::TextUnformatted(fmt::format("Meshes {}", stats.total).c_str());
+      printLists("camera", {DrawList::CAMERA_EARLY, DrawList::CAMERA_LATE});
+      for (uint32_t cascade = 0; cascade < scene.GetLight().GetNumCascades(); ++cascade)
+      {
+         printLists(fmt::format("cascade{}", cascade),
+                    {ShadowCascadeList(cascade), DynamicShadowCascadeList(cascade)});
+      }
+      ImGui::TextUnformatted(
+         fmt::format("  {} meshes disoccluded (second phase)",
+                     stats.meshes.at(static_cast< size_t >(DrawList::CAMERA_LATE)))
+            .c_str());
+
+      if (stats.totalMeshlets > 0)
+      {
+         const auto clusters = stats.meshes.at(static_cast< size_t >(DrawList::CLUSTER_EARLY))
+                               + stats.meshes.at(static_cast< size_t >(DrawList::CLUSTER_LATE));
+         ImGui::TextUnformatted(fmt::format("Meshlets {}", stats.totalMeshlets).c_str());
+         ImGui::TextUnformatted(
+            fmt::format("  clusters {} visible, {} culled, {} triangles", clusters,
+                        stats.totalMeshlets - std::min(clusters, stats.totalMeshlets),
+                        stats.triangles.at(static_cast< size_t >(DrawList::CLUSTER_EARLY))
+                           + stats.triangles.at(static_cast< size_t >(DrawList::CLUSTER_LATE)))
+               .c_str());
+      }
+   }
+
+   if (ImGui::CollapsingHeader("Memory"))
+   {
+      constexpr double bytesInMB = 1024.0 * 1024.0;
+      const auto stats = MemoryAllocator::GetStats();
+
+      for (uint32_t heap = 0; heap < stats.heaps.size(); ++heap)
+      {
+         const auto& heapStats = stats.heaps[heap];
+         if (heapStats.blocks == 0)
+         {
+            continue;
+         }
+
+         ImGui::TextUnformatted(
+            fmt::format("Heap {} ({}, {:.0f} MB)", heap,
+                        heapStats.deviceLocal ? "device local" : "host",
+                        static_cast< double >(heapStats.heapSize) / bytesInMB)
+               .c_str());
+         ImGui::TextUnformatted(
+            fmt::format("  {} blocks, {} allocations", heapStats.blocks, heapStats.allocations)
+               .c_str());
+         ImGui::TextUnformatted(
+            fmt::format("  {:.2f} / {:.2f} MB used, {:.0f}% fragmented",
+                        static_cast< double >(heapStats.usedBytes) / bytesInMB,
+                        static_cast< double >(heapStats.allocatedBytes) / bytesInMB,
+                        heapStats.fragmentation * 100.0f)
+               .c_str());
+      }
+
+      ImGui::Text(" ");
+      ImGui::TextUnformatted(fmt::format("Device memory allocations {} / {}",
+                                         stats.deviceMemoryAllocations,
+                                         stats.maxDeviceMemoryAllocations)
+                                .c_str());
+
+      const auto samplerStats = SamplerCache::GetStats();
+      ImGui::TextUnformatted(fmt::format("Samplers {} / {} ({} requested)", samplerStats.samplers,
+                                         samplerStats.maxSamplers, samplerStats.requests)
+                                .c_str());
+
+      const auto streamingStats = TextureStreamer::GetStats();
+      ImGui::TextUnformatted(fmt::format("Textures {} ({} block compressed), {:.2f} MB uploaded",
+                                         streamingStats.resident, streamingStats.compressed,
+                                         static_cast< double >(streamingStats.bytes) / bytesInMB)
+                                .c_str());
+   }
+
    if (ImGui::CollapsingHeader("Debug"))
    {
       ImGui::InputFloat2("Mouse Position", &mousePos[0], "%.1f", ImGuiInputTextFlags_ReadOnly);
@@ -307,19 +546,21 @@ Gui::UpdateUI(const glm::ivec2& windowSize, scene::Scene& scene)
    ImGui::End();
    ImGui::Render();
 
-   UpdateBuffers();
+   // Draw data is uploaded by Renderer (see Gui::UpdateBuffers), once the GPU is done with
+   // the buffers of the frame that's about to be recorded
 
    return io_handle.WantCaptureMouse;
 }
 
 void
-Gui::Render(VkCommandBuffer commandBuffer)
+Gui::Render(VkCommandBuffer commandBuffer, uint32_t frame)
 {
    auto* imDrawData = ImGui::GetDrawData();
    int32_t vertexOffset = 0;
    uint32_t indexOffset = 0;
 
-   if ((!imDrawData) || (imDrawData->CmdListsCount == 0))
+   if ((!imDrawData) || (imDrawData->CmdListsCount == 0) || (imDrawData->TotalVtxCount == 0)
+       || (m_vertexBuffers.at(frame).GetBuffer() == VK_NULL_HANDLE))
    {
       return;
    }
@@ -336,8 +577,10 @@ Gui::Render(VkCommandBuffer commandBuffer)
                       sizeof(PushConstBlock), &m_pushConstant);
 
    std::array<VkDeviceSize, 1> offsets = {0};
-   vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_vertexBuffer.GetBuffer(), offsets.data());
-   vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer.GetBuffer(), 0, VK_INDEX_TYPE_UINT16);
+   vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_vertexBuffers.at(frame).GetBuffer(),
+                          offsets.data());
+   vkCmdBindIndexBuffer(commandBuffer, m_indexBuffers.at(frame).GetBuffer(), 0,
+                        VK_INDEX_TYPE_UINT16);
 
    for (int32_t i = 0; i < imDrawData->CmdListsCount; i++)
    {
@@ -386,6 +629,8 @@ Gui::PrepareResources()
       Texture::CreateImageView(m_fontImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 
 
+   Command::BeginBatch();
+
    Texture::TransitionImageLayout(m_fontImage, VK_IMAGE_LAYOUT_UNDEFINED,
                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
 
@@ -395,8 +640,10 @@ Gui::PrepareResources()
    Texture::TransitionImageLayout(m_fontImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
 
+   Command::EndBatch();
+
    // Font texture Sampler
-   m_sampler = Texture::CreateSampler();
+   m_sampler = SamplerCache::Get(SamplerKey{});
 
    // Descriptor pool
    VkDescriptorPoolSize descriptorPoolSize{};
@@ -482,6 +729,19 @@ Gui::PreparePipeline(VkPipelineCache pipelineCache, VkRenderPass renderPass)
                                    &m_pipelineLayout),
             "");
 
+   m_pipeline = BuildPipeline(pipelineCache, renderPass);
+   utils::Assert(m_pipeline != VK_NULL_HANDLE, "Gui: failed to create pipeline!");
+
+   ShaderReloader::Register(
+      {"gui",
+       {"default/ui.vert.spv", "default/ui.frag.spv"},
+       [pipelineCache, renderPass] { return BuildPipeline(pipelineCache, renderPass); },
+       [](VkPipeline pipeline) { return std::exchange(m_pipeline, pipeline); }});
+}
+
+VkPipeline
+Gui::BuildPipeline(VkPipelineCache pipelineCache, VkRenderPass renderPass)
+{
    // Setup graphics pipeline for UI rendering
    VkPipelineInputAssemblyStateCreateInfo pipelineInputAssemblyStateCreateInfo{};
    pipelineInputAssemblyStateCreateInfo.sType =
@@ -553,6 +813,12 @@ Gui::PreparePipeline(VkPipelineCache pipelineCache, VkRenderPass renderPass)
 
    auto [vertexInfo, fragmentInfo] =
       Shader::CreateShader(Data::vk_device, "default/ui.vert.spv", "default/ui.frag.spv");
+   if (!vertexInfo.IsValid() || !fragmentInfo.IsValid())
+   {
+      vertexInfo.Destroy();
+      fragmentInfo.Destroy();
+      return VK_NULL_HANDLE;
+   }
    std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {vertexInfo.shaderInfo,
                                                      fragmentInfo.shaderInfo};
 
@@ -620,9 +886,14 @@ Gui::PreparePipeline(VkPipelineCache pipelineCache, VkRenderPass renderPass)
 
    pipelineCreateInfo.pVertexInputState = &pipelineVertexInputStateCreateInfo;
 
-   VK_CHECK(vkCreateGraphicsPipelines(Data::vk_device, pipelineCache, 1, &pipelineCreateInfo,
-                                      nullptr, &m_pipeline),
-            "");
+   VkPipeline pipeline = {};
+   const auto result =
+      PipelineCache::CreateGraphicsPipeline("gui", pipelineCache, pipelineCreateInfo, &pipeline);
+
+   vertexInfo.Destroy();
+   fragmentInfo.Destroy();
+
+   return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
 }
 
 } // namespace shady::app::gui
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "buffer.hpp"
+#include "types.hpp"
 
+#include <array>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -33,19 +35,30 @@ class Gui
    static bool
    UpdateUI(const glm::ivec2& windowSize, scene::Scene& scene);
 
+   // Upload the current ImGui draw data into the buffers owned by given frame in flight.
+   // GPU has to be done with the previous use of 'frame' buffers.
+   // Returns true when the commands recorded by Render for 'frame' are out of date.
    static bool
-   UpdateBuffers();
+   UpdateBuffers(uint32_t frame);
 
+   // Can be recorded into a secondary command buffer and reused for as long as
+   // UpdateBuffers returns false for 'frame'
    static void
-   Render(VkCommandBuffer commandBuffer);
+   Render(VkCommandBuffer commandBuffer, uint32_t frame);
 
  private:
    static void
    PrepareResources();
 
+   // Creates the pipeline layout and the pipeline, which is registered for hot reloading
    static void
    PreparePipeline(VkPipelineCache pipelineCache, VkRenderPass renderPass);
 
+   // Safe to call from any thread once the pipeline layout exists,
+   // VK_NULL_HANDLE when the shaders or the pipeline can't be created (the error is logged)
+   [[nodiscard]] static VkPipeline
+   BuildPipeline(VkPipelineCache pipelineCache, VkRenderPass renderPass);
+
  private:
    inline static VkImage m_fontImage = {};
    inline static VkDeviceMemory m_fontMemory = {};
@@ -60,10 +73,12 @@ class Gui
    inline static uint32_t m_subpass = 0;
 
    inline static PushConstBlock m_pushConstant = {};
-   inline static render::Buffer m_vertexBuffer = {};
-   inline static render::Buffer m_indexBuffer = {};
-   inline static int32_t m_vertexCount = 0;
-   inline static int32_t m_indexCount = 0;
+   inline static std::array< render::Buffer, render::MAX_FRAMES_IN_FLIGHT > m_vertexBuffers = {};
+   inline static std::array< render::Buffer, render::MAX_FRAMES_IN_FLIGHT > m_indexBuffers = {};
+   inline static std::array< int32_t, render::MAX_FRAMES_IN_FLIGHT > m_vertexCounts = {};
+   inline static std::array< int32_t, render::MAX_FRAMES_IN_FLIGHT > m_indexCounts = {};
+   // Layout of the draw commands that were last uploaded for given frame (see UpdateBuffers)
+   inline static std::array< uint64_t, render::MAX_FRAMES_IN_FLIGHT > m_drawCommandsHashes = {};
 };
 
 } // namespace shady::app::gui
@@ -7,6 +7,7 @@ main(int /*argc*/, char** /*argv*/)
 
    shady.Init();
    shady.MainLoop();
+   shady.Shutdown();
 
    return 0;
 }
@@ -51,6 +51,12 @@ Shady::MainLoop()
    }
 }
 
+void
+Shady::Shutdown()
+{
+   render::Renderer::Shutdown();
+}
+
 void
 Shady::OnUpdate()
 {
@@ -24,6 +24,9 @@ class Shady : public input::InputListener
    void
    MainLoop();
 
+   void
+   Shutdown();
+
    // InputListener overrides
  public:
    void
@@ -0,0 +1,240 @@
+/*
+ * Microbenchmark of glTF vertex attribute decoding. Compares the old per-element path
+ * (accessor lookup, checks and stride computation repeated for every element) with
+ * the bulk decoders from scene/accessor.hpp, on synthetic interleaved vertex data.
+ */
+
+#include "scene/accessor.hpp"
+#include "utils/assert.hpp"
+
+#include <tiny_gltf.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <fmt/format.h>
+#include <limits>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using namespace shady;
+
+// Interleaved source layout: position (vec3), normal (vec3), tangent (vec4), uv (vec2)
+struct SourceVertex
+{
+   float position[3];
+   float normal[3];
+   float tangent[4];
+   float uv[2];
+};
+
+tinygltf::Model
+CreateModel(size_t numVertices)
+{
+   std::mt19937 generator(42);
+   std::uniform_real_distribution< float > distribution(-1.0f, 1.0f);
+
+   std::vector< SourceVertex > source(numVertices);
+   for (auto& vertex : source)
+   {
+      for (auto& value : vertex.position)
+      {
+         value = distribution(generator) * 100.0f;
+      }
+      for (auto& value : vertex.normal)
+      {
+         value = distribution(generator);
+      }
+      for (auto& value : vertex.tangent)
+      {
+         value = distribution(generator);
+      }
+      for (auto& value : vertex.uv)
+      {
+         value = (distribution(generator) + 1.0f) * 0.5f;
+      }
+   }
+
+   tinygltf::Model model;
+   model.buffers.resize(1);
+   model.buffers[0].data.resize(source.size() * sizeof(SourceVertex));
+   std::memcpy(model.buffers[0].data.data(), source.data(), model.buffers[0].data.size());
+
+   tinygltf::BufferView view;
+   view.buffer = 0;
+   view.byteLength = model.buffers[0].data.size();
+   view.byteStride = sizeof(SourceVertex);
+   model.bufferViews.push_back(view);
+
+   const auto addAccessor = [&model, numVertices](size_t offset, int type) {
+      tinygltf::Accessor accessor;
+      accessor.bufferView = 0;
+      accessor.byteOffset = offset;
+      accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+      accessor.type = type;
+      accessor.count = numVertices;
+      model.accessors.push_back(accessor);
+   };
+
+   addAccessor(offsetof(SourceVertex, position), TINYGLTF_TYPE_VEC3);
+   addAccessor(offsetof(SourceVertex, normal), TINYGLTF_TYPE_VEC3);
+   addAccessor(offsetof(SourceVertex, tangent), TINYGLTF_TYPE_VEC4);
+   addAccessor(offsetof(SourceVertex, uv), TINYGLTF_TYPE_VEC2);
+
+   return model;
+}
+
+// Same lookups and checks that Model::LoadModel used to do for every element
+template < typename VecType >
+VecType
+ReadElement(const tinygltf::Model& model, const tinygltf::Accessor& acc, size_t idx)
+{
+   utils::Assert(acc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT,
+                 "Unsupported accessor format");
+
+   utils::Assert(acc.bufferView >= 0
+                    && static_cast< size_t >(acc.bufferView) < model.bufferViews.size(),
+                 "bufferView index out of range");
+   const auto& view = model.bufferViews[static_cast< size_t >(acc.bufferView)];
+   utils::Assert(view.buffer >= 0 && static_cast< size_t >(view.buffer) < model.buffers.size(),
+                 "buffer index out of range");
+   const auto& buffer = model.buffers[static_cast< size_t >(view.buffer)];
+
+   const auto strideSigned = acc.ByteStride(view);
+   utils::Assert(strideSigned > 0, "Invalid byte stride");
+   const auto stride = static_cast< size_t >(strideSigned);
+
+   VecType result;
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   std::memcpy(&result, buffer.data.data() + view.byteOffset + acc.byteOffset + idx * stride,
+               sizeof(VecType));
+   return result;
+}
+
+void
+DecodePerElement(const tinygltf::Model& model, const glm::mat4& worldMat,
+                 const glm::mat3& normalMat, std::vector< render::Vertex >& vertices)
+{
+   for (size_t i = 0; i < vertices.size(); ++i)
+   {
+      auto& vertex = vertices[i];
+      const auto position = ReadElement< glm::vec3 >(model, model.accessors[0], i);
+      vertex.m_position = glm::vec3(worldMat * glm::vec4(position, 1.0f));
+      vertex.m_normal =
+         glm::normalize(normalMat * ReadElement< glm::vec3 >(model, model.accessors[1], i));
+      vertex.m_tangent = glm::normalize(
+         normalMat * glm::vec3(ReadElement< glm::vec4 >(model, model.accessors[2], i)));
+      vertex.m_texCoords = ReadElement< glm::vec2 >(model, model.accessors[3], i);
+   }
+}
+
+scene::AccessorView
+ToView(const tinygltf::Model& model, const tinygltf::Accessor& acc)
+{
+   const auto& view = model.bufferViews[static_cast< size_t >(acc.bufferView)];
+
+   scene::AccessorView result;
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   result.data = model.buffers[0].data.data() + view.byteOffset + acc.byteOffset;
+   result.count = acc.count;
+   result.stride = static_cast< size_t >(acc.ByteStride(view));
+   result.componentType = static_cast< scene::ComponentType >(acc.componentType);
+   result.numComponents =
+      static_cast< uint32_t >(tinygltf::GetNumComponentsInType(static_cast< uint32_t >(acc.type)));
+   return result;
+}
+
+void
+DecodeBulk(const tinygltf::Model& model, const glm::mat4& worldMat, const glm::mat3& normalMat,
+           std::vector< render::Vertex >& vertices)
+{
+   scene::DecodePositions(ToView(model, model.accessors[0]), worldMat, vertices);
+   scene::DecodeNormals(ToView(model, model.accessors[1]), normalMat, vertices);
+   scene::DecodeTangents(ToView(model, model.accessors[2]), normalMat, vertices);
+   scene::DecodeTexCoords(ToView(model, model.accessors[3]), vertices);
+}
+
+// Best of 'iterations' runs, in milliseconds
+template < typename Function >
+double
+Measure(uint32_t iterations, Function&& function)
+{
+   auto best = std::numeric_limits< double >::max();
+   for (uint32_t i = 0; i < iterations; ++i)
+   {
+      const auto start = std::chrono::steady_clock::now();
+      function();
+      const std::chrono::duration< double, std::milli > elapsed =
+         std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count());
+   }
+
+   return best;
+}
+
+float
+MaxDifference(const std::vector< render::Vertex >& lhs, const std::vector< render::Vertex >& rhs)
+{
+   float maxDiff = 0.0f;
+   for (size_t i = 0; i < lhs.size(); ++i)
+   {
+      const auto diff = glm::max(
+         glm::max(glm::abs(lhs[i].m_position - rhs[i].m_position),
+                  glm::abs(lhs[i].m_normal - rhs[i].m_normal)),
+         glm::max(glm::abs(lhs[i].m_tangent - rhs[i].m_tangent),
+                  glm::vec3(glm::abs(lhs[i].m_texCoords - rhs[i].m_texCoords), 0.0f)));
+      maxDiff = std::max({maxDiff, diff.x, diff.y, diff.z});
+   }
+
+   return maxDiff;
+}
+
+uint32_t
+ParseArgument(std::string_view text, uint32_t defaultValue)
+{
+   uint32_t value = 0;
+   const auto* end = text.data() + text.size();
+   const auto [ptr, ec] = std::from_chars(text.data(), end, value);
+   return (ec == std::errc() && ptr == end && value > 0) ? value : defaultValue;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+   // Usage: shady_accessor_bench [numVertices] [iterations]
+   const std::vector< std::string_view > args(argv + 1, argv + argc);
+   const auto numVertices = args.empty() ? 1000000U : ParseArgument(args[0], 1000000U);
+   const auto iterations = args.size() < 2 ? 10U : ParseArgument(args[1], 10U);
+
+   const auto model = CreateModel(numVertices);
+   const auto worldMat = glm::mat4(0.5f, 0.0f, 0.2f, 0.0f, 0.0f, 2.0f, 0.0f, 0.0f, -0.1f, 0.0f,
+                                   1.0f, 0.0f, 10.0f, -4.0f, 3.0f, 1.0f);
+   const auto normalMat = glm::transpose(glm::inverse(glm::mat3(worldMat)));
+
+   std::vector< render::Vertex > perElement(numVertices);
+   std::vector< render::Vertex > bulk(numVertices);
+
+   const auto perElementMs =
+      Measure(iterations, [&] { DecodePerElement(model, worldMat, normalMat, perElement); });
+   const auto bulkMs = Measure(iterations, [&] { DecodeBulk(model, worldMat, normalMat, bulk); });
+
+   const auto toThroughput = [numVertices](double ms) {
+      return static_cast< double >(numVertices) / (ms * 1000.0);
+   };
+
+   fmt::print("{} vertices, best of {} runs\n", numVertices, iterations);
+   fmt::print("   per-element: {:8.3f} ms ({:7.1f} Mvertices/s)\n", perElementMs,
+              toThroughput(perElementMs));
+   fmt::print("   bulk:        {:8.3f} ms ({:7.1f} Mvertices/s)\n", bulkMs, toThroughput(bulkMs));
+   fmt::print("   speedup:     {:8.2f}x\n", perElementMs / bulkMs);
+   fmt::print("   max abs difference: {}\n", MaxDifference(perElement, bulk));
+
+   return 0;
+}
@@ -0,0 +1,366 @@
+/*
+ * Round-trip check of the block encoder from render/bc_encoder.hpp. Synthetic images are encoded
+ * into every block format, decoded back with a reference decoder and compared with the source.
+ * Fails (non-zero exit code) when the RMS error of any format exceeds its bound, or when encoding
+ * in parallel doesn't produce the same blocks as encoding on a single thread.
+ */
+
+#include "render/bc_encoder.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fmt/format.h>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using namespace shady;
+
+constexpr uint32_t BLOCK_DIM = 4;
+
+struct FormatInfo
+{
+   render::BlockFormat format;
+   std::string_view name;
+   // Channels stored by the format
+   uint32_t numChannels;
+   // Largest RMS error (in 8 bit units, over the stored channels) that passes the check
+   double maxRmsError;
+};
+
+// Bounds leave some headroom over the errors of the current encoder on the images below
+constexpr std::array< FormatInfo, 5 > FORMATS = {{{render::BlockFormat::BC1, "BC1", 3, 4.0},
+                                                  {render::BlockFormat::BC3, "BC3", 4, 3.5},
+                                                  {render::BlockFormat::BC4, "BC4", 1, 1.0},
+                                                  {render::BlockFormat::BC5, "BC5", 2, 1.0},
+                                                  {render::BlockFormat::BC7, "BC7", 4, 3.5}}};
+
+struct Image
+{
+   std::string_view name;
+   uint32_t width = 0;
+   uint32_t height = 0;
+   // RGBA8, rows tightly packed
+   std::vector< uint8_t > pixels = {};
+};
+
+// Smooth gradients (mostly what the encoder sees in real textures) with some noise on top.
+// Size isn't a multiple of the block size, so the edge blocks are covered as well.
+Image
+CreateGradientImage(uint32_t width, uint32_t height, float noise)
+{
+   std::mt19937 generator(42);
+   std::normal_distribution< float > distribution(0.0f, noise);
+
+   Image image = {"gradient", width, height, std::vector< uint8_t >(size_t{width} * height * 4)};
+   for (uint32_t y = 0; y < height; ++y)
+   {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+         const auto u = static_cast< float >(x) / static_cast< float >(width);
+         const auto v = static_cast< float >(y) / static_cast< float >(height);
+         const std::array< float, 4 > color = {255.0f * u, 255.0f * v,
+                                               127.5f + 127.5f * std::sin(10.0f * (u + v)),
+                                               255.0f * (1.0f - u * v)};
+
+         auto* texel = &image.pixels[(size_t{y} * width + x) * 4];
+         for (size_t channel = 0; channel < color.size(); ++channel)
+         {
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            texel[channel] = static_cast< uint8_t >(
+               std::clamp(std::lround(color[channel] + distribution(generator)), 0L, 255L));
+         }
+      }
+   }
+
+   return image;
+}
+
+// Uniform noise, the worst case for block compression
+Image
+CreateNoiseImage(uint32_t width, uint32_t height)
+{
+   std::mt19937 generator(7);
+   std::uniform_int_distribution< uint32_t > distribution(0, 255);
+
+   Image image = {"noise", width, height, std::vector< uint8_t >(size_t{width} * height * 4)};
+   std::generate(image.pixels.begin(), image.pixels.end(),
+                 [&] { return static_cast< uint8_t >(distribution(generator)); });
+
+   return image;
+}
+
+uint64_t
+ReadBits(const uint8_t* block, uint32_t first, uint32_t numBits)
+{
+   uint64_t value = 0;
+   for (uint32_t bit = 0; bit < numBits; ++bit)
+   {
+      const auto position = first + bit;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      value |= uint64_t{(block[position / 8] >> (position % 8)) & 1U} << bit;
+   }
+
+   return value;
+}
+
+// BC4 block (8 bytes) into 'channel' of 16 texels
+void
+DecodeChannelBlock(const uint8_t* block, uint32_t channel, std::array< uint8_t, 64 >& texels)
+{
+   // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   const auto e0 = uint32_t{block[0]};
+   const auto e1 = uint32_t{block[1]};
+   // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+   std::array< float, 8 > palette = {static_cast< float >(e0), static_cast< float >(e1)};
+   if (e0 > e1)
+   {
+      for (uint32_t i = 2; i < 8; ++i)
+      {
+         palette[i] = static_cast< float >((8 - i) * e0 + (i - 1) * e1) / 7.0f;
+      }
+   }
+   else
+   {
+      for (uint32_t i = 2; i < 6; ++i)
+      {
+         palette[i] = static_cast< float >((6 - i) * e0 + (i - 1) * e1) / 5.0f;
+      }
+      palette[6] = 0.0f;
+      palette[7] = 255.0f;
+   }
+
+   for (uint32_t i = 0; i < BLOCK_DIM * BLOCK_DIM; ++i)
+   {
+      const auto index = ReadBits(block, 16 + 3 * i, 3);
+      texels[i * 4 + channel] = static_cast< uint8_t >(std::lround(palette[index]));
+   }
+}
+
+// BC1 color block (8 bytes) into RGB of 16 texels
+void
+DecodeColorBlock(const uint8_t* block, std::array< uint8_t, 64 >& texels)
+{
+   const auto unpack = [](uint64_t packed) {
+      const auto r = static_cast< uint32_t >((packed >> 11) & 31);
+      const auto g = static_cast< uint32_t >((packed >> 5) & 63);
+      const auto b = static_cast< uint32_t >(packed & 31);
+      return std::array< float, 3 >{static_cast< float >((r << 3) | (r >> 2)),
+                                    static_cast< float >((g << 2) | (g >> 4)),
+                                    static_cast< float >((b << 3) | (b >> 2))};
+   };
+
+   const auto c0 = ReadBits(block, 0, 16);
+   const auto c1 = ReadBits(block, 16, 16);
+   const auto first = unpack(c0);
+   const auto second = unpack(c1);
+
+   // 4 color mode when the first endpoint is larger, 3 colors and black otherwise
+   std::array< std::array< float, 3 >, 4 > palette = {first, second};
+   for (size_t channel = 0; channel < 3; ++channel)
+   {
+      if (c0 > c1)
+      {
+         palette[2][channel] = (2.0f * first[channel] + second[channel]) / 3.0f;
+         palette[3][channel] = (first[channel] + 2.0f * second[channel]) / 3.0f;
+      }
+      else
+      {
+         palette[2][channel] = (first[channel] + second[channel]) / 2.0f;
+      }
+   }
+
+   for (uint32_t i = 0; i < BLOCK_DIM * BLOCK_DIM; ++i)
+   {
+      const auto& color = palette[ReadBits(block, 32 + 2 * i, 2)];
+      for (size_t channel = 0; channel < 3; ++channel)
+      {
+         texels[i * 4 + channel] = static_cast< uint8_t >(std::lround(color[channel]));
+      }
+   }
+}
+
+// BC7 block (16 bytes) into RGBA of 16 texels, false for modes other than 6
+bool
+DecodeBc7Block(const uint8_t* block, std::array< uint8_t, 64 >& texels)
+{
+   constexpr std::array< uint32_t, 16 > weights = {0,  4,  9,  13, 17, 21, 26, 30,
+                                                   34, 38, 43, 47, 51, 55, 60, 64};
+
+   if (ReadBits(block, 0, 7) != (1U << 6))
+   {
+      return false;
+   }
+
+   std::array< std::array< uint32_t, 4 >, 2 > endpoints = {};
+   for (uint32_t channel = 0; channel < 4; ++channel)
+   {
+      endpoints[0][channel] = static_cast< uint32_t >(ReadBits(block, 7 + channel * 14, 7));
+      endpoints[1][channel] = static_cast< uint32_t >(ReadBits(block, 14 + channel * 14, 7));
+   }
+   for (uint32_t endpoint = 0; endpoint < 2; ++endpoint)
+   {
+      const auto pBit = static_cast< uint32_t >(ReadBits(block, 63 + endpoint, 1));
+      for (auto& value : endpoints[endpoint])
+      {
+         value = (value << 1) | pBit;
+      }
+   }
+
+   // First texel's index has an implicit zero most significant bit
+   uint32_t position = 65;
+   for (uint32_t i = 0; i < BLOCK_DIM * BLOCK_DIM; ++i)
+   {
+      const auto numBits = i == 0 ? 3U : 4U;
+      const auto weight = weights[ReadBits(block, position, numBits)];
+      position += numBits;
+
+      for (uint32_t channel = 0; channel < 4; ++channel)
+      {
+         texels[i * 4 + channel] = static_cast< uint8_t >(
+            (endpoints[0][channel] * (64 - weight) + endpoints[1][channel] * weight + 32) >> 6);
+      }
+   }
+
+   return true;
+}
+
+// Reference decoder of 'blocks' back to RGBA8 (channels the format doesn't store are zero),
+// empty when a block can't be decoded
+std::vector< uint8_t >
+DecodeImage(render::BlockFormat format, const std::vector< uint8_t >& blocks, uint32_t width,
+            uint32_t height)
+{
+   const auto blocksX = (width + BLOCK_DIM - 1) / BLOCK_DIM;
+   const auto blocksY = (height + BLOCK_DIM - 1) / BLOCK_DIM;
+   const auto blockSize = render::GetBlockSize(format);
+
+   std::vector< uint8_t > pixels(size_t{width} * height * 4);
+   for (uint32_t blockY = 0; blockY < blocksY; ++blockY)
+   {
+      for (uint32_t blockX = 0; blockX < blocksX; ++blockX)
+      {
+         const auto* block = &blocks[(size_t{blockY} * blocksX + blockX) * blockSize];
+         std::array< uint8_t, 64 > texels = {};
+
+         // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+         switch (format)
+         {
+            case render::BlockFormat::BC1: {
+               DecodeColorBlock(block, texels);
+            }
+            break;
+
+            case render::BlockFormat::BC3: {
+               DecodeChannelBlock(block, 3, texels);
+               DecodeColorBlock(block + 8, texels);
+            }
+            break;
+
+            case render::BlockFormat::BC4: {
+               DecodeChannelBlock(block, 0, texels);
+            }
+            break;
+
+            case render::BlockFormat::BC5: {
+               DecodeChannelBlock(block, 0, texels);
+               DecodeChannelBlock(block + 8, 1, texels);
+            }
+            break;
+
+            case render::BlockFormat::BC7:
+            default: {
+               if (!DecodeBc7Block(block, texels))
+               {
+                  return {};
+               }
+            }
+            break;
+         }
+         // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+         // Parts of the edge blocks outside of the image are dropped
+         for (uint32_t y = 0; y < BLOCK_DIM && blockY * BLOCK_DIM + y < height; ++y)
+         {
+            for (uint32_t x = 0; x < BLOCK_DIM && blockX * BLOCK_DIM + x < width; ++x)
+            {
+               const auto pixel =
+                  (size_t{blockY * BLOCK_DIM + y} * width + blockX * BLOCK_DIM + x) * 4;
+               std::copy_n(&texels[(y * BLOCK_DIM + x) * 4], 4, &pixels[pixel]);
+            }
+         }
+      }
+   }
+
+   return pixels;
+}
+
+// Over the first 'numChannels' channels, in 8 bit units
+double
+RmsError(const std::vector< uint8_t >& source, const std::vector< uint8_t >& decoded,
+         uint32_t numChannels)
+{
+   double sum = 0.0;
+   for (size_t pixel = 0; pixel < source.size(); pixel += 4)
+   {
+      for (size_t channel = 0; channel < numChannels; ++channel)
+      {
+         const auto diff = static_cast< double >(source[pixel + channel])
+                           - static_cast< double >(decoded[pixel + channel]);
+         sum += diff * diff;
+      }
+   }
+
+   return std::sqrt(sum / static_cast< double >(source.size() / 4 * numChannels));
+}
+
+} // namespace
+
+int
+main()
+{
+   // Fixed size, the error bounds depend on how steep the gradients are
+   constexpr uint32_t width = 1027;
+   constexpr uint32_t height = 517;
+
+   const std::array< Image, 2 > images = {CreateGradientImage(width, height, 4.0f),
+                                          CreateNoiseImage(width, height)};
+
+   bool passed = true;
+   for (const auto& image : images)
+   {
+      fmt::print("{} {}x{}\n", image.name, image.width, image.height);
+      for (const auto& info : FORMATS)
+      {
+         const auto start = std::chrono::steady_clock::now();
+         const auto blocks = render::CompressImage(info.format, image.pixels, image.width,
+                                                   image.height, &utils::ThreadPool::GetShared());
+         const std::chrono::duration< double, std::milli > elapsed =
+            std::chrono::steady_clock::now() - start;
+
+         const auto serialBlocks =
+            render::CompressImage(info.format, image.pixels, image.width, image.height);
+         const auto decoded = DecodeImage(info.format, blocks, image.width, image.height);
+
+         // Noise isn't compressible, it's only checked for encoder errors (and decoding)
+         const auto bounded = image.name != "noise";
+         const auto rmsError =
+            decoded.empty() ? 0.0 : RmsError(image.pixels, decoded, info.numChannels);
+         const auto ok = blocks == serialBlocks && !decoded.empty()
+                         && (!bounded || rmsError <= info.maxRmsError);
+         passed = passed && ok;
+
+         fmt::print("   {}: {:8.3f} ms, RMS error {:6.3f}{} {}\n", info.name, elapsed.count(),
+                    rmsError, bounded ? fmt::format(" (max {:.1f})", info.maxRmsError) : "",
+                    ok ? "ok" : "FAILED");
+      }
+   }
+
+   return passed ? 0 : 1;
+}
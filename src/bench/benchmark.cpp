@@ -0,0 +1,485 @@
+#include "bench/benchmark.hpp"
+#include "render/common.hpp"
+#include "render/culling.hpp"
+#include "render/frame_stats.hpp"
+#include "render/renderer.hpp"
+#include "trace/logger.hpp"
+#include "utils/assert.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <fmt/format.h>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string_view>
+#include <utility>
+
+namespace shady::bench {
+
+namespace {
+
+void
+PrintUsage()
+{
+   fmt::print(
+      "Usage: shady_bench --scene <file.gltf> [--frames N] [--warmup N] [--width W] [--height H]\n"
+      "                   [--camera-path <file>] [--output <file.json>]\n"
+      "                   [--compare-occlusion 0|1] [--meshlets 0|1] [--lod-threshold PX]\n");
+}
+
+std::optional< uint32_t >
+ParseNumber(std::string_view text)
+{
+   uint32_t value = 0;
+   const auto* end = text.data() + text.size();
+   const auto [ptr, ec] = std::from_chars(text.data(), end, value);
+
+   if (ec != std::errc() || ptr != end)
+   {
+      return std::nullopt;
+   }
+
+   return value;
+}
+
+std::vector< CameraKeyframe >
+DefaultCameraPath()
+{
+   // Loop around the center of the (Sponza-sized) scene, looking inwards
+   return {{{-90.0f, 20.0f, 0.0f}, {0.0f, 15.0f, 0.0f}},
+           {{0.0f, 25.0f, -30.0f}, {90.0f, 15.0f, 0.0f}},
+           {{90.0f, 20.0f, 0.0f}, {0.0f, 15.0f, 0.0f}},
+           {{0.0f, 25.0f, 30.0f}, {-90.0f, 15.0f, 0.0f}}};
+}
+
+std::vector< CameraKeyframe >
+LoadCameraPath(const std::string& fileName)
+{
+   std::ifstream file(fileName);
+   utils::Assert(file.is_open(), fmt::format("Unable to open camera path file {}", fileName));
+
+   std::vector< CameraKeyframe > keyframes;
+   std::string line;
+
+   while (std::getline(file, line))
+   {
+      if (line.empty() || line.front() == '#')
+      {
+         continue;
+      }
+
+      std::istringstream stream(line);
+      CameraKeyframe keyframe;
+      if (stream >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+          >> keyframe.target.x >> keyframe.target.y >> keyframe.target.z)
+      {
+         keyframes.push_back(keyframe);
+      }
+   }
+
+   utils::Assert(!keyframes.empty(), fmt::format("No keyframes found in {}", fileName));
+
+   return keyframes;
+}
+
+std::string
+EscapeJson(std::string_view text)
+{
+   std::string escaped;
+   escaped.reserve(text.size());
+
+   for (const auto c : text)
+   {
+      switch (c)
+      {
+         case '"':
+            escaped += "\\\"";
+            break;
+         case '\\':
+            escaped += "\\\\";
+            break;
+         case '\n':
+            escaped += "\\n";
+            break;
+         default:
+            escaped += c;
+      }
+   }
+
+   return escaped;
+}
+
+std::string
+SummaryToJson(const Summary& summary)
+{
+   return fmt::format(R"({{"mean": {:.4f}, "p50": {:.4f}, "p95": {:.4f}, "p99": {:.4f}}})",
+                      summary.mean, summary.p50, summary.p95, summary.p99);
+}
+
+} // namespace
+
+std::optional< Config >
+ParseArguments(int argc, char** argv)
+{
+   Config config;
+
+   const std::vector< std::string_view > args(argv + 1, argv + argc);
+
+   for (size_t i = 0; i < args.size(); ++i)
+   {
+      const auto arg = args[i];
+      const auto hasValue = i + 1 < args.size();
+
+      if (!hasValue)
+      {
+         PrintUsage();
+         return std::nullopt;
+      }
+
+      const auto value = args[++i];
+
+      if (arg == "--scene")
+      {
+         config.scenePath = value;
+      }
+      else if (arg == "--camera-path")
+      {
+         config.cameraPathFile = value;
+      }
+      else if (arg == "--output")
+      {
+         config.outputPath = value;
+      }
+      else
+      {
+         const auto number = ParseNumber(value);
+         if (!number)
+         {
+            PrintUsage();
+            return std::nullopt;
+         }
+
+         if (arg == "--frames")
+         {
+            config.frames = *number;
+         }
+         else if (arg == "--warmup")
+         {
+            config.warmupFrames = *number;
+         }
+         else if (arg == "--width")
+         {
+            config.width = *number;
+         }
+         else if (arg == "--height")
+         {
+            config.height = *number;
+         }
+         else if (arg == "--compare-occlusion")
+         {
+            config.compareOcclusion = *number != 0;
+         }
+         else if (arg == "--meshlets")
+         {
+            config.meshlets = *number != 0;
+         }
+         else if (arg == "--lod-threshold")
+         {
+            config.lodThreshold = static_cast< float >(*number);
+         }
+         else
+         {
+            PrintUsage();
+            return std::nullopt;
+         }
+      }
+   }
+
+   if (config.scenePath.empty() || config.frames == 0 || config.width == 0 || config.height == 0)
+   {
+      PrintUsage();
+      return std::nullopt;
+   }
+
+   return config;
+}
+
+Summary
+Summarize(std::vector< double > samples)
+{
+   Summary summary;
+   if (samples.empty())
+   {
+      return summary;
+   }
+
+   std::sort(samples.begin(), samples.end());
+
+   // Nearest-rank percentile
+   const auto percentile = [&samples](double p) {
+      const auto rank = static_cast< size_t >(
+         std::ceil(p / 100.0 * static_cast< double >(samples.size())));
+      return samples[std::clamp< size_t >(rank, 1, samples.size()) - 1];
+   };
+
+   summary.mean = std::accumulate(samples.begin(), samples.end(), 0.0)
+                  / static_cast< double >(samples.size());
+   summary.p50 = percentile(50.0);
+   summary.p95 = percentile(95.0);
+   summary.p99 = percentile(99.0);
+
+   return summary;
+}
+
+Benchmark::Benchmark(Config config)
+   : m_config(std::move(config)),
+     m_cpuSamples(render::NUM_CPU_STAGES),
+     m_gpuSamples(render::NUM_GPU_PASSES)
+{
+}
+
+void
+Benchmark::Init()
+{
+   m_cameraPath = m_config.cameraPathFile.empty() ? DefaultCameraPath()
+                                                  : LoadCameraPath(m_config.cameraPathFile);
+
+   render::Renderer::InitializeHeadless(m_config.width, m_config.height);
+
+   using Clock = std::chrono::steady_clock;
+   const auto loadStart = Clock::now();
+
+   m_scene.SetMeshletsEnabled(m_config.meshlets);
+   m_scene.Load(m_config.scenePath);
+
+   render::Renderer::CreateRenderPipeline();
+   const auto loadEnd = Clock::now();
+
+   m_startupTimings = m_scene.GetLoadTimings();
+   // Vertex/index buffers are created with the render pipeline, the rest of it isn't upload
+   m_geometryUploadTime = render::Renderer::GetGeometryUploadTime();
+   m_startupTotal = std::chrono::duration< double, std::milli >(loadEnd - loadStart).count();
+   m_uploadStats = render::StagingRing::GetStats();
+
+   // Textures are streamed in after the scene is loaded, measured frames should see final ones
+   while (!render::TextureStreamer::IsIdle())
+   {
+      m_scene.Render(static_cast< int32_t >(m_config.width),
+                     static_cast< int32_t >(m_config.height));
+   }
+   m_streamingStats = render::TextureStreamer::GetStats();
+}
+
+void
+Benchmark::UpdateCamera(uint32_t frame)
+{
+   const auto numKeyframes = m_cameraPath.size();
+
+   // Whole path (looped back to first keyframe) is travelled once during measured frames
+   const auto progress = static_cast< float >(frame) / static_cast< float >(m_config.frames)
+                         * static_cast< float >(numKeyframes);
+   const auto segment = static_cast< size_t >(progress) % numKeyframes;
+   const auto t = glm::smoothstep(0.0f, 1.0f, progress - std::floor(progress));
+
+   const auto& from = m_cameraPath[segment];
+   const auto& to = m_cameraPath[(segment + 1) % numKeyframes];
+
+   const auto position = glm::mix(from.position, to.position, t);
+   const auto target = glm::mix(from.target, to.target, t);
+
+   auto& camera = m_scene.GetCamera();
+   camera.SetPosition(position);
+   camera.SetLookAtDirection(target - position);
+}
+
+void
+Benchmark::Run()
+{
+   render::GpuCulling::SetLodThreshold(m_config.lodThreshold);
+   render::GpuCulling::SetOcclusionEnabled(true);
+   MeasurePath(m_occlusionEnabled, true);
+
+   if (m_config.compareOcclusion)
+   {
+      render::GpuCulling::SetOcclusionEnabled(false);
+      MeasurePath(m_occlusionDisabled, false);
+      render::GpuCulling::SetOcclusionEnabled(true);
+   }
+
+   render::Renderer::Shutdown();
+}
+
+void
+Benchmark::MeasurePath(OcclusionSamples& occlusionSamples, bool recordTimings)
+{
+   const auto totalFrames = m_config.warmupFrames + m_config.frames;
+
+   for (uint32_t frame = 0; frame < totalFrames; ++frame)
+   {
+      const auto isWarmup = frame < m_config.warmupFrames;
+      UpdateCamera(isWarmup ? 0 : frame - m_config.warmupFrames);
+
+      m_scene.Render(static_cast< int32_t >(m_config.width),
+                     static_cast< int32_t >(m_config.height));
+
+      if (isWarmup)
+      {
+         continue;
+      }
+
+      const auto& timings = render::FrameStats::GetLastFrame();
+      const auto& cullingStats = render::GpuCulling::GetStats();
+      const auto listTriangles = [&cullingStats](render::DrawList list) {
+         return cullingStats.triangles.at(static_cast< size_t >(list));
+      };
+      occlusionSamples.triangles.push_back(static_cast< double >(
+         listTriangles(render::DrawList::CAMERA_EARLY)
+         + listTriangles(render::DrawList::CAMERA_LATE)
+         + listTriangles(render::DrawList::CLUSTER_EARLY)
+         + listTriangles(render::DrawList::CLUSTER_LATE)));
+      if (timings.gpuValid)
+      {
+         occlusionSamples.gbufferMs.push_back(
+            timings.gpu.at(static_cast< size_t >(render::GpuPass::GBUFFER)));
+      }
+
+      if (!recordTimings)
+      {
+         continue;
+      }
+
+      for (uint32_t stage = 0; stage < render::NUM_CPU_STAGES; ++stage)
+      {
+         m_cpuSamples[stage].push_back(timings.cpu.at(stage));
+      }
+
+      if (timings.gpuValid)
+      {
+         m_gpuTimingsValid = true;
+         for (uint32_t pass = 0; pass < render::NUM_GPU_PASSES; ++pass)
+         {
+            m_gpuSamples[pass].push_back(timings.gpu.at(pass));
+         }
+
+         m_overlapSamples.push_back(timings.overlap);
+         m_overlapRatioSamples.push_back(timings.overlapRatio);
+      }
+   }
+}
+
+std::string
+Benchmark::ToJson() const
+{
+   VkPhysicalDeviceProperties properties{};
+   vkGetPhysicalDeviceProperties(render::Data::vk_physicalDevice, &properties);
+
+   std::string json = "{\n";
+   json += fmt::format("   \"device\": \"{}\",\n", EscapeJson(&properties.deviceName[0]));
+   json += fmt::format("   \"scene\": \"{}\",\n", EscapeJson(m_config.scenePath));
+   json += fmt::format("   \"resolution\": [{}, {}],\n", m_config.width, m_config.height);
+   json += fmt::format("   \"frames\": {},\n", m_config.frames);
+   json += fmt::format("   \"warmup_frames\": {},\n", m_config.warmupFrames);
+   json += fmt::format("   \"gpu_timestamps\": {},\n", m_gpuTimingsValid);
+   json += fmt::format("   \"meshlets\": {},\n", render::GpuCulling::GetStats().totalMeshlets);
+   json += fmt::format("   \"lod_threshold\": {:.1f},\n", m_config.lodThreshold);
+   json += fmt::format("   \"load_threads\": {},\n",
+                       utils::ThreadPool::GetShared().GetNumThreads());
+
+   json += "   \"startup_ms\": {\n";
+   json += fmt::format("      \"parse\": {:.4f},\n", m_startupTimings.parse);
+   json += fmt::format("      \"decode\": {:.4f},\n", m_startupTimings.decode);
+   json += fmt::format("      \"texture\": {:.4f},\n", m_startupTimings.texture);
+   json += fmt::format("      \"meshlets\": {:.4f},\n", m_startupTimings.meshlets);
+   json += fmt::format("      \"submit\": {:.4f},\n", m_startupTimings.submit);
+   json += fmt::format("      \"upload\": {:.4f},\n", m_geometryUploadTime);
+   json += fmt::format("      \"textures_resident\": {:.4f},\n", m_streamingStats.milliseconds);
+   json += fmt::format("      \"total\": {:.4f}\n", m_startupTotal);
+   json += "   },\n";
+
+   json += "   \"upload\": {\n";
+   json += fmt::format("      \"bytes\": {},\n", m_uploadStats.bytes);
+   json += fmt::format("      \"ms\": {:.4f},\n", m_uploadStats.milliseconds);
+   json += fmt::format("      \"mb_per_s\": {:.4f},\n", m_uploadStats.GetThroughput());
+   json += fmt::format("      \"submits\": {}\n", m_uploadStats.submits);
+   json += "   },\n";
+
+   // Streamed textures, bytes include all of their (precomputed) mip levels
+   json += "   \"textures\": {\n";
+   json += fmt::format("      \"resident\": {},\n", m_streamingStats.resident);
+   json += fmt::format("      \"compressed\": {},\n", m_streamingStats.compressed);
+   json += fmt::format("      \"bytes\": {}\n", m_streamingStats.bytes);
+   json += "   },\n";
+
+   // Simulated post-transform cache (render::VERTEX_CACHE_SIZE entries) of the decoded index
+   // buffers, all zero when every model came from the mesh cache
+   const auto& optimization = m_scene.GetOptimizationStats();
+   json += "   \"vertex_cache\": {\n";
+   json += fmt::format("      \"acmr_before\": {:.4f},\n", optimization.before.GetAcmr());
+   json += fmt::format("      \"acmr_after\": {:.4f},\n", optimization.after.GetAcmr());
+   json += fmt::format("      \"atvr_before\": {:.4f},\n", optimization.before.GetAtvr());
+   json += fmt::format("      \"atvr_after\": {:.4f}\n", optimization.after.GetAtvr());
+   json += "   },\n";
+
+   json += "   \"cpu_ms\": {\n";
+   for (uint32_t stage = 0; stage < render::NUM_CPU_STAGES; ++stage)
+   {
+      json += fmt::format("      \"{}\": {}{}\n",
+                          render::ToString(static_cast< render::CpuStage >(stage)),
+                          SummaryToJson(Summarize(m_cpuSamples[stage])),
+                          stage + 1 < render::NUM_CPU_STAGES ? "," : "");
+   }
+   json += "   },\n";
+
+   json += "   \"gpu_ms\": {\n";
+   for (uint32_t pass = 0; pass < render::NUM_GPU_PASSES; ++pass)
+   {
+      json += fmt::format("      \"{}\": {}{}\n",
+                          render::ToString(static_cast< render::GpuPass >(pass)),
+                          SummaryToJson(Summarize(m_gpuSamples[pass])),
+                          pass + 1 < render::NUM_GPU_PASSES ? "," : "");
+   }
+   json += "   },\n";
+
+   // How much of the CPU work is hidden behind the GPU work (see render::FrameTimings)
+   json += "   \"cpu_gpu_overlap\": {\n";
+   json += fmt::format("      \"ms\": {},\n", SummaryToJson(Summarize(m_overlapSamples)));
+   json += fmt::format("      \"ratio\": {}\n", SummaryToJson(Summarize(m_overlapRatioSamples)));
+   json += "   },\n";
+
+   // G-buffer pass (including the occlusion pass when enabled) and triangles it submitted
+   const auto occlusionToJson = [](const OcclusionSamples& samples) {
+      return fmt::format(R"({{"gbuffer_ms": {}, "triangles": {}}})",
+                         SummaryToJson(Summarize(samples.gbufferMs)),
+                         SummaryToJson(Summarize(samples.triangles)));
+   };
+
+   json += "   \"occlusion_culling\": {\n";
+   json += fmt::format("      \"enabled\": {}{}\n", occlusionToJson(m_occlusionEnabled),
+                       m_config.compareOcclusion ? "," : "");
+   if (m_config.compareOcclusion)
+   {
+      json += fmt::format("      \"disabled\": {}\n", occlusionToJson(m_occlusionDisabled));
+   }
+   json += "   }\n";
+   json += "}\n";
+
+   return json;
+}
+
+void
+Benchmark::WriteReport() const
+{
+   const auto json = ToJson();
+
+   std::ofstream file(m_config.outputPath, std::ios::trunc);
+   utils::Assert(file.is_open(), fmt::format("Unable to open {} for writing", m_config.outputPath));
+   file << json;
+
+   trace::Logger::Info("Benchmark report written to {}", m_config.outputPath);
+}
+
+} // namespace shady::bench
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "render/staging_ring.hpp"
+#include "render/texture_streamer.hpp"
+#include "scene/scene.hpp"
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace shady::bench {
+
+struct CameraKeyframe
+{
+   glm::vec3 position = {};
+   glm::vec3 target = {};
+};
+
+struct Config
+{
+   std::string scenePath = {};
+   // Text file with 'px py pz tx ty tz' keyframe per line, built-in path is used when empty
+   std::string cameraPathFile = {};
+   std::string outputPath = "shady_bench.json";
+   uint32_t width = 1920;
+   uint32_t height = 1080;
+   uint32_t frames = 500;
+   uint32_t warmupFrames = 30;
+   // Measure the camera path once more with occlusion culling disabled
+   bool compareOcclusion = true;
+   // Split meshes into meshlets and cull them per cluster
+   bool meshlets = true;
+   // Screen space error (in pixels) allowed for simplified levels of detail, 0 disables them
+   float lodThreshold = 1.0f;
+};
+
+// Per-frame G-buffer cost for a single occlusion culling setting
+struct OcclusionSamples
+{
+   std::vector< double > gbufferMs = {};
+   std::vector< double > triangles = {};
+};
+
+struct Summary
+{
+   double mean = 0.0;
+   double p50 = 0.0;
+   double p95 = 0.0;
+   double p99 = 0.0;
+};
+
+[[nodiscard]] std::optional< Config >
+ParseArguments(int argc, char** argv);
+
+[[nodiscard]] Summary
+Summarize(std::vector< double > samples);
+
+/*
+ * Headless benchmark which renders given glTF scene for a fixed number of frames,
+ * while moving the camera along scripted path. Per-pass CPU and GPU timings are
+ * gathered for every frame and written as JSON report, together with per-stage startup times.
+ */
+class Benchmark
+{
+ public:
+   explicit Benchmark(Config config);
+
+   void
+   Init();
+
+   void
+   Run();
+
+   void
+   WriteReport() const;
+
+ private:
+   void
+   UpdateCamera(uint32_t frame);
+
+   // Render the whole camera path, frame timings are only gathered when 'recordTimings' is set
+   void
+   MeasurePath(OcclusionSamples& occlusionSamples, bool recordTimings);
+
+   [[nodiscard]] std::string
+   ToJson() const;
+
+ private:
+   Config m_config;
+   scene::Scene m_scene;
+   std::vector< CameraKeyframe > m_cameraPath;
+
+   std::vector< std::vector< double > > m_cpuSamples;
+   std::vector< std::vector< double > > m_gpuSamples;
+   std::vector< double > m_overlapSamples;
+   std::vector< double > m_overlapRatioSamples;
+   bool m_gpuTimingsValid = false;
+   OcclusionSamples m_occlusionEnabled = {};
+   OcclusionSamples m_occlusionDisabled = {};
+
+   // Scene load and render pipeline creation, measured once in Init
+   scene::LoadTimings m_startupTimings = {};
+   // Vertex, index and indirect buffers created by the render pipeline (see
+   // Renderer::GetGeometryUploadTime)
+   double m_geometryUploadTime = 0.0;
+   double m_startupTotal = 0.0;
+   // Staging uploads done during startup (scene and render pipeline)
+   render::UploadStats m_uploadStats = {};
+   // Background texture streaming, from the first request until all textures were resident
+   render::StreamingStats m_streamingStats = {};
+};
+
+} // namespace shady::bench
@@ -0,0 +1,23 @@
+#include "bench/benchmark.hpp"
+#include "trace/logger.hpp"
+
+int
+main(int argc, char** argv)
+{
+   const auto config = shady::bench::ParseArguments(argc, argv);
+   if (!config)
+   {
+      return 1;
+   }
+
+   // Keep the output readable, only warnings and errors are interesting here
+   shady::trace::Logger::SetType(shady::trace::TYPE::WARNING);
+
+   shady::bench::Benchmark benchmark(*config);
+
+   benchmark.Init();
+   benchmark.Run();
+   benchmark.WriteReport();
+
+   return 0;
+}
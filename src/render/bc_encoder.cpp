@@ -0,0 +1,586 @@
+#include "bc_encoder.hpp"
+#include "utils/assert.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <limits>
+#include <utility>
+
+namespace shady::render {
+
+// Plain scalar code, per texel math is done on small glm vectors and left to the compiler's
+// auto-vectorization (this file is always built with -O3, see CMakeLists.txt). Throughput comes
+// from encoding rows of blocks in parallel.
+
+namespace {
+
+constexpr uint32_t BLOCK_DIM = 4;
+constexpr uint32_t BLOCK_TEXELS = BLOCK_DIM * BLOCK_DIM;
+
+// Weights (of the second endpoint, out of 64) of the 4 bit BC7 indices
+constexpr std::array< uint32_t, 16 > BC7_WEIGHTS = {0,  4,  9,  13, 17, 21, 26, 30,
+                                                     34, 38, 43, 47, 51, 55, 60, 64};
+
+// RGBA texels of a 4x4 block, row by row
+using Block = std::array< glm::u8vec4, BLOCK_TEXELS >;
+
+template < glm::length_t N >
+using Color = glm::vec< N, float >;
+
+Block
+loadBlock(std::span< const uint8_t > pixels, uint32_t width, uint32_t height, uint32_t blockX,
+          uint32_t blockY)
+{
+   Block block = {};
+   for (uint32_t y = 0; y < BLOCK_DIM; ++y)
+   {
+      const auto srcY = std::min(blockY * BLOCK_DIM + y, height - 1);
+      for (uint32_t x = 0; x < BLOCK_DIM; ++x)
+      {
+         const auto srcX = std::min(blockX * BLOCK_DIM + x, width - 1);
+         std::memcpy(&block[y * BLOCK_DIM + x], &pixels[(size_t{srcY} * width + srcX) * 4], 4);
+      }
+   }
+
+   return block;
+}
+
+template < glm::length_t N >
+Color< N >
+toColor(const glm::u8vec4& texel)
+{
+   return Color< N >(glm::vec4(texel));
+}
+
+/*
+ * Endpoints of the segment that best fits the first N channels of 'block': extremes of the
+ * texels projected onto their principal axis (power iteration on the covariance matrix),
+ * moved inwards by 'inset' of the segment's length.
+ */
+template < glm::length_t N >
+std::pair< Color< N >, Color< N > >
+fitEndpoints(const Block& block, float inset)
+{
+   auto mean = Color< N >(0.0f);
+   auto minColor = Color< N >(255.0f);
+   auto maxColor = Color< N >(0.0f);
+   for (const auto& texel : block)
+   {
+      const auto color = toColor< N >(texel);
+      mean += color;
+      minColor = glm::min(minColor, color);
+      maxColor = glm::max(maxColor, color);
+   }
+   mean /= static_cast< float >(BLOCK_TEXELS);
+
+   glm::mat< N, N, float > covariance(0.0f);
+   for (const auto& texel : block)
+   {
+      const auto offset = toColor< N >(texel) - mean;
+      for (glm::length_t column = 0; column < N; ++column)
+      {
+         covariance[column] += offset * offset[column];
+      }
+   }
+
+   // Bounding box diagonal is a good first guess, few iterations are enough to converge
+   auto axis = maxColor - minColor;
+   for (uint32_t iteration = 0; iteration < 8; ++iteration)
+   {
+      const auto next = covariance * axis;
+      const auto length = glm::length(next);
+      if (length < std::numeric_limits< float >::epsilon())
+      {
+         break;
+      }
+      axis = next / length;
+   }
+
+   const auto axisLength = glm::length(axis);
+   if (axisLength < std::numeric_limits< float >::epsilon())
+   {
+      // All texels are the same
+      return {mean, mean};
+   }
+   axis /= axisLength;
+
+   auto minT = std::numeric_limits< float >::max();
+   auto maxT = std::numeric_limits< float >::lowest();
+   for (const auto& texel : block)
+   {
+      const auto t = glm::dot(toColor< N >(texel) - mean, axis);
+      minT = std::min(minT, t);
+      maxT = std::max(maxT, t);
+   }
+
+   const auto offset = (maxT - minT) * inset;
+   return {glm::clamp(mean + axis * (maxT - offset), 0.0f, 255.0f),
+           glm::clamp(mean + axis * (minT + offset), 0.0f, 255.0f)};
+}
+
+/*
+ * Least squares endpoints for the given weights (of the first endpoint) of each texel.
+ * Returns false when the weights don't determine the endpoints (all texels use one weight).
+ */
+template < glm::length_t N >
+bool
+refitEndpoints(const Block& block, const std::array< float, BLOCK_TEXELS >& weights,
+               Color< N >& first, Color< N >& second)
+{
+   float aa = 0.0f;
+   float ab = 0.0f;
+   float bb = 0.0f;
+   auto ax = Color< N >(0.0f);
+   auto bx = Color< N >(0.0f);
+   for (uint32_t i = 0; i < BLOCK_TEXELS; ++i)
+   {
+      const auto a = weights[i];
+      const auto b = 1.0f - a;
+      const auto color = toColor< N >(block[i]);
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      ax += color * a;
+      bx += color * b;
+   }
+
+   const auto determinant = aa * bb - ab * ab;
+   if (std::abs(determinant) < 1e-6f)
+   {
+      return false;
+   }
+
+   first = glm::clamp((ax * bb - bx * ab) / determinant, 0.0f, 255.0f);
+   second = glm::clamp((bx * aa - ax * ab) / determinant, 0.0f, 255.0f);
+   return true;
+}
+
+void
+writeLittleEndian(uint8_t* out, uint64_t value, uint32_t numBytes)
+{
+   for (uint32_t byte = 0; byte < numBytes; ++byte)
+   {
+      out[byte] = static_cast< uint8_t >(value >> (8 * byte));
+   }
+}
+
+/*
+ * BC4 block (also alpha of BC3 and both halves of BC5): two 8 bit endpoints, first one is
+ * the larger so the 6 values between them are interpolated, and 3 bit index per texel.
+ */
+void
+encodeChannelBlock(const Block& block, uint32_t channel, uint8_t* out)
+{
+   uint8_t minValue = std::numeric_limits< uint8_t >::max();
+   uint8_t maxValue = 0;
+   for (const auto& texel : block)
+   {
+      minValue = std::min(minValue, texel[static_cast< glm::length_t >(channel)]);
+      maxValue = std::max(maxValue, texel[static_cast< glm::length_t >(channel)]);
+   }
+
+   out[0] = maxValue;
+   out[1] = minValue;
+
+   // Equal endpoints decode to the first one with all indices zero
+   uint64_t indices = 0;
+   if (maxValue > minValue)
+   {
+      const auto range = static_cast< float >(maxValue - minValue);
+      for (uint32_t i = 0; i < BLOCK_TEXELS; ++i)
+      {
+         const auto value = block[i][static_cast< glm::length_t >(channel)];
+
+         // Steps of 1/7 from the first endpoint, indices 2-7 are the interpolated values
+         const auto position = static_cast< float >(maxValue - value) / range;
+         const auto step = static_cast< uint64_t >(std::lround(position * 7.0f));
+         const uint64_t index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+         indices |= index << (3 * i);
+      }
+   }
+
+   writeLittleEndian(out + 2, indices, 6);
+}
+
+uint16_t
+packRgb565(const Color< 3 >& color)
+{
+   const auto r = static_cast< uint16_t >(std::lround(color.r * 31.0f / 255.0f));
+   const auto g = static_cast< uint16_t >(std::lround(color.g * 63.0f / 255.0f));
+   const auto b = static_cast< uint16_t >(std::lround(color.b * 31.0f / 255.0f));
+   return static_cast< uint16_t >((r << 11) | (g << 5) | b);
+}
+
+Color< 3 >
+unpackRgb565(uint16_t packed)
+{
+   const auto r = static_cast< uint32_t >((packed >> 11) & 31);
+   const auto g = static_cast< uint32_t >((packed >> 5) & 63);
+   const auto b = static_cast< uint32_t >(packed & 31);
+   return {static_cast< float >((r << 3) | (r >> 2)), static_cast< float >((g << 2) | (g >> 4)),
+           static_cast< float >((b << 3) | (b >> 2))};
+}
+
+// Picks the nearest of the 4 color mode palette entries for every texel, returns the error
+float
+selectColorIndices(const Block& block, uint16_t first, uint16_t second,
+                   std::array< uint32_t, BLOCK_TEXELS >& indices)
+{
+   const auto c0 = unpackRgb565(first);
+   const auto c1 = unpackRgb565(second);
+   const std::array< Color< 3 >, 4 > palette = {c0, c1, (c0 * 2.0f + c1) / 3.0f,
+                                                (c0 + c1 * 2.0f) / 3.0f};
+
+   float error = 0.0f;
+   for (uint32_t i = 0; i < BLOCK_TEXELS; ++i)
+   {
+      const auto color = toColor< 3 >(block[i]);
+
+      auto bestError = std::numeric_limits< float >::max();
+      for (uint32_t entry = 0; entry < palette.size(); ++entry)
+      {
+         const auto offset = color - palette[entry];
+         const auto entryError = glm::dot(offset, offset);
+         if (entryError < bestError)
+         {
+            bestError = entryError;
+            indices[i] = entry;
+         }
+      }
+      error += bestError;
+   }
+
+   return error;
+}
+
+/*
+ * BC1 color block (also color of BC3): two RGB565 endpoints and 2 bit index per texel. The
+ * first endpoint is always the larger one, which selects the 4 color (opaque) mode.
+ */
+void
+encodeColorBlock(const Block& block, uint8_t* out)
+{
+   const auto orderedEndpoints = [](const Color< 3 >& a, const Color< 3 >& b) {
+      auto first = packRgb565(a);
+      auto second = packRgb565(b);
+      if (first < second)
+      {
+         std::swap(first, second);
+      }
+      return std::make_pair(first, second);
+   };
+
+   // Inset moves the endpoints closer to where most of the texels are
+   const auto [fittedFirst, fittedSecond] = fitEndpoints< 3 >(block, 1.0f / 16.0f);
+   auto [first, second] = orderedEndpoints(fittedFirst, fittedSecond);
+
+   std::array< uint32_t, BLOCK_TEXELS > indices = {};
+   auto error = selectColorIndices(block, first, second, indices);
+
+   if (first != second)
+   {
+      constexpr std::array< float, 4 > paletteWeights = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+      std::array< float, BLOCK_TEXELS > weights = {};
+      std::transform(indices.begin(), indices.end(), weights.begin(),
+                     [&paletteWeights](uint32_t index) { return paletteWeights[index]; });
+
+      auto refitFirst = Color< 3 >(0.0f);
+      auto refitSecond = Color< 3 >(0.0f);
+      if (refitEndpoints< 3 >(block, weights, refitFirst, refitSecond))
+      {
+         const auto [newFirst, newSecond] = orderedEndpoints(refitFirst, refitSecond);
+         std::array< uint32_t, BLOCK_TEXELS > newIndices = {};
+         const auto newError = selectColorIndices(block, newFirst, newSecond, newIndices);
+         if (newError < error)
+         {
+            first = newFirst;
+            second = newSecond;
+            indices = newIndices;
+            error = newError;
+         }
+      }
+   }
+
+   // Equal endpoints would select the 3 color mode, index 0 is the same color in both modes
+   uint64_t packedIndices = 0;
+   if (first != second)
+   {
+      for (uint32_t i = 0; i < BLOCK_TEXELS; ++i)
+      {
+         packedIndices |= uint64_t{indices[i]} << (2 * i);
+      }
+   }
+
+   writeLittleEndian(out, first, 2);
+   writeLittleEndian(out + 2, second, 2);
+   writeLittleEndian(out + 4, packedIndices, 4);
+}
+
+// BC7 mode 6 endpoint, 7 bits per channel and a p-bit shared by the channels (8 bits decoded)
+struct Bc7Endpoint
+{
+   glm::u8vec4 value = {};
+   uint32_t pBit = 0;
+
+   [[nodiscard]] Color< 4 >
+   Decode() const
+   {
+      return Color< 4 >(glm::uvec4(value) * 2U + glm::uvec4(pBit));
+   }
+};
+
+Bc7Endpoint
+quantizeBc7Endpoint(const Color< 4 >& color)
+{
+   Bc7Endpoint best = {};
+   auto bestError = std::numeric_limits< float >::max();
+   for (uint32_t pBit = 0; pBit < 2; ++pBit)
+   {
+      Bc7Endpoint endpoint = {};
+      endpoint.pBit = pBit;
+      endpoint.value = glm::u8vec4(
+         glm::clamp(glm::round((color - static_cast< float >(pBit)) / 2.0f), 0.0f, 127.0f));
+
+      const auto offset = endpoint.Decode() - color;
+      const auto error = glm::dot(offset, offset);
+      if (error < bestError)
+      {
+         bestError = error;
+         best = endpoint;
+      }
+   }
+
+   return best;
+}
+
+float
+selectBc7Indices(const Block& block, const Bc7Endpoint& first, const Bc7Endpoint& second,
+                 std::array< uint32_t, BLOCK_TEXELS >& indices)
+{
+   const auto e0 = glm::uvec4(first.Decode());
+   const auto e1 = glm::uvec4(second.Decode());
+
+   std::array< Color< 4 >, BC7_WEIGHTS.size() > palette = {};
+   for (uint32_t entry = 0; entry < palette.size(); ++entry)
+   {
+      const auto weight = BC7_WEIGHTS[entry];
+      palette[entry] = Color< 4 >((e0 * (64 - weight) + e1 * weight + 32U) >> 6U);
+   }
+
+   float error = 0.0f;
+   for (uint32_t i = 0; i < BLOCK_TEXELS; ++i)
+   {
+      const auto color = toColor< 4 >(block[i]);
+
+      auto bestError = std::numeric_limits< float >::max();
+      for (uint32_t entry = 0; entry < palette.size(); ++entry)
+      {
+         const auto offset = color - palette[entry];
+         const auto entryError = glm::dot(offset, offset);
+         if (entryError < bestError)
+         {
+            bestError = entryError;
+            indices[i] = entry;
+         }
+      }
+      error += bestError;
+   }
+
+   return error;
+}
+
+class BitWriter
+{
+ public:
+   explicit BitWriter(uint8_t* out, size_t size) : out_(out)
+   {
+      std::memset(out, 0, size);
+   }
+
+   void
+   Write(uint32_t value, uint32_t numBits)
+   {
+      for (uint32_t bit = 0; bit < numBits; ++bit, ++position_)
+      {
+         if ((value >> bit) & 1U)
+         {
+            out_[position_ / 8] |= static_cast< uint8_t >(1U << (position_ % 8));
+         }
+      }
+   }
+
+ private:
+   uint8_t* out_ = nullptr;
+   uint32_t position_ = 0;
+};
+
+// BC7 mode 6: single subset, RGBA endpoints and 4 bit index per texel
+void
+encodeBc7Block(const Block& block, uint8_t* out)
+{
+   const auto [firstColor, secondColor] = fitEndpoints< 4 >(block, 0.0f);
+
+   auto first = quantizeBc7Endpoint(firstColor);
+   auto second = quantizeBc7Endpoint(secondColor);
+   std::array< uint32_t, BLOCK_TEXELS > indices = {};
+   auto error = selectBc7Indices(block, first, second, indices);
+
+   // Endpoints fitted to the chosen indices usually lower the error further
+   for (uint32_t iteration = 0; iteration < 2 && error > 0.0f; ++iteration)
+   {
+      std::array< float, BLOCK_TEXELS > weights = {};
+      std::transform(indices.begin(), indices.end(), weights.begin(), [](uint32_t index) {
+         return 1.0f - static_cast< float >(BC7_WEIGHTS[index]) / 64.0f;
+      });
+
+      auto refitFirst = Color< 4 >(0.0f);
+      auto refitSecond = Color< 4 >(0.0f);
+      if (!refitEndpoints< 4 >(block, weights, refitFirst, refitSecond))
+      {
+         break;
+      }
+
+      const auto newFirst = quantizeBc7Endpoint(refitFirst);
+      const auto newSecond = quantizeBc7Endpoint(refitSecond);
+      std::array< uint32_t, BLOCK_TEXELS > newIndices = {};
+      const auto newError = selectBc7Indices(block, newFirst, newSecond, newIndices);
+      if (newError >= error)
+      {
+         break;
+      }
+
+      first = newFirst;
+      second = newSecond;
+      indices = newIndices;
+      error = newError;
+   }
+
+   // Most significant bit of the first texel's index is implicitly zero
+   if (indices[0] >= BC7_WEIGHTS.size() / 2)
+   {
+      std::swap(first, second);
+      for (auto& index : indices)
+      {
+         index = static_cast< uint32_t >(BC7_WEIGHTS.size()) - 1 - index;
+      }
+   }
+
+   BitWriter writer(out, GetBlockSize(BlockFormat::BC7));
+
+   // Mode 6 is encoded as six zero bits followed by one
+   writer.Write(1U << 6, 7);
+   for (glm::length_t channel = 0; channel < 4; ++channel)
+   {
+      writer.Write(first.value[channel], 7);
+      writer.Write(second.value[channel], 7);
+   }
+   writer.Write(first.pBit, 1);
+   writer.Write(second.pBit, 1);
+
+   writer.Write(indices[0], 3);
+   for (uint32_t i = 1; i < BLOCK_TEXELS; ++i)
+   {
+      writer.Write(indices[i], 4);
+   }
+}
+
+} // namespace
+
+uint32_t
+GetBlockSize(BlockFormat format)
+{
+   return (format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16;
+}
+
+VkFormat
+GetVkFormat(BlockFormat format, bool srgb)
+{
+   switch (format)
+   {
+      case BlockFormat::BC1:
+         return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+      case BlockFormat::BC3:
+         return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+      case BlockFormat::BC4:
+         return VK_FORMAT_BC4_UNORM_BLOCK;
+      case BlockFormat::BC5:
+         return VK_FORMAT_BC5_UNORM_BLOCK;
+      case BlockFormat::BC7:
+      default:
+         return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+   }
+}
+
+std::vector< uint8_t >
+CompressImage(BlockFormat format, std::span< const uint8_t > pixels, uint32_t width,
+              uint32_t height, utils::ThreadPool* threadPool)
+{
+   utils::Assert(width > 0 && height > 0 && pixels.size() >= size_t{width} * height * 4,
+                 "CompressImage: pixels don't match the image size!");
+
+   const auto blocksX = (width + BLOCK_DIM - 1) / BLOCK_DIM;
+   const auto blocksY = (height + BLOCK_DIM - 1) / BLOCK_DIM;
+   const auto blockSize = GetBlockSize(format);
+
+   std::vector< uint8_t > blocks(size_t{blocksX} * blocksY * blockSize);
+
+   const auto encodeRow = [&](size_t blockY) {
+      for (uint32_t blockX = 0; blockX < blocksX; ++blockX)
+      {
+         const auto block =
+            loadBlock(pixels, width, height, blockX, static_cast< uint32_t >(blockY));
+         auto* out = &blocks[(blockY * blocksX + blockX) * blockSize];
+
+         switch (format)
+         {
+            case BlockFormat::BC1: {
+               encodeColorBlock(block, out);
+            }
+            break;
+
+            case BlockFormat::BC3: {
+               encodeChannelBlock(block, 3, out);
+               encodeColorBlock(block, out + 8);
+            }
+            break;
+
+            case BlockFormat::BC4: {
+               encodeChannelBlock(block, 0, out);
+            }
+            break;
+
+            case BlockFormat::BC5: {
+               encodeChannelBlock(block, 0, out);
+               encodeChannelBlock(block, 1, out + 8);
+            }
+            break;
+
+            case BlockFormat::BC7:
+            default: {
+               encodeBc7Block(block, out);
+            }
+            break;
+         }
+      }
+   };
+
+   if (threadPool)
+   {
+      threadPool->ParallelFor(blocksY, encodeRow);
+   }
+   else
+   {
+      for (size_t blockY = 0; blockY < blocksY; ++blockY)
+      {
+         encodeRow(blockY);
+      }
+   }
+
+   return blocks;
+}
+
+} // namespace shady::render
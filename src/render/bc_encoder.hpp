@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::utils {
+class ThreadPool;
+} // namespace shady::utils
+
+namespace shady::render {
+
+// GPU block compression formats, all of them encode 4x4 texel blocks
+enum class BlockFormat : uint8_t
+{
+   // RGB, 8 bytes per block
+   BC1 = 0,
+   // RGBA (BC1 color with separate alpha), 16 bytes per block
+   BC3 = 1,
+   // Red channel only, 8 bytes per block
+   BC4 = 2,
+   // Red and green channels (two BC4 blocks), 16 bytes per block
+   BC5 = 3,
+   // RGBA, 16 bytes per block
+   BC7 = 4
+};
+
+[[nodiscard]] uint32_t
+GetBlockSize(BlockFormat format);
+
+// 'srgb' only applies to the color formats (BC1, BC3 and BC7)
+[[nodiscard]] VkFormat
+GetVkFormat(BlockFormat format, bool srgb);
+
+/*
+ * Encodes RGBA8 'pixels' (rows of 'width' texels, tightly packed) into blocks of 'format',
+ * stored row by row. Blocks crossing the right or bottom edge repeat the edge texels.
+ * BC4 encodes the red channel, BC5 red and green, BC7 uses a single subset with 4 bit indices
+ * (mode 6). Rows of blocks are encoded in parallel when 'threadPool' is given.
+ */
+[[nodiscard]] std::vector< uint8_t >
+CompressImage(BlockFormat format, std::span< const uint8_t > pixels, uint32_t width,
+              uint32_t height, utils::ThreadPool* threadPool = nullptr);
+
+} // namespace shady::render
@@ -1,6 +1,8 @@
 #include "buffer.hpp"
 #include "command.hpp"
 #include "common.hpp"
+#include "memory_allocator.hpp"
+#include "staging_ring.hpp"
 #include "utils/assert.hpp"
 
 #include <fmt/format.h>
@@ -8,9 +10,11 @@
 namespace shady::render {
 
 void
-Buffer::Map(VkDeviceSize size)
+Buffer::Map(VkDeviceSize /*size*/)
 {
-   vkMapMemory(Data::vk_device, bufferMemory_, 0, size, 0, &mappedMemory_);
+   // Host visible memory stays mapped for its whole lifetime (see MemoryAllocator)
+   mappedMemory_ = MemoryAllocator::GetMappedMemory(buffer_);
+   utils::Assert(mappedMemory_ != nullptr, "Buffer::Map buffer is not host visible!");
    mapped_ = true;
 }
 
@@ -19,7 +23,6 @@ Buffer::Unmap()
 {
    if (mapped_)
    {
-      vkUnmapMemory(Data::vk_device, bufferMemory_);
       mapped_ = false;
       mappedMemory_ = nullptr;
    }
@@ -35,22 +38,12 @@ Buffer::CopyData(const void* data) const
 void
 Buffer::CopyDataWithStaging(void* data, size_t dataSize)
 {
-   VkBuffer stagingBuffer{};
-   VkDeviceMemory stagingBufferMemory{};
-   Buffer::CreateBuffer(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                        stagingBuffer, stagingBufferMemory);
-
-   void* mapped_data{};
-   vkMapMemory(Data::vk_device, stagingBufferMemory, 0, dataSize, 0, &mapped_data);
-   memcpy(mapped_data, data, dataSize);
-   vkUnmapMemory(Data::vk_device, stagingBufferMemory);
-
-   Buffer::CopyBuffer(stagingBuffer, buffer_, dataSize);
+   StagingRing::Upload(buffer_, 0, data, dataSize);
+   StagingRing::Flush();
 }
 
 void
-Buffer::CopyDataToImageWithStaging(VkImage image, void* data, size_t dataSize,
+Buffer::CopyDataToImageWithStaging(VkImage image, const void* data, size_t dataSize,
                                    const std::vector< VkBufferImageCopy >& copyRegions)
 {
    VkBuffer stagingBuffer{};
@@ -59,20 +52,16 @@ Buffer::CopyDataToImageWithStaging(VkImage image, void* data, size_t dataSize,
                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                         stagingBuffer, stagingBufferMemory);
 
-   void* mapped_data{};
-   vkMapMemory(Data::vk_device, stagingBufferMemory, 0, dataSize, 0, &mapped_data);
-   memcpy(mapped_data, data, dataSize);
-   vkUnmapMemory(Data::vk_device, stagingBufferMemory);
+   memcpy(MemoryAllocator::GetMappedMemory(stagingBuffer), data, dataSize);
 
    VkCommandBuffer commandBuffer = Command::BeginSingleTimeCommands();
 
    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                           static_cast< uint32_t >(copyRegions.size()), copyRegions.data());
 
+   // Within a batch the copy executes later, so the staging buffer can't be destroyed here
+   Command::ReleaseAfterSubmit(commandBuffer, stagingBuffer);
    Command::EndSingleTimeCommands(commandBuffer);
-
-   vkDestroyBuffer(Data::vk_device, stagingBuffer, nullptr);
-   vkFreeMemory(Data::vk_device, stagingBufferMemory, nullptr);
 }
 
 void
@@ -83,37 +72,20 @@ Buffer::SetupDescriptor(VkDeviceSize /*size*/, VkDeviceSize offset)
    descriptor_.range = bufferSize_;
 }
 
-void
-AllocateMemory(VkMemoryRequirements memReq, VkDeviceMemory& bufferMemory,
-               VkMemoryPropertyFlags properties)
-{
-   VkMemoryAllocateInfo allocInfo{};
-   allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-   allocInfo.allocationSize = memReq.size;
-   allocInfo.memoryTypeIndex = FindMemoryType(memReq.memoryTypeBits, properties);
-
-   VK_CHECK(vkAllocateMemory(Data::vk_device, &allocInfo, nullptr, &bufferMemory),
-            "failed to allocate buffer memory!");
-}
-
 void
 Buffer::AllocateImageMemory(VkImage image, VkDeviceMemory& bufferMemory,
                             VkMemoryPropertyFlags properties)
 {
-   VkMemoryRequirements memRequirements;
-   vkGetImageMemoryRequirements(Data::vk_device, image, &memRequirements);
-
-   AllocateMemory(memRequirements, bufferMemory, properties);
+   MemoryAllocator::Allocate(image, properties);
+   bufferMemory = MemoryAllocator::GetMemory(image);
 }
 
 void
 Buffer::AllocateBufferMemory(VkBuffer buffer, VkDeviceMemory& bufferMemory,
-                             VkMemoryPropertyFlags properties)
+                             VkMemoryPropertyFlags properties, AllocationStrategy strategy)
 {
-   VkMemoryRequirements memRequirements;
-   vkGetBufferMemoryRequirements(Data::vk_device, buffer, &memRequirements);
-
-   AllocateMemory(memRequirements, bufferMemory, properties);
+   MemoryAllocator::Allocate(buffer, properties, strategy);
+   bufferMemory = MemoryAllocator::GetMemory(buffer);
 }
 
 Buffer
@@ -129,7 +101,8 @@ Buffer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryProper
 
 void
 Buffer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                     VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+                     VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+                     AllocationStrategy strategy)
 {
    VkBufferCreateInfo bufferInfo{};
    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -140,9 +113,7 @@ Buffer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryProper
    VK_CHECK(vkCreateBuffer(Data::vk_device, &bufferInfo, nullptr, &buffer),
             "failed to create buffer!");
 
-   AllocateBufferMemory(buffer, bufferMemory, properties);
-
-   vkBindBufferMemory(Data::vk_device, buffer, bufferMemory, 0);
+   AllocateBufferMemory(buffer, bufferMemory, properties, strategy);
 }
 
 void
@@ -160,13 +131,7 @@ Buffer::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
 void
 Buffer::Flush(VkDeviceSize size, VkDeviceSize offset) const
 {
-   VkMappedMemoryRange mappedRange = {};
-   mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-   mappedRange.memory = bufferMemory_;
-   mappedRange.offset = offset;
-   mappedRange.size = size;
-
-   VK_CHECK(vkFlushMappedMemoryRanges(Data::vk_device, 1, &mappedRange), "Buffer::Flush error!");
+   MemoryAllocator::Flush(buffer_, offset, size);
 }
 
 void
@@ -174,12 +139,9 @@ Buffer::Destroy()
 {
    if (buffer_)
    {
+      MemoryAllocator::Free(buffer_);
       vkDestroyBuffer(Data::vk_device, buffer_, nullptr);
    }
-   if (bufferMemory_)
-   {
-      vkFreeMemory(Data::vk_device, bufferMemory_, nullptr);
-   }
 }
 
 VkBuffer&
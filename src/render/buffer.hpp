@@ -1,5 +1,7 @@
 #pragma once
 
+#include "memory_allocator.hpp"
+
 #include <vector>
 #include <vulkan/vulkan.h>
 
@@ -9,20 +11,23 @@ namespace shady::render {
 class Buffer
 {
  public:
+   // Memory is sub-allocated and bound by MemoryAllocator, 'bufferMemory' is the (shared) block
    static void
    AllocateImageMemory(VkImage image, VkDeviceMemory& bufferMemory,
                        VkMemoryPropertyFlags properties);
 
    static void
    AllocateBufferMemory(VkBuffer buffer, VkDeviceMemory& bufferMemory,
-                        VkMemoryPropertyFlags properties);
+                        VkMemoryPropertyFlags properties,
+                        AllocationStrategy strategy = AllocationStrategy::GENERAL);
 
    static Buffer
    CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
 
    static void
    CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+                VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+                AllocationStrategy strategy = AllocationStrategy::GENERAL);
 
    static void
    CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
@@ -40,7 +45,7 @@ class Buffer
    CopyDataWithStaging(void* data, size_t dataSize);
 
    static void
-   CopyDataToImageWithStaging(VkImage image, void* data, size_t dataSize,
+   CopyDataToImageWithStaging(VkImage image, const void* data, size_t dataSize,
                               const std::vector< VkBufferImageCopy >& copyRegions);
 
    void
@@ -1,43 +1,224 @@
 #include "command.hpp"
 #include "common.hpp"
+#include "memory_allocator.hpp"
+#include "utils/assert.hpp"
+
+#include <algorithm>
 
 namespace shady::render {
 
-VkCommandBuffer
-Command::BeginSingleTimeCommands()
+void
+Command::Init()
 {
-   VkCommandBufferAllocateInfo allocInfo{};
-   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-   allocInfo.commandPool = Data::vk_commandPool;
-   allocInfo.commandBufferCount = 1;
+   VkCommandPoolCreateInfo poolInfo = {};
+   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+                    | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+   poolInfo.queueFamilyIndex = Data::m_graphicsQueueFamily;
+   VK_CHECK(vkCreateCommandPool(Data::vk_device, &poolInfo, nullptr, &m_commandPool),
+            "Command: failed to create command pool!");
 
-   VkCommandBuffer commandBuffer{};
-   vkAllocateCommandBuffers(Data::vk_device, &allocInfo, &commandBuffer);
+   m_slots.clear();
+   m_freeSlots.clear();
+   m_inFlight.clear();
+   m_lastSubmitted = 0;
+   m_lastCompleted = 0;
+   m_batchDepth = 0;
+}
 
-   VkCommandBufferBeginInfo beginInfo{};
-   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-   beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+void
+Command::Shutdown()
+{
+   Wait(m_lastSubmitted);
 
-   vkBeginCommandBuffer(commandBuffer, &beginInfo);
+   for (auto& slot : m_slots)
+   {
+      vkDestroyFence(Data::vk_device, slot.fence, nullptr);
+   }
 
-   return commandBuffer;
+   // Command buffers are freed with the pool
+   vkDestroyCommandPool(Data::vk_device, m_commandPool, nullptr);
+   m_commandPool = {};
+   m_slots.clear();
+   m_freeSlots.clear();
+}
+
+VkCommandBuffer
+Command::BeginSingleTimeCommands()
+{
+   if (m_batchDepth > 0)
+   {
+      return m_slots[m_batchSlot].commandBuffer;
+   }
+
+   return m_slots[AcquireSlot()].commandBuffer;
 }
 
 void
 Command::EndSingleTimeCommands(VkCommandBuffer commandBuffer)
 {
-   vkEndCommandBuffer(commandBuffer);
+   if (m_batchDepth > 0)
+   {
+      return;
+   }
+
+   Wait(Submit(commandBuffer));
+}
 
-   VkSubmitInfo submitInfo{};
+SubmitTicket
+Command::Submit(VkCommandBuffer commandBuffer)
+{
+   // The only command buffer handed out during a batch is the batch's one
+   if (m_batchDepth > 0)
+   {
+      return m_lastSubmitted + 1;
+   }
+
+   const auto slotIdx = FindSlot(commandBuffer);
+   auto& slot = m_slots[slotIdx];
+
+   VK_CHECK(vkEndCommandBuffer(commandBuffer), "Command: failed to end command buffer!");
+
+   VkSubmitInfo submitInfo = {};
    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
    submitInfo.commandBufferCount = 1;
    submitInfo.pCommandBuffers = &commandBuffer;
 
-   vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-   vkQueueWaitIdle(Data::vk_graphicsQueue);
+   VK_CHECK(vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo, slot.fence),
+            "Command: failed to submit command buffer!");
+
+   slot.ticket = ++m_lastSubmitted;
+   m_inFlight.push_back(slotIdx);
+
+   return slot.ticket;
+}
+
+void
+Command::BeginBatch()
+{
+   if (m_batchDepth == 0)
+   {
+      m_batchSlot = AcquireSlot();
+   }
+
+   ++m_batchDepth;
+}
+
+SubmitTicket
+Command::EndBatch()
+{
+   utils::Assert(m_batchDepth > 0, "Command::EndBatch called without BeginBatch!");
+
+   --m_batchDepth;
+   return Submit(m_slots[m_batchSlot].commandBuffer);
+}
+
+bool
+Command::IsComplete(SubmitTicket ticket)
+{
+   RetireCompleted();
+   return ticket <= m_lastCompleted;
+}
+
+void
+Command::Wait(SubmitTicket ticket)
+{
+   utils::Assert(ticket <= m_lastSubmitted, "Command: waiting for a ticket that wasn't submitted!");
+
+   RetireCompleted();
+   while (ticket > m_lastCompleted)
+   {
+      const auto& slot = m_slots[m_inFlight.front()];
+      VK_CHECK(vkWaitForFences(Data::vk_device, 1, &slot.fence, VK_TRUE, UINT64_MAX),
+               "Command: failed to wait for fence!");
+      RetireCompleted();
+   }
+}
+
+void
+Command::ReleaseAfterSubmit(VkCommandBuffer commandBuffer, VkBuffer buffer)
+{
+   m_slots[FindSlot(commandBuffer)].releasedBuffers.push_back(buffer);
+}
+
+uint32_t
+Command::AcquireSlot()
+{
+   RetireCompleted();
+
+   if (m_freeSlots.empty())
+   {
+      CommandSlot slot;
+
+      VkCommandBufferAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandPool = m_commandPool;
+      allocInfo.commandBufferCount = 1;
+      VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo, &slot.commandBuffer),
+               "Command: failed to allocate command buffer!");
+
+      VkFenceCreateInfo fenceInfo = {};
+      fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+      VK_CHECK(vkCreateFence(Data::vk_device, &fenceInfo, nullptr, &slot.fence),
+               "Command: failed to create fence!");
+
+      m_freeSlots.push_back(static_cast< uint32_t >(m_slots.size()));
+      m_slots.push_back(std::move(slot));
+   }
+
+   const auto slotIdx = m_freeSlots.back();
+   m_freeSlots.pop_back();
+
+   VkCommandBufferBeginInfo beginInfo = {};
+   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+   beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+   VK_CHECK(vkBeginCommandBuffer(m_slots[slotIdx].commandBuffer, &beginInfo),
+            "Command: failed to begin command buffer!");
+
+   return slotIdx;
+}
+
+uint32_t
+Command::FindSlot(VkCommandBuffer commandBuffer)
+{
+   const auto it = std::find_if(m_slots.begin(), m_slots.end(), [commandBuffer](const auto& slot) {
+      return slot.commandBuffer == commandBuffer;
+   });
+   utils::Assert(it != m_slots.end(), "Command: command buffer wasn't created by Command!");
+
+   return static_cast< uint32_t >(std::distance(m_slots.begin(), it));
+}
+
+void
+Command::RetireCompleted()
+{
+   while (!m_inFlight.empty()
+          && vkGetFenceStatus(Data::vk_device, m_slots[m_inFlight.front()].fence) == VK_SUCCESS)
+   {
+      Recycle(m_inFlight.front());
+      m_inFlight.pop_front();
+   }
+}
+
+void
+Command::Recycle(uint32_t slotIdx)
+{
+   auto& slot = m_slots[slotIdx];
+
+   VK_CHECK(vkResetCommandBuffer(slot.commandBuffer, 0),
+            "Command: failed to reset command buffer!");
+   VK_CHECK(vkResetFences(Data::vk_device, 1, &slot.fence), "Command: failed to reset fence!");
+
+   for (const auto buffer : slot.releasedBuffers)
+   {
+      MemoryAllocator::Free(buffer);
+      vkDestroyBuffer(Data::vk_device, buffer, nullptr);
+   }
+   slot.releasedBuffers.clear();
 
-   vkFreeCommandBuffers(Data::vk_device, Data::vk_commandPool, 1, &commandBuffer);
+   m_lastCompleted = std::max(m_lastCompleted, slot.ticket);
+   m_freeSlots.push_back(slotIdx);
 }
 
 } // namespace shady::render
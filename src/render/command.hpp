@@ -1,17 +1,100 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
+#include <vector>
 #include <vulkan/vulkan.h>
 
 namespace shady::render {
 
+// Identifies a submission made through Command, every submit gets a higher ticket
+using SubmitTicket = uint64_t;
+
+// Recycled one-time command buffer, see Command
+struct CommandSlot
+{
+   VkCommandBuffer commandBuffer = {};
+   VkFence fence = {};
+   SubmitTicket ticket = 0;
+   // Buffers read by the recorded commands, destroyed once the fence is signaled
+   std::vector< VkBuffer > releasedBuffers;
+};
+
+/*
+ * One-time command submission on the graphics queue. Command buffers and fences are recycled
+ * and each submission gets a ticket that can be polled or waited for, so the queue never has
+ * to go idle. Between BeginBatch and EndBatch every BeginSingleTimeCommands returns the same
+ * command buffer, which turns e.g. layout transitions, copy and mip blits of a texture into a
+ * single submission.
+ */
 class Command
 {
  public:
+   static void
+   Init();
+
+   // Waits for all submissions
+   static void
+   Shutdown();
+
+   // Returns the batch's command buffer when a batch is open
    static VkCommandBuffer
    BeginSingleTimeCommands();
 
+   // Submits 'commandBuffer' and waits for it. Only records when a batch is open.
    static void
    EndSingleTimeCommands(VkCommandBuffer commandBuffer);
+
+   // Submits 'commandBuffer' without waiting. When a batch is open, returns the batch's ticket.
+   [[nodiscard]] static SubmitTicket
+   Submit(VkCommandBuffer commandBuffer);
+
+   // Batches can be nested, only the outermost EndBatch submits
+   static void
+   BeginBatch();
+
+   // Returns the ticket of the batch, which is valid even for nested batches
+   static SubmitTicket
+   EndBatch();
+
+   [[nodiscard]] static bool
+   IsComplete(SubmitTicket ticket);
+
+   static void
+   Wait(SubmitTicket ticket);
+
+   // Destroy 'buffer' (and free its memory) once 'commandBuffer' has finished executing
+   static void
+   ReleaseAfterSubmit(VkCommandBuffer commandBuffer, VkBuffer buffer);
+
+ private:
+   // Returns index of a free slot whose command buffer is already in the recording state
+   [[nodiscard]] static uint32_t
+   AcquireSlot();
+
+   [[nodiscard]] static uint32_t
+   FindSlot(VkCommandBuffer commandBuffer);
+
+   // Recycle slots of finished submissions (they finish in submission order)
+   static void
+   RetireCompleted();
+
+   static void
+   Recycle(uint32_t slotIdx);
+
+ private:
+   inline static VkCommandPool m_commandPool = {};
+
+   inline static std::vector< CommandSlot > m_slots = {};
+   inline static std::vector< uint32_t > m_freeSlots = {};
+   // Submitted slots, oldest first
+   inline static std::deque< uint32_t > m_inFlight = {};
+
+   inline static SubmitTicket m_lastSubmitted = 0;
+   inline static SubmitTicket m_lastCompleted = 0;
+
+   inline static uint32_t m_batchDepth = 0;
+   inline static uint32_t m_batchSlot = 0;
 };
 
 } // namespace shady::render
@@ -2,6 +2,8 @@
 
 #include "scene/camera.hpp"
 #include "scene/light.hpp"
+#include "mesh_lod.hpp"
+#include "meshlet.hpp"
 #include "types.hpp"
 #include "utils/assert.hpp"
 #include "vertex.hpp"
@@ -9,6 +11,7 @@
 #include <array>
 #include <fmt/format.h>
 #include <glm/glm.hpp>
+#include <span>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
@@ -46,10 +49,21 @@ struct Data
    inline static VkPhysicalDevice vk_physicalDevice = VK_NULL_HANDLE;
    inline static VkQueue vk_graphicsQueue = {};
    inline static VkQueue m_presentQueue = {};
+   inline static uint32_t m_graphicsQueueFamily = {};
+   // Dedicated transfer queue, same as graphics queue when the device doesn't have one
+   inline static VkQueue vk_transferQueue = {};
+   inline static uint32_t m_transferQueueFamily = {};
    inline static VkExtent2D m_swapChainExtent = {};
    inline static VkExtent2D m_deferredExtent = {};
+   // Lightmap (layer) size of the directional light and the part of its layer each shadow cascade
+   // is rendered to (see Renderer::ConfigureShadows)
+   inline static VkExtent2D m_shadowMapExtent = {4096, 4096};
+   inline static std::array< uint32_t, MAX_SHADOW_CASCADES > m_shadowCascadeResolutions = {
+      4096, 4096, 4096, 4096};
    inline static VkCommandPool vk_commandPool = {};
    inline static VkSurfaceKHR m_surface = {};
+   // No surface/swapchain, frames are rendered into offscreen images
+   inline static bool m_headless = false;
 
    inline static VkSampleCountFlagBits m_msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
@@ -58,8 +72,22 @@ struct Data
    inline static VkDeviceMemory m_indirectDrawsBufferMemory = {};
    inline static uint32_t m_currentVertex = {};
    inline static uint32_t m_currentIndex = {};
+   // Vertex count of the largest mesh, indices are relative to their mesh (vertexOffset)
+   inline static uint32_t m_maxMeshVertices = {};
+   // 16 bit when every mesh has less than 65536 vertices, see Renderer::CreateIndexBuffer
+   inline static VkIndexType m_indexType = VK_INDEX_TYPE_UINT32;
    inline static uint32_t m_numMeshes = {};
-
+   // World space bounding sphere (xyz center, w radius) of every mesh, in draw command order
+   inline static std::vector< glm::vec4 > m_meshBounds = {};
+   // MESH_FLAG_* bits of every mesh, in draw command order
+   inline static std::vector< uint32_t > m_meshFlags = {};
+   // World space meshlets of all static meshes, grouped by mesh (see Meshlet::meshIndex)
+   inline static std::vector< Meshlet > m_meshlets = {};
+   // MAX_MESH_LODS levels per mesh (unused ones have zero indices), in draw command order. Index
+   // ranges are absolute and errors are in world space.
+   inline static std::vector< MeshLod > m_meshLods = {};
+
+   // Uniform and per instance buffers, one per frame in flight
    inline static std::vector< VkBuffer > m_ssbo = {};
    inline static std::vector< VkDeviceMemory > m_ssboMemory = {};
 
@@ -72,11 +100,11 @@ struct Data
    inline static VkDeviceMemory m_indexBufferMemory = {};
 
    inline static std::vector< PerInstanceBuffer > perInstance;
-   inline static std::vector< Vertex > vertices;
-   inline static std::vector< uint32_t > indices;
-   inline static int32_t currTexIdx = 0;
-   inline static std::unordered_map< std::string, std::pair< int32_t, VkImageView > > textures = {};
-   inline static std::vector< VkImageView > texturesVec = {};
+   // Views of the submitted meshes, uploaded (in order) through StagingRing
+   inline static std::vector< std::span< const Vertex > > vertices;
+   inline static std::vector< std::span< const uint32_t > > indices;
+   // TextureTable slot of every texture used by the submitted meshes
+   inline static std::unordered_map< std::string, uint32_t > textures = {};
 
    inline static VkPipelineCache m_pipelineCache = {};
    inline static VkPipeline m_graphicsPipeline = {};
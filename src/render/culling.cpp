@@ -0,0 +1,507 @@
+#include "culling.hpp"
+#include "command.hpp"
+#include "common.hpp"
+#include "depth_pyramid.hpp"
+#include "memory_allocator.hpp"
+#include "pipeline_cache.hpp"
+#include "shader.hpp"
+#include "staging_ring.hpp"
+#include "trace/logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+namespace shady::render {
+
+namespace {
+
+// Must match 'CullData' in cull_common.glsl (std140)
+struct CullData
+{
+   std::array< glm::vec4, NUM_CULL_VIEWS * 6 > planes = {};
+   // Camera's, used to project bounding spheres onto the depth pyramid
+   glm::mat4 viewProjection = {};
+   glm::vec4 cameraPosition = {};
+   uint32_t numMeshes = 0;
+   uint32_t enabled = 0;
+   uint32_t occlusionEnabled = 0;
+   uint32_t numCascades = 0;
+   uint32_t staticCascades = 0;
+   uint32_t numMeshlets = 0;
+   uint32_t clusterCulling = 0;
+   float lodScale = 0.0f;
+   float lodThreshold = 0.0f;
+};
+
+// Push constant selecting which lists cull.comp and cluster_cull.comp write
+constexpr uint32_t PHASE_EARLY = 0;
+constexpr uint32_t PHASE_LATE = 1;
+
+// Planes (pointing inside) of the frustum defined by 'viewProjection' (Gribb-Hartmann)
+void
+extractFrustumPlanes(const glm::mat4& viewProjection, std::span< glm::vec4, 6 > planes)
+{
+   const auto row = [&viewProjection](int32_t idx) {
+      return glm::vec4{viewProjection[0][idx], viewProjection[1][idx], viewProjection[2][idx],
+                       viewProjection[3][idx]};
+   };
+
+   // Near plane uses OpenGL depth range, which is a bit conservative for Vulkan's [0, 1]
+   planes[0] = row(3) + row(0);
+   planes[1] = row(3) - row(0);
+   planes[2] = row(3) + row(1);
+   planes[3] = row(3) - row(1);
+   planes[4] = row(3) + row(2);
+   planes[5] = row(3) - row(2);
+
+   for (auto& plane : planes)
+   {
+      plane /= glm::length(glm::vec3(plane));
+   }
+}
+
+} // namespace
+
+void
+GpuCulling::Init(VkPipelineCache pipelineCache)
+{
+   m_numMeshes = Data::m_numMeshes;
+   m_numMeshlets = static_cast< uint32_t >(Data::m_meshlets.size());
+   m_stats = {};
+   m_stats.total = m_numMeshes;
+   m_stats.totalMeshlets = m_numMeshlets;
+   m_readbackValid = {};
+
+   CreateBuffers();
+   CreateDescriptors();
+   CreatePipelines(pipelineCache);
+
+   trace::Logger::Debug("GpuCulling: {} meshes, {} meshlets, {} draw lists", m_numMeshes,
+                        m_numMeshlets, NUM_DRAW_LISTS);
+}
+
+void
+GpuCulling::CreateBuffers()
+{
+   const auto boundsSize = Data::m_meshBounds.size() * sizeof(glm::vec4);
+   Buffer::CreateBuffer(boundsSize,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_boundsBuffer, m_boundsMemory,
+                        AllocationStrategy::LINEAR);
+   StagingRing::Upload(m_boundsBuffer, 0, Data::m_meshBounds.data(), boundsSize);
+
+   const auto meshFlagsSize = Data::m_meshFlags.size() * sizeof(uint32_t);
+   Buffer::CreateBuffer(meshFlagsSize,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_meshFlagsBuffer, m_meshFlagsMemory,
+                        AllocationStrategy::LINEAR);
+   StagingRing::Upload(m_meshFlagsBuffer, 0, Data::m_meshFlags.data(), meshFlagsSize);
+
+   // Buffers can't be empty, scenes without meshlets get a single unused element
+   const auto meshletsSize = std::max< VkDeviceSize >(m_numMeshlets, 1) * sizeof(Meshlet);
+   Buffer::CreateBuffer(meshletsSize,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_meshletsBuffer, m_meshletsMemory,
+                        AllocationStrategy::LINEAR);
+   if (m_numMeshlets > 0)
+   {
+      StagingRing::Upload(m_meshletsBuffer, 0, Data::m_meshlets.data(),
+                          m_numMeshlets * sizeof(Meshlet));
+   }
+
+   const auto meshLodsSize = Data::m_meshLods.size() * sizeof(MeshLod);
+   Buffer::CreateBuffer(meshLodsSize,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_meshLodsBuffer, m_meshLodsMemory,
+                        AllocationStrategy::LINEAR);
+   StagingRing::Upload(m_meshLodsBuffer, 0, Data::m_meshLods.data(), meshLodsSize);
+   StagingRing::Flush();
+
+   // Nothing was visible before the first frame, its first phase draws nothing
+   const auto visibilitySize = VkDeviceSize{m_numMeshes} * sizeof(uint32_t);
+   Buffer::CreateBuffer(visibilitySize,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_visibilityBuffer,
+                        m_visibilityMemory, AllocationStrategy::LINEAR);
+
+   const auto clusterVisibilitySize = std::max< VkDeviceSize >(m_numMeshlets, 1) * sizeof(uint32_t);
+   Buffer::CreateBuffer(clusterVisibilitySize,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_clusterVisibilityBuffer,
+                        m_clusterVisibilityMemory, AllocationStrategy::LINEAR);
+
+   auto* commandBuffer = Command::BeginSingleTimeCommands();
+   vkCmdFillBuffer(commandBuffer, m_visibilityBuffer, 0, visibilitySize, 0);
+   vkCmdFillBuffer(commandBuffer, m_clusterVisibilityBuffer, 0, clusterVisibilitySize, 0);
+   Command::EndSingleTimeCommands(commandBuffer);
+
+   const auto outputSize = ListOffset(NUM_DRAW_LISTS);
+
+   m_cullDataBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+   m_outputBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+   m_outputMemory.resize(MAX_FRAMES_IN_FLIGHT);
+   m_readbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+   m_readbackMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+   for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+   {
+      m_cullDataBuffers[frame] = Buffer::CreateBuffer(
+         sizeof(CullData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      m_cullDataBuffers[frame].Map();
+
+      Buffer::CreateBuffer(outputSize,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                              | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                              | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_outputBuffers[frame],
+                           m_outputMemory[frame], AllocationStrategy::LINEAR);
+
+      Buffer::CreateBuffer(COUNTS_SIZE, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           m_readbackBuffers[frame], m_readbackMemory[frame],
+                           AllocationStrategy::LINEAR);
+   }
+}
+
+void
+GpuCulling::CreateDescriptors()
+{
+   std::array< VkDescriptorSetLayoutBinding, 10 > bindings = {};
+   for (uint32_t binding = 0; binding < bindings.size(); ++binding)
+   {
+      bindings[binding].binding = binding;
+      bindings[binding].descriptorCount = 1;
+      bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+   }
+
+   // Binding 0 : Frustum planes
+   bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+   // Binding 5 : Depth pyramid
+   bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+   VkDescriptorSetLayoutCreateInfo layoutInfo{};
+   layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+   layoutInfo.bindingCount = static_cast< uint32_t >(bindings.size());
+   layoutInfo.pBindings = bindings.data();
+
+   VK_CHECK(
+      vkCreateDescriptorSetLayout(Data::vk_device, &layoutInfo, nullptr, &m_descriptorSetLayout),
+      "GpuCulling: failed to create descriptor set layout!");
+
+   std::array< VkDescriptorPoolSize, 3 > poolSizes{};
+   poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+   poolSizes[0].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+   poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+   poolSizes[1].descriptorCount = 8 * MAX_FRAMES_IN_FLIGHT;
+   poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+   poolSizes[2].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+
+   VkDescriptorPoolCreateInfo poolInfo{};
+   poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+   poolInfo.poolSizeCount = static_cast< uint32_t >(poolSizes.size());
+   poolInfo.pPoolSizes = poolSizes.data();
+   poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+
+   VK_CHECK(vkCreateDescriptorPool(Data::vk_device, &poolInfo, nullptr, &m_descriptorPool),
+            "GpuCulling: failed to create descriptor pool!");
+
+   std::vector< VkDescriptorSetLayout > layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
+   VkDescriptorSetAllocateInfo allocInfo{};
+   allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+   allocInfo.descriptorPool = m_descriptorPool;
+   allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+   allocInfo.pSetLayouts = layouts.data();
+
+   m_descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+   VK_CHECK(vkAllocateDescriptorSets(Data::vk_device, &allocInfo, m_descriptorSets.data()),
+            "GpuCulling: failed to allocate descriptor sets!");
+
+   for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+   {
+      std::array< VkDescriptorBufferInfo, 10 > bufferInfos{};
+      bufferInfos[0] = m_cullDataBuffers[frame].GetDescriptor();
+      bufferInfos[1] = {m_boundsBuffer, 0, VK_WHOLE_SIZE};
+      bufferInfos[2] = {Data::m_indirectDrawsBuffer, 0, VK_WHOLE_SIZE};
+      bufferInfos[3] = {m_outputBuffers[frame], 0, VK_WHOLE_SIZE};
+      bufferInfos[4] = {m_visibilityBuffer, 0, VK_WHOLE_SIZE};
+      bufferInfos[6] = {m_meshFlagsBuffer, 0, VK_WHOLE_SIZE};
+      bufferInfos[7] = {m_meshletsBuffer, 0, VK_WHOLE_SIZE};
+      bufferInfos[8] = {m_clusterVisibilityBuffer, 0, VK_WHOLE_SIZE};
+      bufferInfos[9] = {m_meshLodsBuffer, 0, VK_WHOLE_SIZE};
+
+      VkDescriptorImageInfo pyramidInfo{};
+      pyramidInfo.sampler = DepthPyramid::GetSampler();
+      pyramidInfo.imageView = DepthPyramid::GetImageView();
+      pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+      std::array< VkWriteDescriptorSet, 10 > descriptorWrites{};
+      for (uint32_t binding = 0; binding < descriptorWrites.size(); ++binding)
+      {
+         descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+         descriptorWrites[binding].dstSet = m_descriptorSets[frame];
+         descriptorWrites[binding].dstBinding = binding;
+         descriptorWrites[binding].descriptorType = bindings[binding].descriptorType;
+         descriptorWrites[binding].descriptorCount = 1;
+         if (bindings[binding].descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+         {
+            descriptorWrites[binding].pImageInfo = &pyramidInfo;
+         }
+         else
+         {
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+         }
+      }
+
+      vkUpdateDescriptorSets(Data::vk_device, static_cast< uint32_t >(descriptorWrites.size()),
+                             descriptorWrites.data(), 0, nullptr);
+   }
+}
+
+void
+GpuCulling::CreatePipelines(VkPipelineCache pipelineCache)
+{
+   VkPushConstantRange pushConstantRange{};
+   pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+   pushConstantRange.size = sizeof(uint32_t);
+
+   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+   pipelineLayoutInfo.setLayoutCount = 1;
+   pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+   pipelineLayoutInfo.pushConstantRangeCount = 1;
+   pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+   VK_CHECK(
+      vkCreatePipelineLayout(Data::vk_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout),
+      "GpuCulling: failed to create pipeline layout!");
+
+   // Both pipelines share the layout and descriptor sets
+   const auto createPipeline = [pipelineCache](std::string_view shader, VkPipeline& pipeline) {
+      auto computeShader = Shader::LoadShader(shader, VK_SHADER_STAGE_COMPUTE_BIT);
+      utils::Assert(computeShader.IsValid(), "GpuCulling: failed to load compute shader!");
+
+      VkComputePipelineCreateInfo pipelineInfo{};
+      pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      pipelineInfo.stage = computeShader.shaderInfo;
+      pipelineInfo.layout = m_pipelineLayout;
+
+      VK_CHECK(PipelineCache::CreateComputePipeline(shader, pipelineCache, pipelineInfo, &pipeline),
+               "GpuCulling: failed to create compute pipeline!");
+
+      computeShader.Destroy();
+   };
+
+   createPipeline("default/cull.comp.spv", m_pipeline);
+   createPipeline("default/cluster_cull.comp.spv", m_clusterPipeline);
+}
+
+void
+GpuCulling::Update(uint32_t frame, const glm::mat4& cameraViewProjection,
+                   const glm::vec3& cameraPosition, float lodScale,
+                   std::span< const glm::mat4 > cascadeViewProjections,
+                   uint32_t staticCascades)
+{
+   // Counts were copied by the previous submission of this frame, which has finished by now
+   if (m_readbackValid.at(frame))
+   {
+      std::array< uint32_t, COUNTS_SIZE / sizeof(uint32_t) > counts = {};
+      std::memcpy(counts.data(), MemoryAllocator::GetMappedMemory(m_readbackBuffers[frame]),
+                  COUNTS_SIZE);
+
+      for (uint32_t list = 0; list < NUM_DRAW_LISTS; ++list)
+      {
+         m_stats.meshes.at(list) = counts.at(NUM_DRAW_LISTS + list);
+         m_stats.triangles.at(list) = counts.at(2 * NUM_DRAW_LISTS + list);
+      }
+   }
+   m_readbackValid.at(frame) = true;
+
+   const auto numCascades =
+      std::min(static_cast< uint32_t >(cascadeViewProjections.size()), MAX_SHADOW_CASCADES);
+
+   CullData cullData{};
+   const auto viewPlanes = [&cullData](uint32_t view) {
+      return std::span(cullData.planes).subspan(size_t{view} * 6).first< 6 >();
+   };
+   extractFrustumPlanes(cameraViewProjection,
+                        viewPlanes(static_cast< uint32_t >(CullView::CAMERA)));
+   for (uint32_t cascade = 0; cascade < numCascades; ++cascade)
+   {
+      extractFrustumPlanes(
+         cascadeViewProjections[cascade],
+         viewPlanes(static_cast< uint32_t >(CullView::SHADOW_CASCADE) + cascade));
+   }
+   cullData.viewProjection = cameraViewProjection;
+   cullData.cameraPosition = glm::vec4{cameraPosition, 1.0f};
+   cullData.numMeshes = m_numMeshes;
+   cullData.enabled = m_enabled ? 1 : 0;
+   cullData.occlusionEnabled = m_occlusionEnabled ? 1 : 0;
+   cullData.numCascades = numCascades;
+   cullData.staticCascades = staticCascades;
+   cullData.numMeshlets = m_numMeshlets;
+   cullData.clusterCulling = (m_clusterCullingEnabled && m_numMeshlets > 0) ? 1 : 0;
+   cullData.lodScale = lodScale;
+   cullData.lodThreshold = m_lodThreshold;
+
+   m_cullDataBuffers[frame].CopyData(&cullData);
+}
+
+void
+GpuCulling::RecordCulling(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+   auto* outputBuffer = m_outputBuffers[frame];
+
+   vkCmdFillBuffer(commandBuffer, outputBuffer, 0, COUNTS_SIZE, 0);
+
+   // Reset has to be visible to the atomics, visibility written by the previous frame's late
+   // culling to this frame's first phase
+   VkMemoryBarrier barrier{};
+   barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+   barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+   vkCmdPipelineBarrier(commandBuffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                        nullptr);
+
+   Dispatch(commandBuffer, frame, PHASE_EARLY);
+
+   barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                        nullptr);
+}
+
+void
+GpuCulling::RecordLateCulling(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+   auto* outputBuffer = m_outputBuffers[frame];
+
+   // DepthPyramid::RecordBuild already made the pyramid and first phase results visible
+   Dispatch(commandBuffer, frame, PHASE_LATE);
+
+   VkMemoryBarrier barrier{};
+   barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+   barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                        &barrier, 0, nullptr, 0, nullptr);
+
+   // Counts for the stats, read on the host once this frame's fence is signaled
+   VkBufferCopy region{};
+   region.size = COUNTS_SIZE;
+   vkCmdCopyBuffer(commandBuffer, outputBuffer, m_readbackBuffers[frame], 1, &region);
+
+   barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void
+GpuCulling::Dispatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t phase)
+{
+   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1,
+                           &m_descriptorSets[frame], 0, nullptr);
+   vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                      sizeof(phase), &phase);
+   vkCmdDispatch(commandBuffer, (m_numMeshes + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+   // Writes different lists than the mesh culling, no barrier is needed in between. Disabled
+   // cluster culling is handled by the shader, so that recorded command buffers stay valid.
+   if (m_numMeshlets > 0)
+   {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_clusterPipeline);
+      vkCmdDispatch(commandBuffer, (m_numMeshlets + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+   }
+}
+
+VkDeviceSize
+GpuCulling::ListOffset(uint32_t list)
+{
+   const auto meshLists = std::min(list, NUM_MESH_DRAW_LISTS);
+   const auto clusterLists = list - meshLists;
+
+   return COUNTS_SIZE
+          + (VkDeviceSize{meshLists} * m_numMeshes + VkDeviceSize{clusterLists} * m_numMeshlets)
+               * sizeof(VkDrawIndexedIndirectCommand);
+}
+
+void
+GpuCulling::DrawIndirect(VkCommandBuffer commandBuffer, DrawList list, uint32_t frame)
+{
+   const auto listIdx = static_cast< uint32_t >(list);
+   const auto maxDraws = listIdx < NUM_MESH_DRAW_LISTS ? m_numMeshes : m_numMeshlets;
+   if (maxDraws == 0)
+   {
+      return;
+   }
+
+   vkCmdDrawIndexedIndirectCount(commandBuffer, m_outputBuffers[frame], ListOffset(listIdx),
+                                 m_outputBuffers[frame], listIdx * sizeof(uint32_t), maxDraws,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void
+GpuCulling::SetEnabled(bool enabled)
+{
+   m_enabled = enabled;
+}
+
+bool
+GpuCulling::IsEnabled()
+{
+   return m_enabled;
+}
+
+void
+GpuCulling::SetOcclusionEnabled(bool enabled)
+{
+   m_occlusionEnabled = enabled;
+}
+
+bool
+GpuCulling::IsOcclusionEnabled()
+{
+   return m_occlusionEnabled;
+}
+
+void
+GpuCulling::SetClusterCullingEnabled(bool enabled)
+{
+   m_clusterCullingEnabled = enabled;
+}
+
+bool
+GpuCulling::IsClusterCullingEnabled()
+{
+   return m_clusterCullingEnabled;
+}
+
+void
+GpuCulling::SetLodThreshold(float pixels)
+{
+   m_lodThreshold = std::max(pixels, 0.0f);
+}
+
+float
+GpuCulling::GetLodThreshold()
+{
+   return m_lodThreshold;
+}
+
+const CullingStats&
+GpuCulling::GetStats()
+{
+   return m_stats;
+}
+
+} // namespace shady::render
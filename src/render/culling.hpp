@@ -0,0 +1,217 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+// Views (frustums) meshes are culled against
+enum class CullView : uint8_t
+{
+   CAMERA = 0,
+   // First of MAX_SHADOW_CASCADES views, one per shadow cascade
+   SHADOW_CASCADE = 1,
+   COUNT = SHADOW_CASCADE + MAX_SHADOW_CASCADES
+};
+
+// Lists of draw commands produced by the culling. Camera meshes are drawn in two phases, first
+// the ones visible in the last frame, then the rest of them that pass the occlusion test against
+// depth of the first phase. Every shadow cascade has its own lists of static and dynamic
+// casters, static ones are only needed when the cached shadow map is refreshed. With cluster
+// culling, meshes split into meshlets are drawn by the two cluster lists instead of the camera
+// ones, a draw per visible meshlet.
+enum class DrawList : uint8_t
+{
+   CAMERA_EARLY = 0,
+   CAMERA_LATE = 1,
+   // First of MAX_SHADOW_CASCADES lists of static casters (see ShadowCascadeList)
+   SHADOW_CASCADE = 2,
+   // First of MAX_SHADOW_CASCADES lists of dynamic casters (see DynamicShadowCascadeList)
+   SHADOW_CASCADE_DYNAMIC = SHADOW_CASCADE + MAX_SHADOW_CASCADES,
+   CLUSTER_EARLY = SHADOW_CASCADE_DYNAMIC + MAX_SHADOW_CASCADES,
+   CLUSTER_LATE = CLUSTER_EARLY + 1,
+   COUNT = CLUSTER_LATE + 1
+};
+
+static constexpr auto NUM_CULL_VIEWS = static_cast< uint32_t >(CullView::COUNT);
+static constexpr auto NUM_DRAW_LISTS = static_cast< uint32_t >(DrawList::COUNT);
+// Lists with a slot per mesh, the cluster ones have a slot per meshlet
+static constexpr auto NUM_MESH_DRAW_LISTS = static_cast< uint32_t >(DrawList::CLUSTER_EARLY);
+
+constexpr DrawList
+ShadowCascadeList(uint32_t cascade)
+{
+   return static_cast< DrawList >(static_cast< uint32_t >(DrawList::SHADOW_CASCADE) + cascade);
+}
+
+constexpr DrawList
+DynamicShadowCascadeList(uint32_t cascade)
+{
+   return static_cast< DrawList >(static_cast< uint32_t >(DrawList::SHADOW_CASCADE_DYNAMIC)
+                                  + cascade);
+}
+
+struct CullingStats
+{
+   uint32_t total = 0;
+   uint32_t totalMeshlets = 0;
+   // Meshes (meshlets for cluster lists) and triangles submitted by each draw list
+   std::array< uint32_t, NUM_DRAW_LISTS > meshes = {};
+   std::array< uint32_t, NUM_DRAW_LISTS > triangles = {};
+};
+
+/*
+ * Frustum and occlusion culling of meshes on the GPU. Compute passes test the bounding sphere of
+ * each mesh against the frustum of every view and write a list of draw commands per DrawList,
+ * together with the draw count consumed by vkCmdDrawIndexedIndirectCount. Visible meshes are
+ * compacted at the front of each list, every draw keeps the mesh index as its first instance,
+ * which the vertex shaders use to fetch per instance data.
+ *
+ * Cluster culling runs alongside in a second compute pipeline. Meshlets of static meshes are
+ * tested against the camera frustum, their normal cone (backfacing clusters) and the depth
+ * pyramid, visible ones are compacted into the cluster lists. Their draws keep the mesh index
+ * as first instance, which the G-buffer shaders use to fetch per instance data.
+ *
+ * Every mesh's level of detail is selected by the camera (Data::m_meshLods), draws of all views
+ * use the index range of the coarsest level whose screen space error is below the threshold.
+ * Meshlets only cover the full detail level, simplified meshes are drawn as a whole.
+ *
+ * Occlusion culling is two-phase: RecordCulling emits meshes visible in the last frame, the
+ * late culling tests the remaining ones against DepthPyramid built from their depth and
+ * remembers what was visible for the next frame.
+ */
+class GpuCulling
+{
+ public:
+   // Uses Data::m_meshBounds, Data::m_meshFlags, Data::m_meshlets, Data::m_meshLods,
+   // Data::m_indirectDrawsBuffer and DepthPyramid, so it has to be called after
+   // Renderer::SetupData and DepthPyramid::Init
+   static void
+   Init(VkPipelineCache pipelineCache);
+
+   // Should only be called once GPU is done with the previous use of 'frame' resources. Lists of
+   // cascades past 'cascadeViewProjections' size stay empty, so do the static caster lists of
+   // cascades missing in 'staticCascades' (bit per cascade). 'cameraPosition' is used for the
+   // meshlet backface test and level of detail selection, 'lodScale' is the camera's height in
+   // pixels of a unit sized object at unit distance.
+   static void
+   Update(uint32_t frame, const glm::mat4& cameraViewProjection, const glm::vec3& cameraPosition,
+          float lodScale, std::span< const glm::mat4 > cascadeViewProjections,
+          uint32_t staticCascades);
+
+   // Record the first phase of 'frame', CAMERA_EARLY, CLUSTER_EARLY and shadow cascade lists are
+   // ready afterwards
+   static void
+   RecordCulling(VkCommandBuffer commandBuffer, uint32_t frame);
+
+   // Record the second phase, has to follow DepthPyramid::RecordBuild. CAMERA_LATE and
+   // CLUSTER_LATE lists are ready afterwards.
+   static void
+   RecordLateCulling(VkCommandBuffer commandBuffer, uint32_t frame);
+
+   static void
+   DrawIndirect(VkCommandBuffer commandBuffer, DrawList list, uint32_t frame);
+
+   // When disabled, every mesh is considered visible
+   static void
+   SetEnabled(bool enabled);
+
+   [[nodiscard]] static bool
+   IsEnabled();
+
+   // When disabled, only the frustum culling is done and CAMERA_LATE list is always empty
+   static void
+   SetOcclusionEnabled(bool enabled);
+
+   [[nodiscard]] static bool
+   IsOcclusionEnabled();
+
+   // When disabled (or no meshlets were loaded), meshes are only culled as a whole and the
+   // cluster lists stay empty
+   static void
+   SetClusterCullingEnabled(bool enabled);
+
+   [[nodiscard]] static bool
+   IsClusterCullingEnabled();
+
+   // Largest screen space error (in pixels) of a simplified level of detail, zero always draws
+   // the full detail
+   static void
+   SetLodThreshold(float pixels);
+
+   [[nodiscard]] static float
+   GetLodThreshold();
+
+   // Results of the last completed frame
+   [[nodiscard]] static const CullingStats&
+   GetStats();
+
+ private:
+   static void
+   CreateBuffers();
+
+   static void
+   CreateDescriptors();
+
+   static void
+   CreatePipelines(VkPipelineCache pipelineCache);
+
+   static void
+   Dispatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t phase);
+
+   // Offset of the first draw command of 'list' in the output buffer
+   [[nodiscard]] static VkDeviceSize
+   ListOffset(uint32_t list);
+
+ private:
+   // Draw, mesh and triangle counts (uint32_t[NUM_DRAW_LISTS] each) precede the draw commands
+   static constexpr VkDeviceSize COUNTS_SIZE = 3 * NUM_DRAW_LISTS * sizeof(uint32_t);
+   static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+   inline static bool m_enabled = true;
+   inline static bool m_occlusionEnabled = true;
+   inline static bool m_clusterCullingEnabled = true;
+   inline static float m_lodThreshold = 1.0f;
+   inline static uint32_t m_numMeshes = 0;
+   inline static uint32_t m_numMeshlets = 0;
+   inline static CullingStats m_stats = {};
+
+   inline static VkBuffer m_boundsBuffer = {};
+   inline static VkDeviceMemory m_boundsMemory = {};
+   inline static VkBuffer m_meshFlagsBuffer = {};
+   inline static VkDeviceMemory m_meshFlagsMemory = {};
+   inline static VkBuffer m_meshletsBuffer = {};
+   inline static VkDeviceMemory m_meshletsMemory = {};
+   inline static VkBuffer m_meshLodsBuffer = {};
+   inline static VkDeviceMemory m_meshLodsMemory = {};
+   // Whether the mesh (meshlet) was visible to the camera in the last frame. Frames in flight
+   // execute in submission order, so a single copy is shared by all of them.
+   inline static VkBuffer m_visibilityBuffer = {};
+   inline static VkDeviceMemory m_visibilityMemory = {};
+   inline static VkBuffer m_clusterVisibilityBuffer = {};
+   inline static VkDeviceMemory m_clusterVisibilityMemory = {};
+
+   // Per frame in flight
+   inline static std::vector< Buffer > m_cullDataBuffers = {};
+   inline static std::vector< VkBuffer > m_outputBuffers = {};
+   inline static std::vector< VkDeviceMemory > m_outputMemory = {};
+   inline static std::vector< VkBuffer > m_readbackBuffers = {};
+   inline static std::vector< VkDeviceMemory > m_readbackMemory = {};
+   inline static std::array< bool, MAX_FRAMES_IN_FLIGHT > m_readbackValid = {};
+
+   inline static VkDescriptorSetLayout m_descriptorSetLayout = {};
+   inline static VkDescriptorPool m_descriptorPool = {};
+   inline static std::vector< VkDescriptorSet > m_descriptorSets = {};
+   inline static VkPipelineLayout m_pipelineLayout = {};
+   inline static VkPipeline m_pipeline = {};
+   inline static VkPipeline m_clusterPipeline = {};
+};
+
+} // namespace shady::render
@@ -1,13 +1,22 @@
 #include "deferred_pipeline.hpp"
 #include "buffer.hpp"
 #include "common.hpp"
+#include "culling.hpp"
+#include "depth_pyramid.hpp"
+#include "frame_stats.hpp"
+#include "pipeline_cache.hpp"
+#include "sampler_cache.hpp"
 #include "scene/perspective_camera.hpp"
 #include "shader.hpp"
+#include "shader_reloader.hpp"
 #include "texture.hpp"
+#include "texture_table.hpp"
 #include "vertex.hpp"
 
 #include <algorithm>
-#include <iterator>
+#include <cmath>
+#include <span>
+#include <utility>
 #include <fmt/format.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -19,6 +28,8 @@ float timer = 0.0f;
 // Depth bias (and slope) are used to avoid shadowing artifacts
 constexpr float depthBiasConstant = 1.25f;
 constexpr float depthBiasSlope = 1.75f;
+// Bit of every shadow cascade, used and unused
+constexpr uint32_t ALL_CASCADES = (1U << MAX_SHADOW_CASCADES) - 1;
 
 struct Light
 {
@@ -35,17 +46,121 @@ struct UboOffscreenVS
    glm::mat4 view = {};
 };
 
+// Must match 'UboComposition' in composition.frag (std140)
 struct UboComposition
 {
    Light light = {};
    glm::vec4 viewPos = {};
    DebugData debugData = {};
+   std::array< glm::mat4, MAX_SHADOW_CASCADES > cascadeViewProjection = {};
+   // View space depth at which each cascade ends
+   glm::vec4 cascadeSplits = {};
+   // Part of the shadow map layer each cascade is rendered to
+   glm::vec4 cascadeScales = {};
+   glm::vec4 viewDirection = {};
+   uint32_t numCascades = 0;
+   std::array< uint32_t, 3 > padding = {};
 };
 
+static_assert(MAX_SHADOW_CASCADES == 4, "Cascade splits and scales are packed into glm::vec4");
+
+namespace {
+
+// Fixed function state shared by the deferred pipelines, adjusted by each of them
+struct GraphicsPipelineState
+{
+   VkPipelineVertexInputStateCreateInfo vertexInput = {};
+   VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+   VkPipelineViewportStateCreateInfo viewportState = {};
+   VkPipelineRasterizationStateCreateInfo rasterizer = {};
+   VkPipelineMultisampleStateCreateInfo multisampling = {};
+   VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+   std::vector< VkPipelineColorBlendAttachmentState > blendAttachments = {};
+   VkPipelineColorBlendStateCreateInfo colorBlending = {};
+   std::vector< VkDynamicState > dynamicStates = {};
+   VkPipelineDynamicStateCreateInfo dynamicState = {};
+
+   // Returned create info points into this object, so it can't be moved or modified afterwards
+   VkGraphicsPipelineCreateInfo
+   GetCreateInfo(std::span< const VkPipelineShaderStageCreateInfo > stages,
+                 VkPipelineLayout layout, VkRenderPass renderPass)
+   {
+      colorBlending.attachmentCount = static_cast< uint32_t >(blendAttachments.size());
+      colorBlending.pAttachments = blendAttachments.data();
+      dynamicState.dynamicStateCount = static_cast< uint32_t >(dynamicStates.size());
+      dynamicState.pDynamicStates = dynamicStates.data();
+
+      VkGraphicsPipelineCreateInfo pipelineInfo{};
+      pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+      pipelineInfo.stageCount = static_cast< uint32_t >(stages.size());
+      pipelineInfo.pStages = stages.data();
+      pipelineInfo.pVertexInputState = &vertexInput;
+      pipelineInfo.pInputAssemblyState = &inputAssembly;
+      pipelineInfo.pViewportState = &viewportState;
+      pipelineInfo.pRasterizationState = &rasterizer;
+      pipelineInfo.pMultisampleState = &multisampling;
+      pipelineInfo.pDepthStencilState = &depthStencil;
+      pipelineInfo.pColorBlendState = &colorBlending;
+      pipelineInfo.pDynamicState = &dynamicState;
+      pipelineInfo.layout = layout;
+      pipelineInfo.renderPass = renderPass;
+      pipelineInfo.subpass = 0;
+      pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+      return pipelineInfo;
+   }
+};
+
+GraphicsPipelineState
+defaultPipelineState()
+{
+   GraphicsPipelineState state;
+
+   state.vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+   state.inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+   state.inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+   state.inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+   state.viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+   state.viewportState.viewportCount = 1;
+   state.viewportState.scissorCount = 1;
+
+   state.rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+   state.rasterizer.depthClampEnable = VK_FALSE;
+   state.rasterizer.rasterizerDiscardEnable = VK_FALSE;
+   state.rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+   state.rasterizer.lineWidth = 1.0f;
+   state.rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+   state.rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+   state.rasterizer.depthBiasEnable = VK_FALSE;
+
+   state.multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+   state.multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+   state.depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+   state.depthStencil.depthTestEnable = VK_TRUE;
+   state.depthStencil.depthWriteEnable = VK_TRUE;
+   state.depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+   VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+   colorBlendAttachment.colorWriteMask = 0xf;
+   colorBlendAttachment.blendEnable = VK_FALSE;
+   state.blendAttachments = {colorBlendAttachment};
+   state.colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+   state.dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+   state.dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+
+   return state;
+}
+
+} // namespace
+
 VkDescriptorSet&
-DeferredPipeline::GetDescriptorSet()
+DeferredPipeline::GetDescriptorSet(uint32_t frame)
 {
-   return m_descriptorSet;
+   return m_descriptorSets.at(frame);
 }
 
 VkPipeline
@@ -61,14 +176,14 @@ DeferredPipeline::GetPipelineLayout()
 }
 
 VkSemaphore&
-DeferredPipeline::GetOffscreenSemaphore()
+DeferredPipeline::GetOffscreenSemaphore(uint32_t frame)
 {
-   return m_offscreenSemaphore;
+   return m_offscreenSemaphores.at(frame);
 }
 
 // Update matrices used for the offscreen rendering of the scene
 void
-DeferredPipeline::UpdateUniformBufferOffscreen(const scene::Camera* camera)
+DeferredPipeline::UpdateUniformBufferOffscreen(const scene::Camera* camera, uint32_t frame)
 {
    UboOffscreenVS uboOffscreenVS{};
    uboOffscreenVS.projection = camera->GetProjection();
@@ -76,35 +191,51 @@ DeferredPipeline::UpdateUniformBufferOffscreen(const scene::Camera* camera)
    uboOffscreenVS.model = glm::mat4(1.0f);
 
    m_offscreenBuffer.CopyData(&uboOffscreenVS);
-   m_skybox.UpdateBuffers(camera);
+   m_skybox.UpdateBuffers(camera, frame);
 }
 
 VkCommandBuffer&
-DeferredPipeline::GetOffscreenCmdBuffer()
+DeferredPipeline::GetOffscreenCmdBuffer(uint32_t frame)
 {
-   return m_offscreenCommandBuffer;
+   return m_shadowCacheHit.at(frame) ? m_cachedShadowCommandBuffers.at(frame)
+                                     : m_offscreenCommandBuffers.at(frame);
 }
 
 // Update lights and parameters passed to the composition shaders
 void
 DeferredPipeline::UpdateUniformBufferComposition(const scene::Camera* camera,
-                                                 const scene::Light* light)
+                                                 const scene::Light* light, uint32_t frame)
 {
    UboComposition uboComposition{};
-   uboComposition.light.position = glm::vec4(camera->GetPosition(), 1.0f);
+   uboComposition.light.position = glm::vec4(light->GetPosition(), 1.0f);
    uboComposition.light.target = glm::vec4(light->GetLookAt(), 1.0);
    uboComposition.light.color = glm::vec4{light->GetColor(), 1.0f};
    uboComposition.light.viewMatrix = light->GetLightSpaceMat();
    uboComposition.viewPos = glm::vec4(camera->GetPosition(), 0.0f);
    uboComposition.debugData = Data::m_debugData;
 
-   memcpy(m_compositionBuffer.GetMappedMemory(), &uboComposition, sizeof(uboComposition));
+   // Cascade is picked by the distance along the camera's forward axis (-Z in view space)
+   const auto& view = camera->GetView();
+   uboComposition.viewDirection = glm::vec4(-view[0][2], -view[1][2], -view[2][2], 0.0f);
+
+   const auto& cascades = light->GetCascades();
+   for (uint32_t cascade = 0; cascade < MAX_SHADOW_CASCADES; ++cascade)
+   {
+      uboComposition.cascadeViewProjection.at(cascade) = cascades.at(cascade).viewProjection;
+      uboComposition.cascadeSplits[static_cast< int32_t >(cascade)] =
+         cascades.at(cascade).splitDepth;
+      uboComposition.cascadeScales[static_cast< int32_t >(cascade)] =
+         static_cast< float >(Data::m_shadowCascadeResolutions.at(cascade))
+         / static_cast< float >(m_shadowMap.GetSize().x);
+   }
+   uboComposition.numCascades = light->GetNumCascades();
+
+   memcpy(m_compositionBuffers.at(frame).GetMappedMemory(), &uboComposition,
+          sizeof(uboComposition));
 }
 
 void
-DeferredPipeline::Initialize(VkRenderPass mainRenderPass,
-                             const std::vector< VkImageView >& swapChainImageViews,
-                             VkPipelineCache pipelineCache)
+DeferredPipeline::Initialize(VkRenderPass mainRenderPass, VkPipelineCache pipelineCache)
 {
    m_pipelineCache = pipelineCache;
    m_mainRenderPass = mainRenderPass;
@@ -120,14 +251,34 @@ DeferredPipeline::Initialize(VkRenderPass mainRenderPass,
    SetupDescriptorPool();
    SetupDescriptorSet();
 
-
-   BuildDeferredCommandBuffer(swapChainImageViews);
+   DepthPyramid::Init(m_offscreenFrameBuffer.GetDepthImageView(), m_offscreenFrameBuffer.GetSize(),
+                      pipelineCache);
+   GpuCulling::Init(pipelineCache);
+   BuildDeferredCommandBuffers();
 }
 
 void
 DeferredPipeline::ShadowSetup()
 {
-   m_shadowMap.CreateShadowMap(4096, 4096, 1);
+   // Layer per cascade
+   m_shadowMap.CreateShadowMap(static_cast< int32_t >(Data::m_shadowMapExtent.width),
+                               static_cast< int32_t >(Data::m_shadowMapExtent.height),
+                               static_cast< int32_t >(MAX_SHADOW_CASCADES));
+
+   // Without dynamic casters the cache is the shadow map itself
+   m_hasDynamicCasters =
+      std::any_of(Data::m_meshFlags.begin(), Data::m_meshFlags.end(),
+                  [](uint32_t flags) { return (flags & MESH_FLAG_DYNAMIC) != 0; });
+   if (m_hasDynamicCasters)
+   {
+      m_staticShadowMap.CreateShadowMap(static_cast< int32_t >(Data::m_shadowMapExtent.width),
+                                        static_cast< int32_t >(Data::m_shadowMapExtent.height),
+                                        static_cast< int32_t >(MAX_SHADOW_CASCADES));
+   }
+
+   m_validCascades = 0;
+   m_shadowCacheHit = {};
+   m_refreshCascades.fill(ALL_CASCADES);
 }
 
 void
@@ -146,20 +297,25 @@ DeferredPipeline::PrepareUniformBuffers()
       sizeof(UboOffscreenVS), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-   // Deferred fragment shader
-   m_compositionBuffer = Buffer::CreateBuffer(
-      sizeof(UboComposition), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+   // Deferred fragment shader (updated every frame, so each frame in flight has its own copy)
+   m_compositionBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+   for (auto& compositionBuffer : m_compositionBuffers)
+   {
+      compositionBuffer = Buffer::CreateBuffer(
+         sizeof(UboComposition), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+      // Map persistent
+      compositionBuffer.Map();
+   }
 
-   // Map persistent
-   m_compositionBuffer.Map();
    m_offscreenBuffer.Map();
 }
 
 void
 DeferredPipeline::SetupDescriptorSetLayout()
 {
-   // Binding 0 : Vertex shader uniform buffer (mrt.vert)
+   // Binding 0 : Vertex shader uniform buffer (gbuffer.vert)
    VkDescriptorSetLayoutBinding vertexShaderUniform{};
    vertexShaderUniform.binding = 0;
    vertexShaderUniform.descriptorCount = 1;
@@ -167,7 +323,7 @@ DeferredPipeline::SetupDescriptorSetLayout()
    vertexShaderUniform.pImmutableSamplers = nullptr;
    vertexShaderUniform.stageFlags = VK_SHADER_STAGE_VERTEX_BIT /*| VK_SHADER_STAGE_GEOMETRY_BIT*/;
 
-   // Binding 1 : Per object buffer (mrt.vert)
+   // Binding 1 : Per object buffer (gbuffer.vert)
    VkDescriptorSetLayoutBinding perInstanceBinding{};
    perInstanceBinding.binding = 1;
    perInstanceBinding.descriptorCount = 1;
@@ -175,7 +331,7 @@ DeferredPipeline::SetupDescriptorSetLayout()
    perInstanceBinding.pImmutableSamplers = nullptr;
    perInstanceBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-   // Binding 2 : Texture sampler (mrt.frag)
+   // Binding 2 : Texture sampler (gbuffer.frag)
    VkDescriptorSetLayoutBinding sampler{};
    sampler.binding = 2;
    sampler.descriptorCount = 1;
@@ -183,14 +339,6 @@ DeferredPipeline::SetupDescriptorSetLayout()
    sampler.pImmutableSamplers = nullptr;
    sampler.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-   // Binding 3 : Texture sampler (mrt.frag)
-   VkDescriptorSetLayoutBinding textures{};
-   textures.binding = 3;
-   textures.descriptorCount = static_cast< uint32_t >(Data::textures.size());
-   textures.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-   textures.pImmutableSamplers = nullptr;
-   textures.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
    // Binding 4 : Sampler Albedo (deferred.frag)
    VkDescriptorSetLayoutBinding albedoTexture{};
    albedoTexture.binding = 4;
@@ -231,10 +379,10 @@ DeferredPipeline::SetupDescriptorSetLayout()
    shadowmapTexture.pImmutableSamplers = nullptr;
    shadowmapTexture.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-   std::array< VkDescriptorSetLayoutBinding, 9 > bindings = {
-      vertexShaderUniform, perInstanceBinding, sampler,        textures,
-      albedoTexture,       positionsTexture,   normalsTexture, fragmentShaderUniform,
-      shadowmapTexture};
+   // Binding 3 is unused, textures are in the bindless TextureTable (set 1)
+   std::array< VkDescriptorSetLayoutBinding, 8 > bindings = {
+      vertexShaderUniform, perInstanceBinding, sampler,        albedoTexture,
+      positionsTexture,    normalsTexture,     fragmentShaderUniform, shadowmapTexture};
 
    VkDescriptorSetLayoutCreateInfo layoutInfo{};
    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -245,11 +393,22 @@ DeferredPipeline::SetupDescriptorSetLayout()
       vkCreateDescriptorSetLayout(Data::vk_device, &layoutInfo, nullptr, &m_descriptorSetLayout),
       "");
 
+   // Shadow cascade index (shadow_cascade.vert)
+   VkPushConstantRange pushConstantRange{};
+   pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+   pushConstantRange.size = sizeof(uint32_t);
+
+   // Set 1 : Bindless textures (gbuffer.frag)
+   const std::array< VkDescriptorSetLayout, 2 > setLayouts = {
+      m_descriptorSetLayout, TextureTable::GetDescriptorSetLayout()};
+
    // Shared pipeline layout used by all pipelines
    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-   pipelineLayoutCreateInfo.setLayoutCount = 1;
-   pipelineLayoutCreateInfo.pSetLayouts = &m_descriptorSetLayout;
+   pipelineLayoutCreateInfo.setLayoutCount = static_cast< uint32_t >(setLayouts.size());
+   pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+   pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+   pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
    VK_CHECK(vkCreatePipelineLayout(Data::vk_device, &pipelineLayoutCreateInfo, nullptr,
                                    &m_pipelineLayout),
@@ -259,245 +418,191 @@ DeferredPipeline::SetupDescriptorSetLayout()
 void
 DeferredPipeline::PreparePipelines()
 {
-   VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-   inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-   inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-   inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-   VkPipelineRasterizationStateCreateInfo rasterizer{};
-   rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-   rasterizer.depthClampEnable = VK_FALSE;
-   rasterizer.rasterizerDiscardEnable = VK_FALSE;
-   rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-   rasterizer.lineWidth = 1.0f;
-
-   rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-   rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-   rasterizer.depthBiasEnable = VK_FALSE;
-
-   VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-   colorBlendAttachment.colorWriteMask = 0xf;
-   colorBlendAttachment.blendEnable = VK_FALSE;
-
-   VkPipelineColorBlendStateCreateInfo colorBlending{};
-   colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-   /*colorBlending.logicOpEnable = VK_FALSE;
-   colorBlending.logicOp = VK_LOGIC_OP_COPY;*/
-   colorBlending.attachmentCount = 1;
-   colorBlending.pAttachments = &colorBlendAttachment;
-
-   VkPipelineDepthStencilStateCreateInfo depthStencil{};
-   depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-   depthStencil.depthTestEnable = VK_TRUE;
-   depthStencil.depthWriteEnable = VK_TRUE;
-   depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-
-   VkPipelineViewportStateCreateInfo viewportState{};
-   viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-   viewportState.viewportCount = 1;
-   viewportState.scissorCount = 1;
-
-   VkPipelineMultisampleStateCreateInfo multisampling{};
-   multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-   multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-
-   std::vector< VkDynamicState > dynamicStateEnables = {VK_DYNAMIC_STATE_VIEWPORT,
-                                                        VK_DYNAMIC_STATE_SCISSOR};
-
-   VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo{};
-   pipelineDynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-   pipelineDynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
-   pipelineDynamicStateCreateInfo.dynamicStateCount =
-      static_cast< uint32_t >(dynamicStateEnables.size());
-   pipelineDynamicStateCreateInfo.flags = 0;
+   m_compositionPipeline = BuildCompositionPipeline();
+   m_offscreenPipeline = BuildOffscreenPipeline();
+   m_shadowMapPipeline = BuildShadowMapPipeline();
+   utils::Assert(m_compositionPipeline != VK_NULL_HANDLE && m_offscreenPipeline != VK_NULL_HANDLE
+                    && m_shadowMapPipeline != VK_NULL_HANDLE,
+                 "DeferredPipeline: failed to create pipelines!");
+
+   ShaderReloader::Register(
+      {"composition",
+       {"default/composition.vert.spv", "default/composition.frag.spv"},
+       &BuildCompositionPipeline,
+       [](VkPipeline pipeline) { return std::exchange(m_compositionPipeline, pipeline); }});
+   ShaderReloader::Register(
+      {"gbuffer",
+       {"default/gbuffer.vert.spv", "default/gbuffer.frag.spv"},
+       &BuildOffscreenPipeline,
+       [](VkPipeline pipeline) { return std::exchange(m_offscreenPipeline, pipeline); }});
+   ShaderReloader::Register(
+      {"shadow cascade",
+       {"default/shadow_cascade.vert.spv"},
+       &BuildShadowMapPipeline,
+       [](VkPipeline pipeline) { return std::exchange(m_shadowMapPipeline, pipeline); }});
+}
 
-   std::array< VkPipelineShaderStageCreateInfo, 2 > shaderStages{};
+VkPipeline
+DeferredPipeline::BuildCompositionPipeline()
+{
    auto [vertexInfo, fragmentInfo] = Shader::CreateShader(
-      Data::vk_device, "default/deferred.vert.spv", "default/deferred.frag.spv");
+      Data::vk_device, "default/composition.vert.spv", "default/composition.frag.spv");
+   if (!vertexInfo.IsValid() || !fragmentInfo.IsValid())
+   {
+      vertexInfo.Destroy();
+      fragmentInfo.Destroy();
+      return VK_NULL_HANDLE;
+   }
 
    VkSpecializationMapEntry specializationEntry{};
    specializationEntry.constantID = 0;
    specializationEntry.offset = 0;
    specializationEntry.size = sizeof(uint32_t);
 
-   uint32_t specializationData = Data::m_msaaSamples;
+   const uint32_t specializationData = Data::m_msaaSamples;
 
-   VkSpecializationInfo specializationInfo;
+   VkSpecializationInfo specializationInfo{};
    specializationInfo.mapEntryCount = 1;
    specializationInfo.pMapEntries = &specializationEntry;
    specializationInfo.dataSize = sizeof(specializationData);
    specializationInfo.pData = &specializationData;
 
-   shaderStages[0] = vertexInfo.shaderInfo;
-   shaderStages[1] = fragmentInfo.shaderInfo;
+   std::array< VkPipelineShaderStageCreateInfo, 2 > shaderStages = {vertexInfo.shaderInfo,
+                                                                    fragmentInfo.shaderInfo};
    shaderStages[1].pSpecializationInfo = &specializationInfo;
 
-   VkGraphicsPipelineCreateInfo pipelineInfo{};
-   pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-   pipelineInfo.stageCount = static_cast< uint32_t >(shaderStages.size());
-   pipelineInfo.pStages = shaderStages.data();
-   pipelineInfo.pInputAssemblyState = &inputAssembly;
-   pipelineInfo.pViewportState = &viewportState;
-   pipelineInfo.pRasterizationState = &rasterizer;
-   pipelineInfo.pMultisampleState = &multisampling;
-   pipelineInfo.pDepthStencilState = &depthStencil;
-   pipelineInfo.pColorBlendState = &colorBlending;
-   pipelineInfo.layout = m_pipelineLayout;
-   pipelineInfo.renderPass = Data::m_renderPass;
-   pipelineInfo.pDynamicState = &pipelineDynamicStateCreateInfo;
-
-   pipelineInfo.subpass = 0;
-   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-
-   // Final fullscreen composition pass pipeline
-   rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
-
-
-   // Empty vertex input state, vertices are generated by the vertex shader
-   VkPipelineVertexInputStateCreateInfo emptyInputState{};
-   emptyInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-
-   pipelineInfo.pVertexInputState = &emptyInputState;
-   VK_CHECK(vkCreateGraphicsPipelines(Data::vk_device, m_pipelineCache, 1, &pipelineInfo, nullptr,
-                                      &m_compositionPipeline),
-            "");
+   // Final fullscreen composition pass pipeline, vertices are generated by the vertex shader
+   // (empty vertex input state)
+   auto state = defaultPipelineState();
+   state.rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
 
-   // Vertex input state from glTF model for pipeline rendering models
-   pipelineInfo.pInputAssemblyState = &inputAssembly;
-   pipelineInfo.pViewportState = &viewportState;
-   pipelineInfo.pRasterizationState = &rasterizer;
-   pipelineInfo.pMultisampleState = &multisampling;
-   pipelineInfo.pDepthStencilState = &depthStencil;
-   pipelineInfo.pDynamicState = &pipelineDynamicStateCreateInfo;
-   pipelineInfo.layout = m_pipelineLayout;
-
-   VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-   vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-   auto bindingDescription = Vertex::getBindingDescription();
-   auto attributeDescriptions = Vertex::getAttributeDescriptions();
-   vertexInputInfo.vertexBindingDescriptionCount = 1;
-   vertexInputInfo.vertexAttributeDescriptionCount =
-      static_cast< uint32_t >(attributeDescriptions.size());
-   vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-   vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+   const auto pipelineInfo =
+      state.GetCreateInfo(shaderStages, m_pipelineLayout, Data::m_renderPass);
 
-   pipelineInfo.pVertexInputState = &vertexInputInfo;
-   rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-   rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+   VkPipeline pipeline = {};
+   const auto result = PipelineCache::CreateGraphicsPipeline("composition", m_pipelineCache,
+                                                             pipelineInfo, &pipeline);
 
-   // Offscreen pipeline
-   std::tie(vertexInfo, fragmentInfo) =
-      Shader::CreateShader(Data::vk_device, "default/mrt.vert.spv", "default/mrt.frag.spv");
+   vertexInfo.Destroy();
+   fragmentInfo.Destroy();
 
-   multisampling.rasterizationSamples = Data::m_msaaSamples;
-
-   specializationData = static_cast< uint32_t >(Data::textures.size());
+   return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
+}
 
-   specializationInfo.mapEntryCount = 1;
-   specializationInfo.pMapEntries = &specializationEntry;
-   specializationInfo.dataSize = sizeof(specializationData);
-   specializationInfo.pData = &specializationData;
+VkPipeline
+DeferredPipeline::BuildOffscreenPipeline()
+{
+   auto [vertexInfo, fragmentInfo] =
+      Shader::CreateShader(Data::vk_device, "default/gbuffer.vert.spv", "default/gbuffer.frag.spv");
+   if (!vertexInfo.IsValid() || !fragmentInfo.IsValid())
+   {
+      vertexInfo.Destroy();
+      fragmentInfo.Destroy();
+      return VK_NULL_HANDLE;
+   }
 
-   shaderStages[0] = vertexInfo.shaderInfo;
-   shaderStages[1] = fragmentInfo.shaderInfo;
-   shaderStages[1].pSpecializationInfo = &specializationInfo;
+   std::array< VkPipelineShaderStageCreateInfo, 2 > shaderStages = {vertexInfo.shaderInfo,
+                                                                    fragmentInfo.shaderInfo};
 
-   pipelineInfo.stageCount = static_cast< uint32_t >(shaderStages.size());
-   pipelineInfo.pStages = shaderStages.data();
+   // Vertex input state from glTF model for pipeline rendering models
+   auto bindingDescription = GetBindingDescription< GpuVertex >();
+   auto attributeDescriptions = GetAttributeDescriptions< GpuVertex >();
 
-   // Separate render pass
-   pipelineInfo.renderPass = m_offscreenFrameBuffer.GetRenderPass();
+   auto state = defaultPipelineState();
+   state.vertexInput.vertexBindingDescriptionCount = 1;
+   state.vertexInput.pVertexBindingDescriptions = &bindingDescription;
+   state.vertexInput.vertexAttributeDescriptionCount =
+      static_cast< uint32_t >(attributeDescriptions.size());
+   state.vertexInput.pVertexAttributeDescriptions = attributeDescriptions.data();
+   state.rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+   state.multisampling.rasterizationSamples = Data::m_msaaSamples;
 
    // Blend attachment states required for all color attachments
    // This is important, as color write mask will otherwise be 0x0 and you
    // won't see anything rendered to the attachment
-   VkPipelineColorBlendAttachmentState firstColorBlendAttachment{};
-   firstColorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
-                                              | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-   firstColorBlendAttachment.blendEnable = VK_FALSE;
+   VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+   colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+                                         | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+   colorBlendAttachment.blendEnable = VK_FALSE;
+   state.blendAttachments.assign(3, colorBlendAttachment);
 
-   VkPipelineColorBlendAttachmentState secondColorBlendAttachment{};
-   secondColorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
-                                               | VK_COLOR_COMPONENT_B_BIT
-                                               | VK_COLOR_COMPONENT_A_BIT;
-   secondColorBlendAttachment.blendEnable = VK_FALSE;
+   // Separate render pass
+   const auto pipelineInfo = state.GetCreateInfo(shaderStages, m_pipelineLayout,
+                                                 m_offscreenFrameBuffer.GetRenderPass());
 
-   VkPipelineColorBlendAttachmentState thirdColorBlendAttachment{};
-   thirdColorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
-                                              | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-   thirdColorBlendAttachment.blendEnable = VK_FALSE;
+   VkPipeline pipeline = {};
+   const auto result =
+      PipelineCache::CreateGraphicsPipeline("gbuffer", m_pipelineCache, pipelineInfo, &pipeline);
 
-   std::array< VkPipelineColorBlendAttachmentState, 3 > blendAttachmentStates = {
-      firstColorBlendAttachment, secondColorBlendAttachment, thirdColorBlendAttachment};
+   vertexInfo.Destroy();
+   fragmentInfo.Destroy();
 
-   colorBlending.attachmentCount = static_cast< uint32_t >(blendAttachmentStates.size());
-   colorBlending.pAttachments = blendAttachmentStates.data();
+   return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
+}
 
-   pipelineInfo.pColorBlendState = &colorBlending;
+VkPipeline
+DeferredPipeline::BuildShadowMapPipeline()
+{
+   // All shadow cascades are rendered in one render pass, the vertex shader outputs each cascade
+   // into its own shadow map layer (gl_Layer), selected by a push constant
+   const auto vertexInfo =
+      Shader::LoadShader("default/shadow_cascade.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+   if (!vertexInfo.IsValid())
+   {
+      return VK_NULL_HANDLE;
+   }
 
-   VK_CHECK(vkCreateGraphicsPipelines(Data::vk_device, m_pipelineCache, 1, &pipelineInfo, nullptr,
-                                      &m_offscreenPipeline),
-            "");
+   const std::array< VkPipelineShaderStageCreateInfo, 1 > shadowStages = {vertexInfo.shaderInfo};
 
-   // Shadow mapping pipeline
-   // The shadow mapping pipeline uses geometry shader instancing (invocations layout modifier) to
-   // output shadow maps for multiple lights sources into the different shadow map layers in one
-   // single render pass
-   std::array< VkPipelineShaderStageCreateInfo, 1 > shadowStages{};
+   auto bindingDescription = GetBindingDescription< GpuVertex >();
+   auto attributeDescriptions = GetAttributeDescriptions< GpuVertex >();
 
-   shadowStages[0] =
-      Shader::LoadShader("default/shadow.vert.spv", VK_SHADER_STAGE_VERTEX_BIT).shaderInfo;
-   /*shadowStages[1] =
-      Shader::LoadShader("default/shadow.geom.spv",
-      VK_SHADER_STAGE_GEOMETRY_BIT).shaderInfo;*/
+   auto state = defaultPipelineState();
+   state.vertexInput.vertexBindingDescriptionCount = 1;
+   state.vertexInput.pVertexBindingDescriptions = &bindingDescription;
+   state.vertexInput.vertexAttributeDescriptionCount =
+      static_cast< uint32_t >(attributeDescriptions.size());
+   state.vertexInput.pVertexAttributeDescriptions = attributeDescriptions.data();
+   state.rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+   // Cull front faces
+   state.rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
+   // Enable depth bias, it's dynamic state so it can be changed at runtime
+   state.rasterizer.depthBiasEnable = VK_TRUE;
+   state.dynamicStates.push_back(VK_DYNAMIC_STATE_DEPTH_BIAS);
+   // Shadow pass doesn't use any color attachments
+   state.blendAttachments.clear();
 
-   pipelineInfo.pStages = shadowStages.data();
-   pipelineInfo.stageCount = static_cast< uint32_t >(shadowStages.size());
+   const auto pipelineInfo =
+      state.GetCreateInfo(shadowStages, m_pipelineLayout, m_shadowMap.GetRenderPass());
 
-   // Shadow pass doesn't use any color attachments
-   colorBlending.attachmentCount = 0;
-   colorBlending.pAttachments = nullptr;
-   // Cull front faces
-   rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
-   depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-   // Enable depth bias
-   rasterizer.depthBiasEnable = VK_TRUE;
-   // Add depth bias to dynamic state, so we can change it at runtime
-   dynamicStateEnables.push_back(VK_DYNAMIC_STATE_DEPTH_BIAS);
-   pipelineDynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
-   pipelineDynamicStateCreateInfo.dynamicStateCount =
-      static_cast< uint32_t >(dynamicStateEnables.size());
-   pipelineDynamicStateCreateInfo.flags = 0;
-
-   // Reset blend attachment state
-   pipelineInfo.renderPass = m_shadowMap.GetRenderPass();
-   VK_CHECK(vkCreateGraphicsPipelines(Data::vk_device, m_pipelineCache, 1, &pipelineInfo, nullptr,
-                                      &m_shadowMapPipeline),
-            "");
+   VkPipeline pipeline = {};
+   const auto result = PipelineCache::CreateGraphicsPipeline("shadow cascade", m_pipelineCache,
+                                                             pipelineInfo, &pipeline);
+
+   vertexInfo.Destroy();
+
+   return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
 }
 
 void
 DeferredPipeline::SetupDescriptorPool()
 {
-   std::array< VkDescriptorPoolSize, 5 > poolSizes{};
+   // Single descriptor set (see SetupDescriptorSetLayout) per frame in flight
+   std::array< VkDescriptorPoolSize, 4 > poolSizes{};
    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-   poolSizes[0].descriptorCount = 8; // 3 * numfrabuffers in swapchain?
+   poolSizes[0].descriptorCount = 2 * MAX_FRAMES_IN_FLIGHT;
    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-   poolSizes[1].descriptorCount = 9; // 3 * numfrabuffers in swapchain?
+   poolSizes[1].descriptorCount = 4 * MAX_FRAMES_IN_FLIGHT;
    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-   poolSizes[2].descriptorCount = 3; // 1 * numfrabuffers in swapchain?
+   poolSizes[2].descriptorCount = MAX_FRAMES_IN_FLIGHT;
    poolSizes[3].type = VK_DESCRIPTOR_TYPE_SAMPLER;
-   poolSizes[3].descriptorCount = 3; // 1 * numfrabuffers in swapchain?
-   poolSizes[4].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-   poolSizes[4].descriptorCount = 3; // 1 * numfrabuffers in swapchain?
-
+   poolSizes[3].descriptorCount = MAX_FRAMES_IN_FLIGHT;
 
    VkDescriptorPoolCreateInfo poolInfo{};
    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
    poolInfo.poolSizeCount = static_cast< uint32_t >(poolSizes.size());
    poolInfo.pPoolSizes = poolSizes.data();
-   poolInfo.maxSets = 4; // Should be 1?
+   poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
 
    VK_CHECK(vkCreateDescriptorPool(Data::vk_device, &poolInfo, nullptr, &m_descriptorPool), "");
 }
@@ -505,13 +610,16 @@ DeferredPipeline::SetupDescriptorPool()
 void
 DeferredPipeline::SetupDescriptorSet()
 {
-   std::array< VkWriteDescriptorSet, 5 > descriptorWrites{};
+   std::vector< VkDescriptorSetLayout > layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
 
    VkDescriptorSetAllocateInfo allocInfo{};
    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
    allocInfo.descriptorPool = m_descriptorPool;
-   allocInfo.descriptorSetCount = 1;
-   allocInfo.pSetLayouts = &m_descriptorSetLayout;
+   allocInfo.descriptorSetCount = static_cast< uint32_t >(layouts.size());
+   allocInfo.pSetLayouts = layouts.data();
+
+   m_descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+   VK_CHECK(vkAllocateDescriptorSets(Data::vk_device, &allocInfo, m_descriptorSets.data()), "");
 
    // Image descriptors for the offscreen color attachments
    VkDescriptorImageInfo positionsImageInfo{};
@@ -534,220 +642,388 @@ DeferredPipeline::SetupDescriptorSet()
    shadowMapInfo.imageView = m_shadowMap.GetShadowMapView();
    shadowMapInfo.sampler = m_shadowMap.GetSampler();
 
-   // Deferred composition
-   VK_CHECK(vkAllocateDescriptorSets(Data::vk_device, &allocInfo, &m_descriptorSet), "");
-
-   // Binding 5 : Position texture target
-   descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[0].dstSet = m_descriptorSet;
-   descriptorWrites[0].dstBinding = 5;
-   descriptorWrites[0].dstArrayElement = 0;
-   descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-   descriptorWrites[0].descriptorCount = 1;
-   descriptorWrites[0].pImageInfo = &positionsImageInfo;
-
-   // Binding 6 : Normals texture target
-   descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[1].dstSet = m_descriptorSet;
-   descriptorWrites[1].dstBinding = 6;
-   descriptorWrites[1].dstArrayElement = 0;
-   descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-   descriptorWrites[1].descriptorCount = 1;
-   descriptorWrites[1].pImageInfo = &normalsImageInfo;
-
-   // Binding 4 : Albedo texture target
-   descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[2].dstSet = m_descriptorSet;
-   descriptorWrites[2].dstBinding = 4;
-   descriptorWrites[2].dstArrayElement = 0;
-   descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-   descriptorWrites[2].descriptorCount = 1;
-   descriptorWrites[2].pImageInfo = &albedoImageInfo;
-
-   // Binding 7 : Fragment shader uniform buffer
-   descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[3].dstSet = m_descriptorSet;
-   descriptorWrites[3].dstBinding = 7;
-   descriptorWrites[3].dstArrayElement = 0;
-   descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-   descriptorWrites[3].descriptorCount = 1;
-   descriptorWrites[3].pBufferInfo = &m_compositionBuffer.GetDescriptor();
-
-   // Binding 8 : Shadowmap texture
-   descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[4].dstSet = m_descriptorSet;
-   descriptorWrites[4].dstBinding = 8;
-   descriptorWrites[4].dstArrayElement = 0;
-   descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-   descriptorWrites[4].descriptorCount = 1;
-   descriptorWrites[4].pImageInfo = &shadowMapInfo;
-
-   vkUpdateDescriptorSets(Data::vk_device, static_cast< uint32_t >(descriptorWrites.size()),
-                          descriptorWrites.data(), 0, nullptr);
-
    // Offscreen (scene)
 
-   const auto [imageView, sampler] =
-      TextureLibrary::GetTexture(TextureType::DIFFUSE_MAP, "196.png").GetImageViewAndSampler();
-
-   VkDescriptorBufferInfo bufferInfo{};
-   bufferInfo.buffer = Data::m_uniformBuffers[0];
-   bufferInfo.offset = 0;
-   bufferInfo.range = sizeof(UniformBufferObject);
-
-
-   VkDescriptorBufferInfo instanceBufferInfo;
-   instanceBufferInfo.buffer = Data::m_ssbo[0];
-   instanceBufferInfo.offset = 0;
-   instanceBufferInfo.range = Data::perInstance.size() * sizeof(PerInstanceBuffer);
-
-   std::vector< VkDescriptorImageInfo > descriptorImageInfos;
-
-   std::transform(Data::texturesVec.begin(), Data::texturesVec.end(),
-                  std::back_inserter(descriptorImageInfos), [](const auto& texture) {
-                     VkDescriptorImageInfo descriptorInfo;
-                     descriptorInfo.sampler = nullptr;
-                     descriptorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                     descriptorInfo.imageView = texture;
-
-                     return descriptorInfo;
-                  });
-
-   descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[0].dstSet = m_descriptorSet;
-   descriptorWrites[0].dstBinding = 0;
-   descriptorWrites[0].dstArrayElement = 0;
-   descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-   descriptorWrites[0].descriptorCount = 1;
-   descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-   descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[1].dstSet = m_descriptorSet;
-   descriptorWrites[1].dstBinding = 1;
-   descriptorWrites[1].dstArrayElement = 0;
-   descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-   descriptorWrites[1].descriptorCount = 1;
-   descriptorWrites[1].pBufferInfo = &instanceBufferInfo;
-
+   // Textures themselves are in the TextureTable, their mip counts differ so the shared sampler
+   // doesn't clamp the level of detail
    VkDescriptorImageInfo samplerInfo = {};
-   samplerInfo.sampler = sampler;
-
-   descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[2].dstSet = m_descriptorSet;
-   descriptorWrites[2].dstBinding = 2;
-   descriptorWrites[2].dstArrayElement = 0;
-   descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-   descriptorWrites[2].descriptorCount = 1;
-   descriptorWrites[2].pImageInfo = &samplerInfo;
-
-   descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-   descriptorWrites[3].dstSet = m_descriptorSet;
-   descriptorWrites[3].dstBinding = 3;
-   descriptorWrites[3].dstArrayElement = 0;
-   descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-   descriptorWrites[3].descriptorCount = static_cast< uint32_t >(Data::textures.size());
-   descriptorWrites[3].pImageInfo = descriptorImageInfos.data();
+   samplerInfo.sampler = SamplerCache::Get({.mipLevels = 0});
 
-   vkUpdateDescriptorSets(Data::vk_device, static_cast< uint32_t >(descriptorWrites.size()),
-                          descriptorWrites.data(), 0, nullptr);
+   // Render targets and the sampler are shared, only the per frame buffers differ between sets
+   for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+   {
+      const auto descriptorSet = m_descriptorSets[frame];
+
+      std::array< VkWriteDescriptorSet, 8 > descriptorWrites{};
+
+      // Binding 5 : Position texture target
+      descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[0].dstSet = descriptorSet;
+      descriptorWrites[0].dstBinding = 5;
+      descriptorWrites[0].dstArrayElement = 0;
+      descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrites[0].descriptorCount = 1;
+      descriptorWrites[0].pImageInfo = &positionsImageInfo;
+
+      // Binding 6 : Normals texture target
+      descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[1].dstSet = descriptorSet;
+      descriptorWrites[1].dstBinding = 6;
+      descriptorWrites[1].dstArrayElement = 0;
+      descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrites[1].descriptorCount = 1;
+      descriptorWrites[1].pImageInfo = &normalsImageInfo;
+
+      // Binding 4 : Albedo texture target
+      descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[2].dstSet = descriptorSet;
+      descriptorWrites[2].dstBinding = 4;
+      descriptorWrites[2].dstArrayElement = 0;
+      descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrites[2].descriptorCount = 1;
+      descriptorWrites[2].pImageInfo = &albedoImageInfo;
+
+      // Binding 7 : Fragment shader uniform buffer
+      descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[3].dstSet = descriptorSet;
+      descriptorWrites[3].dstBinding = 7;
+      descriptorWrites[3].dstArrayElement = 0;
+      descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+      descriptorWrites[3].descriptorCount = 1;
+      descriptorWrites[3].pBufferInfo = &m_compositionBuffers[frame].GetDescriptor();
+
+      // Binding 8 : Shadowmap texture
+      descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[4].dstSet = descriptorSet;
+      descriptorWrites[4].dstBinding = 8;
+      descriptorWrites[4].dstArrayElement = 0;
+      descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrites[4].descriptorCount = 1;
+      descriptorWrites[4].pImageInfo = &shadowMapInfo;
+
+      VkDescriptorBufferInfo bufferInfo{};
+      bufferInfo.buffer = Data::m_uniformBuffers[frame];
+      bufferInfo.offset = 0;
+      bufferInfo.range = sizeof(UniformBufferObject);
+
+      VkDescriptorBufferInfo instanceBufferInfo;
+      instanceBufferInfo.buffer = Data::m_ssbo[frame];
+      instanceBufferInfo.offset = 0;
+      instanceBufferInfo.range = Data::perInstance.size() * sizeof(PerInstanceBuffer);
+
+      // Binding 0 : Vertex shader uniform buffer
+      descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[5].dstSet = descriptorSet;
+      descriptorWrites[5].dstBinding = 0;
+      descriptorWrites[5].dstArrayElement = 0;
+      descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+      descriptorWrites[5].descriptorCount = 1;
+      descriptorWrites[5].pBufferInfo = &bufferInfo;
+
+      // Binding 1 : Per instance buffer
+      descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[6].dstSet = descriptorSet;
+      descriptorWrites[6].dstBinding = 1;
+      descriptorWrites[6].dstArrayElement = 0;
+      descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      descriptorWrites[6].descriptorCount = 1;
+      descriptorWrites[6].pBufferInfo = &instanceBufferInfo;
+
+      // Binding 2 : Texture sampler
+      descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[7].dstSet = descriptorSet;
+      descriptorWrites[7].dstBinding = 2;
+      descriptorWrites[7].dstArrayElement = 0;
+      descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+      descriptorWrites[7].descriptorCount = 1;
+      descriptorWrites[7].pImageInfo = &samplerInfo;
+
+      vkUpdateDescriptorSets(Data::vk_device, static_cast< uint32_t >(descriptorWrites.size()),
+                             descriptorWrites.data(), 0, nullptr);
+   }
 }
 
 void
-DeferredPipeline::BuildDeferredCommandBuffer(const std::vector< VkImageView >& swapChainImageViews)
+DeferredPipeline::BuildDeferredCommandBuffers()
 {
-   if (m_offscreenCommandBuffer == VK_NULL_HANDLE)
+   if (m_offscreenCommandBuffers.empty())
    {
-      m_commandBuffers.resize(swapChainImageViews.size());
+      m_offscreenCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+      m_cachedShadowCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
       VkCommandBufferAllocateInfo allocInfo{};
       allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
       allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
       allocInfo.commandPool = Data::vk_commandPool;
-      allocInfo.commandBufferCount = static_cast< uint32_t >(m_commandBuffers.size());
+      allocInfo.commandBufferCount = static_cast< uint32_t >(m_offscreenCommandBuffers.size());
 
-      VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo, &m_offscreenCommandBuffer),
+      VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo,
+                                        m_offscreenCommandBuffers.data()),
+               "");
+      VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo,
+                                        m_cachedShadowCommandBuffers.data()),
                "");
    }
 
-   // Create a semaphore used to synchronize offscreen rendering and usage
+   // Create semaphores used to synchronize offscreen rendering and usage
+   m_offscreenSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+
    VkSemaphoreCreateInfo semaphoreCreateInfo{};
    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-   VK_CHECK(
-      vkCreateSemaphore(Data::vk_device, &semaphoreCreateInfo, nullptr, &m_offscreenSemaphore), "");
+   for (auto& semaphore : m_offscreenSemaphores)
+   {
+      VK_CHECK(vkCreateSemaphore(Data::vk_device, &semaphoreCreateInfo, nullptr, &semaphore), "");
+   }
 
+   for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame)
+   {
+      RecordDeferredCommandBuffers(frame);
+   }
+}
+
+void
+DeferredPipeline::RecordDeferredCommandBuffers(uint32_t frame)
+{
    VkCommandBufferBeginInfo cmdBufInfo{};
    cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-   // Clear values for all attachments written in the fragment shader
-   std::array< VkClearValue, 4 > clearValues{};
+   RecordRefreshCommandBuffer(frame, m_refreshCascades.at(frame));
 
-   VkRenderPassBeginInfo renderPassBeginInfo = {};
-   renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-   // First pass: Shadow map generation
-   // -------------------------------------------------------------------------------------------------------
+   VK_CHECK(vkBeginCommandBuffer(m_cachedShadowCommandBuffers[frame], &cmdBufInfo), "");
+   RecordOffscreen(m_cachedShadowCommandBuffers[frame], frame, 0);
+   VK_CHECK(vkEndCommandBuffer(m_cachedShadowCommandBuffers[frame]), "");
 
-   clearValues[0].depthStencil = {1.0f, 0};
+   m_outdatedCommandBuffers.at(frame) = false;
+}
 
-   renderPassBeginInfo.renderPass = m_shadowMap.GetRenderPass();
-   renderPassBeginInfo.framebuffer = m_shadowMap.GetFramebuffer();
-   renderPassBeginInfo.renderArea.extent.width = static_cast< uint32_t >(m_shadowMap.GetSize().x);
-   renderPassBeginInfo.renderArea.extent.height = static_cast< uint32_t >(m_shadowMap.GetSize().y);
-   renderPassBeginInfo.clearValueCount = 1;
-   renderPassBeginInfo.pClearValues = clearValues.data();
+void
+DeferredPipeline::RecordRefreshCommandBuffer(uint32_t frame, uint32_t refreshCascades)
+{
+   VkCommandBufferBeginInfo cmdBufInfo{};
+   cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+   VK_CHECK(vkBeginCommandBuffer(m_offscreenCommandBuffers[frame], &cmdBufInfo), "");
+   RecordOffscreen(m_offscreenCommandBuffers[frame], frame, refreshCascades);
+   VK_CHECK(vkEndCommandBuffer(m_offscreenCommandBuffers[frame]), "");
+
+   m_refreshCascades.at(frame) = refreshCascades;
+}
+
+void
+DeferredPipeline::RecordShadowCascades(VkCommandBuffer commandBuffer, uint32_t frame,
+                                       const Framebuffer& shadowMap, DrawList (*lists)(uint32_t),
+                                       uint32_t cascades, bool clear, uint32_t timestampCascades)
+{
+   VkClearValue clearValue{};
+   clearValue.depthStencil = {1.0f, 0};
 
-   VK_CHECK(vkBeginCommandBuffer(m_offscreenCommandBuffer, &cmdBufInfo), "");
+   // Layers are cleared one by one, unless all of them are
+   const auto clearAll = clear && cascades == ALL_CASCADES;
+
+   VkRenderPassBeginInfo renderPassBeginInfo = {};
+   renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+   renderPassBeginInfo.renderPass =
+      clearAll ? shadowMap.GetRenderPass() : shadowMap.GetLoadRenderPass();
+   renderPassBeginInfo.framebuffer = shadowMap.GetFramebuffer();
+   renderPassBeginInfo.renderArea.extent.width = static_cast< uint32_t >(shadowMap.GetSize().x);
+   renderPassBeginInfo.renderArea.extent.height = static_cast< uint32_t >(shadowMap.GetSize().y);
+   renderPassBeginInfo.clearValueCount = 1;
+   renderPassBeginInfo.pClearValues = &clearValue;
 
    VkViewport viewport{};
-   viewport.width = static_cast< float >(m_shadowMap.GetSize().x);
-   viewport.height = static_cast< float >(m_shadowMap.GetSize().y);
    viewport.minDepth = 0.0f;
    viewport.maxDepth = 1.0f;
 
-   vkCmdSetViewport(m_offscreenCommandBuffer, 0, 1, &viewport);
-
    VkRect2D scissor{};
-   scissor.extent.width = static_cast< uint32_t >(m_shadowMap.GetSize().x);
-   scissor.extent.height = static_cast< uint32_t >(m_shadowMap.GetSize().y);
    scissor.offset.x = 0;
    scissor.offset.y = 0;
 
-   vkCmdSetScissor(m_offscreenCommandBuffer, 0, 1, &scissor);
-
    // Set depth bias (aka "Polygon offset")
-   vkCmdSetDepthBias(m_offscreenCommandBuffer, depthBiasConstant, 0.0f, depthBiasSlope);
+   vkCmdSetDepthBias(commandBuffer, depthBiasConstant, 0.0f, depthBiasSlope);
+
+   vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowMapPipeline);
+
+   std::array< VkDeviceSize, 1 > offsets = {0};
+   vkCmdBindVertexBuffers(commandBuffer, 0, 1, &Data::m_vertexBuffer, offsets.data());
+
+   vkCmdBindIndexBuffer(commandBuffer, Data::m_indexBuffer, 0, Data::m_indexType);
+
+   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
+                           &m_descriptorSets[frame], 0, nullptr);
 
-   vkCmdBeginRenderPass(m_offscreenCommandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-   vkCmdBindPipeline(m_offscreenCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                     m_shadowMapPipeline);
+   VkClearAttachment clearAttachment{};
+   clearAttachment.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+   clearAttachment.clearValue = clearValue;
 
+   VkClearRect clearRect{};
+   clearRect.rect = renderPassBeginInfo.renderArea;
+   clearRect.layerCount = 1;
+
+   // Lists of unused cascades are empty
+   for (uint32_t cascade = 0; cascade < MAX_SHADOW_CASCADES; ++cascade)
    {
-      std::array< VkDeviceSize, 1 > offsets = {0};
-      vkCmdBindVertexBuffers(m_offscreenCommandBuffer, 0, 1, &Data::m_vertexBuffer, offsets.data());
+      if ((cascades & (1U << cascade)) == 0)
+      {
+         continue;
+      }
+
+      const auto resolution = Data::m_shadowCascadeResolutions.at(cascade);
+      const auto timestamps = (timestampCascades & (1U << cascade)) != 0;
+
+      if (timestamps)
+      {
+         FrameStats::BeginPass(commandBuffer, ShadowCascadePass(cascade), frame);
+      }
+
+      if (clear && !clearAll)
+      {
+         clearRect.baseArrayLayer = cascade;
+         vkCmdClearAttachments(commandBuffer, 1, &clearAttachment, 1, &clearRect);
+      }
+
+      viewport.width = static_cast< float >(resolution);
+      viewport.height = static_cast< float >(resolution);
+      vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+      scissor.extent.width = resolution;
+      scissor.extent.height = resolution;
+      vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+      vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                         sizeof(cascade), &cascade);
+      GpuCulling::DrawIndirect(commandBuffer, lists(cascade), frame);
+
+      if (timestamps)
+      {
+         FrameStats::EndPass(commandBuffer, ShadowCascadePass(cascade), frame);
+      }
+   }
 
-      vkCmdBindIndexBuffer(m_offscreenCommandBuffer, Data::m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+   vkCmdEndRenderPass(commandBuffer);
+}
 
-      vkCmdBindDescriptorSets(m_offscreenCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              m_pipelineLayout, 0, 1, &m_descriptorSet, 0, nullptr);
+void
+DeferredPipeline::RecordShadowCacheCopy(VkCommandBuffer commandBuffer)
+{
+   const auto layers = static_cast< uint32_t >(MAX_SHADOW_CASCADES);
 
+   // Previous content of the shadow map is fully overwritten
+   std::array< VkImageMemoryBarrier, 2 > barriers{};
+   for (auto& barrier : barriers)
+   {
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      // Layout of depth and stencil aspects is transitioned together
+      barrier.subresourceRange.aspectMask =
+         VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.layerCount = layers;
+   }
 
-      vkCmdDrawIndexedIndirectCount(m_offscreenCommandBuffer, Data::m_indirectDrawsBuffer, 0,
-                                    Data::m_indirectDrawsBuffer,
-                                    sizeof(VkDrawIndexedIndirectCommand) * Data::m_numMeshes,
-                                    Data::m_numMeshes, sizeof(VkDrawIndexedIndirectCommand));
+   barriers[0].image = m_staticShadowMap.GetDepthImage();
+   barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+   barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+   barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+   barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+   barriers[1].image = m_shadowMap.GetDepthImage();
+   barriers[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+   barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+   barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+   barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+   vkCmdPipelineBarrier(commandBuffer,
+                        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+                           | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                        static_cast< uint32_t >(barriers.size()), barriers.data());
+
+   VkImageCopy region{};
+   region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+   region.srcSubresource.layerCount = layers;
+   region.dstSubresource = region.srcSubresource;
+   region.extent.width = static_cast< uint32_t >(m_shadowMap.GetSize().x);
+   region.extent.height = static_cast< uint32_t >(m_shadowMap.GetSize().y);
+   region.extent.depth = 1;
+
+   vkCmdCopyImage(commandBuffer, m_staticShadowMap.GetDepthImage(),
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_shadowMap.GetDepthImage(),
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+   // Both go back to the layout their render passes expect, the shadow map is loaded next
+   barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+   barriers[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+   barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+   barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+   barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+   barriers[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+                               | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+   barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   barriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+                           | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                        0, 0, nullptr, 0, nullptr, static_cast< uint32_t >(barriers.size()),
+                        barriers.data());
+}
+
+void
+DeferredPipeline::RecordOffscreen(VkCommandBuffer commandBuffer, uint32_t frame,
+                                  uint32_t refreshCascades)
+{
+   auto& descriptorSet = m_descriptorSets[frame];
+
+   FrameStats::ResetQueries(commandBuffer, frame);
+
+   // Draw commands of both passes are produced by the culling
+   FrameStats::BeginPass(commandBuffer, GpuPass::CULLING, frame);
+   GpuCulling::RecordCulling(commandBuffer, frame);
+   FrameStats::EndPass(commandBuffer, GpuPass::CULLING, frame);
+
+   // First pass: Shadow map generation
+   // Static casters are only drawn into the refreshed cascades of the cache, dynamic ones over
+   // its copy
+   // ----------------------------------------------------------------------------------------------
+
+   FrameStats::BeginPass(commandBuffer, GpuPass::SHADOW, frame);
+
+   if (refreshCascades != 0)
+   {
+      const auto& cache = m_hasDynamicCasters ? m_staticShadowMap : m_shadowMap;
+      RecordShadowCascades(commandBuffer, frame, cache, ShadowCascadeList, refreshCascades, true,
+                           refreshCascades);
    }
 
-   vkCmdEndRenderPass(m_offscreenCommandBuffer);
+   if (m_hasDynamicCasters)
+   {
+      RecordShadowCacheCopy(commandBuffer);
+      RecordShadowCascades(commandBuffer, frame, m_shadowMap, DynamicShadowCascadeList,
+                           ALL_CASCADES, false, ALL_CASCADES & ~refreshCascades);
+   }
+
+   FrameStats::EndPass(commandBuffer, GpuPass::SHADOW, frame);
 
    // Second pass: Deferred calculations
-   // -------------------------------------------------------------------------------------------------------
+   // Meshes visible in the last frame are drawn first, their depth is used to find which of
+   // the remaining ones are visible, these are drawn in the second phase
+   // ----------------------------------------------------------------------------------------------
+
+   FrameStats::BeginPass(commandBuffer, GpuPass::GBUFFER, frame);
 
+   // Clear values for all attachments written in the fragment shader
+   std::array< VkClearValue, 4 > clearValues{};
    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 0.0f}};
    clearValues[1].color = {{0.0f, 0.0f, 0.0f, 0.0f}};
    clearValues[2].color = {{0.0f, 0.0f, 0.0f, 0.0f}};
    clearValues[3].depthStencil = {1.0f, 0};
 
-
+   VkRenderPassBeginInfo renderPassBeginInfo = {};
+   renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
    renderPassBeginInfo.renderPass = m_offscreenFrameBuffer.GetRenderPass();
    renderPassBeginInfo.framebuffer = m_offscreenFrameBuffer.GetFramebuffer();
    renderPassBeginInfo.renderArea.extent.width =
@@ -757,52 +1033,174 @@ DeferredPipeline::BuildDeferredCommandBuffer(const std::vector< VkImageView >& s
    renderPassBeginInfo.clearValueCount = static_cast< uint32_t >(clearValues.size());
    renderPassBeginInfo.pClearValues = clearValues.data();
 
-   vkCmdBeginRenderPass(m_offscreenCommandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+   vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
+   VkViewport viewport{};
    viewport.width = static_cast< float >(m_offscreenFrameBuffer.GetSize().x);
    viewport.height = static_cast< float >(m_offscreenFrameBuffer.GetSize().y);
    viewport.minDepth = 0.0f;
    viewport.maxDepth = 1.0f;
 
-   vkCmdSetViewport(m_offscreenCommandBuffer, 0, 1, &viewport);
+   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
+   VkRect2D scissor{};
    scissor.extent.width = static_cast< uint32_t >(m_offscreenFrameBuffer.GetSize().x);
    scissor.extent.height = static_cast< uint32_t >(m_offscreenFrameBuffer.GetSize().y);
    scissor.offset.x = 0;
    scissor.offset.y = 0;
 
-   vkCmdSetScissor(m_offscreenCommandBuffer, 0, 1, &scissor);
+   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+   m_skybox.Draw(commandBuffer, frame);
+
+   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_offscreenPipeline);
+
+
+   std::array< VkDeviceSize, 1 > offsets = {0};
+   vkCmdBindVertexBuffers(commandBuffer, 0, 1, &Data::m_vertexBuffer, offsets.data());
+
+   vkCmdBindIndexBuffer(commandBuffer, Data::m_indexBuffer, 0, Data::m_indexType);
+
+   const std::array< VkDescriptorSet, 2 > descriptorSets = {
+      descriptorSet, TextureTable::GetDescriptorSet(frame)};
+   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0,
+                           static_cast< uint32_t >(descriptorSets.size()), descriptorSets.data(),
+                           0, nullptr);
+
+
+   // Cluster lists stay empty when cluster culling is disabled and vice versa for meshes split
+   // into meshlets, so both are always recorded
+   GpuCulling::DrawIndirect(commandBuffer, DrawList::CAMERA_EARLY, frame);
+   GpuCulling::DrawIndirect(commandBuffer, DrawList::CLUSTER_EARLY, frame);
+
+   vkCmdEndRenderPass(commandBuffer);
+
+   FrameStats::BeginPass(commandBuffer, GpuPass::OCCLUSION, frame);
+   DepthPyramid::RecordBuild(commandBuffer);
+   GpuCulling::RecordLateCulling(commandBuffer, frame);
+   FrameStats::EndPass(commandBuffer, GpuPass::OCCLUSION, frame);
+
+   // Pipeline, viewport and bound buffers are command buffer state, they're still set
+   renderPassBeginInfo.renderPass = m_offscreenFrameBuffer.GetLoadRenderPass();
+   vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+   GpuCulling::DrawIndirect(commandBuffer, DrawList::CAMERA_LATE, frame);
+   GpuCulling::DrawIndirect(commandBuffer, DrawList::CLUSTER_LATE, frame);
+
+   vkCmdEndRenderPass(commandBuffer);
+   FrameStats::EndPass(commandBuffer, GpuPass::GBUFFER, frame);
+}
+
+void
+DeferredPipeline::UpdateDeferred(const scene::Camera* camera, const scene::Light* light,
+                                 uint32_t frame)
+{
+   UpdateUniformBufferOffscreen(camera, frame);
+   UpdateUniformBufferComposition(camera, light, frame);
+   TextureTable::Flush(frame);
+
+   const auto refreshCascades = UpdateShadowCache(light);
+   m_shadowCacheHit.at(frame) = refreshCascades == 0;
 
-   m_skybox.Draw(m_offscreenCommandBuffer);
+   if (m_outdatedCommandBuffers.at(frame))
+   {
+      RecordDeferredCommandBuffers(frame);
+   }
 
-   vkCmdBindPipeline(m_offscreenCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                     m_offscreenPipeline);
+   if (refreshCascades != 0 && refreshCascades != m_refreshCascades.at(frame))
+   {
+      RecordRefreshCommandBuffer(frame, refreshCascades);
+   }
 
+   std::array< glm::mat4, MAX_SHADOW_CASCADES > cascadeViewProjections = {};
+   std::transform(light->GetCascades().begin(), light->GetCascades().end(),
+                  cascadeViewProjections.begin(),
+                  [](const auto& cascade) { return cascade.viewProjection; });
 
-   std::array<VkDeviceSize, 1> offsets = {0};
-   vkCmdBindVertexBuffers(m_offscreenCommandBuffer, 0, 1, &Data::m_vertexBuffer, offsets.data());
+   // Pixels per world unit at unit distance, for projecting the error of simplified meshes
+   const auto lodScale = std::abs(camera->GetProjection()[1][1]) * 0.5f
+                         * static_cast< float >(Data::m_deferredExtent.height);
 
-   vkCmdBindIndexBuffer(m_offscreenCommandBuffer, Data::m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+   GpuCulling::Update(frame, camera->GetViewProjection(), camera->GetPosition(), lodScale,
+                      std::span(cascadeViewProjections).first(light->GetNumCascades()),
+                      refreshCascades);
+}
+
+uint32_t
+DeferredPipeline::UpdateShadowCache(const scene::Light* light)
+{
+   const auto& cascades = light->GetCascades();
+   const auto numCascades = light->GetNumCascades();
 
-   vkCmdBindDescriptorSets(m_offscreenCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                           m_pipelineLayout, 0, 1, &m_descriptorSet, 0, nullptr);
+   // Nothing is worth keeping, so every layer is cleared at once
+   auto refreshCascades = (m_validCascades == 0 || !m_shadowCacheEnabled) ? ALL_CASCADES : 0U;
 
+   m_shadowCacheStats.hit = {};
+   for (uint32_t cascade = 0; cascade < numCascades; ++cascade)
+   {
+      const auto bit = 1U << cascade;
+      const auto hit = (refreshCascades & bit) == 0 && (m_validCascades & bit) != 0
+                       && cascades.at(cascade).viewProjection == m_cachedCascades.at(cascade);
+
+      m_shadowCacheStats.hit.at(cascade) = hit;
+      if (hit)
+      {
+         ++m_shadowCacheStats.hits.at(cascade);
+         continue;
+      }
+
+      ++m_shadowCacheStats.misses.at(cascade);
+      refreshCascades |= bit;
+   }
 
-   vkCmdDrawIndexedIndirectCount(m_offscreenCommandBuffer, Data::m_indirectDrawsBuffer, 0,
-                                 Data::m_indirectDrawsBuffer,
-                                 sizeof(VkDrawIndexedIndirectCommand) * Data::m_numMeshes,
-                                 Data::m_numMeshes, sizeof(VkDrawIndexedIndirectCommand));
+   // Layers of unused cascades are cleared too
+   if (refreshCascades == ALL_CASCADES)
+   {
+      m_validCascades = 0;
+   }
 
-   vkCmdEndRenderPass(m_offscreenCommandBuffer);
+   for (uint32_t cascade = 0; cascade < numCascades; ++cascade)
+   {
+      if ((refreshCascades & (1U << cascade)) != 0)
+      {
+         m_cachedCascades.at(cascade) = cascades.at(cascade).viewProjection;
+         m_validCascades |= 1U << cascade;
+      }
+   }
 
-   VK_CHECK(vkEndCommandBuffer(m_offscreenCommandBuffer), "");
+   return refreshCascades;
 }
 
 void
-DeferredPipeline::UpdateDeferred(const scene::Camera* camera, const scene::Light* light)
+DeferredPipeline::InvalidateShadowCache()
+{
+   m_validCascades = 0;
+}
+
+void
+DeferredPipeline::PipelinesChanged()
+{
+   m_outdatedCommandBuffers.fill(true);
+   // Cached static casters might have been rendered with the old shadow pipeline
+   m_validCascades = 0;
+}
+
+void
+DeferredPipeline::SetShadowCacheEnabled(bool enabled)
+{
+   m_shadowCacheEnabled = enabled;
+}
+
+bool
+DeferredPipeline::IsShadowCacheEnabled()
+{
+   return m_shadowCacheEnabled;
+}
+
+const ShadowCacheStats&
+DeferredPipeline::GetShadowCacheStats()
 {
-   UpdateUniformBufferOffscreen(camera);
-   UpdateUniformBufferComposition(camera, light);
+   return m_shadowCacheStats;
 }
 
 
@@ -1,9 +1,13 @@
 #pragma once
 
 #include "buffer.hpp"
+#include "culling.hpp"
 #include "framebuffer.hpp"
 #include "scene/skybox.hpp"
+#include "types.hpp"
 
+#include <array>
+#include <glm/glm.hpp>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -16,15 +20,30 @@ class Camera;
 
 namespace shady::render {
 
+// Per shadow cascade, unused cascades are never counted
+struct ShadowCacheStats
+{
+   // Whether the last updated frame reused the cached static casters of the cascade
+   std::array< bool, MAX_SHADOW_CASCADES > hit = {};
+   std::array< uint64_t, MAX_SHADOW_CASCADES > hits = {};
+   std::array< uint64_t, MAX_SHADOW_CASCADES > misses = {};
+};
+
+/*
+ * Static casters are rendered into a cached shadow map. Each cascade's layer is only refreshed
+ * when the cascade's matrix changes (or the whole cache gets invalidated), other layers keep
+ * their content. Dynamic casters are drawn over a copy of it every frame. Both variants of the
+ * offscreen command buffer are pre-recorded and the one to submit is picked in UpdateDeferred,
+ * the refreshing one is re-recorded when the set of cascades it refreshes changes.
+ */
 class DeferredPipeline
 {
  public:
    static void
-   Initialize(VkRenderPass mainRenderPass, const std::vector< VkImageView >& swapChainImageViews,
-              VkPipelineCache pipelineCache);
+   Initialize(VkRenderPass mainRenderPass, VkPipelineCache pipelineCache);
 
    static VkDescriptorSet&
-   GetDescriptorSet();
+   GetDescriptorSet(uint32_t frame);
 
    static VkPipelineLayout
    GetPipelineLayout();
@@ -32,14 +51,35 @@ class DeferredPipeline
    static VkPipeline
    GetCompositionPipeline();
 
+   // Variant selected by the last UpdateDeferred of 'frame'
    static VkCommandBuffer&
-   GetOffscreenCmdBuffer();
+   GetOffscreenCmdBuffer(uint32_t frame);
 
    static VkSemaphore&
-   GetOffscreenSemaphore();
+   GetOffscreenSemaphore(uint32_t frame);
+
+   // Should only be called once GPU is done with the previous use of 'frame' resources
+   static void
+   UpdateDeferred(const scene::Camera* camera, const scene::Light* light, uint32_t frame);
+
+   // Static casters are re-rendered the next time a frame is updated
+   static void
+   InvalidateShadowCache();
 
+   // Pipelines were replaced (see ShaderReloader), offscreen command buffers of every frame in
+   // flight are re-recorded the next time that frame is updated
    static void
-   UpdateDeferred(const scene::Camera* camera, const scene::Light* light);
+   PipelinesChanged();
+
+   // When disabled, static casters are rendered every frame
+   static void
+   SetShadowCacheEnabled(bool enabled);
+
+   [[nodiscard]] static bool
+   IsShadowCacheEnabled();
+
+   [[nodiscard]] static const ShadowCacheStats&
+   GetShadowCacheStats();
 
  private:
    static void
@@ -55,28 +95,80 @@ class DeferredPipeline
    static void
    SetupDescriptorSetLayout();
 
+   // Creates the pipelines and registers them for hot reloading
    static void
    PreparePipelines();
 
+   // Safe to call from any thread once the pipeline layout and render passes exist,
+   // VK_NULL_HANDLE when the shaders or the pipeline can't be created (the error is logged)
+   [[nodiscard]] static VkPipeline
+   BuildCompositionPipeline();
+
+   [[nodiscard]] static VkPipeline
+   BuildOffscreenPipeline();
+
+   [[nodiscard]] static VkPipeline
+   BuildShadowMapPipeline();
+
    static void
    SetupDescriptorPool();
 
    static void
    SetupDescriptorSet();
 
+   // Offscreen command buffers are static, so they're recorded once for every frame in flight
+   // (with and without refreshing the cached shadow map)
+   static void
+   BuildDeferredCommandBuffers();
+
+   // Both variants of the offscreen command buffer of 'frame'
+   static void
+   RecordDeferredCommandBuffers(uint32_t frame);
+
+   // Variant of the offscreen command buffer of 'frame' refreshing 'refreshCascades' of the cache
+   static void
+   RecordRefreshCommandBuffer(uint32_t frame, uint32_t refreshCascades);
+
+   // Static casters of 'refreshCascades' (bit per cascade) are re-rendered into the cache
+   static void
+   RecordOffscreen(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t refreshCascades);
+
+   // Draw 'lists' of 'cascades' (bit per cascade) into 'shadowMap'. With 'clear', their layers
+   // are cleared first, while layers of the other cascades keep their content. GPU time is only
+   // measured for 'timestampCascades'.
    static void
-   BuildDeferredCommandBuffer(const std::vector< VkImageView >& swapChainImageViews);
+   RecordShadowCascades(VkCommandBuffer commandBuffer, uint32_t frame, const Framebuffer& shadowMap,
+                        DrawList (*lists)(uint32_t), uint32_t cascades, bool clear,
+                        uint32_t timestampCascades);
+
+   // Copy the cached static casters to the shadow map sampled by the composition
+   static void
+   RecordShadowCacheCopy(VkCommandBuffer commandBuffer);
+
+   // Cascades (bit per cascade) whose static casters have to be re-rendered, updates the stats
+   [[nodiscard]] static uint32_t
+   UpdateShadowCache(const scene::Light* light);
 
    static void
-   UpdateUniformBufferComposition(const scene::Camera* camera, const scene::Light* light);
+   UpdateUniformBufferComposition(const scene::Camera* camera, const scene::Light* light,
+                                  uint32_t frame);
 
    static void
-   UpdateUniformBufferOffscreen(const scene::Camera* camera);
+   UpdateUniformBufferOffscreen(const scene::Camera* camera, uint32_t frame);
 
    inline static VkRenderPass m_mainRenderPass = {};
    inline static VkPipeline m_graphicsPipeline = {};
 
    inline static Framebuffer m_shadowMap = {};
+   // Static casters, only used when there are dynamic ones (otherwise they go to m_shadowMap)
+   inline static Framebuffer m_staticShadowMap = {};
+   inline static bool m_hasDynamicCasters = false;
+   inline static bool m_shadowCacheEnabled = true;
+   // Cascades (bit per cascade) whose layer of the cached shadow map is up to date
+   inline static uint32_t m_validCascades = 0;
+   // Cascades the cached shadow map was rendered with
+   inline static std::array< glm::mat4, MAX_SHADOW_CASCADES > m_cachedCascades = {};
+   inline static ShadowCacheStats m_shadowCacheStats = {};
    inline static Framebuffer m_offscreenFrameBuffer = {};
    inline static Framebuffer m_compositionFrameBuffer = {};
 
@@ -86,21 +178,27 @@ class DeferredPipeline
    inline static VkPipeline m_compositionPipeline = {};
 
    inline static VkPipelineLayout m_pipelineLayout = {};
+   // One per frame in flight
    inline static std::vector< VkDescriptorSet > m_descriptorSets = {};
-   inline static VkDescriptorSet m_descriptorSet = {};
    inline static VkDescriptorSetLayout m_descriptorSetLayout = {};
    inline static VkDescriptorPool m_descriptorPool = {};
 
    inline static Buffer m_offscreenBuffer = {};
-   inline static Buffer m_compositionBuffer = {};
+   inline static std::vector< Buffer > m_compositionBuffers = {};
    inline static VkDescriptorSet m_shadowMapDescriptor = {};
    inline static int32_t m_debugDisplayTarget = 0;
 
    inline static VkSampler m_colorSampler = {};
 
-   inline static std::vector< VkCommandBuffer > m_commandBuffers = {};
-   inline static VkCommandBuffer m_offscreenCommandBuffer = {};
-   inline static VkSemaphore m_offscreenSemaphore = {};
+   inline static std::vector< VkCommandBuffer > m_offscreenCommandBuffers = {};
+   // Same as m_offscreenCommandBuffers, except the static casters come from the cache
+   inline static std::vector< VkCommandBuffer > m_cachedShadowCommandBuffers = {};
+   inline static std::array< bool, MAX_FRAMES_IN_FLIGHT > m_shadowCacheHit = {};
+   // Cascades refreshed by m_offscreenCommandBuffers
+   inline static std::array< uint32_t, MAX_FRAMES_IN_FLIGHT > m_refreshCascades = {};
+   // Recorded with pipelines that have since been replaced
+   inline static std::array< bool, MAX_FRAMES_IN_FLIGHT > m_outdatedCommandBuffers = {};
+   inline static std::vector< VkSemaphore > m_offscreenSemaphores = {};
 
    inline static VkViewport m_viewport = {};
    inline static scene::Skybox m_skybox = {};
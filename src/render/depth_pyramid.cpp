@@ -0,0 +1,282 @@
+#include "depth_pyramid.hpp"
+#include "command.hpp"
+#include "common.hpp"
+#include "pipeline_cache.hpp"
+#include "sampler_cache.hpp"
+#include "shader.hpp"
+#include "texture.hpp"
+#include "trace/logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <tuple>
+
+namespace shady::render {
+
+namespace {
+
+// Must match 'Sizes' push constants in depth_pyramid.comp
+struct PyramidLevel
+{
+   glm::ivec2 srcSize = {};
+   glm::ivec2 dstSize = {};
+};
+
+glm::ivec2
+pyramidLevelSize(const glm::uvec2& size, uint32_t level)
+{
+   return glm::ivec2(std::max(size.x >> level, 1u), std::max(size.y >> level, 1u));
+}
+
+} // namespace
+
+void
+DepthPyramid::Init(VkImageView depthView, const glm::ivec2& depthSize,
+                   VkPipelineCache pipelineCache)
+{
+   m_depthSize = glm::uvec2(depthSize);
+   // Power of two sizes make every level cover exactly 2x2 texels of the previous one
+   m_size = {std::bit_floor(m_depthSize.x), std::bit_floor(m_depthSize.y)};
+   m_numLevels = static_cast< uint32_t >(std::bit_width(std::max(m_size.x, m_size.y)));
+
+   CreateImage();
+   CreateDescriptors(depthView);
+   CreatePipeline(pipelineCache);
+
+   trace::Logger::Debug("DepthPyramid: {}x{} with {} levels", m_size.x, m_size.y, m_numLevels);
+}
+
+void
+DepthPyramid::CreateImage()
+{
+   constexpr auto format = VK_FORMAT_R32_SFLOAT;
+
+   std::tie(m_image, m_imageMemory) = Texture::CreateImage(
+      m_size.x, m_size.y, m_numLevels, VK_SAMPLE_COUNT_1_BIT, format, VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+   m_imageView = Texture::CreateImageView(m_image, format, VK_IMAGE_ASPECT_COLOR_BIT, m_numLevels);
+
+   m_levelViews.resize(m_numLevels);
+   for (uint32_t level = 0; level < m_numLevels; ++level)
+   {
+      VkImageViewCreateInfo viewInfo{};
+      viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewInfo.image = m_image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.format = format;
+      viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      viewInfo.subresourceRange.baseMipLevel = level;
+      viewInfo.subresourceRange.levelCount = 1;
+      viewInfo.subresourceRange.baseArrayLayer = 0;
+      viewInfo.subresourceRange.layerCount = 1;
+
+      VK_CHECK(vkCreateImageView(Data::vk_device, &viewInfo, nullptr, &m_levelViews[level]),
+               "DepthPyramid: failed to create image view!");
+   }
+
+   // Shaders fetch exact texels, filtering is never used
+   m_sampler = SamplerCache::Get({.filter = VK_FILTER_NEAREST,
+                                  .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                                  .mipLevels = m_numLevels,
+                                  .anisotropy = false});
+
+   auto* commandBuffer = Command::BeginSingleTimeCommands();
+
+   VkImageMemoryBarrier barrier{};
+   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+   barrier.srcAccessMask = 0;
+   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+   barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+   barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   barrier.image = m_image;
+   barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+   barrier.subresourceRange.levelCount = m_numLevels;
+   barrier.subresourceRange.layerCount = 1;
+
+   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                        &barrier);
+
+   Command::EndSingleTimeCommands(commandBuffer);
+}
+
+void
+DepthPyramid::CreateDescriptors(VkImageView depthView)
+{
+   // Binding 0 : Previous level (or depth)
+   // Binding 1 : Level to write
+   std::array< VkDescriptorSetLayoutBinding, 2 > bindings = {};
+   bindings[0].binding = 0;
+   bindings[0].descriptorCount = 1;
+   bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+   bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+   bindings[1].binding = 1;
+   bindings[1].descriptorCount = 1;
+   bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+   bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+   VkDescriptorSetLayoutCreateInfo layoutInfo{};
+   layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+   layoutInfo.bindingCount = static_cast< uint32_t >(bindings.size());
+   layoutInfo.pBindings = bindings.data();
+
+   VK_CHECK(
+      vkCreateDescriptorSetLayout(Data::vk_device, &layoutInfo, nullptr, &m_descriptorSetLayout),
+      "DepthPyramid: failed to create descriptor set layout!");
+
+   std::array< VkDescriptorPoolSize, 2 > poolSizes{};
+   poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+   poolSizes[0].descriptorCount = m_numLevels;
+   poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+   poolSizes[1].descriptorCount = m_numLevels;
+
+   VkDescriptorPoolCreateInfo poolInfo{};
+   poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+   poolInfo.poolSizeCount = static_cast< uint32_t >(poolSizes.size());
+   poolInfo.pPoolSizes = poolSizes.data();
+   poolInfo.maxSets = m_numLevels;
+
+   VK_CHECK(vkCreateDescriptorPool(Data::vk_device, &poolInfo, nullptr, &m_descriptorPool),
+            "DepthPyramid: failed to create descriptor pool!");
+
+   std::vector< VkDescriptorSetLayout > layouts(m_numLevels, m_descriptorSetLayout);
+   VkDescriptorSetAllocateInfo allocInfo{};
+   allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+   allocInfo.descriptorPool = m_descriptorPool;
+   allocInfo.descriptorSetCount = m_numLevels;
+   allocInfo.pSetLayouts = layouts.data();
+
+   m_descriptorSets.resize(m_numLevels);
+   VK_CHECK(vkAllocateDescriptorSets(Data::vk_device, &allocInfo, m_descriptorSets.data()),
+            "DepthPyramid: failed to allocate descriptor sets!");
+
+   for (uint32_t level = 0; level < m_numLevels; ++level)
+   {
+      VkDescriptorImageInfo srcInfo{};
+      srcInfo.sampler = m_sampler;
+      srcInfo.imageView = level == 0 ? depthView : m_levelViews[level - 1];
+      srcInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+                                       : VK_IMAGE_LAYOUT_GENERAL;
+
+      VkDescriptorImageInfo dstInfo{};
+      dstInfo.imageView = m_levelViews[level];
+      dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+      std::array< VkWriteDescriptorSet, 2 > descriptorWrites{};
+      descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[0].dstSet = m_descriptorSets[level];
+      descriptorWrites[0].dstBinding = 0;
+      descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrites[0].descriptorCount = 1;
+      descriptorWrites[0].pImageInfo = &srcInfo;
+
+      descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[1].dstSet = m_descriptorSets[level];
+      descriptorWrites[1].dstBinding = 1;
+      descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      descriptorWrites[1].descriptorCount = 1;
+      descriptorWrites[1].pImageInfo = &dstInfo;
+
+      vkUpdateDescriptorSets(Data::vk_device, static_cast< uint32_t >(descriptorWrites.size()),
+                             descriptorWrites.data(), 0, nullptr);
+   }
+}
+
+void
+DepthPyramid::CreatePipeline(VkPipelineCache pipelineCache)
+{
+   VkPushConstantRange pushConstantRange{};
+   pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+   pushConstantRange.size = sizeof(PyramidLevel);
+
+   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+   pipelineLayoutInfo.setLayoutCount = 1;
+   pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+   pipelineLayoutInfo.pushConstantRangeCount = 1;
+   pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+   VK_CHECK(
+      vkCreatePipelineLayout(Data::vk_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout),
+      "DepthPyramid: failed to create pipeline layout!");
+
+   auto computeShader =
+      Shader::LoadShader("default/depth_pyramid.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+   utils::Assert(computeShader.IsValid(), "DepthPyramid: failed to load compute shader!");
+
+   VkComputePipelineCreateInfo pipelineInfo{};
+   pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+   pipelineInfo.stage = computeShader.shaderInfo;
+   pipelineInfo.layout = m_pipelineLayout;
+
+   VK_CHECK(PipelineCache::CreateComputePipeline("depth pyramid", pipelineCache, pipelineInfo,
+                                                 &m_pipeline),
+            "DepthPyramid: failed to create compute pipeline!");
+
+   computeShader.Destroy();
+}
+
+void
+DepthPyramid::RecordBuild(VkCommandBuffer commandBuffer)
+{
+   // Depth has to be written, and the previous culling done with the pyramid
+   VkMemoryBarrier barrier{};
+   barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+   barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+   vkCmdPipelineBarrier(commandBuffer,
+                        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+                           | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                        nullptr);
+
+   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+
+   // Each level reads the previous one
+   barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+   for (uint32_t level = 0; level < m_numLevels; ++level)
+   {
+      PyramidLevel sizes{};
+      sizes.srcSize = level == 0 ? glm::ivec2(m_depthSize) : pyramidLevelSize(m_size, level - 1);
+      sizes.dstSize = pyramidLevelSize(m_size, level);
+
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0,
+                              1, &m_descriptorSets[level], 0, nullptr);
+      vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(sizes), &sizes);
+
+      const auto dstSize = glm::uvec2(sizes.dstSize);
+      vkCmdDispatch(commandBuffer, (dstSize.x + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                    (dstSize.y + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                           nullptr);
+   }
+
+   // Depth can be written again once it was read
+   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+                           | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                        0, 0, nullptr, 0, nullptr, 0, nullptr);
+}
+
+VkImageView
+DepthPyramid::GetImageView()
+{
+   return m_imageView;
+}
+
+VkSampler
+DepthPyramid::GetSampler()
+{
+   return m_sampler;
+}
+
+} // namespace shady::render
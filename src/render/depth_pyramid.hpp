@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+/*
+ * Hierarchical depth (Hi-Z) built from the G-Buffer depth. Every texel holds the farthest depth
+ * of the area it covers, so a single fetch at the right level tells whether a bounding volume
+ * is hidden. Level 0 is the depth rounded down to a power of two, every next level halves it.
+ * The image stays in VK_IMAGE_LAYOUT_GENERAL.
+ */
+class DepthPyramid
+{
+ public:
+   // 'depthView' has to be in VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL when RecordBuild
+   // commands are executed
+   static void
+   Init(VkImageView depthView, const glm::ivec2& depthSize, VkPipelineCache pipelineCache);
+
+   // Has to be recorded outside of a render pass, after the depth was written. Pyramid is
+   // ready to be read by compute shaders afterwards.
+   static void
+   RecordBuild(VkCommandBuffer commandBuffer);
+
+   // View of the whole mip chain
+   [[nodiscard]] static VkImageView
+   GetImageView();
+
+   [[nodiscard]] static VkSampler
+   GetSampler();
+
+ private:
+   static void
+   CreateImage();
+
+   static void
+   CreateDescriptors(VkImageView depthView);
+
+   static void
+   CreatePipeline(VkPipelineCache pipelineCache);
+
+ private:
+   static constexpr uint32_t WORKGROUP_SIZE = 8;
+
+   inline static glm::uvec2 m_depthSize = {};
+   inline static glm::uvec2 m_size = {};
+   inline static uint32_t m_numLevels = 0;
+
+   inline static VkImage m_image = {};
+   inline static VkDeviceMemory m_imageMemory = {};
+   inline static VkImageView m_imageView = {};
+   inline static VkSampler m_sampler = {};
+   // Single level views, one per mip
+   inline static std::vector< VkImageView > m_levelViews = {};
+
+   inline static VkDescriptorSetLayout m_descriptorSetLayout = {};
+   inline static VkDescriptorPool m_descriptorPool = {};
+   // Set 'i' reads level 'i - 1' (or the depth for 0) and writes level 'i'
+   inline static std::vector< VkDescriptorSet > m_descriptorSets = {};
+   inline static VkPipelineLayout m_pipelineLayout = {};
+   inline static VkPipeline m_pipeline = {};
+};
+
+} // namespace shady::render
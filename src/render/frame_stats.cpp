@@ -0,0 +1,245 @@
+#include "frame_stats.hpp"
+#include "common.hpp"
+#include "trace/logger.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace shady::render {
+
+std::string_view
+ToString(GpuPass pass)
+{
+   switch (pass)
+   {
+      case GpuPass::SHADOW:
+         return "shadow";
+      case GpuPass::GBUFFER:
+         return "gbuffer";
+      case GpuPass::COMPOSITION:
+         return "composition";
+      case GpuPass::CULLING:
+         return "culling";
+      case GpuPass::OCCLUSION:
+         return "occlusion";
+      case GpuPass::COUNT:
+         return "unknown";
+      default:
+         break;
+   }
+
+   constexpr std::array< std::string_view, MAX_SHADOW_CASCADES > cascadeNames = {
+      "cascade0", "cascade1", "cascade2", "cascade3"};
+
+   const auto cascade =
+      static_cast< uint32_t >(pass) - static_cast< uint32_t >(GpuPass::SHADOW_CASCADE);
+   return cascade < cascadeNames.size() ? cascadeNames.at(cascade) : "unknown";
+}
+
+std::string_view
+ToString(CpuStage stage)
+{
+   switch (stage)
+   {
+      case CpuStage::UPDATE:
+         return "update";
+      case CpuStage::RECORD:
+         return "record";
+      case CpuStage::SUBMIT:
+         return "submit";
+      case CpuStage::WAIT:
+         return "wait";
+      case CpuStage::FRAME:
+         return "frame";
+      case CpuStage::COUNT:
+      default:
+         return "unknown";
+   }
+}
+
+void
+FrameStats::Init(uint32_t framesInFlight)
+{
+   m_framesInFlight = framesInFlight;
+
+   VkPhysicalDeviceProperties properties{};
+   vkGetPhysicalDeviceProperties(Data::vk_physicalDevice, &properties);
+
+   uint32_t queueFamilyCount = 0;
+   vkGetPhysicalDeviceQueueFamilyProperties(Data::vk_physicalDevice, &queueFamilyCount, nullptr);
+   std::vector< VkQueueFamilyProperties > queueFamilies(queueFamilyCount);
+   vkGetPhysicalDeviceQueueFamilyProperties(Data::vk_physicalDevice, &queueFamilyCount,
+                                            queueFamilies.data());
+
+   const auto validBits = queueFamilies.at(Data::m_graphicsQueueFamily).timestampValidBits;
+   m_timestampsSupported = validBits > 0 && properties.limits.timestampPeriod > 0.0f;
+
+   if (!m_timestampsSupported)
+   {
+      trace::Logger::Warn("FrameStats: timestamp queries are not supported, GPU timings disabled");
+      return;
+   }
+
+   m_timestampPeriod = static_cast< double >(properties.limits.timestampPeriod);
+   m_timestampMask = validBits >= 64 ? ~uint64_t{0} : ((uint64_t{1} << validBits) - 1);
+
+   VkQueryPoolCreateInfo queryPoolInfo{};
+   queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+   queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+   queryPoolInfo.queryCount = 2 * NUM_GPU_PASSES * m_framesInFlight;
+
+   VK_CHECK(vkCreateQueryPool(Data::vk_device, &queryPoolInfo, nullptr, &m_queryPool),
+            "FrameStats: failed to create timestamp query pool!");
+}
+
+void
+FrameStats::Shutdown()
+{
+   if (m_queryPool != VK_NULL_HANDLE)
+   {
+      vkDestroyQueryPool(Data::vk_device, m_queryPool, nullptr);
+      m_queryPool = VK_NULL_HANDLE;
+   }
+}
+
+uint32_t
+FrameStats::QueryIndex(GpuPass pass, uint32_t frame)
+{
+   return (frame * NUM_GPU_PASSES + static_cast< uint32_t >(pass)) * 2;
+}
+
+void
+FrameStats::ResetQueries(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+   if (!m_timestampsSupported)
+   {
+      return;
+   }
+
+   vkCmdResetQueryPool(commandBuffer, m_queryPool, QueryIndex(GpuPass::SHADOW, frame),
+                       2 * NUM_GPU_PASSES);
+}
+
+void
+FrameStats::BeginPass(VkCommandBuffer commandBuffer, GpuPass pass, uint32_t frame)
+{
+   if (!m_timestampsSupported)
+   {
+      return;
+   }
+
+   vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool,
+                       QueryIndex(pass, frame));
+}
+
+void
+FrameStats::EndPass(VkCommandBuffer commandBuffer, GpuPass pass, uint32_t frame)
+{
+   if (!m_timestampsSupported)
+   {
+      return;
+   }
+
+   vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool,
+                       QueryIndex(pass, frame) + 1);
+}
+
+void
+FrameStats::CollectGpuTimings(uint32_t frame)
+{
+   if (!m_timestampsSupported)
+   {
+      return;
+   }
+
+   // [timestamp, availability] pairs for begin/end of every pass
+   std::array< uint64_t, 2 * 2 * NUM_GPU_PASSES > results = {};
+
+   const auto result = vkGetQueryPoolResults(
+      Data::vk_device, m_queryPool, QueryIndex(GpuPass::SHADOW, frame), 2 * NUM_GPU_PASSES,
+      sizeof(results), results.data(), 2 * sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+   // The frame has finished, so unavailable queries belong to passes it skipped (e.g. shadow
+   // cascades with cached shadow map), these are reported as zero
+   m_lastFrame.gpuValid = (result == VK_SUCCESS || result == VK_NOT_READY);
+   if (!m_lastFrame.gpuValid)
+   {
+      return;
+   }
+
+   for (uint32_t pass = 0; pass < NUM_GPU_PASSES; ++pass)
+   {
+      const auto begin = results.at(pass * 4) & m_timestampMask;
+      const auto end = results.at(pass * 4 + 2) & m_timestampMask;
+      const auto available = results.at(pass * 4 + 1) != 0 && results.at(pass * 4 + 3) != 0;
+
+      m_lastFrame.gpu.at(pass) =
+         available && end >= begin
+            ? static_cast< double >(end - begin) * m_timestampPeriod / 1'000'000.0
+            : 0.0;
+   }
+}
+
+void
+FrameStats::BeginStage(CpuStage stage)
+{
+   if (stage == CpuStage::FRAME)
+   {
+      m_lastFrame.cpu = {};
+   }
+
+   m_stageStart.at(static_cast< size_t >(stage)) = std::chrono::steady_clock::now();
+}
+
+void
+FrameStats::EndStage(CpuStage stage)
+{
+   const auto idx = static_cast< size_t >(stage);
+   const std::chrono::duration< double, std::milli > elapsed =
+      std::chrono::steady_clock::now() - m_stageStart.at(idx);
+
+   m_lastFrame.cpu.at(idx) += elapsed.count();
+
+   if (stage == CpuStage::FRAME)
+   {
+      ComputeOverlap();
+   }
+}
+
+void
+FrameStats::ComputeOverlap()
+{
+   m_lastFrame.overlap = 0.0;
+   m_lastFrame.overlapRatio = 0.0;
+
+   if (!m_lastFrame.gpuValid)
+   {
+      return;
+   }
+
+   const auto frame = m_lastFrame.cpu.at(static_cast< size_t >(CpuStage::FRAME));
+   const auto cpuWork = frame - m_lastFrame.cpu.at(static_cast< size_t >(CpuStage::WAIT));
+   auto gpuWork = 0.0;
+   for (uint32_t pass = 0; pass < NUM_GPU_PASSES; ++pass)
+   {
+      if (IsTopLevelPass(static_cast< GpuPass >(pass)))
+      {
+         gpuWork += m_lastFrame.gpu.at(pass);
+      }
+   }
+
+   // In lockstep the frame takes (CPU work + GPU work), when fully pipelined it only takes
+   // max(CPU work, GPU work). Whatever is missing from the sum was done in parallel.
+   const auto maxOverlap = std::min(cpuWork, gpuWork);
+   m_lastFrame.overlap = std::clamp(cpuWork + gpuWork - frame, 0.0, std::max(maxOverlap, 0.0));
+   m_lastFrame.overlapRatio = maxOverlap > 0.0 ? m_lastFrame.overlap / maxOverlap : 0.0;
+}
+
+const FrameTimings&
+FrameStats::GetLastFrame()
+{
+   return m_lastFrame;
+}
+
+} // namespace shady::render
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+enum class GpuPass : uint8_t
+{
+   SHADOW = 0,
+   GBUFFER = 1,
+   COMPOSITION = 2,
+   // Compute pass producing draw commands of shadow and G-buffer passes
+   CULLING = 3,
+   // Depth pyramid build and occlusion culling between the two G-buffer phases (part of GBUFFER)
+   OCCLUSION = 4,
+   // First of MAX_SHADOW_CASCADES passes, draws of each cascade (part of SHADOW, see
+   // ShadowCascadePass). Cascades share a render pass, so their work may overlap a bit. Only
+   // static casters are measured for cascades whose cached shadow map is refreshed, dynamic ones
+   // otherwise.
+   SHADOW_CASCADE = 5,
+   COUNT = SHADOW_CASCADE + MAX_SHADOW_CASCADES
+};
+
+enum class CpuStage : uint8_t
+{
+   // Uniform/SSBO upload
+   UPDATE = 0,
+   // Command buffer (re)recording
+   RECORD = 1,
+   // Queue submission and present
+   SUBMIT = 2,
+   // CPU blocked waiting for the GPU (frame in flight fences and swapchain image acquire)
+   WAIT = 3,
+   // Whole Renderer frame, from Renderer::BeginFrame to the end of Renderer::Draw
+   FRAME = 4,
+   COUNT
+};
+
+static constexpr auto NUM_GPU_PASSES = static_cast< uint32_t >(GpuPass::COUNT);
+static constexpr auto NUM_CPU_STAGES = static_cast< uint32_t >(CpuStage::COUNT);
+
+constexpr GpuPass
+ShadowCascadePass(uint32_t cascade)
+{
+   return static_cast< GpuPass >(static_cast< uint32_t >(GpuPass::SHADOW_CASCADE) + cascade);
+}
+
+// False for passes measured within another pass (OCCLUSION and the shadow cascades), summing
+// only the top level passes doesn't count any GPU work twice
+constexpr bool
+IsTopLevelPass(GpuPass pass)
+{
+   return pass == GpuPass::SHADOW || pass == GpuPass::GBUFFER || pass == GpuPass::COMPOSITION
+          || pass == GpuPass::CULLING;
+}
+
+std::string_view
+ToString(GpuPass pass);
+
+std::string_view
+ToString(CpuStage stage);
+
+/*
+ * Timings (in milliseconds) gathered for the most recent frame.
+ * GPU timings are only valid when the device supports timestamp queries. With multiple frames
+ * in flight they come from the last frame that finished on the GPU, not the one just recorded.
+ */
+struct FrameTimings
+{
+   std::array< double, NUM_GPU_PASSES > gpu = {};
+   std::array< double, NUM_CPU_STAGES > cpu = {};
+   bool gpuValid = false;
+
+   // Estimated CPU work (not counting waits) hidden behind GPU work of the previous frames.
+   // Zero when CPU and GPU run in lockstep, only computed when GPU timings are valid.
+   double overlap = 0.0;
+   // 'overlap' relative to the shorter of CPU work and GPU work, in [0, 1] range
+   double overlapRatio = 0.0;
+};
+
+/*
+ * Per-pass GPU timestamps and per-stage CPU timers.
+ * Queries are laid out as [frame][pass][begin/end], so each frame in flight owns its own range.
+ * CPU stages can be entered several times during a frame, their times are accumulated
+ * until the next CpuStage::FRAME begins.
+ */
+class FrameStats
+{
+ public:
+   static void
+   Init(uint32_t framesInFlight);
+
+   static void
+   Shutdown();
+
+   // Has to be recorded outside of a render pass, before any BeginPass for given frame
+   static void
+   ResetQueries(VkCommandBuffer commandBuffer, uint32_t frame);
+
+   static void
+   BeginPass(VkCommandBuffer commandBuffer, GpuPass pass, uint32_t frame);
+
+   static void
+   EndPass(VkCommandBuffer commandBuffer, GpuPass pass, uint32_t frame);
+
+   // Should only be called once the GPU work for 'frame' is known to be finished
+   static void
+   CollectGpuTimings(uint32_t frame);
+
+   static void
+   BeginStage(CpuStage stage);
+
+   static void
+   EndStage(CpuStage stage);
+
+   [[nodiscard]] static const FrameTimings&
+   GetLastFrame();
+
+ private:
+   [[nodiscard]] static uint32_t
+   QueryIndex(GpuPass pass, uint32_t frame);
+
+   static void
+   ComputeOverlap();
+
+ private:
+   inline static VkQueryPool m_queryPool = {};
+   inline static uint32_t m_framesInFlight = 0;
+   inline static bool m_timestampsSupported = false;
+   inline static double m_timestampPeriod = 1.0;
+   inline static uint64_t m_timestampMask = 0;
+
+   inline static std::array< std::chrono::steady_clock::time_point, NUM_CPU_STAGES > m_stageStart =
+      {};
+   inline static FrameTimings m_lastFrame = {};
+};
+
+} // namespace shady::render
@@ -1,6 +1,8 @@
 #include "framebuffer.hpp"
 #include "assert.hpp"
+#include "buffer.hpp"
 #include "common.hpp"
+#include "sampler_cache.hpp"
 
 #include <algorithm>
 #include <fmt/format.h>
@@ -40,12 +42,16 @@ Framebuffer::Create(int32_t width, int32_t height)
    const auto attDepthFormat = FindDepthFormat();
 
    attachmentInfo.format_ = attDepthFormat;
-   attachmentInfo.usage_ = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+   // Sampled when building the depth pyramid used for occlusion culling
+   // Transfer usage lets the cached static shadow map be copied under the dynamic casters
+   attachmentInfo.usage_ = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+                           | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
    AddAttachment(attachmentInfo);
 
-   // Create sampler to sample from the color attachments
-   m_sampler =
-      CreateSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+   // Sampler to sample from the color attachments
+   m_sampler = SamplerCache::Get({.filter = VK_FILTER_NEAREST,
+                                  .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                                  .anisotropy = false});
 
    // Create default renderpass for the framebuffer
    CreateRenderPass();
@@ -61,10 +67,8 @@ Framebuffer::CreateShadowMap(int32_t width, int32_t height, int32_t numLights)
    constexpr auto SHADOWMAP_FORMAT = VK_FORMAT_D32_SFLOAT_S8_UINT;
 
    // Create a layered depth attachment for rendering the depth maps from the lights' point of view
-   // Each layer corresponds to one of the lights
-   // The actual output to the separate layers is done in the geometry shader using shader
-   // instancing We will pass the matrices of the lights to the GS that selects the layer by the
-   // current invocation
+   // Each layer corresponds to one of the lights (or one of the directional light's cascades)
+   // The actual output to the separate layers is done in the vertex shader (gl_Layer)
    AttachmentCreateInfo attachmentInfo = {};
    attachmentInfo.format_ = SHADOWMAP_FORMAT;
    attachmentInfo.width_ = static_cast< uint32_t >(width);
@@ -74,10 +78,10 @@ Framebuffer::CreateShadowMap(int32_t width, int32_t height, int32_t numLights)
 
    AddAttachment(attachmentInfo);
 
-   // Create sampler to sample from to depth attachment
+   // Sampler to sample from to depth attachment
    // Used to sample in the fragment shader for shadowed rendering
-   m_sampler =
-      CreateSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+   m_sampler = SamplerCache::Get(
+      {.addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, .anisotropy = false});
 
    // Create default renderpass for the framebuffer
    CreateRenderPass();
@@ -95,6 +99,12 @@ Framebuffer::GetRenderPass() const
    return m_renderPass;
 }
 
+VkRenderPass
+Framebuffer::GetLoadRenderPass() const
+{
+   return m_loadRenderPass;
+}
+
 VkFramebuffer
 Framebuffer::GetFramebuffer() const
 {
@@ -135,28 +145,22 @@ Framebuffer::GetShadowMapView() const
    return m_attachments[0].view_;
 }
 
-VkSampler
-Framebuffer::CreateSampler(VkFilter magFilter, VkFilter minFilter, VkSamplerAddressMode adressMode)
+VkImageView
+Framebuffer::GetDepthImageView() const
 {
-   VkSampler sampler{};
-
-   VkSamplerCreateInfo samplerInfo{};
-   samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-   samplerInfo.magFilter = magFilter;
-   samplerInfo.minFilter = minFilter;
-   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-   samplerInfo.addressModeU = adressMode;
-   samplerInfo.addressModeV = adressMode;
-   samplerInfo.addressModeW = adressMode;
-   samplerInfo.mipLodBias = 0.0f;
-   samplerInfo.maxAnisotropy = 1.0f;
-   samplerInfo.minLod = 0.0f;
-   samplerInfo.maxLod = 1.0f;
-   samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-
-   VK_CHECK(vkCreateSampler(Data::vk_device, &samplerInfo, nullptr, &sampler), "");
-
-   return sampler;
+   const auto depth = std::find_if(m_attachments.begin(), m_attachments.end(),
+                                   [](const auto& attachment) { return attachment.hasDepth(); });
+   utils::Assert(depth != m_attachments.end(), "Framebuffer: no depth attachment!");
+   return depth->view_;
+}
+
+VkImage
+Framebuffer::GetDepthImage() const
+{
+   const auto depth = std::find_if(m_attachments.begin(), m_attachments.end(),
+                                   [](const auto& attachment) { return attachment.hasDepth(); });
+   utils::Assert(depth != m_attachments.end(), "Framebuffer: no depth attachment!");
+   return depth->image_;
 }
 
 uint32_t
@@ -204,18 +208,10 @@ Framebuffer::AddAttachment(AttachmentCreateInfo createinfo)
    image.tiling = VK_IMAGE_TILING_OPTIMAL;
    image.usage = createinfo.usage_;
 
-   VkMemoryAllocateInfo memAlloc = {};
-   memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-   VkMemoryRequirements memReqs;
-
    // Create image for this attachment
    VK_CHECK(vkCreateImage(Data::vk_device, &image, nullptr, &attachment.image_), "");
-   vkGetImageMemoryRequirements(Data::vk_device, attachment.image_, &memReqs);
-   memAlloc.allocationSize = memReqs.size;
-   memAlloc.memoryTypeIndex =
-      FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-   VK_CHECK(vkAllocateMemory(Data::vk_device, &memAlloc, nullptr, &attachment.memory_), "");
-   VK_CHECK(vkBindImageMemory(Data::vk_device, attachment.image_, attachment.memory_, 0), "");
+   Buffer::AllocateImageMemory(attachment.image_, attachment.memory_,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
    attachment.subresourceRange_ = {};
    attachment.subresourceRange_.aspectMask = aspectMask;
@@ -341,6 +337,14 @@ Framebuffer::CreateRenderPass()
    renderPassInfo.pDependencies = dependencies.data();
    VK_CHECK(vkCreateRenderPass(Data::vk_device, &renderPassInfo, nullptr, &m_renderPass), "");
 
+   // Same render pass, only with the attachments loaded from their final layout
+   for (auto& description : attachmentDescriptions)
+   {
+      description.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+      description.initialLayout = description.finalLayout;
+   }
+   VK_CHECK(vkCreateRenderPass(Data::vk_device, &renderPassInfo, nullptr, &m_loadRenderPass), "");
+
    std::vector< VkImageView > attachmentViews;
    std::transform(m_attachments.begin(), m_attachments.end(), std::back_inserter(attachmentViews),
                   [](const auto& attachment) { return attachment.view_; });
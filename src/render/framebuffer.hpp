@@ -87,6 +87,11 @@ class Framebuffer
    [[nodiscard]] VkRenderPass
    GetRenderPass() const;
 
+   // Compatible with GetRenderPass (same framebuffer and pipelines can be used), but keeps the
+   // content of the attachments instead of clearing them
+   [[nodiscard]] VkRenderPass
+   GetLoadRenderPass() const;
+
    [[nodiscard]] VkFramebuffer
    GetFramebuffer() const;
 
@@ -102,12 +107,21 @@ class Framebuffer
    [[nodiscard]] VkImageView
    GetShadowMapView() const;
 
+   // Depth attachment of the G-Buffer, in VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL after
+   // the render pass
+   [[nodiscard]] VkImageView
+   GetDepthImageView() const;
+
+   // Image of the depth attachment (e.g. for copying the shadow map)
+   [[nodiscard]] VkImage
+   GetDepthImage() const;
+
    [[nodiscard]] VkSampler
    GetSampler() const;
 
  private:
    /**
-    * Creates a default render pass setup with one sub pass
+    * Creates a default render pass setup with one sub pass (and its load variant)
     */
    void
    CreateRenderPass();
@@ -125,25 +139,13 @@ class Framebuffer
    void
    CreateAttachment(VkFormat format, VkImageUsageFlagBits usage, FramebufferAttachment* attachment);
 
-   /**
-    * Creates a default sampler for sampling from any of the framebuffer attachments
-    * Applications are free to create their own samplers for different use cases
-    *
-    * @param magFilter Magnification filter for lookups
-    * @param minFilter Minification filter for lookups
-    * @param adressMode Addressing mode for the U,V and W coordinates
-    *
-    * @return VkResult for the sampler creation
-    */
-   static VkSampler
-   CreateSampler(VkFilter magFilter, VkFilter minFilter, VkSamplerAddressMode adressMode);
-
  private:
    int32_t m_width = {};
    int32_t m_height = {};
    VkFramebuffer m_framebuffer = {};
    std::vector< FramebufferAttachment > m_attachments;
    VkRenderPass m_renderPass = {};
+   VkRenderPass m_loadRenderPass = {};
    VkSampler m_sampler = {};
 };
 
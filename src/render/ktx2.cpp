@@ -0,0 +1,436 @@
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <type_traits>
+
+namespace shady::render {
+
+namespace {
+
+constexpr std::array< uint8_t, 12 > KTX2_IDENTIFIER = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32,
+                                                       0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+// Far more than the largest image Vulkan can create
+constexpr uint32_t KTX2_MAX_LEVELS = 32;
+
+struct KtxHeader
+{
+   std::array< uint8_t, 12 > identifier = KTX2_IDENTIFIER;
+   uint32_t vkFormat = 0;
+   // Always 1 for block compressed and 8 bit formats
+   uint32_t typeSize = 1;
+   uint32_t pixelWidth = 0;
+   uint32_t pixelHeight = 0;
+   // 0 for 2D images and images that aren't arrays
+   uint32_t pixelDepth = 0;
+   uint32_t layerCount = 0;
+   uint32_t faceCount = 1;
+   uint32_t levelCount = 0;
+   uint32_t supercompressionScheme = 0;
+   uint32_t dfdByteOffset = 0;
+   uint32_t dfdByteLength = 0;
+   uint32_t kvdByteOffset = 0;
+   uint32_t kvdByteLength = 0;
+   uint64_t sgdByteOffset = 0;
+   uint64_t sgdByteLength = 0;
+};
+
+struct KtxLevelIndex
+{
+   uint64_t byteOffset = 0;
+   uint64_t byteLength = 0;
+   uint64_t uncompressedByteLength = 0;
+};
+
+static_assert(std::is_trivially_copyable_v< KtxHeader >);
+static_assert(sizeof(KtxHeader) == 80);
+static_assert(sizeof(KtxLevelIndex) == 24);
+
+// Subset of the Khronos Data Format needed to describe the RGBA8 and BCn formats
+constexpr uint32_t KHR_DF_VERSION = 2;
+constexpr uint8_t KHR_DF_MODEL_RGBSDA = 1;
+constexpr uint8_t KHR_DF_MODEL_BC1A = 128;
+constexpr uint8_t KHR_DF_MODEL_BC3 = 130;
+constexpr uint8_t KHR_DF_MODEL_BC4 = 131;
+constexpr uint8_t KHR_DF_MODEL_BC5 = 132;
+constexpr uint8_t KHR_DF_MODEL_BC7 = 134;
+constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+constexpr uint8_t KHR_DF_CHANNEL_COLOR = 0;
+constexpr uint8_t KHR_DF_CHANNEL_RED = 0;
+constexpr uint8_t KHR_DF_CHANNEL_GREEN = 1;
+constexpr uint8_t KHR_DF_CHANNEL_BLUE = 2;
+// Alpha of both RGBSDA and BC3
+constexpr uint8_t KHR_DF_CHANNEL_ALPHA = 15;
+// Channel isn't affected by the transfer function (alpha of sRGB formats)
+constexpr uint8_t KHR_DF_SAMPLE_DATATYPE_LINEAR = 0x10;
+
+struct DataFormat
+{
+   uint8_t colorModel = 0;
+   uint32_t blockSize = 0;
+   // Texels per side of the block, 1 for uncompressed formats
+   uint32_t blockDim = 4;
+   bool srgb = false;
+   // Channel of every sample, samples split the block evenly (BC1 and BC4 have one for the
+   // whole block, BC3 and BC5 one per 64 bit half, RGBA8 one per byte)
+   std::vector< uint8_t > channels;
+};
+
+std::optional< DataFormat >
+getDataFormat(VkFormat format)
+{
+   switch (format)
+   {
+      case VK_FORMAT_R8G8B8A8_UNORM:
+      case VK_FORMAT_R8G8B8A8_SRGB:
+         return DataFormat{
+            KHR_DF_MODEL_RGBSDA,
+            4,
+            1,
+            format == VK_FORMAT_R8G8B8A8_SRGB,
+            {KHR_DF_CHANNEL_RED, KHR_DF_CHANNEL_GREEN, KHR_DF_CHANNEL_BLUE, KHR_DF_CHANNEL_ALPHA}};
+      case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+      case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+         return DataFormat{KHR_DF_MODEL_BC1A, 8, 4, format == VK_FORMAT_BC1_RGB_SRGB_BLOCK,
+                           {KHR_DF_CHANNEL_COLOR}};
+      case VK_FORMAT_BC3_UNORM_BLOCK:
+      case VK_FORMAT_BC3_SRGB_BLOCK:
+         return DataFormat{KHR_DF_MODEL_BC3,
+                           16,
+                           4,
+                           format == VK_FORMAT_BC3_SRGB_BLOCK,
+                           {KHR_DF_CHANNEL_ALPHA, KHR_DF_CHANNEL_COLOR}};
+      case VK_FORMAT_BC4_UNORM_BLOCK:
+         return DataFormat{KHR_DF_MODEL_BC4, 8, 4, false, {KHR_DF_CHANNEL_COLOR}};
+      case VK_FORMAT_BC5_UNORM_BLOCK:
+         return DataFormat{
+            KHR_DF_MODEL_BC5, 16, 4, false, {KHR_DF_CHANNEL_COLOR, KHR_DF_CHANNEL_GREEN}};
+      case VK_FORMAT_BC7_UNORM_BLOCK:
+      case VK_FORMAT_BC7_SRGB_BLOCK:
+         return DataFormat{KHR_DF_MODEL_BC7, 16, 4, format == VK_FORMAT_BC7_SRGB_BLOCK,
+                           {KHR_DF_CHANNEL_COLOR}};
+      default:
+         return std::nullopt;
+   }
+}
+
+constexpr uint64_t
+alignOffset(uint64_t offset, uint64_t alignment)
+{
+   return (offset + alignment - 1) / alignment * alignment;
+}
+
+uint64_t
+levelSize(const DataFormat& format, uint32_t width, uint32_t height)
+{
+   const auto blocksX = (width + format.blockDim - 1) / format.blockDim;
+   const auto blocksY = (height + format.blockDim - 1) / format.blockDim;
+   return uint64_t{blocksX} * blocksY * format.blockSize;
+}
+
+void
+appendBytes(std::vector< uint8_t >& out, const void* bytes, size_t numBytes)
+{
+   const auto* begin = static_cast< const uint8_t* >(bytes);
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   out.insert(out.end(), begin, begin + numBytes);
+}
+
+void
+appendWord(std::vector< uint8_t >& out, uint32_t word)
+{
+   appendBytes(out, &word, sizeof(word));
+}
+
+// Basic data format descriptor block, preceded by the descriptor's total size
+std::vector< uint8_t >
+createDataFormatDescriptor(const DataFormat& format)
+{
+   constexpr uint32_t basicBlockHeaderSize = 24;
+   constexpr uint32_t sampleSize = 16;
+   const auto blockSize =
+      basicBlockHeaderSize + static_cast< uint32_t >(format.channels.size()) * sampleSize;
+
+   std::vector< uint8_t > dfd;
+   appendWord(dfd, static_cast< uint32_t >(sizeof(uint32_t)) + blockSize);
+   // Khronos vendor and basic descriptor type are both 0
+   appendWord(dfd, 0);
+   appendWord(dfd, KHR_DF_VERSION | (blockSize << 16));
+   appendWord(dfd, format.colorModel | (KHR_DF_PRIMARIES_BT709 << 8)
+                      | ((format.srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16));
+   // Texel block dimensions minus one, 4x4x1x1 or 1x1x1x1
+   appendWord(dfd, (format.blockDim - 1) | ((format.blockDim - 1) << 8));
+   // Bytes of plane 0, other planes are unused
+   appendWord(dfd, format.blockSize);
+   appendWord(dfd, 0);
+
+   const auto sampleBits =
+      format.blockSize * 8 / static_cast< uint32_t >(format.channels.size());
+   const auto sampleUpper = sampleBits < 32 ? (1U << sampleBits) - 1 : UINT32_MAX;
+   for (uint32_t sample = 0; sample < format.channels.size(); ++sample)
+   {
+      auto channel = format.channels[sample];
+      if (format.srgb && channel == KHR_DF_CHANNEL_ALPHA)
+      {
+         channel |= KHR_DF_SAMPLE_DATATYPE_LINEAR;
+      }
+
+      appendWord(dfd, (sample * sampleBits) | ((sampleBits - 1) << 16)
+                         | (static_cast< uint32_t >(channel) << 24));
+      // Sample position within the block, lower and upper value of the channel
+      appendWord(dfd, 0);
+      appendWord(dfd, 0);
+      appendWord(dfd, sampleUpper);
+   }
+
+   return dfd;
+}
+
+// Key/value pairs sorted by key, each entry padded to 4 bytes
+std::vector< uint8_t >
+createKeyValueData(std::vector< std::pair< std::string, std::string > > keyValues)
+{
+   std::sort(keyValues.begin(), keyValues.end());
+
+   std::vector< uint8_t > kvd;
+   for (const auto& [key, value] : keyValues)
+   {
+      // Both key and value are null terminated
+      appendWord(kvd, static_cast< uint32_t >(key.size() + value.size() + 2));
+      appendBytes(kvd, key.c_str(), key.size() + 1);
+      appendBytes(kvd, value.c_str(), value.size() + 1);
+      kvd.resize(alignOffset(kvd.size(), 4));
+   }
+
+   return kvd;
+}
+
+bool
+parseKeyValueData(const uint8_t* data, size_t size,
+                  std::vector< std::pair< std::string, std::string > >& keyValues)
+{
+   size_t offset = 0;
+   while (offset + sizeof(uint32_t) <= size)
+   {
+      uint32_t length = 0;
+      std::memcpy(&length, data + offset, sizeof(length));
+      offset += sizeof(length);
+      if (length > size - offset)
+      {
+         return false;
+      }
+
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const std::string_view entry(reinterpret_cast< const char* >(data + offset), length);
+      const auto separator = entry.find('\0');
+      if (separator == std::string_view::npos)
+      {
+         return false;
+      }
+
+      auto value = entry.substr(separator + 1);
+      if (!value.empty() && value.back() == '\0')
+      {
+         value.remove_suffix(1);
+      }
+      keyValues.emplace_back(entry.substr(0, separator), value);
+
+      offset = alignOffset(offset + length, 4);
+   }
+
+   return true;
+}
+
+} // namespace
+
+std::string_view
+KtxTexture::FindValue(std::string_view key) const
+{
+   const auto it = std::find_if(keyValues.begin(), keyValues.end(),
+                                [key](const auto& keyValue) { return keyValue.first == key; });
+   return it != keyValues.end() ? std::string_view(it->second) : std::string_view{};
+}
+
+std::span< const uint8_t >
+KtxTexture::GetData() const
+{
+   if (!file.GetData())
+   {
+      return data;
+   }
+
+   uint64_t size = 0;
+   for (const auto& level : levels)
+   {
+      size = std::max(size, level.offset + level.size);
+   }
+
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   return {file.GetData() + fileOffset, size};
+}
+
+std::span< const uint8_t >
+KtxTexture::GetLevel(size_t level) const
+{
+   return GetData().subspan(levels[level].offset, levels[level].size);
+}
+
+std::vector< VkBufferImageCopy >
+KtxTexture::GetCopyRegions() const
+{
+   std::vector< VkBufferImageCopy > regions;
+   for (uint32_t level = 0; level < levels.size(); ++level)
+   {
+      VkBufferImageCopy region = {};
+      region.bufferOffset = levels[level].offset;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = level;
+      region.imageSubresource.layerCount = 1;
+      region.imageExtent = {levels[level].width, levels[level].height, 1};
+      regions.push_back(region);
+   }
+
+   return regions;
+}
+
+uint32_t
+GetKtxBlockSize(VkFormat format)
+{
+   const auto dataFormat = getDataFormat(format);
+   return dataFormat ? dataFormat->blockSize : 0;
+}
+
+std::optional< KtxTexture >
+ReadKtx2(const std::filesystem::path& path)
+{
+   auto file = utils::MappedFile::Open(path);
+   if (!file)
+   {
+      return std::nullopt;
+   }
+
+   KtxTexture texture;
+   texture.file = std::move(*file);
+   const auto* data = texture.file.GetData();
+   const auto size = texture.file.GetSize();
+
+   KtxHeader header = {};
+   if (size < sizeof(header))
+   {
+      return std::nullopt;
+   }
+   std::memcpy(&header, data, sizeof(header));
+
+   texture.format = static_cast< VkFormat >(header.vkFormat);
+   const auto dataFormat = getDataFormat(texture.format);
+   const auto valid = header.identifier == KTX2_IDENTIFIER && header.typeSize == 1
+                      && dataFormat && header.pixelWidth > 0
+                      && header.pixelHeight > 0 && header.pixelDepth == 0
+                      && header.layerCount == 0 && header.faceCount == 1
+                      && header.levelCount > 0 && header.levelCount <= KTX2_MAX_LEVELS
+                      && header.supercompressionScheme == 0
+                      && sizeof(header) + header.levelCount * sizeof(KtxLevelIndex) <= size
+                      && uint64_t{header.kvdByteOffset} + header.kvdByteLength <= size;
+   if (!valid)
+   {
+      return std::nullopt;
+   }
+
+   for (uint32_t level = 0; level < header.levelCount; ++level)
+   {
+      KtxLevelIndex index = {};
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::memcpy(&index, data + sizeof(header) + level * sizeof(index), sizeof(index));
+
+      const auto width = std::max(header.pixelWidth >> level, 1U);
+      const auto height = std::max(header.pixelHeight >> level, 1U);
+      if (index.byteLength != levelSize(*dataFormat, width, height)
+          || index.byteOffset > size || index.byteLength > size - index.byteOffset)
+      {
+         return std::nullopt;
+      }
+
+      texture.levels.push_back({width, height, index.byteOffset, index.byteLength});
+   }
+
+   // Levels are consecutive (smallest first), so they're a single range of the mapped file
+   texture.fileOffset = std::min_element(texture.levels.begin(), texture.levels.end(),
+                                         [](const auto& left, const auto& right) {
+                                            return left.offset < right.offset;
+                                         })
+                           ->offset;
+   for (auto& level : texture.levels)
+   {
+      level.offset -= texture.fileOffset;
+   }
+
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   if (!parseKeyValueData(data + header.kvdByteOffset, header.kvdByteLength, texture.keyValues))
+   {
+      return std::nullopt;
+   }
+
+   return texture;
+}
+
+bool
+WriteKtx2(std::ostream& stream, const KtxTexture& texture)
+{
+   const auto dataFormat = getDataFormat(texture.format);
+   if (!dataFormat || texture.levels.empty() || texture.levels.size() > KTX2_MAX_LEVELS)
+   {
+      return false;
+   }
+
+   const auto dfd = createDataFormatDescriptor(*dataFormat);
+   const auto kvd = createKeyValueData(texture.keyValues);
+
+   const auto numLevels = static_cast< uint32_t >(texture.levels.size());
+
+   KtxHeader header = {};
+   header.vkFormat = static_cast< uint32_t >(texture.format);
+   header.pixelWidth = texture.levels.front().width;
+   header.pixelHeight = texture.levels.front().height;
+   header.levelCount = numLevels;
+   header.dfdByteOffset =
+      static_cast< uint32_t >(sizeof(header) + numLevels * sizeof(KtxLevelIndex));
+   header.dfdByteLength = static_cast< uint32_t >(dfd.size());
+   header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+   header.kvdByteLength = static_cast< uint32_t >(kvd.size());
+
+   // Levels are stored from the smallest one, each aligned to the block size
+   std::vector< KtxLevelIndex > levelIndex(numLevels);
+   uint64_t offset = uint64_t{header.kvdByteOffset} + header.kvdByteLength;
+   for (auto level = numLevels; level-- > 0;)
+   {
+      offset = alignOffset(offset, dataFormat->blockSize);
+      const auto& source = texture.levels[level];
+      levelIndex[level] = {offset, source.size, source.size};
+      offset += source.size;
+   }
+
+   const auto writeBytes = [&stream](const void* bytes, size_t numBytes) {
+      stream.write(static_cast< const char* >(bytes), static_cast< std::streamsize >(numBytes));
+   };
+
+   writeBytes(&header, sizeof(header));
+   writeBytes(levelIndex.data(), levelIndex.size() * sizeof(KtxLevelIndex));
+   writeBytes(dfd.data(), dfd.size());
+   writeBytes(kvd.data(), kvd.size());
+
+   for (auto level = numLevels; level-- > 0;)
+   {
+      const std::array< char, 16 > zeros = {};
+      writeBytes(zeros.data(),
+                 levelIndex[level].byteOffset - static_cast< uint64_t >(stream.tellp()));
+      const auto bytes = texture.GetLevel(level);
+      writeBytes(bytes.data(), bytes.size());
+   }
+
+   return stream.good();
+}
+
+} // namespace shady::render
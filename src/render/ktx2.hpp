@@ -0,0 +1,76 @@
+#pragma once
+
+#include "utils/mapped_file.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+// Single mip level of KtxTexture
+struct KtxLevel
+{
+   uint32_t width = 0;
+   uint32_t height = 0;
+   // Byte range within KtxTexture::GetData()
+   uint64_t offset = 0;
+   uint64_t size = 0;
+};
+
+/*
+ * Texture stored in KTX2 (Khronos Texture 2.0) container. Only what TextureCache produces is
+ * supported: 2D image with a single layer and face, RGBA8/BC1/BC3/BC4/BC5/BC7 format and no
+ * supercompression. Key/value pairs are kept as strings, without the terminating null.
+ * Texture read from a file keeps it memory mapped, its levels are never copied to the heap.
+ */
+struct KtxTexture
+{
+   VkFormat format = VK_FORMAT_UNDEFINED;
+   // Level 0 (the largest) first
+   std::vector< KtxLevel > levels;
+   // Levels of a texture created in memory, empty when it's read from a file
+   std::vector< uint8_t > data;
+   std::vector< std::pair< std::string, std::string > > keyValues;
+
+   // Mapped KTX2 file, GetData() starts 'fileOffset' bytes into it
+   utils::MappedFile file;
+   uint64_t fileOffset = 0;
+
+   // Empty when there's no such key
+   [[nodiscard]] std::string_view
+   FindValue(std::string_view key) const;
+
+   // Bytes of all levels (and the padding between them), either 'data' or part of 'file'
+   [[nodiscard]] std::span< const uint8_t >
+   GetData() const;
+
+   [[nodiscard]] std::span< const uint8_t >
+   GetLevel(size_t level) const;
+
+   // Copy of every level to the image, from a buffer which holds GetData() at offset 0
+   [[nodiscard]] std::vector< VkBufferImageCopy >
+   GetCopyRegions() const;
+};
+
+// Bytes per block of 'format' (4x4 texels, single texel for uncompressed formats),
+// 0 for formats not supported by the KTX2 functions
+[[nodiscard]] uint32_t
+GetKtxBlockSize(VkFormat format);
+
+// Returns std::nullopt when the file doesn't exist, is corrupted or unsupported
+[[nodiscard]] std::optional< KtxTexture >
+ReadKtx2(const std::filesystem::path& path);
+
+// False when 'texture' can't be stored as KTX2, 'stream' has to be checked for write errors
+[[nodiscard]] bool
+WriteKtx2(std::ostream& stream, const KtxTexture& texture);
+
+} // namespace shady::render
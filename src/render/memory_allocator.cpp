@@ -0,0 +1,707 @@
+#include "memory_allocator.hpp"
+#include "common.hpp"
+#include "trace/logger.hpp"
+#include "utils/assert.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <fmt/format.h>
+
+namespace shady::render {
+
+namespace {
+
+constexpr VkDeviceSize PREFERRED_BLOCK_SIZE = VkDeviceSize{64} * 1024 * 1024;
+// Heaps up to this size get blocks of 1/8 of the heap (e.g. 256MB BAR memory)
+constexpr VkDeviceSize SMALL_HEAP_SIZE = VkDeviceSize{1024} * 1024 * 1024;
+
+constexpr uint64_t
+alignOffset(uint64_t offset, uint64_t alignment)
+{
+   return (offset + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+/**************************************************************************************************
+ ******************************************* TLSF *************************************************
+ *************************************************************************************************/
+
+TlsfAllocator::TlsfAllocator(uint64_t size) : size_(size / GRANULARITY * GRANULARITY)
+{
+   for (auto& lists : freeLists_)
+   {
+      lists.fill(NIL);
+   }
+
+   if (size_ > 0)
+   {
+      InsertFree(CreateRange(0, size_));
+   }
+}
+
+uint64_t
+TlsfAllocator::Allocate(uint64_t size, uint64_t alignment)
+{
+   size = alignOffset(std::max(size, GRANULARITY), GRANULARITY);
+   alignment = std::max(alignment, GRANULARITY);
+
+   // Worst case padding needed to align the start of a free range
+   const auto searchSize = size + (alignment - GRANULARITY);
+   if (searchSize > size_)
+   {
+      return INVALID_OFFSET;
+   }
+
+   // Round the size up to the next list, so every range in the found list is big enough
+   const auto searchFl = static_cast< uint32_t >(std::bit_width(searchSize)) - 1;
+   const auto rounded = searchSize + (uint64_t{1} << (searchFl - SL_BITS)) - 1;
+   auto fl = static_cast< uint32_t >(std::bit_width(rounded)) - 1;
+   auto sl = static_cast< uint32_t >(rounded >> (fl - SL_BITS)) ^ SL_COUNT;
+
+   auto range = NIL;
+   auto slMap = slBitmaps_[fl] & (~0U << sl);
+   const auto flMap = fl + 1 < FL_COUNT ? flBitmap_ & (~uint64_t{0} << (fl + 1)) : 0;
+   if (slMap != 0 || flMap != 0)
+   {
+      if (slMap == 0)
+      {
+         fl = static_cast< uint32_t >(std::countr_zero(flMap));
+         slMap = slBitmaps_[fl];
+      }
+      sl = static_cast< uint32_t >(std::countr_zero(slMap));
+      range = freeLists_[fl][sl];
+   }
+   else
+   {
+      // Nothing in the bigger lists, a range that fits may still be in the list of 'searchSize'
+      const auto searchSl = static_cast< uint32_t >(searchSize >> (searchFl - SL_BITS)) ^ SL_COUNT;
+      range = freeLists_[searchFl][searchSl];
+      while (range != NIL && ranges_[range].size < searchSize)
+      {
+         range = ranges_[range].nextFree;
+      }
+
+      if (range == NIL)
+      {
+         return INVALID_OFFSET;
+      }
+   }
+
+   RemoveFree(range);
+
+   const auto padding = alignOffset(ranges_[range].offset, alignment) - ranges_[range].offset;
+   if (padding > 0)
+   {
+      // Leading part stays free, previous range can't be free (it'd be merged already)
+      SplitFree(range, padding);
+      const auto aligned = ranges_[range].next;
+      RemoveFree(aligned);
+      InsertFree(range);
+      range = aligned;
+   }
+
+   if (ranges_[range].size > size)
+   {
+      SplitFree(range, size);
+   }
+
+   ranges_[range].free = false;
+   used_ += ranges_[range].size;
+   allocated_[ranges_[range].offset] = range;
+
+   return ranges_[range].offset;
+}
+
+void
+TlsfAllocator::Free(uint64_t offset)
+{
+   const auto it = allocated_.find(offset);
+   if (it == allocated_.end())
+   {
+      return;
+   }
+
+   auto range = it->second;
+   allocated_.erase(it);
+   used_ -= ranges_[range].size;
+
+   const auto prev = ranges_[range].prev;
+   if (prev != NIL && ranges_[prev].free)
+   {
+      RemoveFree(prev);
+      ranges_[prev].size += ranges_[range].size;
+      ranges_[prev].next = ranges_[range].next;
+      if (ranges_[range].next != NIL)
+      {
+         ranges_[ranges_[range].next].prev = prev;
+      }
+      ReleaseRange(range);
+      range = prev;
+   }
+
+   const auto next = ranges_[range].next;
+   if (next != NIL && ranges_[next].free)
+   {
+      RemoveFree(next);
+      ranges_[range].size += ranges_[next].size;
+      ranges_[range].next = ranges_[next].next;
+      if (ranges_[next].next != NIL)
+      {
+         ranges_[ranges_[next].next].prev = range;
+      }
+      ReleaseRange(next);
+   }
+
+   InsertFree(range);
+}
+
+uint64_t
+TlsfAllocator::GetUsed() const
+{
+   return used_;
+}
+
+uint64_t
+TlsfAllocator::GetSize() const
+{
+   return size_;
+}
+
+uint64_t
+TlsfAllocator::GetLargestFree() const
+{
+   if (flBitmap_ == 0)
+   {
+      return 0;
+   }
+
+   // Ranges within the last non-empty list aren't sorted, so check all of them
+   const auto fl = static_cast< uint32_t >(std::bit_width(flBitmap_)) - 1;
+   const auto sl = 31U - static_cast< uint32_t >(std::countl_zero(slBitmaps_[fl]));
+
+   uint64_t largest = 0;
+   for (auto range = freeLists_[fl][sl]; range != NIL; range = ranges_[range].nextFree)
+   {
+      largest = std::max(largest, ranges_[range].size);
+   }
+
+   return largest;
+}
+
+uint32_t
+TlsfAllocator::GetNumAllocations() const
+{
+   return static_cast< uint32_t >(allocated_.size());
+}
+
+uint32_t
+TlsfAllocator::CreateRange(uint64_t offset, uint64_t size)
+{
+   Range newRange;
+   newRange.offset = offset;
+   newRange.size = size;
+
+   if (!unusedRanges_.empty())
+   {
+      const auto range = unusedRanges_.back();
+      unusedRanges_.pop_back();
+      ranges_[range] = newRange;
+      return range;
+   }
+
+   ranges_.push_back(newRange);
+   return static_cast< uint32_t >(ranges_.size() - 1);
+}
+
+void
+TlsfAllocator::ReleaseRange(uint32_t range)
+{
+   unusedRanges_.push_back(range);
+}
+
+void
+TlsfAllocator::InsertFree(uint32_t range)
+{
+   auto& current = ranges_[range];
+   const auto fl = static_cast< uint32_t >(std::bit_width(current.size)) - 1;
+   const auto sl = static_cast< uint32_t >(current.size >> (fl - SL_BITS)) ^ SL_COUNT;
+
+   current.free = true;
+   current.prevFree = NIL;
+   current.nextFree = freeLists_[fl][sl];
+   if (current.nextFree != NIL)
+   {
+      ranges_[current.nextFree].prevFree = range;
+   }
+
+   freeLists_[fl][sl] = range;
+   slBitmaps_[fl] |= 1U << sl;
+   flBitmap_ |= uint64_t{1} << fl;
+}
+
+void
+TlsfAllocator::RemoveFree(uint32_t range)
+{
+   auto& current = ranges_[range];
+   const auto fl = static_cast< uint32_t >(std::bit_width(current.size)) - 1;
+   const auto sl = static_cast< uint32_t >(current.size >> (fl - SL_BITS)) ^ SL_COUNT;
+
+   if (current.prevFree != NIL)
+   {
+      ranges_[current.prevFree].nextFree = current.nextFree;
+   }
+   else
+   {
+      freeLists_[fl][sl] = current.nextFree;
+   }
+
+   if (current.nextFree != NIL)
+   {
+      ranges_[current.nextFree].prevFree = current.prevFree;
+   }
+
+   if (freeLists_[fl][sl] == NIL)
+   {
+      slBitmaps_[fl] &= ~(1U << sl);
+      if (slBitmaps_[fl] == 0)
+      {
+         flBitmap_ &= ~(uint64_t{1} << fl);
+      }
+   }
+
+   current.free = false;
+   current.prevFree = NIL;
+   current.nextFree = NIL;
+}
+
+void
+TlsfAllocator::SplitFree(uint32_t range, uint64_t size)
+{
+   // CreateRange can reallocate 'ranges_', so no references are held across it
+   const auto remainder =
+      CreateRange(ranges_[range].offset + size, ranges_[range].size - size);
+
+   ranges_[remainder].prev = range;
+   ranges_[remainder].next = ranges_[range].next;
+   if (ranges_[range].next != NIL)
+   {
+      ranges_[ranges_[range].next].prev = remainder;
+   }
+
+   ranges_[range].next = remainder;
+   ranges_[range].size = size;
+
+   InsertFree(remainder);
+}
+
+/**************************************************************************************************
+ ****************************************** LINEAR ************************************************
+ *************************************************************************************************/
+
+LinearAllocator::LinearAllocator(uint64_t size) : size_(size)
+{
+}
+
+uint64_t
+LinearAllocator::Allocate(uint64_t size, uint64_t alignment)
+{
+   const auto offset = alignOffset(head_, std::max(alignment, uint64_t{1}));
+   if (offset + size > size_)
+   {
+      return TlsfAllocator::INVALID_OFFSET;
+   }
+
+   head_ = offset + size;
+   ++numAllocations_;
+
+   return offset;
+}
+
+void
+LinearAllocator::Free()
+{
+   if (numAllocations_ > 0 && --numAllocations_ == 0)
+   {
+      head_ = 0;
+   }
+}
+
+uint64_t
+LinearAllocator::GetUsed() const
+{
+   return head_;
+}
+
+uint64_t
+LinearAllocator::GetSize() const
+{
+   return size_;
+}
+
+uint32_t
+LinearAllocator::GetNumAllocations() const
+{
+   return numAllocations_;
+}
+
+/**************************************************************************************************
+ ************************************** MEMORY ALLOCATOR ******************************************
+ *************************************************************************************************/
+
+void
+MemoryAllocator::Init()
+{
+   vkGetPhysicalDeviceMemoryProperties(Data::vk_physicalDevice, &m_memoryProperties);
+
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(Data::vk_physicalDevice, &properties);
+   m_nonCoherentAtomSize = std::max(properties.limits.nonCoherentAtomSize, VkDeviceSize{1});
+   m_maxAllocations = properties.limits.maxMemoryAllocationCount;
+}
+
+void
+MemoryAllocator::Allocate(VkBuffer buffer, VkMemoryPropertyFlags properties,
+                          AllocationStrategy strategy)
+{
+   VkMemoryRequirements requirements;
+   vkGetBufferMemoryRequirements(Data::vk_device, buffer, &requirements);
+
+   const std::lock_guard lock(m_mutex);
+   const auto allocation = AllocateMemory(requirements, properties, strategy, false);
+   VK_CHECK(vkBindBufferMemory(Data::vk_device, buffer, m_blocks[allocation.block]->memory,
+                               allocation.offset),
+            "MemoryAllocator: failed to bind buffer memory!");
+
+   m_buffers[buffer] = allocation;
+}
+
+void
+MemoryAllocator::Allocate(VkImage image, VkMemoryPropertyFlags properties,
+                          AllocationStrategy strategy)
+{
+   VkMemoryRequirements requirements;
+   vkGetImageMemoryRequirements(Data::vk_device, image, &requirements);
+
+   const std::lock_guard lock(m_mutex);
+   const auto allocation = AllocateMemory(requirements, properties, strategy, true);
+   VK_CHECK(vkBindImageMemory(Data::vk_device, image, m_blocks[allocation.block]->memory,
+                              allocation.offset),
+            "MemoryAllocator: failed to bind image memory!");
+
+   m_images[image] = allocation;
+}
+
+void
+MemoryAllocator::Free(VkBuffer buffer)
+{
+   const std::lock_guard lock(m_mutex);
+   const auto it = m_buffers.find(buffer);
+   if (it != m_buffers.end())
+   {
+      FreeMemory(it->second);
+      m_buffers.erase(it);
+   }
+}
+
+void
+MemoryAllocator::Free(VkImage image)
+{
+   const std::lock_guard lock(m_mutex);
+   const auto it = m_images.find(image);
+   if (it != m_images.end())
+   {
+      FreeMemory(it->second);
+      m_images.erase(it);
+   }
+}
+
+void*
+MemoryAllocator::GetMappedMemory(VkBuffer buffer)
+{
+   const std::lock_guard lock(m_mutex);
+   const auto it = m_buffers.find(buffer);
+   if (it == m_buffers.end() || m_blocks[it->second.block]->mapped == nullptr)
+   {
+      return nullptr;
+   }
+
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   return m_blocks[it->second.block]->mapped + it->second.offset;
+}
+
+VkDeviceMemory
+MemoryAllocator::GetMemory(VkBuffer buffer)
+{
+   const std::lock_guard lock(m_mutex);
+   const auto it = m_buffers.find(buffer);
+   return it != m_buffers.end() ? m_blocks[it->second.block]->memory : VK_NULL_HANDLE;
+}
+
+VkDeviceMemory
+MemoryAllocator::GetMemory(VkImage image)
+{
+   const std::lock_guard lock(m_mutex);
+   const auto it = m_images.find(image);
+   return it != m_images.end() ? m_blocks[it->second.block]->memory : VK_NULL_HANDLE;
+}
+
+void
+MemoryAllocator::Flush(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+   const std::lock_guard lock(m_mutex);
+   const auto it = m_buffers.find(buffer);
+   if (it == m_buffers.end())
+   {
+      return;
+   }
+
+   const auto& allocation = it->second;
+   const auto& block = *m_blocks[allocation.block];
+   if (m_memoryProperties.memoryTypes[block.memoryType].propertyFlags
+       & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+   {
+      return;
+   }
+
+   // Range has to be aligned to nonCoherentAtomSize, which may reach into the neighbors
+   // of this allocation. Flushing them is harmless.
+   size = size == VK_WHOLE_SIZE ? allocation.size - offset : size;
+   const auto begin = (allocation.offset + offset) / m_nonCoherentAtomSize * m_nonCoherentAtomSize;
+   const auto end =
+      std::min(alignOffset(allocation.offset + offset + size, m_nonCoherentAtomSize), block.size);
+
+   VkMappedMemoryRange mappedRange = {};
+   mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+   mappedRange.memory = block.memory;
+   mappedRange.offset = begin;
+   mappedRange.size = end - begin;
+
+   VK_CHECK(vkFlushMappedMemoryRanges(Data::vk_device, 1, &mappedRange),
+            "MemoryAllocator: failed to flush memory!");
+}
+
+MemoryStats
+MemoryAllocator::GetStats()
+{
+   const std::lock_guard lock(m_mutex);
+
+   MemoryStats stats;
+   stats.deviceMemoryAllocations = m_numAllocations;
+   stats.maxDeviceMemoryAllocations = m_maxAllocations;
+   stats.heaps.resize(m_memoryProperties.memoryHeapCount);
+
+   std::vector< VkDeviceSize > largestFree(stats.heaps.size(), 0);
+   for (uint32_t heap = 0; heap < m_memoryProperties.memoryHeapCount; ++heap)
+   {
+      stats.heaps[heap].heapSize = m_memoryProperties.memoryHeaps[heap].size;
+      stats.heaps[heap].deviceLocal =
+         (m_memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+   }
+
+   for (const auto& block : m_blocks)
+   {
+      if (!block)
+      {
+         continue;
+      }
+
+      const auto heap = m_memoryProperties.memoryTypes[block->memoryType].heapIndex;
+      auto& heapStats = stats.heaps[heap];
+      ++heapStats.blocks;
+      heapStats.allocatedBytes += block->size;
+
+      if (block->dedicated)
+      {
+         ++heapStats.allocations;
+         heapStats.usedBytes += block->size;
+      }
+      else if (block->tlsf)
+      {
+         heapStats.allocations += block->tlsf->GetNumAllocations();
+         heapStats.usedBytes += block->tlsf->GetUsed();
+         largestFree[heap] = std::max(largestFree[heap], block->tlsf->GetLargestFree());
+      }
+      else
+      {
+         heapStats.allocations += block->linear->GetNumAllocations();
+         heapStats.usedBytes += block->linear->GetUsed();
+         largestFree[heap] =
+            std::max(largestFree[heap], block->linear->GetSize() - block->linear->GetUsed());
+      }
+   }
+
+   for (size_t heap = 0; heap < stats.heaps.size(); ++heap)
+   {
+      auto& heapStats = stats.heaps[heap];
+      const auto freeBytes = heapStats.allocatedBytes - heapStats.usedBytes;
+      heapStats.fragmentation =
+         freeBytes > 0 ? 1.0f
+                            - static_cast< float >(static_cast< double >(largestFree[heap])
+                                                   / static_cast< double >(freeBytes))
+                       : 0.0f;
+   }
+
+   return stats;
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::AllocateMemory(const VkMemoryRequirements& requirements,
+                                VkMemoryPropertyFlags properties, AllocationStrategy strategy,
+                                bool image)
+{
+   const auto memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+   const auto blockSize = GetBlockSize(memoryType);
+
+   if (requirements.size > blockSize / 2)
+   {
+      const auto block = CreateBlock(requirements.size, memoryType, strategy, image, true);
+      return {block, 0, requirements.size};
+   }
+
+   const auto tryAllocate = [&requirements](Block& block) {
+      return block.tlsf ? block.tlsf->Allocate(requirements.size, requirements.alignment)
+                        : block.linear->Allocate(requirements.size, requirements.alignment);
+   };
+
+   for (uint32_t i = 0; i < m_blocks.size(); ++i)
+   {
+      auto& block = m_blocks[i];
+      if (!block || block->dedicated || block->memoryType != memoryType
+          || block->strategy != strategy || block->image != image)
+      {
+         continue;
+      }
+
+      const auto offset = tryAllocate(*block);
+      if (offset != TlsfAllocator::INVALID_OFFSET)
+      {
+         return {i, offset, requirements.size};
+      }
+   }
+
+   const auto block = CreateBlock(blockSize, memoryType, strategy, image, false);
+   const auto offset = tryAllocate(*m_blocks[block]);
+   utils::Assert(offset != TlsfAllocator::INVALID_OFFSET,
+                 "MemoryAllocator: allocation doesn't fit into a new block!");
+
+   return {block, offset, requirements.size};
+}
+
+void
+MemoryAllocator::FreeMemory(const Allocation& allocation)
+{
+   auto& block = *m_blocks[allocation.block];
+
+   uint32_t remaining = 0;
+   if (block.tlsf)
+   {
+      block.tlsf->Free(allocation.offset);
+      remaining = block.tlsf->GetNumAllocations();
+   }
+   else if (block.linear)
+   {
+      block.linear->Free();
+      remaining = block.linear->GetNumAllocations();
+   }
+
+   if (remaining > 0)
+   {
+      return;
+   }
+
+   // Keep one empty block per pool around, so allocating and freeing doesn't thrash blocks
+   const auto samePool = [&block](const auto& other) {
+      return other && other.get() != &block && !other->dedicated
+             && other->memoryType == block.memoryType && other->strategy == block.strategy
+             && other->image == block.image;
+   };
+   const auto hasOtherBlock = std::any_of(m_blocks.begin(), m_blocks.end(), samePool);
+
+   if (block.dedicated || hasOtherBlock)
+   {
+      DestroyBlock(allocation.block);
+   }
+}
+
+uint32_t
+MemoryAllocator::CreateBlock(VkDeviceSize size, uint32_t memoryType, AllocationStrategy strategy,
+                             bool image, bool dedicated)
+{
+   utils::Assert(m_maxAllocations == 0 || m_numAllocations < m_maxAllocations,
+                 "MemoryAllocator: maxMemoryAllocationCount reached!");
+
+   VkMemoryAllocateInfo allocInfo = {};
+   allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+   allocInfo.allocationSize = size;
+   allocInfo.memoryTypeIndex = memoryType;
+
+   auto block = std::make_unique< Block >();
+   VK_CHECK(vkAllocateMemory(Data::vk_device, &allocInfo, nullptr, &block->memory),
+            fmt::format("MemoryAllocator: failed to allocate {} bytes!", size));
+   ++m_numAllocations;
+
+   block->size = size;
+   block->memoryType = memoryType;
+   block->strategy = strategy;
+   block->image = image;
+   block->dedicated = dedicated;
+
+   if (!dedicated)
+   {
+      if (strategy == AllocationStrategy::LINEAR)
+      {
+         block->linear = std::make_unique< LinearAllocator >(size);
+      }
+      else
+      {
+         block->tlsf = std::make_unique< TlsfAllocator >(size);
+      }
+   }
+
+   if (m_memoryProperties.memoryTypes[memoryType].propertyFlags
+       & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+   {
+      void* mapped = nullptr;
+      VK_CHECK(vkMapMemory(Data::vk_device, block->memory, 0, VK_WHOLE_SIZE, 0, &mapped),
+               "MemoryAllocator: failed to map memory!");
+      block->mapped = static_cast< uint8_t* >(mapped);
+   }
+
+   trace::Logger::Debug("MemoryAllocator: new {}block of {} KB (memory type {})",
+                        dedicated ? "dedicated " : "", size / 1024, memoryType);
+
+   const auto freeSlot = std::find(m_blocks.begin(), m_blocks.end(), nullptr);
+   if (freeSlot != m_blocks.end())
+   {
+      *freeSlot = std::move(block);
+      return static_cast< uint32_t >(freeSlot - m_blocks.begin());
+   }
+
+   m_blocks.push_back(std::move(block));
+   return static_cast< uint32_t >(m_blocks.size() - 1);
+}
+
+void
+MemoryAllocator::DestroyBlock(uint32_t block)
+{
+   if (m_blocks[block]->mapped != nullptr)
+   {
+      vkUnmapMemory(Data::vk_device, m_blocks[block]->memory);
+   }
+
+   vkFreeMemory(Data::vk_device, m_blocks[block]->memory, nullptr);
+   --m_numAllocations;
+   m_blocks[block].reset();
+}
+
+VkDeviceSize
+MemoryAllocator::GetBlockSize(uint32_t memoryType)
+{
+   const auto heap = m_memoryProperties.memoryTypes[memoryType].heapIndex;
+   const auto heapSize = m_memoryProperties.memoryHeaps[heap].size;
+
+   return heapSize <= SMALL_HEAP_SIZE ? heapSize / 8 : PREFERRED_BLOCK_SIZE;
+}
+
+} // namespace shady::render
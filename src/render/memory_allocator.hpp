@@ -0,0 +1,252 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+/*
+ * Two-level segregated fit allocator of ranges within [0, size). It only manages offsets,
+ * the memory itself is owned by the caller. Allocation and free are O(1): free ranges are
+ * kept in lists indexed by (log2 of size, 16 linear subdivisions) with bitmaps of non-empty
+ * lists, and neighboring free ranges are merged on free.
+ */
+class TlsfAllocator
+{
+ public:
+   static constexpr uint64_t INVALID_OFFSET = ~uint64_t{0};
+   // Every range is a multiple of this (and starts at such offset)
+   static constexpr uint64_t GRANULARITY = 256;
+
+   explicit TlsfAllocator(uint64_t size);
+
+   // Returns INVALID_OFFSET when there's no free range big enough
+   [[nodiscard]] uint64_t
+   Allocate(uint64_t size, uint64_t alignment);
+
+   void
+   Free(uint64_t offset);
+
+   // Includes rounding (granularity) of allocated ranges
+   [[nodiscard]] uint64_t
+   GetUsed() const;
+
+   [[nodiscard]] uint64_t
+   GetSize() const;
+
+   [[nodiscard]] uint64_t
+   GetLargestFree() const;
+
+   [[nodiscard]] uint32_t
+   GetNumAllocations() const;
+
+ private:
+   static constexpr uint32_t SL_BITS = 4;
+   static constexpr uint32_t SL_COUNT = 1U << SL_BITS;
+   static constexpr uint32_t FL_COUNT = 64;
+   static constexpr uint32_t NIL = ~uint32_t{0};
+
+   struct Range
+   {
+      uint64_t offset = 0;
+      uint64_t size = 0;
+      // Physical neighbors (by offset)
+      uint32_t prev = NIL;
+      uint32_t next = NIL;
+      // Neighbors within the free list, only valid when 'free'
+      uint32_t prevFree = NIL;
+      uint32_t nextFree = NIL;
+      bool free = false;
+   };
+
+   [[nodiscard]] uint32_t
+   CreateRange(uint64_t offset, uint64_t size);
+
+   void
+   ReleaseRange(uint32_t range);
+
+   void
+   InsertFree(uint32_t range);
+
+   void
+   RemoveFree(uint32_t range);
+
+   // Split 'range' at 'size', the second part becomes a new free range
+   void
+   SplitFree(uint32_t range, uint64_t size);
+
+ private:
+   uint64_t size_ = 0;
+   uint64_t used_ = 0;
+   std::vector< Range > ranges_;
+   std::vector< uint32_t > unusedRanges_;
+   std::unordered_map< uint64_t, uint32_t > allocated_;
+
+   uint64_t flBitmap_ = 0;
+   std::array< uint32_t, FL_COUNT > slBitmaps_ = {};
+   std::array< std::array< uint32_t, SL_COUNT >, FL_COUNT > freeLists_ = {};
+};
+
+/*
+ * Bump allocator, individual frees only decrease the number of live allocations and the whole
+ * range is reused once all of them are freed. Meant for resources living as long as the scene.
+ */
+class LinearAllocator
+{
+ public:
+   explicit LinearAllocator(uint64_t size);
+
+   // Returns TlsfAllocator::INVALID_OFFSET when there's not enough space left
+   [[nodiscard]] uint64_t
+   Allocate(uint64_t size, uint64_t alignment);
+
+   void
+   Free();
+
+   [[nodiscard]] uint64_t
+   GetUsed() const;
+
+   [[nodiscard]] uint64_t
+   GetSize() const;
+
+   [[nodiscard]] uint32_t
+   GetNumAllocations() const;
+
+ private:
+   uint64_t size_ = 0;
+   uint64_t head_ = 0;
+   uint32_t numAllocations_ = 0;
+};
+
+enum class AllocationStrategy : uint8_t
+{
+   // TLSF, for resources that are created and destroyed independently
+   GENERAL = 0,
+   // Bump allocation, for resources that live until the end
+   LINEAR = 1
+};
+
+struct HeapStats
+{
+   VkDeviceSize heapSize = 0;
+   bool deviceLocal = false;
+   uint32_t blocks = 0;
+   uint32_t allocations = 0;
+   // Memory allocated from Vulkan (sum of blocks) and the part of it used by resources
+   VkDeviceSize allocatedBytes = 0;
+   VkDeviceSize usedBytes = 0;
+   // 1 - largest free range / all free memory, 0 means the free memory is contiguous
+   float fragmentation = 0.0f;
+};
+
+struct MemoryStats
+{
+   std::vector< HeapStats > heaps;
+   uint32_t deviceMemoryAllocations = 0;
+   uint32_t maxDeviceMemoryAllocations = 0;
+};
+
+/*
+ * Sub-allocates buffers and images from large VkDeviceMemory blocks, one set of blocks per
+ * memory type, strategy and resource kind (buffers and images don't share blocks, so
+ * bufferImageGranularity never has to be considered). Resources bigger than half of a block
+ * get dedicated allocation. Host visible blocks are persistently mapped, so memory returned
+ * by GetMappedMemory shouldn't be mapped with vkMapMemory again.
+ */
+class MemoryAllocator
+{
+ public:
+   static void
+   Init();
+
+   // Allocates memory for 'buffer' and binds it
+   static void
+   Allocate(VkBuffer buffer, VkMemoryPropertyFlags properties,
+            AllocationStrategy strategy = AllocationStrategy::GENERAL);
+
+   // Allocates memory for 'image' and binds it
+   static void
+   Allocate(VkImage image, VkMemoryPropertyFlags properties,
+            AllocationStrategy strategy = AllocationStrategy::GENERAL);
+
+   // Has to be called before the resource is destroyed
+   static void
+   Free(VkBuffer buffer);
+
+   static void
+   Free(VkImage image);
+
+   // nullptr if the buffer is not host visible
+   [[nodiscard]] static void*
+   GetMappedMemory(VkBuffer buffer);
+
+   [[nodiscard]] static VkDeviceMemory
+   GetMemory(VkBuffer buffer);
+
+   [[nodiscard]] static VkDeviceMemory
+   GetMemory(VkImage image);
+
+   // No-op for host coherent memory, range is relative to the buffer
+   static void
+   Flush(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+
+   [[nodiscard]] static MemoryStats
+   GetStats();
+
+ private:
+   struct Block
+   {
+      VkDeviceMemory memory = {};
+      VkDeviceSize size = 0;
+      uint8_t* mapped = nullptr;
+      uint32_t memoryType = 0;
+      AllocationStrategy strategy = AllocationStrategy::GENERAL;
+      bool image = false;
+      bool dedicated = false;
+      std::unique_ptr< TlsfAllocator > tlsf;
+      std::unique_ptr< LinearAllocator > linear;
+   };
+
+   struct Allocation
+   {
+      uint32_t block = 0;
+      VkDeviceSize offset = 0;
+      VkDeviceSize size = 0;
+   };
+
+   [[nodiscard]] static Allocation
+   AllocateMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+                  AllocationStrategy strategy, bool image);
+
+   static void
+   FreeMemory(const Allocation& allocation);
+
+   [[nodiscard]] static uint32_t
+   CreateBlock(VkDeviceSize size, uint32_t memoryType, AllocationStrategy strategy, bool image,
+               bool dedicated);
+
+   static void
+   DestroyBlock(uint32_t block);
+
+   [[nodiscard]] static VkDeviceSize
+   GetBlockSize(uint32_t memoryType);
+
+ private:
+   inline static std::mutex m_mutex = {};
+   inline static VkPhysicalDeviceMemoryProperties m_memoryProperties = {};
+   inline static VkDeviceSize m_nonCoherentAtomSize = 1;
+   inline static uint32_t m_maxAllocations = 0;
+   inline static uint32_t m_numAllocations = 0;
+
+   // Destroyed blocks leave empty slots, so block indices stored in allocations stay valid
+   inline static std::vector< std::unique_ptr< Block > > m_blocks = {};
+   inline static std::unordered_map< VkBuffer, Allocation > m_buffers = {};
+   inline static std::unordered_map< VkImage, Allocation > m_images = {};
+};
+
+} // namespace shady::render
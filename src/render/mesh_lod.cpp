@@ -0,0 +1,380 @@
+#include "mesh_lod.hpp"
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+namespace shady::render {
+
+namespace {
+
+// Every level aims at this fraction of the previous level's triangles
+constexpr float LOD_REDUCTION = 0.5f;
+// Levels which kept more than this fraction of the previous level's triangles are not worth it
+constexpr float MIN_LOD_REDUCTION = 0.85f;
+
+// Sum of squared distances to the planes of triangles (Garland-Heckbert), weighted by their area
+struct Quadric
+{
+   // Symmetric matrix A, vector b and constant c of x^T * A * x + 2 * b^T * x + c
+   float a00 = 0.0f;
+   float a11 = 0.0f;
+   float a22 = 0.0f;
+   float a01 = 0.0f;
+   float a02 = 0.0f;
+   float a12 = 0.0f;
+   float b0 = 0.0f;
+   float b1 = 0.0f;
+   float b2 = 0.0f;
+   float c = 0.0f;
+   float weight = 0.0f;
+};
+
+// Edge collapse, 'from' is moved onto 'to'
+struct Collapse
+{
+   float error = 0.0f;
+   uint32_t from = 0;
+   uint32_t to = 0;
+};
+
+Quadric
+planeQuadric(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+   auto normal = glm::cross(b - a, c - a);
+   const auto length = glm::length(normal);
+   if (length == 0.0f)
+   {
+      return {};
+   }
+
+   normal /= length;
+   const auto distance = -glm::dot(normal, a);
+   const auto area = length * 0.5f;
+
+   Quadric quadric;
+   quadric.a00 = area * normal.x * normal.x;
+   quadric.a11 = area * normal.y * normal.y;
+   quadric.a22 = area * normal.z * normal.z;
+   quadric.a01 = area * normal.x * normal.y;
+   quadric.a02 = area * normal.x * normal.z;
+   quadric.a12 = area * normal.y * normal.z;
+   quadric.b0 = area * normal.x * distance;
+   quadric.b1 = area * normal.y * distance;
+   quadric.b2 = area * normal.z * distance;
+   quadric.c = area * distance * distance;
+   quadric.weight = area;
+
+   return quadric;
+}
+
+void
+addQuadric(Quadric& quadric, const Quadric& other)
+{
+   quadric.a00 += other.a00;
+   quadric.a11 += other.a11;
+   quadric.a22 += other.a22;
+   quadric.a01 += other.a01;
+   quadric.a02 += other.a02;
+   quadric.a12 += other.a12;
+   quadric.b0 += other.b0;
+   quadric.b1 += other.b1;
+   quadric.b2 += other.b2;
+   quadric.c += other.c;
+   quadric.weight += other.weight;
+}
+
+// Mean squared distance of 'point' from the planes of both quadrics
+float
+collapseError(Quadric quadric, const Quadric& other, const glm::vec3& point)
+{
+   addQuadric(quadric, other);
+   if (quadric.weight == 0.0f)
+   {
+      return 0.0f;
+   }
+
+   const auto& p = point;
+   const auto rx = quadric.a00 * p.x + quadric.a01 * p.y + quadric.a02 * p.z;
+   const auto ry = quadric.a01 * p.x + quadric.a11 * p.y + quadric.a12 * p.z;
+   const auto rz = quadric.a02 * p.x + quadric.a12 * p.y + quadric.a22 * p.z;
+   const auto value = p.x * rx + p.y * ry + p.z * rz
+                      + 2.0f * (quadric.b0 * p.x + quadric.b1 * p.y + quadric.b2 * p.z)
+                      + quadric.c;
+
+   return std::abs(value) / quadric.weight;
+}
+
+// Vertices of edges used by a single triangle, seams are borders as well since vertices on
+// either side of them are distinct
+std::vector< uint8_t >
+findBorderVertices(size_t numVertices, std::span< const uint32_t > indices)
+{
+   std::unordered_map< uint64_t, uint32_t > edgeUses;
+   edgeUses.reserve(indices.size());
+
+   const auto edgeKey = [](uint32_t a, uint32_t b) {
+      return (uint64_t{std::min(a, b)} << 32U) | std::max(a, b);
+   };
+
+   for (size_t triangle = 0; triangle < indices.size(); triangle += 3)
+   {
+      for (size_t corner = 0; corner < 3; ++corner)
+      {
+         ++edgeUses[edgeKey(indices[triangle + corner], indices[triangle + (corner + 1) % 3])];
+      }
+   }
+
+   std::vector< uint8_t > border(numVertices, 0);
+   for (const auto& [key, uses] : edgeUses)
+   {
+      // Non-manifold edges are kept as well
+      if (uses != 2)
+      {
+         border[key >> 32U] = 1;
+         border[key & 0xFFFFFFFFU] = 1;
+      }
+   }
+
+   return border;
+}
+
+// Collapsing would turn one of the triangles around 'from' upside down (or to a line)
+bool
+collapseFlips(std::span< const Vertex > vertices, std::span< const uint32_t > indices,
+              std::span< const uint32_t > triangles, const Collapse& collapse)
+{
+   const auto& target = vertices[collapse.to].m_position;
+
+   for (const auto triangle : triangles)
+   {
+      const auto* corners = &indices[size_t{triangle} * 3];
+      if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+      {
+         // Collapsed edge, the triangle disappears
+         continue;
+      }
+
+      std::array< glm::vec3, 3 > before = {};
+      std::array< glm::vec3, 3 > after = {};
+      for (size_t corner = 0; corner < 3; ++corner)
+      {
+         before[corner] = vertices[corners[corner]].m_position;
+         after[corner] = corners[corner] == collapse.from ? target : before[corner];
+      }
+
+      const auto normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+      const auto normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+      if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+// Collapses edges of 'indices' until there's at most 'targetCount' indices left (or nothing can
+// be collapsed). Returns the simplified indices and the largest error of the collapses.
+std::pair< std::vector< uint32_t >, float >
+simplify(std::span< const Vertex > vertices, std::vector< Quadric > quadrics,
+         std::span< const uint8_t > locked, std::span< const uint32_t > indices,
+         size_t targetCount)
+{
+   std::vector< uint32_t > result(indices.begin(), indices.end());
+   std::vector< uint32_t > remap(vertices.size());
+   std::vector< uint8_t > touched(vertices.size());
+   std::vector< uint32_t > offsets(vertices.size() + 1);
+   std::vector< uint32_t > adjacency;
+   std::vector< Collapse > collapses;
+   float maxError = 0.0f;
+
+   while (result.size() > targetCount)
+   {
+      // Triangles around each vertex
+      std::fill(offsets.begin(), offsets.end(), 0);
+      for (const auto index : result)
+      {
+         ++offsets[index + 1];
+      }
+      std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+      adjacency.resize(result.size());
+      auto cursor = offsets;
+      for (size_t index = 0; index < result.size(); ++index)
+      {
+         adjacency[cursor[result[index]]++] = static_cast< uint32_t >(index / 3);
+      }
+
+      // Every interior edge is shared by two triangles, take it from the one where it's ascending
+      collapses.clear();
+      for (size_t index = 0; index < result.size(); ++index)
+      {
+         const auto a = result[index];
+         const auto b = result[index - index % 3 + (index + 1) % 3];
+         if (a >= b || (locked[a] && locked[b]))
+         {
+            continue;
+         }
+
+         const auto& positionA = vertices[a].m_position;
+         const auto& positionB = vertices[b].m_position;
+         const Collapse toB = {collapseError(quadrics[a], quadrics[b], positionB), a, b};
+         const Collapse toA = {collapseError(quadrics[a], quadrics[b], positionA), b, a};
+
+         if (locked[a] || (!locked[b] && toA.error < toB.error))
+         {
+            collapses.push_back(toA);
+         }
+         else
+         {
+            collapses.push_back(toB);
+         }
+      }
+
+      std::sort(collapses.begin(), collapses.end(), [](const auto& left, const auto& right) {
+         return std::tie(left.error, left.from, left.to)
+                < std::tie(right.error, right.from, right.to);
+      });
+
+      std::iota(remap.begin(), remap.end(), 0);
+      std::fill(touched.begin(), touched.end(), 0);
+
+      const auto toRemove = (result.size() - targetCount) / 3;
+      size_t removed = 0;
+      size_t numCollapses = 0;
+
+      for (const auto& collapse : collapses)
+      {
+         if (removed >= toRemove)
+         {
+            break;
+         }
+
+         // Error and flip test are only valid while the neighbourhood is unchanged
+         if (touched[collapse.from] || touched[collapse.to])
+         {
+            continue;
+         }
+
+         const auto triangles = std::span(adjacency).subspan(
+            offsets[collapse.from], offsets[collapse.from + 1] - offsets[collapse.from]);
+         if (collapseFlips(vertices, result, triangles, collapse))
+         {
+            continue;
+         }
+
+         for (const auto triangle : triangles)
+         {
+            const auto* corners = &result[size_t{triangle} * 3];
+            touched[corners[0]] = 1;
+            touched[corners[1]] = 1;
+            touched[corners[2]] = 1;
+
+            if (corners[0] == collapse.to || corners[1] == collapse.to
+                || corners[2] == collapse.to)
+            {
+               ++removed;
+            }
+         }
+
+         remap[collapse.from] = collapse.to;
+         addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+         maxError = std::max(maxError, collapse.error);
+         ++numCollapses;
+      }
+
+      if (numCollapses == 0)
+      {
+         break;
+      }
+
+      size_t write = 0;
+      for (size_t triangle = 0; triangle < result.size(); triangle += 3)
+      {
+         const auto a = remap[result[triangle]];
+         const auto b = remap[result[triangle + 1]];
+         const auto c = remap[result[triangle + 2]];
+         if (a != b && b != c && a != c)
+         {
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+         }
+      }
+      result.resize(write);
+   }
+
+   return {std::move(result), std::sqrt(maxError)};
+}
+
+} // namespace
+
+LodChain
+BuildLodChain(std::span< const Vertex > vertices, std::span< const uint32_t > indices)
+{
+   LodChain chain;
+
+   const auto base = indices.first(indices.size() / 3 * 3);
+   if (base.empty() || vertices.empty())
+   {
+      return chain;
+   }
+
+   std::vector< Quadric > quadrics(vertices.size());
+   for (size_t triangle = 0; triangle < base.size(); triangle += 3)
+   {
+      const auto a = base[triangle];
+      const auto b = base[triangle + 1];
+      const auto c = base[triangle + 2];
+      const auto quadric =
+         planeQuadric(vertices[a].m_position, vertices[b].m_position, vertices[c].m_position);
+
+      addQuadric(quadrics[a], quadric);
+      addQuadric(quadrics[b], quadric);
+      addQuadric(quadrics[c], quadric);
+   }
+
+   const auto locked = findBorderVertices(vertices.size(), base);
+
+   // Every level is simplified from the full detail mesh, so its error is measured against it
+   auto previousCount = base.size();
+   float previousError = 0.0f;
+   for (uint32_t level = 1; level < MAX_MESH_LODS; ++level)
+   {
+      const auto targetCount =
+         static_cast< size_t >(static_cast< float >(previousCount / 3) * LOD_REDUCTION) * 3;
+      auto [levelIndices, error] = simplify(vertices, quadrics, locked, base, targetCount);
+
+      if (levelIndices.empty()
+          || static_cast< float >(levelIndices.size())
+                > static_cast< float >(previousCount) * MIN_LOD_REDUCTION)
+      {
+         break;
+      }
+
+      // Collapses leave the triangles in the order of the full detail level, which is no
+      // longer cache friendly
+      OptimizeVertexCache(levelIndices, vertices.size());
+
+      MeshLod lod;
+      lod.firstIndex = static_cast< uint32_t >(chain.indices.size());
+      lod.indexCount = static_cast< uint32_t >(levelIndices.size());
+      // Coarser levels are never selected closer than finer ones
+      lod.error = std::max(error, previousError);
+      chain.lods.push_back(lod);
+      chain.indices.insert(chain.indices.end(), levelIndices.begin(), levelIndices.end());
+
+      previousCount = levelIndices.size();
+      previousError = lod.error;
+   }
+
+   return chain;
+}
+
+} // namespace shady::render
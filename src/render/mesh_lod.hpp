@@ -0,0 +1,44 @@
+#pragma once
+
+#include "vertex.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace shady::render {
+
+// Detail levels per mesh, including the full detail one
+static constexpr uint32_t MAX_MESH_LODS = 4;
+
+// Index range of a single detail level. Must match 'MeshLod' in cull_common.glsl (std430).
+struct MeshLod
+{
+   uint32_t firstIndex = 0;
+   uint32_t indexCount = 0;
+   // Largest distance (RMS, in the space of the vertices) of the simplified surface from the
+   // full detail one
+   float error = 0.0f;
+   uint32_t padding = 0;
+};
+
+// Simplified levels of a mesh, full detail level is the mesh itself and is not part of it
+struct LodChain
+{
+   // Indices of all levels, one after another
+   std::vector< uint32_t > indices = {};
+   // Ranges within 'indices', from the most to the least detailed level
+   std::vector< MeshLod > lods = {};
+};
+
+/*
+ * Builds up to MAX_MESH_LODS - 1 simplified index buffers of triangle list 'indices', each with
+ * about half the triangles of the previous one. Simplification collapses edges (onto one of the
+ * edge's vertices) in order of their quadric error, so the levels reuse 'vertices'. Vertices on
+ * borders (including UV and normal seams) are kept in place. Levels stop once the mesh can't be
+ * simplified any further.
+ */
+[[nodiscard]] LodChain
+BuildLodChain(std::span< const Vertex > vertices, std::span< const uint32_t > indices);
+
+} // namespace shady::render
@@ -0,0 +1,483 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+namespace shady::render {
+
+namespace {
+
+// Cache modelled by the Forsyth scoring, larger than the simulated one on purpose (the exact
+// size of the hardware cache is unknown, a larger model works well for smaller caches too)
+constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+constexpr uint32_t INVALID_INDEX = std::numeric_limits< uint32_t >::max();
+
+// Score of a vertex at 'cachePosition' (negative when not cached) used by 'remaining' triangles
+float
+vertexScore(int32_t cachePosition, uint32_t remaining)
+{
+   if (remaining == 0)
+   {
+      return -1.0f;
+   }
+
+   float score = 0.0f;
+   if (cachePosition >= 0)
+   {
+      if (cachePosition < 3)
+      {
+         // Vertices of the last triangle, favouring them doesn't matter for the cache order
+         score = FORSYTH_LAST_TRIANGLE_SCORE;
+      }
+      else
+      {
+         const auto scale = 1.0f / static_cast< float >(FORSYTH_CACHE_SIZE - 3);
+         score = std::pow(1.0f - static_cast< float >(cachePosition - 3) * scale,
+                          FORSYTH_CACHE_DECAY_POWER);
+      }
+   }
+
+   // Vertices with few triangles left are finished first, so they don't end up stranded
+   score += FORSYTH_VALENCE_BOOST_SCALE
+            * std::pow(static_cast< float >(remaining), -FORSYTH_VALENCE_BOOST_POWER);
+
+   return score;
+}
+
+// Byte wise hash and comparison, welding only merges exact duplicates
+struct VertexHash
+{
+   size_t
+   operator()(const Vertex& vertex) const
+   {
+      // FNV-1a
+      uint64_t hash = 14695981039346656037ULL;
+      std::array< uint8_t, sizeof(Vertex) > bytes = {};
+      std::memcpy(bytes.data(), &vertex, sizeof(Vertex));
+      for (const auto byte : bytes)
+      {
+         hash = (hash ^ byte) * 1099511628211ULL;
+      }
+      return static_cast< size_t >(hash);
+   }
+};
+
+struct VertexEqual
+{
+   bool
+   operator()(const Vertex& left, const Vertex& right) const
+   {
+      return std::memcmp(&left, &right, sizeof(Vertex)) == 0;
+   }
+};
+
+static_assert(sizeof(Vertex) == 11 * sizeof(float), "Vertex can't have padding bytes");
+
+} // namespace
+
+float
+VertexCacheStats::GetAcmr() const
+{
+   return triangles > 0 ? static_cast< float >(misses) / static_cast< float >(triangles) : 0.0f;
+}
+
+float
+VertexCacheStats::GetAtvr() const
+{
+   return vertices > 0 ? static_cast< float >(misses) / static_cast< float >(vertices) : 0.0f;
+}
+
+VertexCacheStats&
+VertexCacheStats::operator+=(const VertexCacheStats& other)
+{
+   misses += other.misses;
+   triangles += other.triangles;
+   vertices += other.vertices;
+   return *this;
+}
+
+MeshOptimizationStats&
+MeshOptimizationStats::operator+=(const MeshOptimizationStats& other)
+{
+   before += other.before;
+   after += other.after;
+   return *this;
+}
+
+VertexCacheStats
+AnalyzeVertexCache(std::span< const uint32_t > indices, size_t numVertices)
+{
+   VertexCacheStats stats;
+   stats.triangles = indices.size() / 3;
+
+   // Time at which each vertex entered the cache, it's still there while less than
+   // VERTEX_CACHE_SIZE vertices were added since
+   std::vector< uint64_t > cachedAt(numVertices, std::numeric_limits< uint64_t >::max());
+   uint64_t time = 0;
+
+   for (const auto index : indices.first(stats.triangles * 3))
+   {
+      if (cachedAt[index] == std::numeric_limits< uint64_t >::max())
+      {
+         ++stats.vertices;
+      }
+
+      if (cachedAt[index] == std::numeric_limits< uint64_t >::max()
+          || time - cachedAt[index] >= VERTEX_CACHE_SIZE)
+      {
+         cachedAt[index] = time++;
+         ++stats.misses;
+      }
+   }
+
+   return stats;
+}
+
+void
+WeldVertices(std::vector< Vertex >& vertices, std::span< uint32_t > indices)
+{
+   std::unordered_map< Vertex, uint32_t, VertexHash, VertexEqual > unique;
+   unique.reserve(vertices.size());
+
+   std::vector< uint32_t > remap(vertices.size());
+   std::vector< Vertex > welded;
+   welded.reserve(vertices.size());
+
+   for (size_t idx = 0; idx < vertices.size(); ++idx)
+   {
+      const auto [it, inserted] =
+         unique.try_emplace(vertices[idx], static_cast< uint32_t >(welded.size()));
+      if (inserted)
+      {
+         welded.push_back(vertices[idx]);
+      }
+      remap[idx] = it->second;
+   }
+
+   if (welded.size() == vertices.size())
+   {
+      return;
+   }
+
+   for (auto& index : indices)
+   {
+      index = remap[index];
+   }
+   vertices = std::move(welded);
+}
+
+void
+OptimizeVertexCache(std::span< uint32_t > indices, size_t numVertices)
+{
+   const auto numTriangles = indices.size() / 3;
+   if (numTriangles == 0)
+   {
+      return;
+   }
+
+   // Triangles around each vertex, the ones not emitted yet are kept at the front
+   std::vector< uint32_t > remaining(numVertices, 0);
+   for (const auto index : indices.first(numTriangles * 3))
+   {
+      ++remaining[index];
+   }
+
+   std::vector< uint32_t > offsets(numVertices + 1, 0);
+   std::partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+
+   std::vector< uint32_t > adjacency(numTriangles * 3);
+   {
+      auto cursor = offsets;
+      for (size_t index = 0; index < numTriangles * 3; ++index)
+      {
+         adjacency[cursor[indices[index]]++] = static_cast< uint32_t >(index / 3);
+      }
+   }
+
+   std::vector< int32_t > cachePosition(numVertices, -1);
+   std::vector< float > vertexScores(numVertices);
+   for (size_t vertex = 0; vertex < numVertices; ++vertex)
+   {
+      vertexScores[vertex] = vertexScore(-1, remaining[vertex]);
+   }
+
+   std::vector< float > triangleScores(numTriangles);
+   for (size_t triangle = 0; triangle < numTriangles; ++triangle)
+   {
+      triangleScores[triangle] = vertexScores[indices[triangle * 3]]
+                                 + vertexScores[indices[triangle * 3 + 1]]
+                                 + vertexScores[indices[triangle * 3 + 2]];
+   }
+
+   std::vector< uint8_t > emitted(numTriangles, 0);
+   std::vector< uint32_t > result;
+   result.reserve(numTriangles * 3);
+
+   // Three extra slots for the vertices pushing out the oldest ones
+   std::array< uint32_t, FORSYTH_CACHE_SIZE + 3 > cache = {};
+   std::array< uint32_t, FORSYTH_CACHE_SIZE + 3 > newCache = {};
+   uint32_t cacheSize = 0;
+
+   auto best = static_cast< uint32_t >(
+      std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin());
+   // Fallback when no cached vertex has triangles left, continues in the original order
+   size_t deadEndCursor = 0;
+
+   for (size_t count = 0; count < numTriangles; ++count)
+   {
+      if (best == INVALID_INDEX)
+      {
+         while (emitted[deadEndCursor])
+         {
+            ++deadEndCursor;
+         }
+         best = static_cast< uint32_t >(deadEndCursor);
+      }
+
+      const std::array< uint32_t, 3 > corners = {indices[size_t{best} * 3],
+                                                 indices[size_t{best} * 3 + 1],
+                                                 indices[size_t{best} * 3 + 2]};
+      result.insert(result.end(), corners.begin(), corners.end());
+      emitted[best] = 1;
+
+      for (const auto vertex : corners)
+      {
+         auto* first = &adjacency[offsets[vertex]];
+         auto* last = first + remaining[vertex];
+         auto* it = std::find(first, last, best);
+         if (it != last)
+         {
+            std::swap(*it, *(last - 1));
+            --remaining[vertex];
+         }
+      }
+
+      // Most recently used first
+      uint32_t newCacheSize = 0;
+      for (const auto vertex : corners)
+      {
+         if (std::find(newCache.begin(), newCache.begin() + newCacheSize, vertex)
+             == newCache.begin() + newCacheSize)
+         {
+            newCache[newCacheSize++] = vertex;
+         }
+      }
+      for (uint32_t slot = 0; slot < cacheSize; ++slot)
+      {
+         const auto vertex = cache[slot];
+         if (std::find(corners.begin(), corners.end(), vertex) == corners.end())
+         {
+            newCache[newCacheSize++] = vertex;
+         }
+      }
+
+      // Rescore everything that was or is in the cache, evicted vertices fall out of it
+      best = INVALID_INDEX;
+      float bestScore = -1.0f;
+      for (uint32_t slot = 0; slot < newCacheSize; ++slot)
+      {
+         const auto vertex = newCache[slot];
+         const auto position = slot < FORSYTH_CACHE_SIZE ? static_cast< int32_t >(slot) : -1;
+         cachePosition[vertex] = position;
+
+         const auto score = vertexScore(position, remaining[vertex]);
+         const auto delta = score - vertexScores[vertex];
+         vertexScores[vertex] = score;
+
+         for (uint32_t idx = 0; idx < remaining[vertex]; ++idx)
+         {
+            const auto triangle = adjacency[offsets[vertex] + idx];
+            triangleScores[triangle] += delta;
+         }
+      }
+
+      // Only triangles of cached vertices changed their score, the best one is among them
+      for (uint32_t slot = 0; slot < std::min(newCacheSize, FORSYTH_CACHE_SIZE); ++slot)
+      {
+         const auto vertex = newCache[slot];
+         for (uint32_t idx = 0; idx < remaining[vertex]; ++idx)
+         {
+            const auto triangle = adjacency[offsets[vertex] + idx];
+            if (triangleScores[triangle] > bestScore)
+            {
+               bestScore = triangleScores[triangle];
+               best = triangle;
+            }
+         }
+      }
+
+      cacheSize = std::min(newCacheSize, FORSYTH_CACHE_SIZE);
+      std::copy(newCache.begin(), newCache.begin() + cacheSize, cache.begin());
+   }
+
+   std::copy(result.begin(), result.end(), indices.begin());
+}
+
+void
+OptimizeOverdraw(std::span< uint32_t > indices, std::span< const Vertex > vertices)
+{
+   const auto numTriangles = indices.size() / 3;
+   if (numTriangles < 2)
+   {
+      return;
+   }
+
+   // Clusters start where the simulated cache has none of the triangle's vertices, reordering
+   // them can't make the cache behaviour noticeably worse
+   std::vector< uint32_t > clusterStarts;
+   {
+      std::vector< uint64_t > cachedAt(vertices.size(), std::numeric_limits< uint64_t >::max());
+      uint64_t time = 0;
+      for (size_t triangle = 0; triangle < numTriangles; ++triangle)
+      {
+         uint32_t misses = 0;
+         for (size_t corner = 0; corner < 3; ++corner)
+         {
+            const auto index = indices[triangle * 3 + corner];
+            if (cachedAt[index] == std::numeric_limits< uint64_t >::max()
+                || time - cachedAt[index] >= VERTEX_CACHE_SIZE)
+            {
+               cachedAt[index] = time++;
+               ++misses;
+            }
+         }
+
+         if (triangle == 0 || misses == 3)
+         {
+            clusterStarts.push_back(static_cast< uint32_t >(triangle));
+         }
+      }
+   }
+
+   if (clusterStarts.size() < 2)
+   {
+      return;
+   }
+   clusterStarts.push_back(static_cast< uint32_t >(numTriangles));
+
+   const auto position = [&vertices, &indices](size_t triangle, size_t corner) {
+      return vertices[indices[triangle * 3 + corner]].m_position;
+   };
+
+   // Area weighted centroid of the whole mesh
+   glm::vec3 meshCentroid{0.0f};
+   float meshArea = 0.0f;
+   for (size_t triangle = 0; triangle < numTriangles; ++triangle)
+   {
+      const auto area = glm::length(glm::cross(position(triangle, 1) - position(triangle, 0),
+                                               position(triangle, 2) - position(triangle, 0)));
+      meshCentroid += (position(triangle, 0) + position(triangle, 1) + position(triangle, 2))
+                      * (area / 3.0f);
+      meshArea += area;
+   }
+   meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+   // How much each cluster faces away from the center, outer surfaces occlude the inner ones
+   const auto numClusters = clusterStarts.size() - 1;
+   std::vector< float > sortKeys(numClusters);
+   for (size_t cluster = 0; cluster < numClusters; ++cluster)
+   {
+      glm::vec3 centroid{0.0f};
+      glm::vec3 normal{0.0f};
+      float area = 0.0f;
+      for (size_t triangle = clusterStarts[cluster]; triangle < clusterStarts[cluster + 1];
+           ++triangle)
+      {
+         const auto cross = glm::cross(position(triangle, 1) - position(triangle, 0),
+                                       position(triangle, 2) - position(triangle, 0));
+         const auto triangleArea = glm::length(cross);
+         centroid += (position(triangle, 0) + position(triangle, 1) + position(triangle, 2))
+                     * (triangleArea / 3.0f);
+         normal += cross;
+         area += triangleArea;
+      }
+
+      const auto normalLength = glm::length(normal);
+      if (area == 0.0f || normalLength == 0.0f)
+      {
+         sortKeys[cluster] = std::numeric_limits< float >::lowest();
+         continue;
+      }
+
+      sortKeys[cluster] = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+   }
+
+   std::vector< uint32_t > order(numClusters);
+   std::iota(order.begin(), order.end(), 0);
+   std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t left, uint32_t right) {
+      return sortKeys[left] > sortKeys[right];
+   });
+
+   std::vector< uint32_t > result;
+   result.reserve(numTriangles * 3);
+   for (const auto cluster : order)
+   {
+      result.insert(result.end(), indices.begin() + size_t{clusterStarts[cluster]} * 3,
+                    indices.begin() + size_t{clusterStarts[cluster + 1]} * 3);
+   }
+   std::copy(result.begin(), result.end(), indices.begin());
+}
+
+void
+OptimizeVertexFetch(std::vector< Vertex >& vertices, std::span< uint32_t > indices)
+{
+   std::vector< uint32_t > remap(vertices.size(), INVALID_INDEX);
+   std::vector< Vertex > reordered;
+   reordered.reserve(vertices.size());
+
+   for (auto& index : indices)
+   {
+      if (remap[index] == INVALID_INDEX)
+      {
+         remap[index] = static_cast< uint32_t >(reordered.size());
+         reordered.push_back(vertices[index]);
+      }
+      index = remap[index];
+   }
+
+   vertices = std::move(reordered);
+}
+
+MeshOptimizationStats
+OptimizeMesh(std::vector< Vertex >& vertices, std::vector< uint32_t >& indices)
+{
+   // Triangles referencing missing vertices can't be drawn, degenerate ones don't draw anything
+   size_t write = 0;
+   for (size_t triangle = 0; triangle + 2 < indices.size(); triangle += 3)
+   {
+      const auto a = indices[triangle];
+      const auto b = indices[triangle + 1];
+      const auto c = indices[triangle + 2];
+      if (a < vertices.size() && b < vertices.size() && c < vertices.size() && a != b
+          && b != c && a != c)
+      {
+         indices[write++] = a;
+         indices[write++] = b;
+         indices[write++] = c;
+      }
+   }
+   indices.resize(write);
+
+   MeshOptimizationStats stats;
+   stats.before = AnalyzeVertexCache(indices, vertices.size());
+
+   WeldVertices(vertices, indices);
+   OptimizeVertexCache(indices, vertices.size());
+   OptimizeOverdraw(indices, vertices);
+   OptimizeVertexFetch(vertices, indices);
+
+   stats.after = AnalyzeVertexCache(indices, vertices.size());
+   return stats;
+}
+
+} // namespace shady::render
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "vertex.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace shady::render {
+
+// Entries of the simulated post-transform (FIFO) vertex cache used for statistics
+static constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Post-transform vertex cache behaviour of an index buffer, sums of any number of meshes
+struct VertexCacheStats
+{
+   uint64_t misses = 0;
+   uint64_t triangles = 0;
+   // Unique vertices referenced by the indices
+   uint64_t vertices = 0;
+
+   // Average cache miss ratio, transformed vertices per triangle (0.5 best, 3 worst)
+   [[nodiscard]] float
+   GetAcmr() const;
+
+   // Average transformed to vertex ratio, transformed vertices per unique vertex (1 best)
+   [[nodiscard]] float
+   GetAtvr() const;
+
+   VertexCacheStats&
+   operator+=(const VertexCacheStats& other);
+};
+
+[[nodiscard]] VertexCacheStats
+AnalyzeVertexCache(std::span< const uint32_t > indices, size_t numVertices);
+
+// Merges bitwise identical vertices, 'indices' are remapped to the remaining ones
+void
+WeldVertices(std::vector< Vertex >& vertices, std::span< uint32_t > indices);
+
+// Reorders triangles of 'indices' for post-transform cache locality (Forsyth)
+void
+OptimizeVertexCache(std::span< uint32_t > indices, size_t numVertices);
+
+/*
+ * Splits vertex cache optimized 'indices' into clusters at points where the cache starts over
+ * and sorts them, so the outward facing ones (likely occluders of the rest) are drawn first
+ * (Sander et al.). Cache locality within the clusters is kept.
+ */
+void
+OptimizeOverdraw(std::span< uint32_t > indices, std::span< const Vertex > vertices);
+
+// Reorders 'vertices' in order of their first use by 'indices' and drops unused ones
+void
+OptimizeVertexFetch(std::vector< Vertex >& vertices, std::span< uint32_t > indices);
+
+// Vertex cache statistics of a mesh before and after OptimizeMesh
+struct MeshOptimizationStats
+{
+   VertexCacheStats before = {};
+   VertexCacheStats after = {};
+
+   MeshOptimizationStats&
+   operator+=(const MeshOptimizationStats& other);
+};
+
+// Runs all of the above on triangle list 'indices', in the order they are declared
+MeshOptimizationStats
+OptimizeMesh(std::vector< Vertex >& vertices, std::vector< uint32_t >& indices);
+
+} // namespace shady::render
@@ -0,0 +1,171 @@
+#include "meshlet.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace shady::render {
+
+namespace {
+
+// Normal cones narrower than this (cosine of the widest normal) are treated as degenerate
+constexpr float MIN_CONE_DOT = 0.1f;
+
+// Bounding sphere and normal cone of triangles in [firstIndex, firstIndex + indexCount)
+Meshlet
+meshletBounds(std::span< const Vertex > vertices, std::span< const uint32_t > indices,
+              uint32_t firstIndex, uint32_t indexCount)
+{
+   Meshlet meshlet;
+   meshlet.firstIndex = firstIndex;
+   meshlet.indexCount = indexCount;
+
+   const auto triangles = indices.subspan(firstIndex, indexCount);
+
+   glm::vec3 boundsMin{std::numeric_limits< float >::max()};
+   glm::vec3 boundsMax{std::numeric_limits< float >::lowest()};
+   for (const auto index : triangles)
+   {
+      boundsMin = glm::min(boundsMin, vertices[index].m_position);
+      boundsMax = glm::max(boundsMax, vertices[index].m_position);
+   }
+
+   const auto center = (boundsMin + boundsMax) * 0.5f;
+   float radius = 0.0f;
+   for (const auto index : triangles)
+   {
+      radius = std::max(radius, glm::length(vertices[index].m_position - center));
+   }
+   meshlet.sphere = glm::vec4{center, radius};
+
+   // Face normals (counter-clockwise front faces, as in glTF)
+   std::vector< glm::vec3 > normals;
+   normals.reserve(indexCount / 3);
+   for (uint32_t triangle = 0; triangle + 2 < indexCount; triangle += 3)
+   {
+      const auto& a = vertices[triangles[triangle]].m_position;
+      const auto& b = vertices[triangles[triangle + 1]].m_position;
+      const auto& c = vertices[triangles[triangle + 2]].m_position;
+
+      const auto normal = glm::cross(b - a, c - a);
+      const auto length = glm::length(normal);
+      if (length > 0.0f)
+      {
+         normals.push_back(normal / length);
+      }
+   }
+
+   glm::vec3 axis{0.0f};
+   for (const auto& normal : normals)
+   {
+      axis += normal;
+   }
+
+   // Cutoff of 1 never passes the backface test
+   meshlet.cone = glm::vec4{0.0f, 0.0f, 1.0f, 1.0f};
+   if (normals.empty() || glm::length(axis) == 0.0f)
+   {
+      return meshlet;
+   }
+
+   axis = glm::normalize(axis);
+   float minDot = 1.0f;
+   for (const auto& normal : normals)
+   {
+      minDot = std::min(minDot, glm::dot(normal, axis));
+   }
+
+   if (minDot > MIN_CONE_DOT)
+   {
+      meshlet.cone = glm::vec4{axis, std::sqrt(1.0f - minDot * minDot)};
+   }
+
+   return meshlet;
+}
+
+} // namespace
+
+std::vector< Meshlet >
+BuildMeshlets(std::span< const Vertex > vertices, std::span< const uint32_t > indices)
+{
+   std::vector< Meshlet > meshlets;
+
+   // Meshlet that last used each vertex, so the vertex count doesn't need a per meshlet set
+   std::vector< uint32_t > lastMeshlet(vertices.size(), std::numeric_limits< uint32_t >::max());
+
+   const auto numIndices = static_cast< uint32_t >(indices.size() / 3 * 3);
+   uint32_t firstIndex = 0;
+   uint32_t numVertices = 0;
+   uint32_t numTriangles = 0;
+
+   const auto countNew = [&lastMeshlet, &meshlets](uint32_t a, uint32_t b, uint32_t c) {
+      const auto current = static_cast< uint32_t >(meshlets.size());
+      uint32_t count = lastMeshlet[a] != current ? 1 : 0;
+      count += (lastMeshlet[b] != current && b != a) ? 1 : 0;
+      count += (lastMeshlet[c] != current && c != a && c != b) ? 1 : 0;
+      return count;
+   };
+
+   for (uint32_t index = 0; index < numIndices; index += 3)
+   {
+      const auto a = indices[index];
+      const auto b = indices[index + 1];
+      const auto c = indices[index + 2];
+
+      if (numVertices + countNew(a, b, c) > MESHLET_MAX_VERTICES
+          || numTriangles == MESHLET_MAX_TRIANGLES)
+      {
+         meshlets.push_back(meshletBounds(vertices, indices, firstIndex, index - firstIndex));
+         firstIndex = index;
+         numVertices = 0;
+         numTriangles = 0;
+      }
+
+      numVertices += countNew(a, b, c);
+      ++numTriangles;
+
+      const auto current = static_cast< uint32_t >(meshlets.size());
+      lastMeshlet[a] = current;
+      lastMeshlet[b] = current;
+      lastMeshlet[c] = current;
+   }
+
+   if (numTriangles > 0)
+   {
+      meshlets.push_back(meshletBounds(vertices, indices, firstIndex, numIndices - firstIndex));
+   }
+
+   return meshlets;
+}
+
+Meshlet
+TransformMeshlet(const Meshlet& meshlet, const glm::mat4& modelMat)
+{
+   Meshlet transformed = meshlet;
+
+   const glm::mat3 linear{modelMat};
+   const auto scaleX = glm::length(linear[0]);
+   const auto scaleY = glm::length(linear[1]);
+   const auto scaleZ = glm::length(linear[2]);
+   const auto maxScale = std::max({scaleX, scaleY, scaleZ});
+
+   transformed.sphere = glm::vec4{glm::vec3(modelMat * glm::vec4(glm::vec3(meshlet.sphere), 1.0f)),
+                                  meshlet.sphere.w * maxScale};
+
+   constexpr float epsilon = 1e-3f;
+   const auto minScale = std::min({scaleX, scaleY, scaleZ});
+   if (meshlet.cone.w >= 1.0f || maxScale - minScale > epsilon * maxScale)
+   {
+      transformed.cone = glm::vec4{0.0f, 0.0f, 1.0f, 1.0f};
+      return transformed;
+   }
+
+   // Mirroring transforms flip the winding, and with it the face normals
+   const auto sign = glm::determinant(linear) < 0.0f ? -1.0f : 1.0f;
+   const auto axis = glm::normalize(linear * glm::vec3(meshlet.cone)) * sign;
+   transformed.cone = glm::vec4{axis, meshlet.cone.w};
+
+   return transformed;
+}
+
+} // namespace shady::render
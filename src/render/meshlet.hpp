@@ -0,0 +1,48 @@
+#pragma once
+
+#include "vertex.hpp"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+namespace shady::render {
+
+// Limits of a single meshlet, small enough to keep its vertices in on-chip caches
+static constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+static constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+/*
+ * Cluster of at most MESHLET_MAX_TRIANGLES triangles referencing at most MESHLET_MAX_VERTICES
+ * unique vertices. Every meshlet is a consecutive range of its mesh's indices, so it's drawn
+ * straight from the shared index buffer.
+ * Must match 'Meshlet' in cluster_cull.comp (std430).
+ */
+struct Meshlet
+{
+   // Bounding sphere, xyz center and w radius
+   glm::vec4 sphere = {};
+   // Normal cone, xyz axis (average normal) and w sine of the cone's half angle. The whole
+   // meshlet faces away from the camera when
+   // dot(center - camera, axis) >= cutoff * length(center - camera) + radius
+   glm::vec4 cone = {};
+   // Relative to the first index of the mesh
+   uint32_t firstIndex = 0;
+   uint32_t indexCount = 0;
+   // Mesh (draw command) the meshlet belongs to, assigned by Renderer::MeshLoaded
+   uint32_t meshIndex = 0;
+   uint32_t padding = 0;
+};
+
+// Splits triangle list 'indices' into meshlets, in the order of the index buffer. Bounds are in
+// the space of 'vertices'.
+[[nodiscard]] std::vector< Meshlet >
+BuildMeshlets(std::span< const Vertex > vertices, std::span< const uint32_t > indices);
+
+// 'meshlet' with bounds transformed by 'modelMat'. Normal cone is disabled when the transform
+// doesn't preserve angles (non-uniform scale).
+[[nodiscard]] Meshlet
+TransformMeshlet(const Meshlet& meshlet, const glm::mat4& modelMat);
+
+} // namespace shady::render
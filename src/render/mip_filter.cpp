@@ -0,0 +1,252 @@
+#include "mip_filter.hpp"
+#include "utils/assert.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+
+namespace shady::render {
+
+namespace {
+
+// Shape of the Kaiser window, higher values trade sharpness for less ringing
+constexpr float KAISER_ALPHA = 4.0f;
+// Half width of the Kaiser window, in destination texels
+constexpr float KAISER_RADIUS = 1.5f;
+
+// Source texels weighted into a single destination texel, the same for both axes
+struct Kernel
+{
+   // Offset of the first source texel from (destination texel * 2)
+   int32_t first = 0;
+   std::vector< float > weights;
+};
+
+struct SrgbTables
+{
+   // 8 bit sRGB to linear [0, 1]
+   std::array< float, 256 > toLinear = {};
+   // Linear values halfway (in sRGB space) between two consecutive 8 bit values
+   std::array< float, 255 > thresholds = {};
+   // 8 bit linear to [0, 1]
+   std::array< float, 256 > unorm = {};
+};
+
+float
+srgbToLinear(float value)
+{
+   return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// Modified Bessel function of the first kind (order 0), power series
+float
+besselI0(float x)
+{
+   auto sum = 1.0f;
+   auto term = 1.0f;
+   for (int32_t k = 1; k < 16; ++k)
+   {
+      const auto factor = x / (2.0f * static_cast< float >(k));
+      term *= factor * factor;
+      sum += term;
+   }
+
+   return sum;
+}
+
+float
+sinc(float x)
+{
+   if (x == 0.0f)
+   {
+      return 1.0f;
+   }
+
+   const auto angle = std::numbers::pi_v< float > * x;
+   return std::sin(angle) / angle;
+}
+
+Kernel
+makeKaiserKernel()
+{
+   // 6 source texels, 3 on each side of the destination texel's center
+   Kernel kernel = {-2, {}};
+   auto sum = 0.0f;
+   for (int32_t tap = 0; tap < 6; ++tap)
+   {
+      // Distance between source and destination texel centers, in destination texels
+      const auto distance = (static_cast< float >(kernel.first + tap) - 0.5f) / 2.0f;
+      const auto ratio = distance / KAISER_RADIUS;
+      const auto window =
+         besselI0(KAISER_ALPHA * std::sqrt(1.0f - ratio * ratio)) / besselI0(KAISER_ALPHA);
+
+      kernel.weights.push_back(sinc(distance) * window);
+      sum += kernel.weights.back();
+   }
+
+   for (auto& weight : kernel.weights)
+   {
+      weight /= sum;
+   }
+
+   return kernel;
+}
+
+const Kernel&
+getKernel(MipFilter filter)
+{
+   static const Kernel box = {0, {0.5f, 0.5f}};
+   static const Kernel kaiser = makeKaiserKernel();
+
+   return filter == MipFilter::KAISER ? kaiser : box;
+}
+
+const SrgbTables&
+getSrgbTables()
+{
+   static const SrgbTables tables = [] {
+      SrgbTables result;
+      for (uint32_t value = 0; value < 256; ++value)
+      {
+         result.toLinear[value] = srgbToLinear(static_cast< float >(value) / 255.0f);
+         result.unorm[value] = static_cast< float >(value) / 255.0f;
+      }
+      for (uint32_t value = 0; value < 255; ++value)
+      {
+         result.thresholds[value] = srgbToLinear((static_cast< float >(value) + 0.5f) / 255.0f);
+      }
+
+      return result;
+   }();
+
+   return tables;
+}
+
+uint8_t
+toUnorm(float value)
+{
+   return static_cast< uint8_t >(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+// Nearest 8 bit sRGB value of linear 'value'
+uint8_t
+toSrgb(float value, const SrgbTables& tables)
+{
+   return static_cast< uint8_t >(
+      std::upper_bound(tables.thresholds.begin(), tables.thresholds.end(), value)
+      - tables.thresholds.begin());
+}
+
+void
+storeTexel(std::array< float, 4 > color, ColorSpace colorSpace, const SrgbTables& tables,
+           uint8_t* texel)
+{
+   if (colorSpace == ColorSpace::NORMAL)
+   {
+      std::array< float, 3 > normal = {};
+      auto lengthSquared = 0.0f;
+      for (size_t channel = 0; channel < 3; ++channel)
+      {
+         normal[channel] = color[channel] * 2.0f - 1.0f;
+         lengthSquared += normal[channel] * normal[channel];
+      }
+
+      // Averaged normals get shorter, degenerate ones (opposing directions) are kept as they are
+      if (lengthSquared > 0.0f)
+      {
+         const auto scale = 1.0f / std::sqrt(lengthSquared);
+         for (size_t channel = 0; channel < 3; ++channel)
+         {
+            color[channel] = normal[channel] * scale * 0.5f + 0.5f;
+         }
+      }
+   }
+
+   for (size_t channel = 0; channel < 3; ++channel)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      texel[channel] = colorSpace == ColorSpace::SRGB ? toSrgb(color[channel], tables)
+                                                      : toUnorm(color[channel]);
+   }
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   texel[3] = toUnorm(color[3]);
+}
+
+} // namespace
+
+std::vector< uint8_t >
+DownsampleImage(std::span< const uint8_t > pixels, uint32_t width, uint32_t height,
+                ColorSpace colorSpace, MipFilter filter, utils::ThreadPool* threadPool)
+{
+   utils::Assert(pixels.size() == size_t{width} * height * 4,
+                 "DownsampleImage: image size doesn't match its dimensions!");
+
+   const auto dstWidth = std::max(width / 2, 1U);
+   const auto dstHeight = std::max(height / 2, 1U);
+
+   const auto& kernel = getKernel(filter);
+   const auto& tables = getSrgbTables();
+   // Alpha is never sRGB encoded
+   const auto& colorTable = colorSpace == ColorSpace::SRGB ? tables.toLinear : tables.unorm;
+   const auto& alphaTable = tables.unorm;
+
+   const auto clampTexel = [](int64_t texel, uint32_t size) {
+      return static_cast< size_t >(std::clamp< int64_t >(texel, 0, int64_t{size} - 1));
+   };
+
+   std::vector< uint8_t > result(size_t{dstWidth} * dstHeight * 4);
+
+   // Separable filter, source rows are first filtered vertically into a single (linear) row
+   const auto filterRow = [&](size_t dstY) {
+      std::vector< float > row(size_t{width} * 4, 0.0f);
+      for (size_t tap = 0; tap < kernel.weights.size(); ++tap)
+      {
+         const auto srcY =
+            clampTexel(static_cast< int64_t >(dstY * 2 + tap) + kernel.first, height);
+         const auto source = pixels.subspan(srcY * row.size(), row.size());
+         const auto weight = kernel.weights[tap];
+
+         for (size_t index = 0; index < row.size(); index += 4)
+         {
+            row[index] += weight * colorTable[source[index]];
+            row[index + 1] += weight * colorTable[source[index + 1]];
+            row[index + 2] += weight * colorTable[source[index + 2]];
+            row[index + 3] += weight * alphaTable[source[index + 3]];
+         }
+      }
+
+      for (size_t dstX = 0; dstX < dstWidth; ++dstX)
+      {
+         std::array< float, 4 > color = {};
+         for (size_t tap = 0; tap < kernel.weights.size(); ++tap)
+         {
+            const auto srcX =
+               clampTexel(static_cast< int64_t >(dstX * 2 + tap) + kernel.first, width);
+            for (size_t channel = 0; channel < 4; ++channel)
+            {
+               color[channel] += kernel.weights[tap] * row[srcX * 4 + channel];
+            }
+         }
+
+         storeTexel(color, colorSpace, tables, &result[(dstY * dstWidth + dstX) * 4]);
+      }
+   };
+
+   if (threadPool)
+   {
+      threadPool->ParallelFor(dstHeight, filterRow);
+   }
+   else
+   {
+      for (size_t dstY = 0; dstY < dstHeight; ++dstY)
+      {
+         filterRow(dstY);
+      }
+   }
+
+   return result;
+}
+
+} // namespace shady::render
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace shady::utils {
+class ThreadPool;
+} // namespace shady::utils
+
+namespace shady::render {
+
+// How the channels of RGBA8 image are interpreted while filtering
+enum class ColorSpace : uint8_t
+{
+   // RGB is sRGB encoded and filtered in linear space, alpha is linear
+   SRGB = 0,
+   LINEAR = 1,
+   // RGB is a unit vector mapped to [0, 1] (normal map), renormalized after filtering
+   NORMAL = 2
+};
+
+enum class MipFilter : uint8_t
+{
+   // Average of 2x2 texels
+   BOX = 0,
+   // Kaiser windowed sinc over 6x6 texels, keeps more detail than BOX with less aliasing
+   KAISER = 1
+};
+
+/*
+ * Next mip level (half the size, rounded down) of RGBA8 'pixels', rows tightly packed.
+ * Texels outside of the image are clamped to the edge. Rows are filtered in parallel when
+ * 'threadPool' is given.
+ */
+[[nodiscard]] std::vector< uint8_t >
+DownsampleImage(std::span< const uint8_t > pixels, uint32_t width, uint32_t height,
+                ColorSpace colorSpace, MipFilter filter, utils::ThreadPool* threadPool = nullptr);
+
+} // namespace shady::render
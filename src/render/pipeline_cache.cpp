@@ -0,0 +1,247 @@
+#include "pipeline_cache.hpp"
+#include "common.hpp"
+#include "trace/logger.hpp"
+#include "utils/atomic_file.hpp"
+#include "utils/file_manager.hpp"
+#include "utils/hash.hpp"
+#include "utils/mapped_file.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+namespace shady::render {
+
+namespace {
+
+// "SHPC" in little endian
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43504853;
+constexpr uint32_t PIPELINE_CACHE_FORMAT_VERSION = 1;
+
+// Precedes the data returned by vkGetPipelineCacheData in the cache file
+struct PipelineCacheFileHeader
+{
+   uint32_t magic = PIPELINE_CACHE_MAGIC;
+   uint32_t formatVersion = PIPELINE_CACHE_FORMAT_VERSION;
+   uint64_t shaderHash = 0;
+   uint64_t dataSize = 0;
+   uint64_t dataHash = 0;
+};
+
+static_assert(sizeof(PipelineCacheFileHeader) == 32);
+
+// Whether 'data' (as returned by vkGetPipelineCacheData) was produced by the current device
+bool
+isCompatibleCacheData(const uint8_t* data, size_t size)
+{
+   VkPipelineCacheHeaderVersionOne header = {};
+   if (size < sizeof(header))
+   {
+      return false;
+   }
+   std::memcpy(&header, data, sizeof(header));
+
+   VkPhysicalDeviceProperties properties = {};
+   vkGetPhysicalDeviceProperties(Data::vk_physicalDevice, &properties);
+
+   return header.headerSize >= sizeof(header) && header.headerSize <= size
+          && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+          && header.vendorID == properties.vendorID && header.deviceID == properties.deviceID
+          && std::equal(std::begin(header.pipelineCacheUUID), std::end(header.pipelineCacheUUID),
+                        std::begin(properties.pipelineCacheUUID));
+}
+
+double
+millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+   return std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+void
+PipelineCache::Init()
+{
+   m_shaderHash = HashShaders();
+   {
+      const std::lock_guard lock(m_statsMutex);
+      m_creationTime = 0.0;
+      m_numPipelines = 0;
+   }
+
+   VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+   pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+   const auto cachePath = GetCachePath();
+   const auto file = utils::MappedFile::Open(cachePath);
+   if (file)
+   {
+      const auto* data = file->GetData();
+
+      PipelineCacheFileHeader header = {};
+      const auto hasHeader = file->GetSize() >= sizeof(header);
+      if (hasHeader)
+      {
+         std::memcpy(&header, data, sizeof(header));
+      }
+
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto* cacheData = data + sizeof(header);
+      if (!hasHeader || header.magic != PIPELINE_CACHE_MAGIC
+          || header.formatVersion != PIPELINE_CACHE_FORMAT_VERSION
+          || header.dataSize != file->GetSize() - sizeof(header)
+          || header.dataHash != utils::HashBytes(cacheData, header.dataSize, 0))
+      {
+         trace::Logger::Warn("PipelineCache: {} is corrupted, ignoring it", cachePath.string());
+      }
+      else if (header.shaderHash != m_shaderHash)
+      {
+         trace::Logger::Info("PipelineCache: shaders have changed, starting with empty cache");
+      }
+      else if (!isCompatibleCacheData(cacheData, header.dataSize))
+      {
+         trace::Logger::Info("PipelineCache: saved cache is from different device or driver, "
+                             "starting with empty cache");
+      }
+      else
+      {
+         pipelineCacheCreateInfo.initialDataSize = header.dataSize;
+         pipelineCacheCreateInfo.pInitialData = cacheData;
+         trace::Logger::Info("PipelineCache: loaded {} bytes from {}", header.dataSize,
+                             cachePath.string());
+      }
+   }
+
+   VK_CHECK(vkCreatePipelineCache(Data::vk_device, &pipelineCacheCreateInfo, nullptr,
+                                  &Data::m_pipelineCache),
+            "PipelineCache: failed to create pipeline cache!");
+}
+
+void
+PipelineCache::Save()
+{
+   if (Data::m_pipelineCache == VK_NULL_HANDLE)
+   {
+      return;
+   }
+
+   {
+      const std::lock_guard lock(m_statsMutex);
+      trace::Logger::Info("PipelineCache: {} pipelines were created in {:.2f}ms", m_numPipelines,
+                          m_creationTime);
+   }
+
+   size_t dataSize = 0;
+   VK_CHECK(vkGetPipelineCacheData(Data::vk_device, Data::m_pipelineCache, &dataSize, nullptr),
+            "PipelineCache: failed to query cache size!");
+
+   std::vector< uint8_t > data(dataSize);
+   VK_CHECK(
+      vkGetPipelineCacheData(Data::vk_device, Data::m_pipelineCache, &dataSize, data.data()),
+      "PipelineCache: failed to retrieve cache data!");
+   data.resize(dataSize);
+
+   PipelineCacheFileHeader header = {};
+   header.shaderHash = m_shaderHash;
+   header.dataSize = data.size();
+   header.dataHash = utils::HashBytes(data.data(), data.size(), 0);
+
+   const auto cachePath = GetCachePath();
+   const auto written = utils::WriteFileAtomic(cachePath, [&header, &data](std::ostream& stream) {
+      stream.write(reinterpret_cast< const char* >(&header), sizeof(header));
+      stream.write(reinterpret_cast< const char* >(data.data()),
+                   static_cast< std::streamsize >(data.size()));
+      return true;
+   });
+   if (!written)
+   {
+      return;
+   }
+
+   trace::Logger::Info("PipelineCache: saved {} bytes to {}", data.size(), cachePath.string());
+}
+
+VkResult
+PipelineCache::CreateGraphicsPipeline(std::string_view name, VkPipelineCache pipelineCache,
+                                      const VkGraphicsPipelineCreateInfo& createInfo,
+                                      VkPipeline* pipeline)
+{
+   const auto start = std::chrono::steady_clock::now();
+   const auto result =
+      vkCreateGraphicsPipelines(Data::vk_device, pipelineCache, 1, &createInfo, nullptr, pipeline);
+   PipelineCreated(name, millisecondsSince(start), result);
+
+   return result;
+}
+
+VkResult
+PipelineCache::CreateComputePipeline(std::string_view name, VkPipelineCache pipelineCache,
+                                     const VkComputePipelineCreateInfo& createInfo,
+                                     VkPipeline* pipeline)
+{
+   const auto start = std::chrono::steady_clock::now();
+   const auto result =
+      vkCreateComputePipelines(Data::vk_device, pipelineCache, 1, &createInfo, nullptr, pipeline);
+   PipelineCreated(name, millisecondsSince(start), result);
+
+   return result;
+}
+
+std::filesystem::path
+PipelineCache::GetCachePath()
+{
+   return utils::FileManager::CACHE_DIR / "pipeline.cache";
+}
+
+uint64_t
+PipelineCache::HashShaders()
+{
+   // Directory iteration order is unspecified, so hash the shaders in sorted order
+   std::vector< std::filesystem::path > shaders;
+   std::error_code error;
+   const std::filesystem::recursive_directory_iterator directory(utils::FileManager::SHADERS_DIR,
+                                                                 error);
+   for (const auto& entry : directory)
+   {
+      if (entry.is_regular_file() && entry.path().extension() == ".spv")
+      {
+         shaders.push_back(entry.path());
+      }
+   }
+
+   std::sort(shaders.begin(), shaders.end());
+
+   uint64_t hash = PIPELINE_CACHE_FORMAT_VERSION;
+   for (const auto& shader : shaders)
+   {
+      const auto name = shader.filename().string();
+      hash = utils::HashBytes(reinterpret_cast< const uint8_t* >(name.data()), name.size(), hash);
+      hash = utils::HashFile(shader, hash);
+   }
+
+   return hash;
+}
+
+void
+PipelineCache::PipelineCreated(std::string_view name, double milliseconds, VkResult result)
+{
+   if (result != VK_SUCCESS)
+   {
+      trace::Logger::Warn("PipelineCache: pipeline '{}' creation failed! Return value {}", name,
+                          string_VkResult(result));
+      return;
+   }
+
+   {
+      const std::lock_guard lock(m_statsMutex);
+      m_creationTime += milliseconds;
+      ++m_numPipelines;
+   }
+
+   trace::Logger::Info("PipelineCache: pipeline '{}' created in {:.2f}ms", name, milliseconds);
+}
+
+} // namespace shady::render
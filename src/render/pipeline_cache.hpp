@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+/*
+ * Owner of Data::m_pipelineCache. Its contents are saved to FileManager::CACHE_DIR on shutdown
+ * and used to seed the cache on the next run, so the driver can skip compiling pipelines it has
+ * already seen. Saved data is dropped when it was produced by a different device/driver (see
+ * VkPipelineCacheHeaderVersionOne) or when any compiled shader (*.spv) has changed since.
+ */
+class PipelineCache
+{
+ public:
+   // Creates Data::m_pipelineCache, has to be called before any pipeline gets created
+   static void
+   Init();
+
+   // Writes the cache contents to disk, GPU has to be idle
+   static void
+   Save();
+
+   // vkCreateGraphicsPipelines/vkCreateComputePipelines for a single pipeline, which also log
+   // how long the creation took, or the failure. 'name' is only used for the log.
+   [[nodiscard]] static VkResult
+   CreateGraphicsPipeline(std::string_view name, VkPipelineCache pipelineCache,
+                          const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline* pipeline);
+
+   [[nodiscard]] static VkResult
+   CreateComputePipeline(std::string_view name, VkPipelineCache pipelineCache,
+                         const VkComputePipelineCreateInfo& createInfo, VkPipeline* pipeline);
+
+ private:
+   [[nodiscard]] static std::filesystem::path
+   GetCachePath();
+
+   // Hash of every compiled shader in FileManager::SHADERS_DIR
+   [[nodiscard]] static uint64_t
+   HashShaders();
+
+   // Accumulates creation statistics, logged on Save. Called from the shader reload thread too.
+   static void
+   PipelineCreated(std::string_view name, double milliseconds, VkResult result);
+
+ private:
+   inline static uint64_t m_shaderHash = 0;
+   // Guards the creation statistics
+   inline static std::mutex m_statsMutex = {};
+   // Sum of all pipeline creation times since Init, in milliseconds
+   inline static double m_creationTime = 0.0;
+   inline static uint32_t m_numPipelines = 0;
+};
+
+} // namespace shady::render
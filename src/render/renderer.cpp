@@ -5,47 +5,149 @@
 #include "command.hpp"
 #include "common.hpp"
 #include "deferred_pipeline.hpp"
+#include "frame_stats.hpp"
+#include "memory_allocator.hpp"
+#include "pipeline_cache.hpp"
+#include "sampler_cache.hpp"
 #include "shader.hpp"
+#include "shader_reloader.hpp"
+#include "staging_ring.hpp"
 #include "texture.hpp"
+#include "texture_cache.hpp"
+#include "texture_streamer.hpp"
+#include "texture_table.hpp"
 #include "trace/logger.hpp"
 #include "utils/assert.hpp"
 #include "utils/file_manager.hpp"
 
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <limits>
 #include <optional>
 #include <set>
+#include <type_traits>
+#include <utility>
 
 #undef max
 #undef min
 
 namespace shady::render {
 
-static size_t currentFrame = 0;
-constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+namespace {
+
+// Model space AABB (minimum and maximum) of the mesh, empty meshes get a point at the origin
+std::pair< glm::vec3, glm::vec3 >
+meshLocalBounds(std::span< const Vertex > vertices)
+{
+   if (vertices.empty())
+   {
+      return {glm::vec3{0.0f}, glm::vec3{0.0f}};
+   }
+
+   auto localMin = vertices.front().m_position;
+   auto localMax = localMin;
+   for (const auto& vertex : vertices)
+   {
+      localMin = glm::min(localMin, vertex.m_position);
+      localMax = glm::max(localMax, vertex.m_position);
+   }
+
+   return {localMin, localMax};
+}
+
+// Sphere around the world space AABB of the mesh
+glm::vec4
+meshBoundingSphere(const glm::vec3& localMin, const glm::vec3& localMax, const glm::mat4& modelMat)
+{
+   glm::vec3 worldMin{std::numeric_limits< float >::max()};
+   glm::vec3 worldMax{std::numeric_limits< float >::lowest()};
+   for (uint32_t corner = 0; corner < 8; ++corner)
+   {
+      const glm::vec3 local{(corner & 1U) ? localMax.x : localMin.x,
+                            (corner & 2U) ? localMax.y : localMin.y,
+                            (corner & 4U) ? localMax.z : localMin.z};
+      const auto world = glm::vec3(modelMat * glm::vec4(local, 1.0f));
+      worldMin = glm::min(worldMin, world);
+      worldMax = glm::max(worldMax, world);
+   }
+
+   return glm::vec4{(worldMin + worldMax) * 0.5f, glm::length(worldMax - worldMin) * 0.5f};
+}
+
+} // namespace
 
 void
-Renderer::MeshLoaded(const std::vector< Vertex >& vertices, const std::vector< uint32_t >& indicies,
-                     const TextureMaps& textures, const glm::mat4& modelMat)
+Renderer::MeshLoaded(std::span< const Vertex > vertices, std::span< const uint32_t > indicies,
+                     const TextureMaps& textures, const glm::mat4& modelMat, bool dynamic,
+                     std::span< const Meshlet > meshlets, std::span< const uint32_t > lodIndices,
+                     std::span< const MeshLod > lods)
 {
-   std::copy(vertices.begin(), vertices.end(), std::back_inserter(Data::vertices));
-   std::copy(indicies.begin(), indicies.end(), std::back_inserter(Data::indices));
+   Data::vertices.push_back(vertices);
+   Data::indices.push_back(indicies);
+   // Simplified levels directly follow the full detail one
+   if (!lodIndices.empty())
+   {
+      Data::indices.push_back(lodIndices);
+   }
 
    VkDrawIndexedIndirectCommand newModel = {};
    newModel.firstIndex = Data::m_currentIndex;
    newModel.indexCount = static_cast< uint32_t >(indicies.size());
-   newModel.firstInstance = 0;
+   // Shaders index per instance data with gl_InstanceIndex, which has to survive splitting the
+   // draw into meshlets
+   newModel.firstInstance = Data::m_numMeshes;
    newModel.instanceCount = 1;
    newModel.vertexOffset = static_cast< int32_t >(Data::m_currentVertex);
    Data::m_renderCommands.push_back(newModel);
 
+   // Level 0 is the mesh itself, the rest is selected per frame by GpuCulling
+   std::array< MeshLod, MAX_MESH_LODS > meshLods = {};
+   meshLods[0].firstIndex = newModel.firstIndex;
+   meshLods[0].indexCount = newModel.indexCount;
+   const auto lodsFirstIndex = newModel.firstIndex + newModel.indexCount;
+   const auto numLods = std::min(lods.size(), size_t{MAX_MESH_LODS - 1});
+   // Errors scale with the mesh
+   const auto maxScale = std::max({glm::length(glm::vec3(modelMat[0])),
+                                   glm::length(glm::vec3(modelMat[1])),
+                                   glm::length(glm::vec3(modelMat[2]))});
+   for (size_t level = 0; level < numLods; ++level)
+   {
+      meshLods.at(level + 1).firstIndex = lodsFirstIndex + lods[level].firstIndex;
+      meshLods.at(level + 1).indexCount = lods[level].indexCount;
+      meshLods.at(level + 1).error = lods[level].error * maxScale;
+   }
+   Data::m_meshLods.insert(Data::m_meshLods.end(), meshLods.begin(), meshLods.end());
+
    Data::m_currentVertex += static_cast< uint32_t >(vertices.size());
-   Data::m_currentIndex += static_cast< uint32_t >(indicies.size());
+   Data::m_maxMeshVertices =
+      std::max(Data::m_maxMeshVertices, static_cast< uint32_t >(vertices.size()));
+   Data::m_currentIndex += static_cast< uint32_t >(indicies.size() + lodIndices.size());
+
+   const auto [localMin, localMax] = meshLocalBounds(vertices);
+   Data::m_meshBounds.push_back(meshBoundingSphere(localMin, localMax, modelMat));
+
+   uint32_t flags = dynamic ? MESH_FLAG_DYNAMIC : 0;
+   if (!dynamic && !meshlets.empty())
+   {
+      flags |= MESH_FLAG_MESHLETS;
+      for (const auto& meshlet : meshlets)
+      {
+         auto& transformed = Data::m_meshlets.emplace_back(TransformMeshlet(meshlet, modelMat));
+         transformed.meshIndex = Data::m_numMeshes;
+      }
+   }
+   Data::m_meshFlags.push_back(flags);
 
    PerInstanceBuffer newInstance;
    newInstance.model = modelMat;
+   newInstance.positionOffset = glm::vec4{localMin, 0.0f};
+   newInstance.positionScale = glm::vec4{localMax - localMin, 0.0f};
+   // Missing maps are left negative, so shaders can skip them
+   newInstance.textures = glm::vec4{-1.0f};
 
    for (const auto& texture : textures)
    {
@@ -54,19 +156,18 @@ Renderer::MeshLoaded(const std::vector< Vertex >& vertices, const std::vector< u
          continue;
       }
 
-      const auto it = std::find_if(Data::textures.begin(), Data::textures.end(),
-                                   [texture](const auto& tex) { return texture == tex.first; });
+      const auto& tex = TextureLibrary::GetTexture(texture);
+
+      // Textures shared between meshes get a single slot of the table
+      auto it = Data::textures.find(texture);
       if (it == Data::textures.end())
       {
-         Data::textures[texture] = {
-            Data::currTexIdx++, TextureLibrary::GetTexture(texture).GetImageViewAndSampler().first};
-
-         Data::texturesVec.push_back(
-            TextureLibrary::GetTexture(texture).GetImageViewAndSampler().first);
+         it = Data::textures
+                 .emplace(texture, TextureTable::Allocate(tex.GetImageViewAndSampler().first))
+                 .first;
       }
 
-      const auto idx = Data::textures[texture].first;
-      const auto& tex = TextureLibrary::GetTexture(texture);
+      const auto idx = it->second;
       switch (tex.GetType())
       {
          case TextureType::DIFFUSE_MAP: {
@@ -98,37 +199,48 @@ Renderer::MeshLoaded(const std::vector< Vertex >& vertices, const std::vector< u
 void
 Renderer::SetupData()
 {
+   const auto start = std::chrono::steady_clock::now();
+   const auto uploadStats = StagingRing::GetStats();
+
    CreateVertexBuffer();
    CreateIndexBuffer();
    CreateUniformBuffers();
 
    const auto commandsSize = Data::m_renderCommands.size() * sizeof(VkDrawIndexedIndirectCommand);
-   // VkBuffer stagingBuffer;
-   // VkDeviceMemory stagingBufferMemory;
 
-   ////  Commands + draw count
+   //  Commands + draw count
    const VkDeviceSize bufferSize = commandsSize + sizeof(uint32_t);
 
-   Buffer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
-                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                        Data::m_indirectDrawsBuffer, Data::m_indirectDrawsBufferMemory);
-
-   void* data = nullptr;
-   vkMapMemory(Data::vk_device, Data::m_indirectDrawsBufferMemory, 0, bufferSize, 0, &data);
-   memcpy(data, Data::m_renderCommands.data(), bufferSize);
-   memcpy(static_cast< uint8_t* >(data) + commandsSize, &Data::m_numMeshes, sizeof(uint32_t));
-
-
-   // vkUnmapMemory(Data::vk_device, stagingBufferMemory);
-
-   /*  Buffer::CreateBuffer(
-        bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indirectDrawsBuffer, m_indirectDrawsBufferMemory);
-
-     Buffer::CopyBuffer(stagingBuffer, m_indirectDrawsBuffer, bufferSize);
-
-     vkDestroyBuffer(Data::vk_device, stagingBuffer, nullptr);
-     vkFreeMemory(Data::vk_device, stagingBufferMemory, nullptr);*/
+   Buffer::CreateBuffer(
+      bufferSize,
+      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+         | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Data::m_indirectDrawsBuffer,
+      Data::m_indirectDrawsBufferMemory, AllocationStrategy::LINEAR);
+
+   StagingRing::Upload(Data::m_indirectDrawsBuffer, 0, Data::m_renderCommands.data(),
+                       commandsSize);
+   StagingRing::Upload(Data::m_indirectDrawsBuffer, commandsSize, &Data::m_numMeshes,
+                       sizeof(uint32_t));
+
+   // Vertex, index and indirect uploads share the staging batches, wait for all of them at once
+   StagingRing::Flush();
+
+   const auto& totalStats = StagingRing::GetStats();
+   const auto megabytes =
+      static_cast< double >(totalStats.bytes - uploadStats.bytes) / (1024.0 * 1024.0);
+   const auto milliseconds = totalStats.milliseconds - uploadStats.milliseconds;
+   trace::Logger::Info("Uploaded {:.2f} MB of geometry in {:.2f}ms ({:.1f} MB/s, {} submits)",
+                       megabytes, milliseconds,
+                       milliseconds > 0.0 ? megabytes / (milliseconds / 1000.0) : 0.0,
+                       totalStats.submits - uploadStats.submits);
+
+   // Only needed until uploaded, meshes don't have to keep their data alive after this
+   Data::vertices.clear();
+   Data::indices.clear();
+
+   m_geometryUploadTime =
+      std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - start).count();
 }
 
 struct QueueFamilyIndices
@@ -152,15 +264,20 @@ struct SwapChainSupportDetails
 
 
 /*
- *  Query GLFW for required extensions
+ *  Query GLFW for required extensions (none are needed in headless mode)
  */
 std::vector< const char* >
 getRequiredExtensions()
 {
-   uint32_t glfwExtensionCount = 0;
-   const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+   std::vector< const char* > extensions;
 
-   std::vector< const char* > extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+   if (!Data::m_headless)
+   {
+      uint32_t glfwExtensionCount = 0;
+      const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+      extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+   }
 
    if constexpr (ENABLE_VALIDATION)
    {
@@ -257,12 +374,20 @@ findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface)
       }
 
       VkBool32 presentSupport = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+      if (surface != VK_NULL_HANDLE)
+      {
+         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+      }
 
       if (presentSupport)
       {
          indices.presentFamily = i;
       }
+      else if (surface == VK_NULL_HANDLE)
+      {
+         // Without surface there's nothing to present to, graphics queue is used for both
+         indices.presentFamily = indices.graphicsFamily;
+      }
 
       if (indices.isComplete())
       {
@@ -277,6 +402,29 @@ findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface)
    return indices;
 }
 
+// Family that supports transfers but not graphics/compute, which usually maps to copy engine
+std::optional< uint32_t >
+findTransferQueueFamily(VkPhysicalDevice device)
+{
+   uint32_t queueFamilyCount = 0;
+   vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+   std::vector< VkQueueFamilyProperties > queueFamilies(queueFamilyCount);
+   vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+   for (uint32_t i = 0; i < queueFamilyCount; ++i)
+   {
+      const auto flags = queueFamilies[i].queueFlags;
+      if ((flags & VK_QUEUE_TRANSFER_BIT)
+          && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+      {
+         return i;
+      }
+   }
+
+   return std::nullopt;
+}
+
 SwapChainSupportDetails
 querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface)
 {
@@ -306,6 +454,18 @@ querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface)
    return details;
 }
 
+std::vector< const char* >
+getDeviceExtensions()
+{
+   // Swapchain is not needed when rendering offscreen
+   if (Data::m_headless)
+   {
+      return {};
+   }
+
+   return {DEVICE_EXTENSIONS.begin(), DEVICE_EXTENSIONS.end()};
+}
+
 bool
 checkDeviceExtensionSupport(VkPhysicalDevice device)
 {
@@ -316,7 +476,8 @@ checkDeviceExtensionSupport(VkPhysicalDevice device)
    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                         availableExtensions.data());
 
-   std::set< std::string > requiredExtensions(DEVICE_EXTENSIONS.begin(), DEVICE_EXTENSIONS.end());
+   const auto deviceExtensions = getDeviceExtensions();
+   std::set< std::string > requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
    for (const auto& extension : availableExtensions)
    {
@@ -333,8 +494,8 @@ isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface)
 
    const auto extensionsSupported = checkDeviceExtensionSupport(device);
 
-   auto swapChainAdequate = false;
-   if (extensionsSupported)
+   auto swapChainAdequate = Data::m_headless;
+   if (extensionsSupported && !Data::m_headless)
    {
       const auto swapChainSupport = querySwapChainSupport(device, surface);
       swapChainAdequate =
@@ -344,13 +505,46 @@ isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface)
    VkPhysicalDeviceFeatures supportedFeatures{};
    vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-   // Make sure we use discrete GPU
+   // Shadow cascades select their shadow map layer in the vertex shader, textures are bindless
+   VkPhysicalDeviceVulkan12Features supportedFeatures_12{};
+   supportedFeatures_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+   VkPhysicalDeviceFeatures2 supportedFeatures2{};
+   supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+   supportedFeatures2.pNext = &supportedFeatures_12;
+   vkGetPhysicalDeviceFeatures2(device, &supportedFeatures2);
+
+   return indices.isComplete() && extensionsSupported && swapChainAdequate
+          && supportedFeatures.samplerAnisotropy && supportedFeatures.multiDrawIndirect
+          && supportedFeatures.drawIndirectFirstInstance
+          && supportedFeatures.shaderSampledImageArrayDynamicIndexing
+          && supportedFeatures_12.shaderOutputLayer && supportedFeatures_12.runtimeDescriptorArray
+          && supportedFeatures_12.descriptorBindingPartiallyBound
+          && supportedFeatures_12.descriptorBindingSampledImageUpdateAfterBind;
+}
+
+/*
+ *  Used to pick the best device out of the suitable ones. Discrete GPU is preferred, but
+ *  integrated and software (lavapipe) devices are accepted, e.g. on CI machines.
+ */
+uint32_t
+rateDeviceType(VkPhysicalDevice device)
+{
    VkPhysicalDeviceProperties physicalDeviceProperties{};
    vkGetPhysicalDeviceProperties(device, &physicalDeviceProperties);
-   auto isDiscrete = physicalDeviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
 
-   return indices.isComplete() && extensionsSupported && swapChainAdequate && isDiscrete
-          && supportedFeatures.samplerAnisotropy && supportedFeatures.multiDrawIndirect;
+   switch (physicalDeviceProperties.deviceType)
+   {
+      case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+         return 4;
+      case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+         return 3;
+      case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+         return 2;
+      case VK_PHYSICAL_DEVICE_TYPE_CPU:
+         return 1;
+      default:
+         return 0;
+   }
 }
 
 VkSampleCountFlagBits
@@ -439,56 +633,94 @@ chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, GLFWwindow* windo
    return capabilities.currentExtent;
 }
 
+/*
+ *  Upload all 'spans' back to back into 'buffer', one (incremental) upload per mesh
+ */
+template < typename T >
+void
+uploadSpans(const std::vector< std::span< const T > >& spans, VkBuffer buffer)
+{
+   VkDeviceSize offset = 0;
+   for (const auto& span : spans)
+   {
+      StagingRing::Upload(buffer, offset, span.data(), span.size_bytes());
+      offset += span.size_bytes();
+   }
+}
+
 void
 Renderer::CreateVertexBuffer()
 {
-   const VkDeviceSize bufferSize = sizeof(Data::vertices[0]) * Data::vertices.size();
-
-   VkBuffer stagingBuffer = {};
-   VkDeviceMemory stagingBufferMemory = {};
-   Buffer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                        stagingBuffer, stagingBufferMemory);
-
-   void* data = nullptr;
-   vkMapMemory(Data::vk_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-   memcpy(data, Data::vertices.data(), bufferSize);
-   vkUnmapMemory(Data::vk_device, stagingBufferMemory);
+   const VkDeviceSize bufferSize = sizeof(GpuVertex) * Data::m_currentVertex;
 
    Buffer::CreateBuffer(
       bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Data::m_vertexBuffer, Data::m_vertexBufferMemory);
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Data::m_vertexBuffer, Data::m_vertexBufferMemory,
+      AllocationStrategy::LINEAR);
 
-   Buffer::CopyBuffer(stagingBuffer, Data::m_vertexBuffer, bufferSize);
+   trace::Logger::Debug("Vertex buffer: {} vertices, {} bytes each", Data::m_currentVertex,
+                        sizeof(GpuVertex));
 
-   vkDestroyBuffer(Data::vk_device, stagingBuffer, nullptr);
-   vkFreeMemory(Data::vk_device, stagingBufferMemory, nullptr);
+   if constexpr (std::is_same_v< GpuVertex, Vertex >)
+   {
+      uploadSpans(Data::vertices, Data::m_vertexBuffer);
+   }
+   else
+   {
+      // Every mesh is quantized within its own bounds, see MeshLoaded
+      std::vector< PackedVertex > packed;
+      VkDeviceSize offset = 0;
+      for (size_t mesh = 0; mesh < Data::vertices.size(); ++mesh)
+      {
+         const auto& instance = Data::perInstance[mesh];
+         packed.resize(Data::vertices[mesh].size());
+         PackVertices(Data::vertices[mesh], glm::vec3(instance.positionOffset),
+                      glm::vec3(instance.positionScale), packed);
+
+         const auto size = std::span(packed).size_bytes();
+         StagingRing::Upload(Data::m_vertexBuffer, offset, packed.data(), size);
+         offset += size;
+      }
+   }
 }
 
 void
 Renderer::CreateIndexBuffer()
 {
-   const VkDeviceSize bufferSize = sizeof(Data::indices[0]) * Data::indices.size();
+   // All meshes share the buffer (and a single vkCmdBindIndexBuffer), so a single mesh with
+   // too many vertices needs 32 bit indices for all of them
+   const auto narrow = Data::m_maxMeshVertices <= std::numeric_limits< uint16_t >::max();
+   Data::m_indexType = narrow ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 
-   VkBuffer stagingBuffer = {};
-   VkDeviceMemory stagingBufferMemory = {};
-   Buffer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                        stagingBuffer, stagingBufferMemory);
-
-   void* data = nullptr;
-   vkMapMemory(Data::vk_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-   memcpy(data, Data::indices.data(), bufferSize);
-   vkUnmapMemory(Data::vk_device, stagingBufferMemory);
+   const VkDeviceSize bufferSize =
+      (narrow ? sizeof(uint16_t) : sizeof(uint32_t)) * VkDeviceSize{Data::m_currentIndex};
 
    Buffer::CreateBuffer(
       bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Data::m_indexBuffer, Data::m_indexBufferMemory);
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Data::m_indexBuffer, Data::m_indexBufferMemory,
+      AllocationStrategy::LINEAR);
+
+   trace::Logger::Debug("Index buffer: {} indices, {} bit", Data::m_currentIndex,
+                        narrow ? 16 : 32);
+
+   if (!narrow)
+   {
+      uploadSpans(Data::indices, Data::m_indexBuffer);
+      return;
+   }
 
-   Buffer::CopyBuffer(stagingBuffer, Data::m_indexBuffer, bufferSize);
+   std::vector< uint16_t > narrowed;
+   VkDeviceSize offset = 0;
+   for (const auto& indices : Data::indices)
+   {
+      narrowed.resize(indices.size());
+      std::transform(indices.begin(), indices.end(), narrowed.begin(),
+                     [](uint32_t index) { return static_cast< uint16_t >(index); });
 
-   vkDestroyBuffer(Data::vk_device, stagingBuffer, nullptr);
-   vkFreeMemory(Data::vk_device, stagingBufferMemory, nullptr);
+      const auto size = std::span(narrowed).size_bytes();
+      StagingRing::Upload(Data::m_indexBuffer, offset, narrowed.data(), size);
+      offset += size;
+   }
 }
 
 void
@@ -497,14 +729,15 @@ Renderer::CreateUniformBuffers()
    const VkDeviceSize bufferSize = sizeof(UniformBufferObject);
    const VkDeviceSize SSBObufferSize = Data::perInstance.size() * sizeof(PerInstanceBuffer);
 
-   const auto swapchainImagesSize = m_swapChainImages.size();
-
-   Data::m_uniformBuffers.resize(swapchainImagesSize);
-   Data::m_uniformBuffersMemory.resize(swapchainImagesSize);
-   Data::m_ssbo.resize(swapchainImagesSize);
-   Data::m_ssboMemory.resize(swapchainImagesSize);
+   // Buffers are rewritten every frame, so each frame in flight needs its own copy
+   Data::m_uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+   Data::m_uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+   Data::m_ssbo.resize(MAX_FRAMES_IN_FLIGHT);
+   Data::m_ssboMemory.resize(MAX_FRAMES_IN_FLIGHT);
+   m_uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+   m_ssboMapped.resize(MAX_FRAMES_IN_FLIGHT);
 
-   for (size_t i = 0; i < swapchainImagesSize; i++)
+   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
    {
       Buffer::CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
@@ -515,12 +748,18 @@ Renderer::CreateUniformBuffers()
                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
                               | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                            Data::m_ssbo[i], Data::m_ssboMemory[i]);
+
+      // Host coherent memory, persistently mapped by the allocator
+      m_uniformBuffersMapped[i] = MemoryAllocator::GetMappedMemory(Data::m_uniformBuffers[i]);
+      m_ssboMapped[i] = MemoryAllocator::GetMappedMemory(Data::m_ssbo[i]);
    }
 }
 
 void
 Renderer::Initialize(GLFWwindow* windowHandle)
 {
+   Data::m_headless = false;
+
    CreateInstance();
 
    utils::Assert(glfwCreateWindowSurface(Data::vk_instance, windowHandle, nullptr, &Data::m_surface)
@@ -528,19 +767,35 @@ Renderer::Initialize(GLFWwindow* windowHandle)
                  "failed to create window surface!");
 
    CreateDevice();
+   MemoryAllocator::Init();
+   SamplerCache::Init();
    CreateSwapchain(windowHandle);
    CreateImageViews();
    CreateCommandPool();
+   Command::Init();
+   StagingRing::Init();
+   TextureTable::Init();
+   TextureCache::Init();
+   TextureStreamer::Init();
 }
 
 void
-Renderer::CreatePipelineCache()
+Renderer::InitializeHeadless(uint32_t width, uint32_t height)
 {
-   VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-   pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-   VK_CHECK(vkCreatePipelineCache(Data::vk_device, &pipelineCacheCreateInfo, nullptr,
-                                  &Data::m_pipelineCache),
-            "");
+   Data::m_headless = true;
+
+   CreateInstance();
+   CreateDevice();
+   MemoryAllocator::Init();
+   SamplerCache::Init();
+   CreateOffscreenTargets(width, height);
+   CreateImageViews();
+   CreateCommandPool();
+   Command::Init();
+   StagingRing::Init();
+   TextureTable::Init();
+   TextureCache::Init();
+   TextureStreamer::Init();
 }
 
 void
@@ -552,39 +807,125 @@ Renderer::CreateRenderPipeline()
    CreateColorResources();
    CreateDepthResources();
    CreateFramebuffers();
-   CreatePipelineCache();
+   PipelineCache::Init();
+   ShaderReloader::Init();
 
+   FrameStats::Init(MAX_FRAMES_IN_FLIGHT);
 
-   DeferredPipeline::Initialize(Data::m_renderPass, m_swapChainImageViews, Data::m_pipelineCache);
+   DeferredPipeline::Initialize(Data::m_renderPass, Data::m_pipelineCache);
    app::gui::Gui::Init({Data::m_swapChainExtent.width, Data::m_swapChainExtent.height});
    //  app::gui::Gui::UpdateUI({Data::m_swapChainExtent.width, Data::m_swapChainExtent.height});
-   CreateCommandBufferForDeferred();
-
 
+   CreateCommandBuffers();
    CreateSyncObjects();
 }
 
+void
+Renderer::Shutdown()
+{
+   vkDeviceWaitIdle(Data::vk_device);
+
+   ShaderReloader::Shutdown();
+   PipelineCache::Save();
+}
+
+void
+Renderer::BeginFrame()
+{
+   FrameStats::BeginStage(CpuStage::FRAME);
+
+   // The fence is signaled by the last submit of this frame slot, MAX_FRAMES_IN_FLIGHT frames ago
+   FrameStats::BeginStage(CpuStage::WAIT);
+   vkWaitForFences(Data::vk_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+   FrameStats::EndStage(CpuStage::WAIT);
+
+   // Queries of this slot are only written once it has been submitted at least once
+   if (m_frameNumber >= MAX_FRAMES_IN_FLIGHT)
+   {
+      FrameStats::CollectGpuTimings(m_currentFrame);
+   }
+
+   // Reloaded shaders are only swapped in here, every frame slot re-records its commands with
+   // the new pipelines the next time it's used
+   if (ShaderReloader::Update())
+   {
+      DeferredPipeline::PipelinesChanged();
+      m_outdatedCompositions.fill(true);
+   }
+}
+
 void
 Renderer::UpdateUniformBuffer(const scene::Camera* camera, const scene::Light* light)
 {
+   FrameStats::BeginStage(CpuStage::UPDATE);
+
    UniformBufferObject ubo{};
 
    ubo.proj = camera->GetViewProjection();
    ubo.lightView = light->GetLightSpaceMat();
+   for (uint32_t cascade = 0; cascade < MAX_SHADOW_CASCADES; ++cascade)
+   {
+      ubo.cascadeViewProjection.at(cascade) = light->GetCascades().at(cascade).viewProjection;
+   }
+
+   memcpy(m_uniformBuffersMapped[m_currentFrame], &ubo, sizeof(ubo));
+   memcpy(m_ssboMapped[m_currentFrame], Data::perInstance.data(),
+          Data::perInstance.size() * sizeof(PerInstanceBuffer));
+
+   UpdateStreamedTextures();
+   DeferredPipeline::UpdateDeferred(camera, light, m_currentFrame);
+
+   FrameStats::EndStage(CpuStage::UPDATE);
+}
+
+double
+Renderer::GetGeometryUploadTime()
+{
+   return m_geometryUploadTime;
+}
+
+std::pair< glm::vec3, glm::vec3 >
+Renderer::GetSceneBounds()
+{
+   auto sceneMin = glm::vec3(std::numeric_limits< float >::max());
+   auto sceneMax = glm::vec3(std::numeric_limits< float >::lowest());
 
-   void* data = nullptr;
-   vkMapMemory(Data::vk_device, Data::m_uniformBuffersMemory[m_imageIndex], 0, sizeof(ubo), 0,
-               &data);
-   memcpy(data, &ubo, sizeof(ubo));
-   vkUnmapMemory(Data::vk_device, Data::m_uniformBuffersMemory[m_imageIndex]);
+   for (const auto& sphere : Data::m_meshBounds)
+   {
+      sceneMin = glm::min(sceneMin, glm::vec3(sphere) - sphere.w);
+      sceneMax = glm::max(sceneMax, glm::vec3(sphere) + sphere.w);
+   }
+
+   return {sceneMin, sceneMax};
+}
 
-   void* data2 = nullptr;
-   vkMapMemory(Data::vk_device, Data::m_ssboMemory[m_imageIndex], 0,
-               Data::perInstance.size() * sizeof(PerInstanceBuffer), 0, &data2);
-   memcpy(data2, Data::perInstance.data(), Data::perInstance.size() * sizeof(PerInstanceBuffer));
-   vkUnmapMemory(Data::vk_device, Data::m_ssboMemory[m_imageIndex]);
+void
+Renderer::ConfigureShadows(const scene::Light& light)
+{
+   const auto size = light.GetLightmapSize();
+   Data::m_shadowMapExtent = {size.x, size.y};
+
+   const auto& cascades = light.GetCascades();
+   for (uint32_t cascade = 0; cascade < MAX_SHADOW_CASCADES; ++cascade)
+   {
+      Data::m_shadowCascadeResolutions.at(cascade) = cascades.at(cascade).resolution;
+   }
+}
+
+void
+Renderer::UpdateStreamedTextures()
+{
+   for (const auto& name : TextureStreamer::Update())
+   {
+      auto it = Data::textures.find(name);
+      if (it == Data::textures.end())
+      {
+         continue;
+      }
 
-   DeferredPipeline::UpdateDeferred(camera, light);
+      TextureTable::Update(it->second,
+                           TextureLibrary::GetTexture(name).GetImageViewAndSampler().first);
+   }
 }
 
 void
@@ -621,43 +962,69 @@ Renderer::CreateDepthResources()
 void
 Renderer::Draw()
 {
-   // Always recreate the command buffers for composition, mostly due to imgui
-   CreateCommandBufferForDeferred();
+   // Resources of the current frame slot are no longer used by the GPU (see BeginFrame)
+   FrameStats::BeginStage(CpuStage::UPDATE);
+   const auto guiChanged = app::gui::Gui::UpdateBuffers(m_currentFrame);
+   FrameStats::EndStage(CpuStage::UPDATE);
 
-   // vkWaitForFences(Data::vk_device, 1, &m_inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+   FrameStats::BeginStage(CpuStage::WAIT);
 
-   vkAcquireNextImageKHR(Data::vk_device, m_swapChain, UINT64_MAX,
-                         m_imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &m_imageIndex);
+   if (Data::m_headless)
+   {
+      // Offscreen targets are simply used in round-robin fashion
+      m_imageIndex = static_cast< uint32_t >(m_frameNumber % m_swapChainImages.size());
+   }
+   else
+   {
+      vkAcquireNextImageKHR(Data::vk_device, m_swapChain, UINT64_MAX,
+                            m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE,
+                            &m_imageIndex);
+   }
+
+   // Image might still be used by a frame from the other slot (images can be acquired out of order)
+   if (m_imagesInFlight[m_imageIndex] != VK_NULL_HANDLE)
+   {
+      vkWaitForFences(Data::vk_device, 1, &m_imagesInFlight[m_imageIndex], VK_TRUE, UINT64_MAX);
+   }
+   m_imagesInFlight[m_imageIndex] = m_inFlightFences[m_currentFrame];
 
-   // UpdateUniformBuffer();
-   // if (m_imagesInFlight[imageIndex] != VK_NULL_HANDLE)
-   //{
-   //   vkWaitForFences(Data::vk_device, 1, &m_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
-   //}
-   // m_imagesInFlight[imageIndex] = m_inFlightFences[currentFrame];
+   FrameStats::EndStage(CpuStage::WAIT);
+
+   // Composition pass is static, UI commands are only recorded when the UI has changed and
+   // only the primary buffer for the acquired image gets (re)recorded, if it's out of date
+   FrameStats::BeginStage(CpuStage::RECORD);
+   const auto compositionChanged = m_outdatedCompositions[m_currentFrame];
+   if (compositionChanged)
+   {
+      RecordCompositionCommandBuffer();
+   }
+   // UI pipeline might have been replaced too, re-recording it also invalidates the primary
+   // buffers executing the old composition commands
+   if (guiChanged || compositionChanged)
+   {
+      RecordGuiCommandBuffer();
+   }
+   RecordCommandBuffer();
+   FrameStats::EndStage(CpuStage::RECORD);
 
+   FrameStats::BeginStage(CpuStage::SUBMIT);
 
    //
    // Offscreen rendering
    //
 
+   // Shadow map and G-Buffer don't depend on the swapchain image, so there's nothing to wait for
    VkSubmitInfo submitInfo{};
    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-   std::array< VkPipelineStageFlags, 1 > waitStages = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-   submitInfo.pWaitDstStageMask = waitStages.data();
-
-   // Wait for swap chain presentation to finish
-   submitInfo.pWaitSemaphores = &m_imageAvailableSemaphores[currentFrame];
-   submitInfo.waitSemaphoreCount = 1;
+   submitInfo.waitSemaphoreCount = 0;
 
    // Signal ready with offscreen semaphore
-   submitInfo.pSignalSemaphores = &DeferredPipeline::GetOffscreenSemaphore();
+   submitInfo.pSignalSemaphores = &DeferredPipeline::GetOffscreenSemaphore(m_currentFrame);
    submitInfo.signalSemaphoreCount = 1;
 
    // Submit work
    submitInfo.commandBufferCount = 1;
-   submitInfo.pCommandBuffers = &DeferredPipeline::GetOffscreenCmdBuffer();
+   submitInfo.pCommandBuffers = &DeferredPipeline::GetOffscreenCmdBuffer(m_currentFrame);
    VK_CHECK(vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE),
             "failed to submit offscreen draw command buffer!");
 
@@ -666,39 +1033,54 @@ Renderer::Draw()
    // Scene rendering
    //
 
-   submitInfo.pWaitSemaphores = &DeferredPipeline::GetOffscreenSemaphore();
+   // G-Buffer is sampled in the fragment shader, swapchain image is only needed for the output
+   // (nothing to wait for in headless mode)
+   const std::array< VkSemaphore, 2 > waitSemaphores = {
+      DeferredPipeline::GetOffscreenSemaphore(m_currentFrame),
+      m_imageAvailableSemaphores[m_currentFrame]};
+   const std::array< VkPipelineStageFlags, 2 > waitStages = {
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
-   submitInfo.pSignalSemaphores = &m_renderFinishedSemaphores[currentFrame];
+   submitInfo.pWaitSemaphores = waitSemaphores.data();
+   submitInfo.pWaitDstStageMask = waitStages.data();
+   submitInfo.waitSemaphoreCount = Data::m_headless ? 1 : 2;
 
-   submitInfo.pCommandBuffers = &m_commandBuffers[m_imageIndex];
-   submitInfo.commandBufferCount = 1;
+   submitInfo.pSignalSemaphores = &m_renderFinishedSemaphores[m_currentFrame];
+   submitInfo.signalSemaphoreCount = Data::m_headless ? 0 : 1;
 
+   submitInfo.pCommandBuffers = &m_commandBuffers[GetCommandBufferIndex()];
+   submitInfo.commandBufferCount = 1;
 
-   // vkResetFences(Data::vk_device, 1, &m_inFlightFences[currentFrame]);
+   vkResetFences(Data::vk_device, 1, &m_inFlightFences[m_currentFrame]);
 
-   // VK_CHECK(vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo,
-   // m_inFlightFences[currentFrame]),
-   //         "failed to submit draw command buffer!");
+   // Composition is the last submit of the frame, so the fence covers the offscreen work too
+   VK_CHECK(
+      vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]),
+      "failed to submit draw command buffer!");
 
-   VK_CHECK(vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE),
-            "failed to submit draw command buffer!");
+   if (!Data::m_headless)
+   {
+      VkPresentInfoKHR presentInfo{};
+      presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
-   VkPresentInfoKHR presentInfo{};
-   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      presentInfo.waitSemaphoreCount = 1;
+      presentInfo.pWaitSemaphores = &m_renderFinishedSemaphores[m_currentFrame];
 
-   presentInfo.waitSemaphoreCount = 1;
-   presentInfo.pWaitSemaphores = &m_renderFinishedSemaphores[currentFrame];
+      presentInfo.swapchainCount = 1;
+      presentInfo.pSwapchains = &m_swapChain;
 
-   presentInfo.swapchainCount = 1;
-   presentInfo.pSwapchains = &m_swapChain;
+      presentInfo.pImageIndices = &m_imageIndex;
 
-   presentInfo.pImageIndices = &m_imageIndex;
+      vkQueuePresentKHR(Data::m_presentQueue, &presentInfo);
+   }
 
-   vkQueuePresentKHR(Data::m_presentQueue, &presentInfo);
+   FrameStats::EndStage(CpuStage::SUBMIT);
 
-   vkQueueWaitIdle(Data::vk_graphicsQueue);
+   // No waiting here, CPU moves on to the next frame while GPU is still busy with this one
+   m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+   ++m_frameNumber;
 
-   currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+   FrameStats::EndStage(CpuStage::FRAME);
 }
 
 void
@@ -747,9 +1129,15 @@ Renderer::CreateDevice()
    vkEnumeratePhysicalDevices(Data::vk_instance, &deviceCount, devices.data());
 
 
-   const auto found = std::find_if(devices.begin(), devices.end(), [](const auto& device) {
-      return isDeviceSuitable(device, Data::m_surface);
-   });
+   auto found = devices.end();
+   for (auto it = devices.begin(); it != devices.end(); ++it)
+   {
+      if (isDeviceSuitable(*it, Data::m_surface)
+          && (found == devices.end() || rateDeviceType(*it) > rateDeviceType(*found)))
+      {
+         found = it;
+      }
+   }
 
    if (found != devices.end())
    {
@@ -772,9 +1160,14 @@ Renderer::CreateDevice()
 
    // indices.isComplete() is called in findQueueFamilies
    // NOLINTBEGIN
-   const std::set< uint32_t > uniqueQueueFamilies = {indices.graphicsFamily.value(),
-                                                     indices.presentFamily.value()};
+   const auto transferFamily = findTransferQueueFamily(Data::vk_physicalDevice);
+   std::set< uint32_t > uniqueQueueFamilies = {indices.graphicsFamily.value(),
+                                               indices.presentFamily.value()};
    // NOLINTEND
+   if (transferFamily.has_value())
+   {
+      uniqueQueueFamilies.insert(transferFamily.value());
+   }
 
    const auto queuePriority = 1.0f;
    for (auto queueFamily : uniqueQueueFamilies)
@@ -791,6 +1184,11 @@ Renderer::CreateDevice()
    VkPhysicalDeviceVulkan12Features deviceFeatures_12{};
    deviceFeatures_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
    deviceFeatures_12.drawIndirectCount = VK_TRUE;
+   // Bindless textures (TextureTable)
+   deviceFeatures_12.runtimeDescriptorArray = VK_TRUE;
+   deviceFeatures_12.descriptorBindingPartiallyBound = VK_TRUE;
+   deviceFeatures_12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+   deviceFeatures_12.shaderOutputLayer = VK_TRUE;
 
    VkPhysicalDeviceVulkan11Features deviceFeatures_11{};
    deviceFeatures_11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
@@ -800,8 +1198,15 @@ Renderer::CreateDevice()
    VkPhysicalDeviceFeatures deviceFeatures{};
    deviceFeatures.samplerAnisotropy = VK_TRUE;
    deviceFeatures.multiDrawIndirect = VK_TRUE;
+   deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+   deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
    deviceFeatures.geometryShader = VK_TRUE;
 
+   // Optional, TextureCache falls back to uncompressed textures without it
+   VkPhysicalDeviceFeatures supportedFeatures{};
+   vkGetPhysicalDeviceFeatures(Data::vk_physicalDevice, &supportedFeatures);
+   deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
    VkDeviceCreateInfo createInfo{};
    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
    createInfo.pNext = &deviceFeatures_11;
@@ -811,8 +1216,9 @@ Renderer::CreateDevice()
 
    createInfo.pEnabledFeatures = &deviceFeatures;
 
-   createInfo.enabledExtensionCount = static_cast< uint32_t >(DEVICE_EXTENSIONS.size());
-   createInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+   const auto deviceExtensions = getDeviceExtensions();
+   createInfo.enabledExtensionCount = static_cast< uint32_t >(deviceExtensions.size());
+   createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
    if constexpr (ENABLE_VALIDATION)
    {
@@ -828,7 +1234,18 @@ Renderer::CreateDevice()
    // NOLINTBEGIN
    vkGetDeviceQueue(Data::vk_device, indices.graphicsFamily.value(), 0, &Data::vk_graphicsQueue);
    vkGetDeviceQueue(Data::vk_device, indices.presentFamily.value(), 0, &Data::m_presentQueue);
+   Data::m_graphicsQueueFamily = indices.graphicsFamily.value();
    // NOLINTEND
+
+   Data::m_transferQueueFamily = transferFamily.value_or(Data::m_graphicsQueueFamily);
+   if (transferFamily.has_value())
+   {
+      vkGetDeviceQueue(Data::vk_device, Data::m_transferQueueFamily, 0, &Data::vk_transferQueue);
+   }
+   else
+   {
+      Data::vk_transferQueue = Data::vk_graphicsQueue;
+   }
 }
 
 void
@@ -894,6 +1311,25 @@ Renderer::CreateSwapchain(GLFWwindow* windowHandle)
    Data::m_swapChainExtent = extent;
 }
 
+void
+Renderer::CreateOffscreenTargets(uint32_t width, uint32_t height)
+{
+   // Same format we'd pick for the swapchain, so all pipelines stay identical
+   m_swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+   Data::m_swapChainExtent = {width, height};
+
+   m_swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+   m_offscreenTargetsMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+   for (size_t i = 0; i < m_swapChainImages.size(); ++i)
+   {
+      std::tie(m_swapChainImages[i], m_offscreenTargetsMemory[i]) = Texture::CreateImage(
+         width, height, 1, VK_SAMPLE_COUNT_1_BIT, m_swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+   }
+}
+
 void
 Renderer::CreateImageViews()
 {
@@ -918,7 +1354,9 @@ Renderer::CreateRenderPass()
    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-   colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+   // PRESENT_SRC layout requires swapchain extension, offscreen targets are left ready for readback
+   colorAttachment.finalLayout = Data::m_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                  : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
    VkAttachmentDescription depthAttachment{};
    depthAttachment.format = FindDepthFormat();
@@ -1048,21 +1486,135 @@ Renderer::CreateCommandPool()
             "failed to create command pool!");
 }
 
+/*
+ *  Begin secondary command buffer that's executed inside the main render pass. Viewport and
+ *  scissor are not inherited from the primary buffer, so they're set here.
+ */
+void
+beginSecondaryCommandBuffer(VkCommandBuffer commandBuffer)
+{
+   VkCommandBufferInheritanceInfo inheritanceInfo{};
+   inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+   inheritanceInfo.renderPass = Data::m_renderPass;
+   inheritanceInfo.subpass = 0;
+   // Same buffer is executed for every swapchain framebuffer
+   inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+   VkCommandBufferBeginInfo beginInfo{};
+   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+   beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT
+                     | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+   beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+   VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo), "");
+
+   VkViewport viewport{};
+   viewport.width = static_cast< float >(Data::m_swapChainExtent.width);
+   viewport.height = static_cast< float >(Data::m_swapChainExtent.height);
+   viewport.minDepth = 0.0f;
+   viewport.maxDepth = 1.0f;
+
+   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+   VkRect2D scissor{};
+   scissor.extent.width = Data::m_swapChainExtent.width;
+   scissor.extent.height = Data::m_swapChainExtent.height;
+   scissor.offset.x = 0;
+   scissor.offset.y = 0;
+
+   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
 void
-Renderer::CreateCommandBufferForDeferred()
+Renderer::CreateCommandBuffers()
 {
-   if (m_commandBuffers.empty())
+   const auto numPrimaries =
+      MAX_FRAMES_IN_FLIGHT * static_cast< uint32_t >(m_swapChainImages.size());
+   m_commandBuffers.resize(numPrimaries);
+   m_recordedGuiGenerations.resize(numPrimaries, 0);
+   m_compositionCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+   m_guiCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+   m_guiGenerations.resize(MAX_FRAMES_IN_FLIGHT, 0);
+
+   VkCommandBufferAllocateInfo allocInfo{};
+   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+   allocInfo.commandPool = Data::vk_commandPool;
+   allocInfo.commandBufferCount = numPrimaries;
+
+   VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo, m_commandBuffers.data()),
+            "failed to allocate command buffers!");
+
+   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+   allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+
+   VK_CHECK(
+      vkAllocateCommandBuffers(Data::vk_device, &allocInfo, m_compositionCommandBuffers.data()),
+      "failed to allocate composition command buffers!");
+   VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo, m_guiCommandBuffers.data()),
+            "failed to allocate UI command buffers!");
+
+   // Composition doesn't depend on the swapchain image, so it's recorded once for every frame
+   // in flight. UI buffers are recorded (empty until there's something to draw), so that they
+   // can be executed unconditionally.
+   const auto currentFrame = m_currentFrame;
+   for (m_currentFrame = 0; m_currentFrame < MAX_FRAMES_IN_FLIGHT; ++m_currentFrame)
    {
-      m_commandBuffers.resize(m_swapChainFramebuffers.size());
+      RecordCompositionCommandBuffer();
+      RecordGuiCommandBuffer();
+   }
+   m_currentFrame = currentFrame;
+}
+
+void
+Renderer::RecordCompositionCommandBuffer()
+{
+   /*
+    * STAGE 2 - COMPOSITION
+    */
+   auto* commandBuffer = m_compositionCommandBuffers[m_currentFrame];
+   beginSecondaryCommandBuffer(commandBuffer);
+
+   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                           DeferredPipeline::GetPipelineLayout(), 0, 1,
+                           &DeferredPipeline::GetDescriptorSet(m_currentFrame), 0, nullptr);
+
+   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                     DeferredPipeline::GetCompositionPipeline());
+
+   // Final composition as full screen quad
+   vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+   VK_CHECK(vkEndCommandBuffer(commandBuffer), "");
+
+   m_outdatedCompositions[m_currentFrame] = false;
+}
+
+void
+Renderer::RecordGuiCommandBuffer()
+{
+   /*
+    * STAGE 3 - DRAW UI
+    */
+   auto* commandBuffer = m_guiCommandBuffers[m_currentFrame];
+   beginSecondaryCommandBuffer(commandBuffer);
 
-      VkCommandBufferAllocateInfo allocInfo{};
-      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-      allocInfo.commandPool = Data::vk_commandPool;
-      allocInfo.commandBufferCount = static_cast< uint32_t >(m_commandBuffers.size());
+   app::gui::Gui::Render(commandBuffer, m_currentFrame);
 
-      VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo, m_commandBuffers.data()),
-               "failed to allocate command buffers!");
+   VK_CHECK(vkEndCommandBuffer(commandBuffer), "");
+
+   // Every primary buffer that executes the old UI commands is now invalid
+   ++m_guiGenerations[m_currentFrame];
+}
+
+void
+Renderer::RecordCommandBuffer()
+{
+   // Recorded at most once per UI change for every (frame in flight, swapchain image) pair
+   const auto index = GetCommandBufferIndex();
+   if (m_recordedGuiGenerations[index] == m_guiGenerations[m_currentFrame])
+   {
+      return;
    }
 
    VkCommandBufferBeginInfo beginInfo{};
@@ -1075,57 +1627,37 @@ Renderer::CreateCommandBufferForDeferred()
    VkRenderPassBeginInfo renderPassInfo{};
    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
    renderPassInfo.renderPass = Data::m_renderPass;
+   renderPassInfo.framebuffer = m_swapChainFramebuffers[m_imageIndex];
    renderPassInfo.renderArea.offset = {0, 0};
    renderPassInfo.renderArea.extent = Data::m_swapChainExtent;
    renderPassInfo.clearValueCount = static_cast< uint32_t >(clearValues.size());
    renderPassInfo.pClearValues = clearValues.data();
 
-   for (uint32_t i = 0; i < m_commandBuffers.size(); ++i)
-   {
-      renderPassInfo.framebuffer = m_swapChainFramebuffers[i];
-
-      VK_CHECK(vkBeginCommandBuffer(m_commandBuffers[i], &beginInfo), "");
+   auto* commandBuffer = m_commandBuffers[index];
 
-      vkCmdBeginRenderPass(m_commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+   VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo), "");
 
-      VkViewport viewport{};
-      viewport.width = static_cast< float >(Data::m_swapChainExtent.width);
-      viewport.height = static_cast< float >(Data::m_swapChainExtent.height);
-      viewport.minDepth = 0.0f;
-      viewport.maxDepth = 1.0f;
+   FrameStats::BeginPass(commandBuffer, GpuPass::COMPOSITION, m_currentFrame);
+   vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                        VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-      vkCmdSetViewport(m_commandBuffers[i], 0, 1, &viewport);
+   const std::array< VkCommandBuffer, 2 > secondaries = {
+      m_compositionCommandBuffers[m_currentFrame], m_guiCommandBuffers[m_currentFrame]};
+   vkCmdExecuteCommands(commandBuffer, static_cast< uint32_t >(secondaries.size()),
+                        secondaries.data());
 
-      VkRect2D scissor{};
-      scissor.extent.width = Data::m_swapChainExtent.width;
-      scissor.extent.height = Data::m_swapChainExtent.height;
-      scissor.offset.x = 0;
-      scissor.offset.y = 0;
+   vkCmdEndRenderPass(commandBuffer);
+   FrameStats::EndPass(commandBuffer, GpuPass::COMPOSITION, m_currentFrame);
 
-      vkCmdSetScissor(m_commandBuffers[i], 0, 1, &scissor);
+   VK_CHECK(vkEndCommandBuffer(commandBuffer), "");
 
-      /*
-       * STAGE 2 - COMPOSITION
-       */
-      vkCmdBindDescriptorSets(m_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              DeferredPipeline::GetPipelineLayout(), 0, 1,
-                              &DeferredPipeline::GetDescriptorSet(), 0, nullptr);
-
-      vkCmdBindPipeline(m_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                        DeferredPipeline::GetCompositionPipeline());
-
-      // Final composition as full screen quad
-      vkCmdDraw(m_commandBuffers[i], 3, 1, 0, 0);
-
-      /*
-       * STAGE 3 - DRAW UI
-       */
-      app::gui::Gui::Render(m_commandBuffers[i]);
-
-      vkCmdEndRenderPass(m_commandBuffers[i]);
+   m_recordedGuiGenerations[index] = m_guiGenerations[m_currentFrame];
+}
 
-      VK_CHECK(vkEndCommandBuffer(m_commandBuffers[i]), "");
-   }
+uint32_t
+Renderer::GetCommandBufferIndex()
+{
+   return m_currentFrame * static_cast< uint32_t >(m_swapChainImages.size()) + m_imageIndex;
 }
 
 void
@@ -5,6 +5,8 @@
 #include "types.hpp"
 
 #include <glm/glm.hpp>
+#include <span>
+#include <utility>
 #include <vector>
 #include <vulkan/vulkan.h>
 
@@ -18,23 +20,53 @@ class Renderer
    static void
    Initialize(GLFWwindow* windowHandle);
 
+   // Initialize without window/surface, frames are rendered into offscreen images
+   static void
+   InitializeHeadless(uint32_t width, uint32_t height);
+
    static void
    CreateRenderPipeline();
 
+   // Waits until the GPU is idle and saves data worth keeping for the next run (pipeline cache).
+   // Has to be called once no more frames will be rendered.
    static void
-   Draw();
+   Shutdown();
 
+   // Wait until GPU is done with the resources of the current frame in flight. Has to be called
+   // before any per frame data (uniforms, GUI buffers) gets updated.
    static void
-   MeshLoaded(const std::vector< Vertex >& vertices,
-              const std::vector< uint32_t >& indicies, const TextureMaps& textures,
-              const glm::mat4& modelMat);
+   BeginFrame();
+
+   static void
+   Draw();
 
+   // Vertex and index data is not copied, it has to stay alive until the pipeline is created.
+   // Shadows of 'dynamic' meshes are drawn every frame over the cached shadow map. Local space
+   // 'meshlets' are used for cluster culling of static meshes, dynamic ones are culled whole.
+   // 'lods' are simplified levels of detail, with ranges pointing into 'lodIndices'.
    static void
-   CreateCommandBufferForDeferred();
+   MeshLoaded(std::span< const Vertex > vertices, std::span< const uint32_t > indicies,
+              const TextureMaps& textures, const glm::mat4& modelMat, bool dynamic = false,
+              std::span< const Meshlet > meshlets = {},
+              std::span< const uint32_t > lodIndices = {}, std::span< const MeshLod > lods = {});
 
    static void
    UpdateUniformBuffer(const scene::Camera* camera, const scene::Light* light);
 
+   // World space bounds (min, max) of all meshes passed to MeshLoaded so far
+   [[nodiscard]] static std::pair< glm::vec3, glm::vec3 >
+   GetSceneBounds();
+
+   // Time (in milliseconds) CreateRenderPipeline spent creating the vertex, index and indirect
+   // buffers and uploading them, including the wait for the staging uploads
+   [[nodiscard]] static double
+   GetGeometryUploadTime();
+
+   // Lightmap and shadow cascade resolutions of 'light', has to be called before
+   // CreateRenderPipeline. 4096x4096 is used for every cascade by default.
+   static void
+   ConfigureShadows(const scene::Light& light);
+
  private:
    static void
    SetupData();
@@ -48,6 +80,9 @@ class Renderer
    static void
    CreateSwapchain(GLFWwindow* windowHandle);
 
+   static void
+   CreateOffscreenTargets(uint32_t width, uint32_t height);
+
    static void
    CreateImageViews();
 
@@ -63,8 +98,24 @@ class Renderer
    static void
    CreateSyncObjects();
 
+   // Allocate command buffers for the main render pass and record its static part (composition)
+   static void
+   CreateCommandBuffers();
+
+   // Re-record composition commands of the current frame in flight
    static void
-   CreatePipelineCache();
+   RecordCompositionCommandBuffer();
+
+   // Re-record UI commands of the current frame in flight
+   static void
+   RecordGuiCommandBuffer();
+
+   // Record primary buffer for the current frame in flight and acquired image (if it's stale)
+   static void
+   RecordCommandBuffer();
+
+   static uint32_t
+   GetCommandBufferIndex();
 
    static void
    CreateVertexBuffer();
@@ -81,6 +132,10 @@ class Renderer
    static void
    CreateColorResources();
 
+   // Swap placeholders of textures that finished streaming since the last frame
+   static void
+   UpdateStreamedTextures();
+
  private:
    inline static VkDebugUtilsMessengerCreateInfoEXT m_debugCreateInfo = {};
    inline static VkDebugUtilsMessengerEXT m_debugMessenger = {};
@@ -90,6 +145,8 @@ class Renderer
    inline static std::vector< VkImageView > m_swapChainImageViews = {};
    inline static std::vector< VkFramebuffer > m_swapChainFramebuffers = {};
    inline static VkFormat m_swapChainImageFormat = {};
+   // Only used in headless mode, where swapchain images are replaced by offscreen targets
+   inline static std::vector< VkDeviceMemory > m_offscreenTargetsMemory = {};
 
    inline static VkDescriptorSetLayout m_descriptorSetLayout = {};
    inline static VkDescriptorPool m_descriptorPool = {};
@@ -97,7 +154,17 @@ class Renderer
 
    inline static VkPipelineLayout m_pipelineLayout = {};
 
+   // One per [frame in flight][swapchain image] pair, see GetCommandBufferIndex
    inline static std::vector< VkCommandBuffer > m_commandBuffers = {};
+   // UI generation (see m_guiGenerations) that given primary buffer was recorded with
+   inline static std::vector< uint64_t > m_recordedGuiGenerations = {};
+   // Secondary buffers, one per frame in flight
+   inline static std::vector< VkCommandBuffer > m_compositionCommandBuffers = {};
+   inline static std::vector< VkCommandBuffer > m_guiCommandBuffers = {};
+   // Composition buffers recorded with a pipeline that has since been reloaded
+   inline static std::array< bool, MAX_FRAMES_IN_FLIGHT > m_outdatedCompositions = {};
+   // Bumped every time UI buffer of given frame in flight is re-recorded
+   inline static std::vector< uint64_t > m_guiGenerations = {};
 
    inline static std::vector< VkSemaphore > m_imageAvailableSemaphores = {};
    inline static std::vector< VkSemaphore > m_renderFinishedSemaphores = {};
@@ -112,8 +179,15 @@ class Renderer
    inline static VkDeviceMemory m_colorImageMemory = {};
    inline static VkImageView m_colorImageView = {};
 
+   // Persistently mapped per frame in flight uniform/SSBO buffers (see Data::m_uniformBuffers)
+   inline static std::vector< void* > m_uniformBuffersMapped = {};
+   inline static std::vector< void* > m_ssboMapped = {};
+
    inline static DeferredPipeline m_deferredPipeline = {};
    inline static uint32_t m_imageIndex = {};
+   inline static uint32_t m_currentFrame = 0;
+   inline static uint64_t m_frameNumber = 0;
+   inline static double m_geometryUploadTime = 0.0;
 };
 
 } // namespace shady::render::vulkan
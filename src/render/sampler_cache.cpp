@@ -0,0 +1,83 @@
+#include "sampler_cache.hpp"
+#include "common.hpp"
+#include "trace/logger.hpp"
+#include "utils/assert.hpp"
+
+#include <algorithm>
+
+namespace shady::render {
+
+void
+SamplerCache::Init()
+{
+   VkPhysicalDeviceProperties properties{};
+   vkGetPhysicalDeviceProperties(Data::vk_physicalDevice, &properties);
+
+   m_maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+   m_maxSamplers = properties.limits.maxSamplerAllocationCount;
+}
+
+VkSampler
+SamplerCache::Get(const SamplerKey& key)
+{
+   const std::lock_guard lock(m_mutex);
+   ++m_numRequests;
+
+   const auto it = std::find_if(m_samplers.begin(), m_samplers.end(),
+                                [&key](const auto& sampler) { return sampler.first == key; });
+   if (it != m_samplers.end())
+   {
+      return it->second;
+   }
+
+   utils::Assert(m_samplers.size() < m_maxSamplers,
+                 "SamplerCache: maxSamplerAllocationCount reached!");
+
+   const auto sampler = CreateSampler(key);
+   m_samplers.emplace_back(key, sampler);
+
+   trace::Logger::Debug("SamplerCache: created sampler #{} (filter {}, address mode {}, {} mips, "
+                        "anisotropy {})",
+                        m_samplers.size(), static_cast< int32_t >(key.filter),
+                        static_cast< int32_t >(key.addressMode), key.mipLevels, key.anisotropy);
+
+   return sampler;
+}
+
+SamplerStats
+SamplerCache::GetStats()
+{
+   const std::lock_guard lock(m_mutex);
+   return {static_cast< uint32_t >(m_samplers.size()), m_numRequests, m_maxSamplers};
+}
+
+VkSampler
+SamplerCache::CreateSampler(const SamplerKey& key)
+{
+   VkSamplerCreateInfo samplerInfo{};
+   samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+   samplerInfo.magFilter = key.filter;
+   samplerInfo.minFilter = key.filter;
+   samplerInfo.mipmapMode = key.filter == VK_FILTER_NEAREST ? VK_SAMPLER_MIPMAP_MODE_NEAREST
+                                                             : VK_SAMPLER_MIPMAP_MODE_LINEAR;
+   samplerInfo.addressModeU = key.addressMode;
+   samplerInfo.addressModeV = key.addressMode;
+   samplerInfo.addressModeW = key.addressMode;
+   samplerInfo.anisotropyEnable = key.anisotropy ? VK_TRUE : VK_FALSE;
+   samplerInfo.maxAnisotropy = key.anisotropy ? m_maxAnisotropy : 1.0f;
+   samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+   samplerInfo.unnormalizedCoordinates = VK_FALSE;
+   samplerInfo.compareEnable = VK_FALSE;
+   samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+   samplerInfo.minLod = 0.0f;
+   samplerInfo.maxLod = key.mipLevels > 0 ? static_cast< float >(key.mipLevels) : VK_LOD_CLAMP_NONE;
+   samplerInfo.mipLodBias = 0.0f;
+
+   VkSampler sampler{};
+   VK_CHECK(vkCreateSampler(Data::vk_device, &samplerInfo, nullptr, &sampler),
+            "SamplerCache: failed to create sampler!");
+
+   return sampler;
+}
+
+} // namespace shady::render
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+// Sampler state, samplers with equal keys are shared
+struct SamplerKey
+{
+   // Used for magnification, minification and (nearest or linear) between mip levels
+   VkFilter filter = VK_FILTER_LINEAR;
+   // Same for U, V and W
+   VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+   // Highest level of detail is clamped to it, 0 doesn't clamp (every level of the image is used)
+   uint32_t mipLevels = 1;
+   // Uses the device's maximum anisotropy
+   bool anisotropy = true;
+
+   bool
+   operator==(const SamplerKey& other) const = default;
+};
+
+struct SamplerStats
+{
+   // Unique samplers created
+   uint32_t samplers = 0;
+   uint32_t requests = 0;
+   // maxSamplerAllocationCount of the device
+   uint32_t maxSamplers = 0;
+};
+
+/*
+ * Hands out shared samplers, one per unique SamplerKey. Samplers live until the end of the
+ * application, so the callers never destroy them. Thread safe.
+ */
+class SamplerCache
+{
+ public:
+   // Queries the device limits, has to be called before Get
+   static void
+   Init();
+
+   [[nodiscard]] static VkSampler
+   Get(const SamplerKey& key);
+
+   [[nodiscard]] static SamplerStats
+   GetStats();
+
+ private:
+   [[nodiscard]] static VkSampler
+   CreateSampler(const SamplerKey& key);
+
+ private:
+   inline static std::mutex m_mutex = {};
+   inline static float m_maxAnisotropy = 1.0f;
+   inline static uint32_t m_maxSamplers = 0;
+   inline static uint32_t m_numRequests = 0;
+   // Only a handful of unique states are used, so linear search is fine
+   inline static std::vector< std::pair< SamplerKey, VkSampler > > m_samplers = {};
+};
+
+} // namespace shady::render
@@ -4,19 +4,65 @@
 #include "utils/assert.hpp"
 #include "utils/file_manager.hpp"
 
+#include <cstring>
+#include <fstream>
+
 namespace shady::render {
 
+// Magic number in the first word of every SPIR-V module
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+// Unlike FileManager::ReadBinaryFile, doesn't assert, as the file can be in the middle of being
+// rewritten by the shader compiler while it's reloaded
+static std::vector< char >
+ReadShaderCode(const std::filesystem::path& path)
+{
+   std::ifstream fileHandle(path, std::ios::binary | std::ios::ate);
+   if (!fileHandle.is_open())
+   {
+      return {};
+   }
+
+   std::vector< char > buffer(static_cast< size_t >(fileHandle.tellg()));
+   fileHandle.seekg(0);
+   fileHandle.read(buffer.data(), static_cast< std::streamsize >(buffer.size()));
+
+   return fileHandle ? buffer : std::vector< char >{};
+}
+
+// VK_NULL_HANDLE when 'shader' can't be loaded, the reason is logged
 static VkShaderModule
-CreateShaderModule(VkDevice device, const std::vector< char >& shaderByteCode)
+CreateShaderModule(VkDevice device, std::string_view shader)
 {
+   const auto shaderByteCode = ReadShaderCode(utils::FileManager::SHADERS_DIR / shader);
+
+   uint32_t magic = 0;
+   if (shaderByteCode.size() < sizeof(magic) || shaderByteCode.size() % sizeof(uint32_t) != 0)
+   {
+      trace::Logger::Warn("Shader: {} can't be read or isn't valid SPIR-V", shader);
+      return VK_NULL_HANDLE;
+   }
+
+   std::memcpy(&magic, shaderByteCode.data(), sizeof(magic));
+   if (magic != SPIRV_MAGIC)
+   {
+      trace::Logger::Warn("Shader: {} isn't valid SPIR-V", shader);
+      return VK_NULL_HANDLE;
+   }
+
    VkShaderModuleCreateInfo createInfo{};
    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
    createInfo.codeSize = shaderByteCode.size();
    createInfo.pCode = reinterpret_cast< const uint32_t* >(shaderByteCode.data());
 
    VkShaderModule shaderModule = {};
-   VK_CHECK(vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule),
-            "Failed to create shader module!");
+   const auto result = vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule);
+   if (result != VK_SUCCESS)
+   {
+      trace::Logger::Warn("Shader: failed to create shader module for {}! Return value {}", shader,
+                          string_VkResult(result));
+      return VK_NULL_HANDLE;
+   }
 
    return shaderModule;
 }
@@ -25,9 +71,7 @@ CreateShaderModule(VkDevice device, const std::vector< char >& shaderByteCode)
 ShaderInfoWrapper
 Shader::LoadShader(std::string_view shader, VkShaderStageFlagBits stage)
 {
-   VkShaderModule shaderModule = CreateShaderModule(
-      Data::vk_device,
-      utils::FileManager::ReadBinaryFile(utils::FileManager::SHADERS_DIR / shader));
+   VkShaderModule shaderModule = CreateShaderModule(Data::vk_device, shader);
 
    VkPipelineShaderStageCreateInfo shaderStageInfo{};
    shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -41,10 +85,8 @@ Shader::LoadShader(std::string_view shader, VkShaderStageFlagBits stage)
 std::pair< VertexShaderInfo, FragmentShaderInfo >
 Shader::CreateShader(VkDevice device, std::string_view vertex, std::string_view fragment)
 {
-   VkShaderModule vertShaderModule = CreateShaderModule(
-      device, utils::FileManager::ReadBinaryFile(utils::FileManager::SHADERS_DIR / vertex));
-   VkShaderModule fragShaderModule = CreateShaderModule(
-      device, utils::FileManager::ReadBinaryFile(utils::FileManager::SHADERS_DIR / fragment));
+   VkShaderModule vertShaderModule = CreateShaderModule(device, vertex);
+   VkShaderModule fragShaderModule = CreateShaderModule(device, fragment);
 
    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
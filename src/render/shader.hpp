@@ -17,6 +17,13 @@ struct ShaderInfoWrapper
       vkDestroyShaderModule(device, shaderInfo.module, nullptr);
    }
 
+   // False when the shader couldn't be loaded (the reason is logged)
+   [[nodiscard]] bool
+   IsValid() const
+   {
+      return shaderInfo.module != VK_NULL_HANDLE;
+   }
+
    VkDevice device;
    VkPipelineShaderStageCreateInfo shaderInfo;
 };
@@ -25,6 +32,10 @@ using VertexShaderInfo = ShaderInfoWrapper;
 using GeometryShaderInfo = ShaderInfoWrapper;
 using FragmentShaderInfo = ShaderInfoWrapper;
 
+/*
+ * Failures (missing or malformed SPIR-V, module creation errors) aren't fatal, so shaders can be
+ * rebuilt while the application is running. Callers have to check ShaderInfoWrapper::IsValid.
+ */
 class Shader
 {
  public:
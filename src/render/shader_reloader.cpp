@@ -0,0 +1,147 @@
+#include "shader_reloader.hpp"
+#include "common.hpp"
+#include "trace/logger.hpp"
+#include "utils/file_manager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace shady::render {
+
+void
+ShaderReloader::Init()
+{
+   if (m_watcher.Watch(utils::FileManager::SHADERS_DIR))
+   {
+      trace::Logger::Info("ShaderReloader: watching {} for changes",
+                          utils::FileManager::SHADERS_DIR.string());
+   }
+}
+
+void
+ShaderReloader::Register(ReloadablePipeline pipeline)
+{
+   m_pipelines.push_back(std::move(pipeline));
+}
+
+bool
+ShaderReloader::Update()
+{
+   ++m_frameNumber;
+
+   // Every frame slot has been re-recorded with the new pipeline and waited for since the swap
+   std::erase_if(m_retired, [](const RetiredPipeline& retired) {
+      if (m_frameNumber < retired.frame + MAX_FRAMES_IN_FLIGHT)
+      {
+         return false;
+      }
+
+      vkDestroyPipeline(Data::vk_device, retired.pipeline, nullptr);
+      return true;
+   });
+
+   for (const auto& path : m_watcher.Poll())
+   {
+      if (path.extension() != ".spv")
+      {
+         continue;
+      }
+
+      const auto shader = path.lexically_relative(utils::FileManager::SHADERS_DIR).generic_string();
+      for (size_t idx = 0; idx < m_pipelines.size(); ++idx)
+      {
+         const auto& shaders = m_pipelines[idx].shaders;
+         if (std::find(shaders.begin(), shaders.end(), shader) != shaders.end()
+             && std::find(m_pending.begin(), m_pending.end(), idx) == m_pending.end())
+         {
+            trace::Logger::Info("ShaderReloader: {} changed, rebuilding '{}'", shader,
+                                m_pipelines[idx].name);
+            m_pending.push_back(idx);
+         }
+      }
+   }
+
+   auto swapped = false;
+   if (m_rebuild.valid()
+       && m_rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+   {
+      for (const auto& rebuilt : m_rebuild.get())
+      {
+         auto& pipeline = m_pipelines[rebuilt.index];
+         if (rebuilt.pipeline == VK_NULL_HANDLE)
+         {
+            trace::Logger::Warn("ShaderReloader: failed to rebuild '{}', keeping the current one",
+                                pipeline.name);
+            continue;
+         }
+
+         m_retired.push_back({pipeline.swap(rebuilt.pipeline), m_frameNumber});
+         trace::Logger::Info("ShaderReloader: '{}' rebuilt in {:.2f}ms", pipeline.name,
+                             rebuilt.milliseconds);
+         swapped = true;
+      }
+   }
+
+   // Changes made during the rebuild are picked up by the next one
+   if (!m_rebuild.valid() && !m_pending.empty())
+   {
+      StartRebuild();
+   }
+
+   return swapped;
+}
+
+void
+ShaderReloader::StartRebuild()
+{
+   // Build functions are copied, so Register can be called while the rebuild is running
+   std::vector< std::pair< size_t, std::function< VkPipeline() > > > jobs;
+   jobs.reserve(m_pending.size());
+   for (const auto idx : m_pending)
+   {
+      jobs.emplace_back(idx, m_pipelines[idx].build);
+   }
+   m_pending.clear();
+
+   m_rebuild = std::async(std::launch::async, [jobs = std::move(jobs)] {
+      std::vector< RebuiltPipeline > rebuilt;
+      rebuilt.reserve(jobs.size());
+
+      for (const auto& [index, build] : jobs)
+      {
+         const auto start = std::chrono::steady_clock::now();
+         const auto pipeline = build();
+         const auto milliseconds =
+            std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - start)
+               .count();
+
+         rebuilt.push_back({index, pipeline, milliseconds});
+      }
+
+      return rebuilt;
+   });
+}
+
+void
+ShaderReloader::Shutdown()
+{
+   // Finished pipelines that were never swapped in
+   if (m_rebuild.valid())
+   {
+      for (const auto& rebuilt : m_rebuild.get())
+      {
+         vkDestroyPipeline(Data::vk_device, rebuilt.pipeline, nullptr);
+      }
+   }
+
+   for (const auto& retired : m_retired)
+   {
+      vkDestroyPipeline(Data::vk_device, retired.pipeline, nullptr);
+   }
+
+   m_retired.clear();
+   m_pending.clear();
+}
+
+} // namespace shady::render
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "utils/file_watcher.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+// Pipeline that gets rebuilt whenever any of its shaders changes on disk
+struct ReloadablePipeline
+{
+   // Only used for logging
+   std::string name = {};
+   // Compiled shaders relative to FileManager::SHADERS_DIR (as passed to Shader::LoadShader)
+   std::vector< std::string > shaders = {};
+   // Creates new pipeline, called on a background thread. Must not assert on failure (the shader
+   // can be broken or half written), but log it and return VK_NULL_HANDLE instead.
+   std::function< VkPipeline() > build = {};
+   // Installs the new pipeline and returns the one it replaces, called on the render thread
+   std::function< VkPipeline(VkPipeline) > swap = {};
+};
+
+/*
+ * Shader hot reloading. Compiled shaders (*.spv) in FileManager::SHADERS_DIR are watched and the
+ * pipelines using a changed one are rebuilt on a background thread, through the pipeline cache.
+ * Finished pipelines are swapped in by Update at the start of a frame, so rendering never waits
+ * for them. Replaced pipelines are destroyed once no frame in flight can be using them. When
+ * a rebuild fails, the current pipeline is kept until the shader changes again.
+ */
+class ShaderReloader
+{
+ public:
+   static void
+   Init();
+
+   static void
+   Register(ReloadablePipeline pipeline);
+
+   // Has to be called at the start of a frame, once the GPU is done with its frame slot.
+   // Returns true when any pipeline was swapped, command buffers recorded with the replaced ones
+   // have to be re-recorded before they're submitted again.
+   [[nodiscard]] static bool
+   Update();
+
+   // Waits for the rebuild in progress and destroys replaced pipelines, GPU has to be idle
+   static void
+   Shutdown();
+
+ private:
+   struct RebuiltPipeline
+   {
+      size_t index = 0;
+      // VK_NULL_HANDLE when the build failed
+      VkPipeline pipeline = {};
+      // Includes loading the shaders
+      double milliseconds = 0.0;
+   };
+
+   struct RetiredPipeline
+   {
+      VkPipeline pipeline = {};
+      // Value of m_frameNumber when it was replaced
+      uint64_t frame = 0;
+   };
+
+   // Rebuild every pending pipeline on a background thread
+   static void
+   StartRebuild();
+
+ private:
+   inline static std::vector< ReloadablePipeline > m_pipelines = {};
+   inline static utils::FileWatcher m_watcher;
+   // Indices into m_pipelines, waiting for the rebuild in progress to finish
+   inline static std::vector< size_t > m_pending = {};
+   inline static std::future< std::vector< RebuiltPipeline > > m_rebuild = {};
+   inline static std::vector< RetiredPipeline > m_retired = {};
+   inline static uint64_t m_frameNumber = 0;
+};
+
+} // namespace shady::render
@@ -0,0 +1,278 @@
+#include "staging_ring.hpp"
+#include "buffer.hpp"
+#include "common.hpp"
+#include "memory_allocator.hpp"
+#include "trace/logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace shady::render {
+
+namespace {
+
+// Also satisfies the (texel size) offset alignment of buffer -> image copies
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+} // namespace
+
+double
+UploadStats::GetThroughput() const
+{
+   if (milliseconds <= 0.0)
+   {
+      return 0.0;
+   }
+
+   constexpr double bytesInMB = 1024.0 * 1024.0;
+   return (static_cast< double >(bytes) / bytesInMB) / (milliseconds / 1000.0);
+}
+
+void
+StagingRing::Init(VkDeviceSize size)
+{
+   m_size = size;
+   // Each batch is submitted once it reaches a chunk, so a few of them fit into the ring at once
+   m_chunkSize = size / (NUM_BATCHES / 2);
+
+   Buffer::CreateBuffer(m_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        m_buffer, m_memory);
+   m_mapped = static_cast< uint8_t* >(MemoryAllocator::GetMappedMemory(m_buffer));
+
+   VkCommandPoolCreateInfo poolInfo = {};
+   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+                    | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+   poolInfo.queueFamilyIndex = Data::m_graphicsQueueFamily;
+   VK_CHECK(vkCreateCommandPool(Data::vk_device, &poolInfo, nullptr, &m_commandPool),
+            "StagingRing: failed to create command pool!");
+
+   std::array< VkCommandBuffer, NUM_BATCHES > commandBuffers = {};
+   VkCommandBufferAllocateInfo allocInfo = {};
+   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+   allocInfo.commandPool = m_commandPool;
+   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+   allocInfo.commandBufferCount = NUM_BATCHES;
+   VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo, commandBuffers.data()),
+            "StagingRing: failed to allocate command buffers!");
+
+   VkFenceCreateInfo fenceInfo = {};
+   fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+   for (uint32_t i = 0; i < NUM_BATCHES; ++i)
+   {
+      m_batches[i].commandBuffer = commandBuffers[i];
+      VK_CHECK(vkCreateFence(Data::vk_device, &fenceInfo, nullptr, &m_batches[i].fence),
+               "StagingRing: failed to create fence!");
+   }
+
+   m_head = 0;
+   m_tail = 0;
+   m_currentBatch = 0;
+   m_recording = false;
+   m_inFlight.clear();
+
+   trace::Logger::Debug("StagingRing: {} KB ring, {} KB chunks", m_size / 1024,
+                        m_chunkSize / 1024);
+}
+
+void
+StagingRing::Shutdown()
+{
+   Flush();
+
+   for (auto& batch : m_batches)
+   {
+      vkDestroyFence(Data::vk_device, batch.fence, nullptr);
+      batch = {};
+   }
+
+   vkDestroyCommandPool(Data::vk_device, m_commandPool, nullptr);
+   MemoryAllocator::Free(m_buffer);
+   vkDestroyBuffer(Data::vk_device, m_buffer, nullptr);
+
+   m_commandPool = {};
+   m_buffer = {};
+   m_memory = {};
+   m_mapped = nullptr;
+}
+
+void
+StagingRing::Upload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data,
+                    VkDeviceSize size)
+{
+   if (!m_uploading)
+   {
+      m_uploading = true;
+      m_uploadStart = std::chrono::steady_clock::now();
+   }
+
+   const auto* src = static_cast< const uint8_t* >(data);
+   while (size > 0)
+   {
+      const auto chunk = std::min(size, m_chunkSize);
+      const auto offset = Allocate(chunk);
+
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::memcpy(m_mapped + offset, src, chunk);
+
+      VkBufferCopy region = {};
+      region.srcOffset = offset;
+      region.dstOffset = dstOffset;
+      region.size = chunk;
+      vkCmdCopyBuffer(GetCommandBuffer(), m_buffer, dstBuffer, 1, &region);
+
+      m_stats.bytes += chunk;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      src += chunk;
+      dstOffset += chunk;
+      size -= chunk;
+
+      // Let the GPU start on this chunk while the next one is being written
+      if (m_head - m_batchStart >= m_chunkSize)
+      {
+         Submit();
+      }
+   }
+}
+
+void
+StagingRing::Flush()
+{
+   Submit();
+
+   while (!m_inFlight.empty())
+   {
+      WaitOldest();
+   }
+
+   if (m_uploading)
+   {
+      m_uploading = false;
+      m_stats.milliseconds += std::chrono::duration< double, std::milli >(
+                                 std::chrono::steady_clock::now() - m_uploadStart)
+                                 .count();
+   }
+}
+
+const UploadStats&
+StagingRing::GetStats()
+{
+   return m_stats;
+}
+
+void
+StagingRing::ResetStats()
+{
+   m_stats = {};
+}
+
+VkDeviceSize
+StagingRing::Allocate(VkDeviceSize size)
+{
+   auto position = (m_head + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+   // Allocation can't wrap around, skip to the beginning of the ring instead
+   const auto offset = position % m_size;
+   if (offset + size > m_size)
+   {
+      position += m_size - offset;
+   }
+
+   while (position + size - m_tail > m_size)
+   {
+      // Space is held by the batch that's still being recorded, so it has to go first
+      if (m_inFlight.empty())
+      {
+         Submit();
+      }
+
+      WaitOldest();
+   }
+
+   m_head = position + size;
+   return position % m_size;
+}
+
+VkCommandBuffer
+StagingRing::GetCommandBuffer()
+{
+   auto& batch = m_batches[m_currentBatch];
+
+   if (!m_recording)
+   {
+      VkCommandBufferBeginInfo beginInfo = {};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+      VK_CHECK(vkBeginCommandBuffer(batch.commandBuffer, &beginInfo),
+               "StagingRing: failed to begin command buffer!");
+
+      m_recording = true;
+   }
+
+   return batch.commandBuffer;
+}
+
+void
+StagingRing::Submit()
+{
+   if (!m_recording)
+   {
+      return;
+   }
+
+   auto& batch = m_batches[m_currentBatch];
+
+   // Make the copies visible to every kind of read that can consume uploaded buffers
+   VkMemoryBarrier barrier = {};
+   barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+   barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+                           | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT
+                           | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+   vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0,
+                        nullptr);
+
+   VK_CHECK(vkEndCommandBuffer(batch.commandBuffer),
+            "StagingRing: failed to end command buffer!");
+
+   VkSubmitInfo submitInfo = {};
+   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+   submitInfo.commandBufferCount = 1;
+   submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+   VK_CHECK(vkResetFences(Data::vk_device, 1, &batch.fence), "StagingRing: failed to reset fence!");
+   VK_CHECK(vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo, batch.fence),
+            "StagingRing: failed to submit upload!");
+
+   batch.end = m_head;
+   m_inFlight.push_back(m_currentBatch);
+   m_recording = false;
+   m_batchStart = m_head;
+   ++m_stats.submits;
+
+   m_currentBatch = (m_currentBatch + 1) % NUM_BATCHES;
+   // Round robin, so if the next batch is still in flight it's the oldest one
+   if (!m_inFlight.empty() && m_inFlight.front() == m_currentBatch)
+   {
+      WaitOldest();
+   }
+}
+
+void
+StagingRing::WaitOldest()
+{
+   const auto& batch = m_batches[m_inFlight.front()];
+
+   VK_CHECK(vkWaitForFences(Data::vk_device, 1, &batch.fence, VK_TRUE, UINT64_MAX),
+            "StagingRing: failed to wait for upload!");
+   VK_CHECK(vkResetCommandBuffer(batch.commandBuffer, 0),
+            "StagingRing: failed to reset command buffer!");
+
+   m_tail = batch.end;
+   m_inFlight.pop_front();
+}
+
+} // namespace shady::render
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+struct UploadStats
+{
+   uint64_t bytes = 0;
+   // Time from the first Upload to the end of Flush, summed over all flushes
+   double milliseconds = 0.0;
+   uint32_t submits = 0;
+
+   [[nodiscard]] double
+   GetThroughput() const;
+};
+
+// Copies submitted together, see StagingRing
+struct StagingBatch
+{
+   VkCommandBuffer commandBuffer = {};
+   VkFence fence = {};
+   // Ring position (monotonic) right after the last byte used by this batch
+   uint64_t end = 0;
+};
+
+/*
+ * Persistently mapped host visible buffer used as a ring for all CPU -> device local uploads.
+ * Copies are recorded into batches, each batch is submitted once it grows past a chunk, so the
+ * GPU copies one chunk while the next one is written. Uploads larger than a chunk are split,
+ * which bounds the staging memory regardless of the upload size. When the ring is full,
+ * the oldest submitted batch is waited for and its space is reused.
+ *
+ * Uploaded data is only guaranteed to be visible after Flush() (or for any queue submission
+ * that follows it), since batches end with a transfer -> read barrier.
+ */
+class StagingRing
+{
+ public:
+   static constexpr VkDeviceSize DEFAULT_SIZE = VkDeviceSize{32} * 1024 * 1024;
+
+   static void
+   Init(VkDeviceSize size = DEFAULT_SIZE);
+
+   static void
+   Shutdown();
+
+   // Copy 'size' bytes of 'data' to 'dstBuffer' at 'dstOffset'. 'dstBuffer' has to be
+   // created with VK_BUFFER_USAGE_TRANSFER_DST_BIT. 'data' can be reused once this returns.
+   static void
+   Upload(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+   // Submit pending copies and wait until all of them are finished
+   static void
+   Flush();
+
+   // Accumulated since Init (or last ResetStats)
+   [[nodiscard]] static const UploadStats&
+   GetStats();
+
+   static void
+   ResetStats();
+
+ private:
+   // Returns offset within the ring, blocks until enough space is free
+   [[nodiscard]] static VkDeviceSize
+   Allocate(VkDeviceSize size);
+
+   [[nodiscard]] static VkCommandBuffer
+   GetCommandBuffer();
+
+   static void
+   Submit();
+
+   static void
+   WaitOldest();
+
+ private:
+   static constexpr uint32_t NUM_BATCHES = 8;
+
+   inline static VkBuffer m_buffer = {};
+   inline static VkDeviceMemory m_memory = {};
+   inline static uint8_t* m_mapped = nullptr;
+   inline static VkDeviceSize m_size = 0;
+   inline static VkDeviceSize m_chunkSize = 0;
+   inline static VkCommandPool m_commandPool = {};
+
+   // Positions only grow, the actual offset is position % m_size
+   inline static uint64_t m_head = 0;
+   inline static uint64_t m_tail = 0;
+
+   inline static std::array< StagingBatch, NUM_BATCHES > m_batches = {};
+   // Batches are used round robin, the submitted ones are kept in submission order
+   inline static uint32_t m_currentBatch = 0;
+   inline static bool m_recording = false;
+   inline static uint64_t m_batchStart = 0;
+   inline static std::deque< uint32_t > m_inFlight = {};
+
+   inline static bool m_uploading = false;
+   inline static std::chrono::steady_clock::time_point m_uploadStart = {};
+   inline static UploadStats m_stats = {};
+};
+
+} // namespace shady::render
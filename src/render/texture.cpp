@@ -2,9 +2,12 @@
 #include "buffer.hpp"
 #include "command.hpp"
 #include "common.hpp"
+#include "memory_allocator.hpp"
+#include "sampler_cache.hpp"
+#include "texture_cache.hpp"
+#include "texture_streamer.hpp"
 #include "trace/logger.hpp"
 #include "utils/assert.hpp"
-#include "utils/file_manager.hpp"
 
 #undef max
 
@@ -19,10 +22,14 @@ namespace shady::render {
 void
 Texture::Destroy()
 {
-   vkDestroySampler(Data::vk_device, m_textureSampler, nullptr);
+   if (m_placeholder)
+   {
+      return;
+   }
+
    vkDestroyImageView(Data::vk_device, m_textureImageView, nullptr);
+   MemoryAllocator::Free(m_textureImage);
    vkDestroyImage(Data::vk_device, m_textureImage, nullptr);
-   vkFreeMemory(Data::vk_device, m_textureImageMemory, nullptr);
 }
 
 Texture::Texture(TextureType type, std::string_view textureName)
@@ -32,34 +39,61 @@ Texture::Texture(TextureType type, std::string_view textureName)
 
 void
 Texture::CreateTextureImage(TextureType type, std::string_view textureName)
+{
+   // Every level is precomputed by the cache, mapped file is copied to staging as it is
+   const auto texture = TextureCache::Load(type, textureName, utils::ThreadPool::GetShared());
+   const auto data = texture.GetData();
+   CreateImageResources(type, textureName, texture.levels.front().width,
+                        texture.levels.front().height, texture.format,
+                        static_cast< uint32_t >(texture.levels.size()),
+                        TextureCache::GetComponentMapping(texture));
+
+   // Rendering is submitted to the same queue later on, so there's no need to wait for the upload
+   Command::BeginBatch();
+
+   TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mips);
+
+   Buffer::CopyDataToImageWithStaging(m_textureImage, data.data(), data.size(),
+                                      texture.GetCopyRegions());
+
+   TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_mips);
+
+   Command::EndBatch();
+}
+
+void
+Texture::CreateImageResources(TextureType type, std::string_view textureName, uint32_t width,
+                              uint32_t height, VkFormat format, uint32_t mipLevels,
+                              const VkComponentMapping& components)
 {
    m_name = textureName;
    m_type = type;
-   auto textureData = utils::FileManager::ReadTexture(textureName);
-   m_width = textureData.m_size.x;
-   m_height = textureData.m_size.y;
-
-   m_format = type == TextureType::DIFFUSE_MAP ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
-   m_mips = static_cast< uint32_t >(std::floor(std::log2(std::max(m_width, m_height)))) + 1;
+   m_width = width;
+   m_height = height;
+   m_format = format;
+   m_mips = mipLevels;
 
    std::tie(m_textureImage, m_textureImageMemory) = CreateImage(
       m_width, m_height, m_mips, VK_SAMPLE_COUNT_1_BIT, m_format, VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
-         | VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, type == TextureType::CUBE_MAP);
 
    m_textureImageView = CreateImageView(m_textureImage, m_format, VK_IMAGE_ASPECT_COLOR_BIT, m_mips,
-                                        type == TextureType::CUBE_MAP);
+                                        type == TextureType::CUBE_MAP, components);
 
    CreateTextureSampler();
+}
 
-   TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mips);
-
-   CopyBufferToImage(textureData.m_bytes.get());
+Texture
+Texture::CreatePlaceholder(TextureType type, std::string_view textureName, const Texture& fallback)
+{
+   Texture placeholder = fallback;
+   placeholder.m_name = textureName;
+   placeholder.m_type = type;
+   placeholder.m_placeholder = true;
 
-   // transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
-   GenerateMipmaps(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, static_cast< int32_t >(m_width),
-                   static_cast< int32_t >(m_height), m_mips);
+   return placeholder;
 }
 
 std::pair< VkImage, VkDeviceMemory >
@@ -96,20 +130,19 @@ Texture::CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels,
 
    Buffer::AllocateImageMemory(image, imageMemory, properties);
 
-   vkBindImageMemory(Data::vk_device, image, imageMemory, 0);
-
    return {image, imageMemory};
 }
 
 VkImageView
 Texture::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
-                         uint32_t mipLevels, bool cubemap)
+                         uint32_t mipLevels, bool cubemap, const VkComponentMapping& components)
 {
    VkImageViewCreateInfo viewInfo{};
    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
    viewInfo.image = image;
    viewInfo.viewType = not cubemap ? VK_IMAGE_VIEW_TYPE_2D : VK_IMAGE_VIEW_TYPE_CUBE;
    viewInfo.format = format;
+   viewInfo.components = components;
    viewInfo.subresourceRange.baseMipLevel = 0;
    viewInfo.subresourceRange.levelCount = mipLevels;
    viewInfo.subresourceRange.aspectMask = aspectFlags;
@@ -123,128 +156,6 @@ Texture::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspe
    return imageView;
 }
 
-VkSampler
-Texture::CreateSampler(uint32_t mipLevels)
-{
-   VkSampler sampler{};
-
-   VkPhysicalDeviceProperties properties{};
-   vkGetPhysicalDeviceProperties(Data::vk_physicalDevice, &properties);
-
-   VkSamplerCreateInfo samplerInfo{};
-   samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-   samplerInfo.magFilter = VK_FILTER_LINEAR;
-   samplerInfo.minFilter = VK_FILTER_LINEAR;
-   samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-   samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-   samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-   samplerInfo.anisotropyEnable = VK_TRUE;
-   samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
-   samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-   samplerInfo.unnormalizedCoordinates = VK_FALSE;
-   samplerInfo.compareEnable = VK_FALSE;
-   samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-   samplerInfo.minLod = 0.0f;
-   samplerInfo.maxLod = static_cast< float >(mipLevels);
-   samplerInfo.mipLodBias = 0.0f;
-
-   VK_CHECK(vkCreateSampler(Data::vk_device, &samplerInfo, nullptr, &sampler),
-            "Failed to create texture sampler!");
-
-   return sampler;
-}
-
-void
-Texture::GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight,
-                         uint32_t mipLevels)
-{
-   // Check if image format supports linear blitting
-   VkFormatProperties formatProperties;
-   vkGetPhysicalDeviceFormatProperties(Data::vk_physicalDevice, imageFormat, &formatProperties);
-
-   if (!(formatProperties.optimalTilingFeatures
-         & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
-   {
-      utils::Assert(false, "Texture image format does not support linear blitting!");
-   }
-
-   VkCommandBuffer commandBuffer = Command::BeginSingleTimeCommands();
-
-   VkImageMemoryBarrier barrier{};
-   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-   barrier.image = image;
-   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-   barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-   barrier.subresourceRange.baseArrayLayer = 0;
-   barrier.subresourceRange.layerCount = 1;
-   barrier.subresourceRange.levelCount = 1;
-
-   int32_t mipWidth = texWidth;
-   int32_t mipHeight = texHeight;
-
-   for (uint32_t i = 1; i < mipLevels; i++)
-   {
-      barrier.subresourceRange.baseMipLevel = i - 1;
-      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-      VkImageBlit blit{};
-      blit.srcOffsets[0] = {0, 0, 0};
-      blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-      blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      blit.srcSubresource.mipLevel = i - 1;
-      blit.srcSubresource.baseArrayLayer = 0;
-      blit.srcSubresource.layerCount = 1;
-      blit.dstOffsets[0] = {0, 0, 0};
-      blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
-      blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      blit.dstSubresource.mipLevel = i;
-      blit.dstSubresource.baseArrayLayer = 0;
-      blit.dstSubresource.layerCount = 1;
-
-      vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
-                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
-                           &barrier);
-
-      if (mipWidth > 1)
-      {
-         mipWidth /= 2;
-      }
-
-      if (mipHeight > 1)
-      {
-         mipHeight /= 2;
-      }
-   }
-
-   barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-   barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-   barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-   barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-   vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
-                        &barrier);
-
-   Command::EndSingleTimeCommands(commandBuffer);
-}
-
 std::pair< VkImageView, VkSampler >
 Texture::GetImageViewAndSampler() const
 {
@@ -262,10 +173,29 @@ Texture::GetName() const {
    return m_name;
 }
 
+VkImage
+Texture::GetImage() const
+{
+   return m_textureImage;
+}
+
+VkFormat
+Texture::GetFormat() const
+{
+   return m_format;
+}
+
+uint32_t
+Texture::GetMips() const
+{
+   return m_mips;
+}
+
 void
 Texture::CreateTextureSampler()
 {
-   m_textureSampler = CreateSampler(m_mips);
+   // Shared with every other texture with the same number of mips
+   m_textureSampler = SamplerCache::Get({.mipLevels = m_mips});
 }
 
 void
@@ -313,6 +243,8 @@ Texture::CopyBufferToCubemapImage(VkImage image, uint32_t texWidth, uint32_t tex
       bufferCopyRegions.push_back(bufferCopyRegion);
    }
 
+   Command::BeginBatch();
+
    Texture::TransitionImageLayout(image, VK_IMAGE_LAYOUT_UNDEFINED,
                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, true);
 
@@ -320,12 +252,8 @@ Texture::CopyBufferToCubemapImage(VkImage image, uint32_t texWidth, uint32_t tex
 
    Texture::TransitionImageLayout(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, true);
-}
 
-void
-Texture::CopyBufferToImage(uint8_t* data)
-{
-   CopyBufferToImage(m_textureImage, m_width, m_height, data);
+   Command::EndBatch();
 }
 
 void
@@ -420,6 +348,13 @@ TextureLibrary::CreateTexture(TextureType type, const std::string& textureName)
    }
 }
 
+void
+TextureLibrary::MakeResident(Texture&& texture)
+{
+   const auto name = texture.GetName();
+   s_loadedTextures[name] = std::move(texture);
+}
+
 void
 TextureLibrary::Clear()
 {
@@ -429,7 +364,19 @@ TextureLibrary::Clear()
 void
 TextureLibrary::LoadTexture(TextureType type, std::string_view textureName)
 {
-   s_loadedTextures[std::string{textureName}] = {type, textureName};
+   // Fallback has to be there right away and cube maps aren't streamed
+   if (!TextureStreamer::IsEnabled() || textureName == FALLBACK_TEXTURE
+       || type == TextureType::CUBE_MAP)
+   {
+      s_loadedTextures[std::string{textureName}] = {type, textureName};
+      return;
+   }
+
+   auto placeholder = Texture::CreatePlaceholder(
+      type, textureName, GetTexture(TextureType::DIFFUSE_MAP, std::string{FALLBACK_TEXTURE}));
+   s_loadedTextures[std::string{textureName}] = std::move(placeholder);
+
+   TextureStreamer::Request(type, std::string{textureName});
 }
 
 } // namespace shady::render
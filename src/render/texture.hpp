@@ -17,24 +17,30 @@ class Texture
    void
    Destroy();
 
+   // Uploads every level of the cached texture (see TextureCache)
    void
    CreateTextureImage(TextureType type, std::string_view textureName);
 
+   // Create image, view and sampler. Content of the image is undefined, it's meant to be filled
+   // with precomputed levels. 'components' swizzles the image view.
+   void
+   CreateImageResources(TextureType type, std::string_view textureName, uint32_t width,
+                        uint32_t height, VkFormat format, uint32_t mipLevels,
+                        const VkComponentMapping& components = {});
+
+   // Texture named 'textureName' that uses resources of 'fallback' until it's loaded
+   [[nodiscard]] static Texture
+   CreatePlaceholder(TextureType type, std::string_view textureName, const Texture& fallback);
+
    static std::pair< VkImage, VkDeviceMemory >
    CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels,
                VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling,
                VkImageUsageFlags usage, VkMemoryPropertyFlags properties, bool cubemap = false);
 
-   static void
-   GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight,
-                   uint32_t mipLevels);
-
    static VkImageView
    CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags,
-                   uint32_t mipLevels, bool cubemap = false);
-
-   static VkSampler
-   CreateSampler(uint32_t mipLevels = 1);
+                   uint32_t mipLevels, bool cubemap = false,
+                   const VkComponentMapping& components = {});
 
    static void
    TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
@@ -58,13 +64,19 @@ class Texture
    [[nodiscard]] std::string
    GetName() const;
 
+   [[nodiscard]] VkImage
+   GetImage() const;
+
+   [[nodiscard]] VkFormat
+   GetFormat() const;
+
+   [[nodiscard]] uint32_t
+   GetMips() const;
+
  private:
    void
    TransitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
 
-   void
-   CopyBufferToImage(uint8_t* data);
-
  private:
    TextureType m_type = {};
    VkImage m_textureImage = {};
@@ -77,20 +89,30 @@ class Texture
    uint32_t m_width = {};
    uint32_t m_height = {};
    std::string m_name = "196.png";
+   // Placeholders don't own their resources
+   bool m_placeholder = false;
 };
 
 class TextureLibrary
 {
  public:
+   // Used for missing textures and while the textures are being streamed
+   static constexpr std::string_view FALLBACK_TEXTURE = "196.png";
+
    static const Texture&
    GetTexture(TextureType type, const std::string& textureName);
 
    static const Texture&
    GetTexture(const std::string& textureName);
 
+   // Streamed (see TextureStreamer) when it's enabled, placeholder is used until then
    static void
    CreateTexture(TextureType type, const std::string& textureName);
 
+   // Replace the placeholder with the streamed texture
+   static void
+   MakeResident(Texture&& texture);
+
    static void
    Clear();
 
@@ -0,0 +1,275 @@
+#include "texture_cache.hpp"
+#include "bc_encoder.hpp"
+#include "common.hpp"
+#include "mip_filter.hpp"
+#include "trace/logger.hpp"
+#include "utils/assert.hpp"
+#include "utils/atomic_file.hpp"
+#include "utils/file_manager.hpp"
+#include "utils/hash.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fmt/format.h>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace shady::render {
+
+namespace {
+
+constexpr std::string_view SOURCE_HASH_KEY = "ShadySourceHash";
+constexpr std::string_view SWIZZLE_KEY = "KTXswizzle";
+constexpr std::string_view WRITER_KEY = "KTXwriter";
+
+constexpr std::array< std::string_view, 5 > BLOCK_FORMAT_NAMES = {"BC1", "BC3", "BC4", "BC5",
+                                                                  "BC7"};
+
+/*
+ * Picks the block format for 'type' and moves the channels it stores to the front of 'pixels'.
+ * Returns the swizzle (KTXswizzle) which maps them back, empty for identity.
+ */
+std::pair< BlockFormat, std::string >
+prepareChannels(TextureType type, std::vector< uint8_t >& pixels)
+{
+   switch (type)
+   {
+      case TextureType::NORMAL_MAP:
+         return {BlockFormat::BC5, ""};
+
+      case TextureType::SPECULAR_MAP: {
+         // glTF metallic-roughness, roughness is in G and metallic in B
+         const auto metallic = pixels[2];
+         auto constantMetallic = metallic == 0 || metallic == 255;
+         for (size_t texel = 0; texel < pixels.size(); texel += 4)
+         {
+            constantMetallic = constantMetallic && pixels[texel + 2] == metallic;
+            pixels[texel] = pixels[texel + 1];
+            pixels[texel + 1] = pixels[texel + 2];
+         }
+
+         if (constantMetallic)
+         {
+            return {BlockFormat::BC4, metallic == 0 ? "0r01" : "0r11"};
+         }
+         return {BlockFormat::BC5, "0rg1"};
+      }
+
+      case TextureType::DIFFUSE_MAP:
+      default:
+         return {BlockFormat::BC7, ""};
+   }
+}
+
+ColorSpace
+getColorSpace(TextureType type)
+{
+   switch (type)
+   {
+      case TextureType::DIFFUSE_MAP:
+         return ColorSpace::SRGB;
+      case TextureType::NORMAL_MAP:
+         return ColorSpace::NORMAL;
+      default:
+         return ColorSpace::LINEAR;
+   }
+}
+
+VkComponentSwizzle
+toComponentSwizzle(char component)
+{
+   switch (component)
+   {
+      case 'r':
+         return VK_COMPONENT_SWIZZLE_R;
+      case 'g':
+         return VK_COMPONENT_SWIZZLE_G;
+      case 'b':
+         return VK_COMPONENT_SWIZZLE_B;
+      case 'a':
+         return VK_COMPONENT_SWIZZLE_A;
+      case '0':
+         return VK_COMPONENT_SWIZZLE_ZERO;
+      case '1':
+         return VK_COMPONENT_SWIZZLE_ONE;
+      default:
+         return VK_COMPONENT_SWIZZLE_IDENTITY;
+   }
+}
+
+} // namespace
+
+void
+TextureCache::Init()
+{
+   VkPhysicalDeviceFeatures features = {};
+   vkGetPhysicalDeviceFeatures(Data::vk_physicalDevice, &features);
+
+   constexpr std::array formats = {VK_FORMAT_BC4_UNORM_BLOCK, VK_FORMAT_BC5_UNORM_BLOCK,
+                                   VK_FORMAT_BC7_SRGB_BLOCK};
+   constexpr VkFormatFeatureFlags requiredFeatures =
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+      | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+
+   m_blockCompressed = features.textureCompressionBC == VK_TRUE
+               && std::all_of(formats.begin(), formats.end(), [](VkFormat format) {
+                     VkFormatProperties properties = {};
+                     vkGetPhysicalDeviceFormatProperties(Data::vk_physicalDevice, format,
+                                                         &properties);
+                     return (properties.optimalTilingFeatures & requiredFeatures)
+                            == requiredFeatures;
+                  });
+
+   trace::Logger::Info("TextureCache: {}", m_blockCompressed
+                                              ? "textures are block compressed"
+                                              : "BC formats aren't supported, textures are "
+                                                "stored uncompressed");
+}
+
+bool
+TextureCache::IsBlockCompressed()
+{
+   return m_blockCompressed;
+}
+
+KtxTexture
+TextureCache::Load(TextureType type, std::string_view textureName, utils::ThreadPool& threadPool)
+{
+   utils::Assert(type != TextureType::CUBE_MAP, "TextureCache: cube maps can't be cached!");
+
+   const auto sourceHash =
+      utils::HashFile(utils::FileManager::TEXTURES_DIR / textureName, ENCODER_VERSION);
+   const auto sourceKey = fmt::format("{:016x}", sourceHash);
+   const auto cachePath = GetCachePath(type, textureName);
+
+   auto cached = ReadKtx2(cachePath);
+   if (cached && cached->FindValue(SOURCE_HASH_KEY) == sourceKey)
+   {
+      trace::Logger::Debug("TextureCache: loaded {}", cachePath.string());
+      return std::move(*cached);
+   }
+
+   trace::Logger::Debug("TextureCache: {} for {}", cached ? "stale cache" : "no cache",
+                        textureName);
+
+   auto texture = Encode(type, textureName, threadPool);
+   texture.keyValues.emplace_back(SOURCE_HASH_KEY, sourceKey);
+   Write(cachePath, texture);
+
+   return texture;
+}
+
+VkComponentMapping
+TextureCache::GetComponentMapping(const KtxTexture& texture)
+{
+   const auto swizzle = texture.FindValue(SWIZZLE_KEY);
+   if (swizzle.size() != 4)
+   {
+      return {};
+   }
+
+   return {toComponentSwizzle(swizzle[0]), toComponentSwizzle(swizzle[1]),
+           toComponentSwizzle(swizzle[2]), toComponentSwizzle(swizzle[3])};
+}
+
+KtxTexture
+TextureCache::Encode(TextureType type, std::string_view textureName, utils::ThreadPool& threadPool)
+{
+   const auto start = std::chrono::steady_clock::now();
+
+   const auto image = utils::FileManager::ReadTexture(textureName);
+   auto width = image.m_size.x;
+   auto height = image.m_size.y;
+
+   // Always decoded as RGBA
+   std::vector< uint8_t > pixels(image.m_bytes.get(),
+                                 image.m_bytes.get() + size_t{width} * height * 4);
+
+   const auto srgb = type == TextureType::DIFFUSE_MAP;
+
+   KtxTexture texture;
+   texture.keyValues.emplace_back(WRITER_KEY, "Shady");
+
+   auto blockFormat = BlockFormat::BC7;
+   if (m_blockCompressed)
+   {
+      std::string swizzle;
+      std::tie(blockFormat, swizzle) = prepareChannels(type, pixels);
+
+      texture.format = GetVkFormat(blockFormat, srgb);
+      if (!swizzle.empty())
+      {
+         texture.keyValues.emplace_back(SWIZZLE_KEY, swizzle);
+      }
+   }
+   else
+   {
+      texture.format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+   }
+
+   // Moved channels keep their color space, so every level is filtered from the previous one
+   const auto colorSpace = getColorSpace(type);
+
+   // Rows (or blocks) of each level are split across the pool
+   while (true)
+   {
+      const auto level = m_blockCompressed
+                            ? CompressImage(blockFormat, pixels, width, height, &threadPool)
+                            : pixels;
+      texture.levels.push_back({width, height, texture.data.size(), level.size()});
+      texture.data.insert(texture.data.end(), level.begin(), level.end());
+
+      if (width == 1 && height == 1)
+      {
+         break;
+      }
+
+      pixels =
+         DownsampleImage(pixels, width, height, colorSpace, MipFilter::KAISER, &threadPool);
+      width = std::max(width / 2, 1U);
+      height = std::max(height / 2, 1U);
+   }
+
+   trace::Logger::Debug("TextureCache: encoded {} as {} ({}x{}, {} levels) in {:.2f}ms",
+                        textureName,
+                        m_blockCompressed ? BLOCK_FORMAT_NAMES[static_cast< size_t >(blockFormat)]
+                                          : "RGBA8",
+                        texture.levels.front().width, texture.levels.front().height,
+                        texture.levels.size(),
+                        std::chrono::duration< double, std::milli >(
+                           std::chrono::steady_clock::now() - start)
+                           .count());
+
+   return texture;
+}
+
+void
+TextureCache::Write(const std::filesystem::path& cachePath, const KtxTexture& texture)
+{
+   const auto written = utils::WriteFileAtomic(
+      cachePath, [&texture](std::ostream& stream) { return WriteKtx2(stream, texture); });
+   if (!written)
+   {
+      return;
+   }
+
+   trace::Logger::Debug("TextureCache: written {}", cachePath.string());
+}
+
+std::filesystem::path
+TextureCache::GetCachePath(TextureType type, std::string_view textureName)
+{
+   // The same image can be used as different types, which are encoded differently. Block
+   // compressed and uncompressed versions are kept apart, as they depend on the device.
+   const auto nameHash = std::hash< std::string >{}(fmt::format(
+      "{}:{}:{}", static_cast< int32_t >(type), textureName, m_blockCompressed));
+
+   return utils::FileManager::CACHE_DIR / "textures"
+          / fmt::format("{}-{:016x}.ktx2", std::filesystem::path(textureName).stem().string(),
+                        nameHash);
+}
+
+} // namespace shady::render
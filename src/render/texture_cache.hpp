@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ktx2.hpp"
+#include "types.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+/*
+ * Textures from FileManager::TEXTURES_DIR with their full mip chain, stored as KTX2 files in
+ * FileManager::CACHE_DIR. Mip levels are built (see DownsampleImage) and encoded the first time
+ * the texture is loaded, later loads map the cached file whose levels are uploaded as they are,
+ * so nothing is filtered or encoded on the load path.
+ *
+ *   DIFFUSE_MAP  -> BC7 (sRGB), filtered in linear space
+ *   NORMAL_MAP   -> BC5 of X and Y, Z is reconstructed in the shader. Filtered normals are
+ *                   renormalized.
+ *   SPECULAR_MAP -> BC5 of roughness (G) and metallic (B), or BC4 of roughness when metallic
+ *                   is either 0 or 1 everywhere. Image view's swizzle (KTXswizzle) moves the
+ *                   channels back where the shader expects them.
+ *
+ * Devices without BC formats get RGBA8 levels instead (sRGB only for DIFFUSE_MAP).
+ * Cache is only valid for the same source file content (hash) and ENCODER_VERSION.
+ */
+class TextureCache
+{
+ public:
+   // Has to be bumped whenever the encoded data changes
+   static constexpr uint32_t ENCODER_VERSION = 2;
+
+   // Checks that the device can sample every block compressed format the cache uses
+   static void
+   Init();
+
+   // Textures are stored uncompressed when the device doesn't support BC formats
+   [[nodiscard]] static bool
+   IsBlockCompressed();
+
+   // Cached texture, encoded (and written to the cache) when there's no valid one. Encoding is
+   // split across 'threadPool', which may be the pool the caller runs on. Thread safe.
+   [[nodiscard]] static KtxTexture
+   Load(TextureType type, std::string_view textureName, utils::ThreadPool& threadPool);
+
+   // Image view swizzle of 'texture'
+   [[nodiscard]] static VkComponentMapping
+   GetComponentMapping(const KtxTexture& texture);
+
+ private:
+   [[nodiscard]] static KtxTexture
+   Encode(TextureType type, std::string_view textureName, utils::ThreadPool& threadPool);
+
+   // Failing to write the cache is not an error, texture will just be encoded next time
+   static void
+   Write(const std::filesystem::path& cachePath, const KtxTexture& texture);
+
+   [[nodiscard]] static std::filesystem::path
+   GetCachePath(TextureType type, std::string_view textureName);
+
+ private:
+   inline static bool m_blockCompressed = false;
+};
+
+} // namespace shady::render
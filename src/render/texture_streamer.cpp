@@ -0,0 +1,404 @@
+#include "texture_streamer.hpp"
+#include "buffer.hpp"
+#include "common.hpp"
+#include "memory_allocator.hpp"
+#include "texture_cache.hpp"
+#include "trace/logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+namespace shady::render {
+
+namespace {
+
+uint64_t
+streamingImageSize(const DecodedTexture& decoded)
+{
+   return decoded.texture.GetData().size();
+}
+
+} // namespace
+
+void
+TextureStreamer::Init()
+{
+   VkCommandPoolCreateInfo poolInfo = {};
+   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+   poolInfo.queueFamilyIndex = Data::m_transferQueueFamily;
+   VK_CHECK(vkCreateCommandPool(Data::vk_device, &poolInfo, nullptr, &m_transferCommandPool),
+            "TextureStreamer: failed to create transfer command pool!");
+
+   poolInfo.queueFamilyIndex = Data::m_graphicsQueueFamily;
+   VK_CHECK(vkCreateCommandPool(Data::vk_device, &poolInfo, nullptr, &m_graphicsCommandPool),
+            "TextureStreamer: failed to create graphics command pool!");
+
+   // Rest of the cores stay free for the render thread and mesh decoding
+   const auto numWorkers = std::max(std::thread::hardware_concurrency() / 2, 1U);
+   m_decodePool = std::make_unique< utils::ThreadPool >(numWorkers);
+   m_enabled = true;
+
+   trace::Logger::Debug("TextureStreamer: {} decode threads, {} queue for uploads", numWorkers,
+                        Data::m_transferQueueFamily != Data::m_graphicsQueueFamily ? "transfer"
+                                                                                  : "graphics");
+}
+
+void
+TextureStreamer::Shutdown()
+{
+   // Workers finish the queued decodes before they're joined
+   m_decodePool.reset();
+   m_enabled = false;
+
+   for (auto& batch : m_inFlight)
+   {
+      VK_CHECK(vkWaitForFences(Data::vk_device, 1, &batch.fence, VK_TRUE, UINT64_MAX),
+               "TextureStreamer: failed to wait for upload!");
+      for (auto& texture : batch.textures)
+      {
+         texture.Destroy();
+      }
+      Retire(batch);
+   }
+   m_inFlight.clear();
+   m_decoded.clear();
+
+   vkDestroyCommandPool(Data::vk_device, m_transferCommandPool, nullptr);
+   vkDestroyCommandPool(Data::vk_device, m_graphicsCommandPool, nullptr);
+   m_transferCommandPool = {};
+   m_graphicsCommandPool = {};
+}
+
+bool
+TextureStreamer::IsEnabled()
+{
+   return m_enabled;
+}
+
+void
+TextureStreamer::Request(TextureType type, const std::string& textureName)
+{
+   {
+      const std::lock_guard lock(m_mutex);
+      if (m_pending == 0)
+      {
+         m_start = std::chrono::steady_clock::now();
+      }
+      ++m_pending;
+      ++m_stats.requested;
+   }
+
+   // Pool is captured, as the member is already reset while the queued decodes finish
+   m_decodePool->Submit([type, textureName, decodePool = m_decodePool.get()] {
+      // Missing texture shouldn't bring the whole application down, placeholder is kept instead
+      if (!std::filesystem::exists(utils::FileManager::TEXTURES_DIR / textureName))
+      {
+         trace::Logger::Warn("TextureStreamer: {} not found, using the fallback texture",
+                             textureName);
+         Finished(1, false);
+         return;
+      }
+
+      // Encoding of uncached textures stays on the streaming pool, so it doesn't hold up the
+      // mesh decoding running on the shared one
+      DecodedTexture decoded = {type, textureName,
+                                TextureCache::Load(type, textureName, *decodePool)};
+
+      const std::lock_guard lock(m_mutex);
+      m_decoded.push_back(std::move(decoded));
+   });
+}
+
+std::vector< std::string >
+TextureStreamer::Update()
+{
+   std::vector< std::string > resident;
+
+   // Batches are submitted in order, so the first unfinished one ends the search
+   while (!m_inFlight.empty()
+          && vkGetFenceStatus(Data::vk_device, m_inFlight.front().fence) == VK_SUCCESS)
+   {
+      auto& batch = m_inFlight.front();
+      for (auto& texture : batch.textures)
+      {
+         resident.push_back(texture.GetName());
+         TextureLibrary::MakeResident(std::move(texture));
+      }
+
+      Retire(batch);
+      m_inFlight.pop_front();
+   }
+
+   if (!resident.empty())
+   {
+      Finished(static_cast< uint32_t >(resident.size()), true);
+   }
+
+   std::vector< DecodedTexture > decoded;
+   {
+      const std::lock_guard lock(m_mutex);
+
+      // At least one texture per frame, no matter how big it is
+      uint64_t bytes = 0;
+      auto last = m_decoded.begin();
+      while (last != m_decoded.end()
+             && (last == m_decoded.begin()
+                 || bytes + streamingImageSize(*last) <= MAX_UPLOAD_BYTES_PER_FRAME))
+      {
+         bytes += streamingImageSize(*last);
+         ++last;
+      }
+
+      decoded.assign(std::make_move_iterator(m_decoded.begin()), std::make_move_iterator(last));
+      m_decoded.erase(m_decoded.begin(), last);
+   }
+
+   if (!decoded.empty())
+   {
+      Submit(std::move(decoded));
+   }
+
+   return resident;
+}
+
+bool
+TextureStreamer::IsIdle()
+{
+   const std::lock_guard lock(m_mutex);
+   return m_pending == 0;
+}
+
+StreamingStats
+TextureStreamer::GetStats()
+{
+   const std::lock_guard lock(m_mutex);
+   return m_stats;
+}
+
+void
+TextureStreamer::Submit(std::vector< DecodedTexture >&& decoded)
+{
+   const auto dedicatedTransfer = Data::m_transferQueueFamily != Data::m_graphicsQueueFamily;
+
+   StreamingBatch batch;
+
+   VkCommandBufferAllocateInfo allocInfo = {};
+   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+   allocInfo.commandBufferCount = 1;
+
+   allocInfo.commandPool = m_graphicsCommandPool;
+   VK_CHECK(vkAllocateCommandBuffers(Data::vk_device, &allocInfo, &batch.graphicsCommandBuffer),
+            "TextureStreamer: failed to allocate command buffer!");
+
+   // Without dedicated transfer queue, copies and barriers are recorded into the same buffer
+   batch.transferCommandBuffer = batch.graphicsCommandBuffer;
+   if (dedicatedTransfer)
+   {
+      allocInfo.commandPool = m_transferCommandPool;
+      VK_CHECK(
+         vkAllocateCommandBuffers(Data::vk_device, &allocInfo, &batch.transferCommandBuffer),
+         "TextureStreamer: failed to allocate command buffer!");
+
+      VkSemaphoreCreateInfo semaphoreInfo = {};
+      semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+      VK_CHECK(vkCreateSemaphore(Data::vk_device, &semaphoreInfo, nullptr, &batch.transferDone),
+               "TextureStreamer: failed to create semaphore!");
+   }
+
+   VkFenceCreateInfo fenceInfo = {};
+   fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+   VK_CHECK(vkCreateFence(Data::vk_device, &fenceInfo, nullptr, &batch.fence),
+            "TextureStreamer: failed to create fence!");
+
+   VkCommandBufferBeginInfo beginInfo = {};
+   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+   beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+   VK_CHECK(vkBeginCommandBuffer(batch.graphicsCommandBuffer, &beginInfo),
+            "TextureStreamer: failed to begin command buffer!");
+   if (dedicatedTransfer)
+   {
+      VK_CHECK(vkBeginCommandBuffer(batch.transferCommandBuffer, &beginInfo),
+               "TextureStreamer: failed to begin command buffer!");
+   }
+
+   for (const auto& texture : decoded)
+   {
+      RecordUpload(batch, texture);
+   }
+
+   VK_CHECK(vkEndCommandBuffer(batch.graphicsCommandBuffer),
+            "TextureStreamer: failed to end command buffer!");
+
+   VkSubmitInfo submitInfo = {};
+   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+   submitInfo.commandBufferCount = 1;
+
+   // Has to match the source stage of the acquire barriers recorded by RecordUpload
+   const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+   if (dedicatedTransfer)
+   {
+      VK_CHECK(vkEndCommandBuffer(batch.transferCommandBuffer),
+               "TextureStreamer: failed to end command buffer!");
+
+      submitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+      submitInfo.signalSemaphoreCount = 1;
+      submitInfo.pSignalSemaphores = &batch.transferDone;
+      VK_CHECK(vkQueueSubmit(Data::vk_transferQueue, 1, &submitInfo, VK_NULL_HANDLE),
+               "TextureStreamer: failed to submit copies!");
+
+      submitInfo.signalSemaphoreCount = 0;
+      submitInfo.pSignalSemaphores = nullptr;
+      submitInfo.waitSemaphoreCount = 1;
+      submitInfo.pWaitSemaphores = &batch.transferDone;
+      submitInfo.pWaitDstStageMask = &waitStage;
+   }
+
+   submitInfo.pCommandBuffers = &batch.graphicsCommandBuffer;
+   VK_CHECK(vkQueueSubmit(Data::vk_graphicsQueue, 1, &submitInfo, batch.fence),
+            "TextureStreamer: failed to submit ownership transfer!");
+
+   m_inFlight.push_back(std::move(batch));
+}
+
+void
+TextureStreamer::RecordUpload(StreamingBatch& batch, const DecodedTexture& decoded)
+{
+   const auto& source = decoded.texture;
+   const auto& baseLevel = source.levels.front();
+   const auto mips = static_cast< uint32_t >(source.levels.size());
+   const auto data = source.GetData();
+
+   Texture texture;
+   texture.CreateImageResources(decoded.type, decoded.name, baseLevel.width, baseLevel.height,
+                                source.format, mips, TextureCache::GetComponentMapping(source));
+   const auto image = texture.GetImage();
+
+   VkBuffer stagingBuffer = {};
+   VkDeviceMemory stagingMemory = {};
+   Buffer::CreateBuffer(data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        stagingBuffer, stagingMemory);
+   batch.stagingBuffers.push_back(stagingBuffer);
+
+   // Levels keep their layout (and alignment) from the cached file, which is copied as it is
+   std::memcpy(MemoryAllocator::GetMappedMemory(stagingBuffer), data.data(), data.size());
+   const auto regions = source.GetCopyRegions();
+
+   VkImageMemoryBarrier barrier = {};
+   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+   barrier.image = image;
+   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+   barrier.subresourceRange.levelCount = mips;
+   barrier.subresourceRange.layerCount = 1;
+   barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+   barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   barrier.srcAccessMask = 0;
+   barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+   vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+   vkCmdCopyBufferToImage(batch.transferCommandBuffer, stagingBuffer, image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          static_cast< uint32_t >(regions.size()), regions.data());
+
+   // Mip levels are precomputed, all of them go straight to the shader read layout
+   barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+   barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+   if (Data::m_transferQueueFamily != Data::m_graphicsQueueFamily)
+   {
+      // Queue family ownership transfer (with the layout transition), release on the transfer
+      // queue ...
+      barrier.srcQueueFamilyIndex = Data::m_transferQueueFamily;
+      barrier.dstQueueFamilyIndex = Data::m_graphicsQueueFamily;
+      barrier.dstAccessMask = 0;
+
+      vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                           &barrier);
+
+      // ... and acquire on the graphics one. Source stage is the semaphore's wait stage (see
+      // Submit), which chains the acquire (and its layout transition) after the release.
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                           &barrier);
+   }
+   else
+   {
+      vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                           &barrier);
+   }
+
+   {
+      const std::lock_guard lock(m_mutex);
+      m_stats.bytes += data.size();
+      if (TextureCache::IsBlockCompressed())
+      {
+         ++m_stats.compressed;
+      }
+   }
+
+   batch.textures.push_back(std::move(texture));
+}
+
+void
+TextureStreamer::Retire(StreamingBatch& batch)
+{
+   vkFreeCommandBuffers(Data::vk_device, m_graphicsCommandPool, 1, &batch.graphicsCommandBuffer);
+   if (batch.transferCommandBuffer != batch.graphicsCommandBuffer)
+   {
+      vkFreeCommandBuffers(Data::vk_device, m_transferCommandPool, 1,
+                           &batch.transferCommandBuffer);
+      vkDestroySemaphore(Data::vk_device, batch.transferDone, nullptr);
+   }
+   vkDestroyFence(Data::vk_device, batch.fence, nullptr);
+
+   for (const auto buffer : batch.stagingBuffers)
+   {
+      MemoryAllocator::Free(buffer);
+      vkDestroyBuffer(Data::vk_device, buffer, nullptr);
+   }
+
+   batch = {};
+}
+
+void
+TextureStreamer::Finished(uint32_t count, bool resident)
+{
+   const std::lock_guard lock(m_mutex);
+
+   m_pending -= std::min(count, m_pending);
+   if (resident)
+   {
+      m_stats.resident += count;
+   }
+
+   if (m_pending == 0)
+   {
+      m_stats.milliseconds = std::chrono::duration< double, std::milli >(
+                                std::chrono::steady_clock::now() - m_start)
+                                .count();
+
+      trace::Logger::Info("TextureStreamer: {} textures ({:.2f} MB) streamed in {:.2f}ms",
+                          m_stats.resident,
+                          static_cast< double >(m_stats.bytes) / (1024.0 * 1024.0),
+                          m_stats.milliseconds);
+   }
+}
+
+} // namespace shady::render
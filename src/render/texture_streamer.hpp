@@ -0,0 +1,124 @@
+#pragma once
+
+#include "ktx2.hpp"
+#include "texture.hpp"
+#include "types.hpp"
+#include "utils/file_manager.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+struct StreamingStats
+{
+   uint32_t requested = 0;
+   uint32_t resident = 0;
+   // Uploaded in block compressed formats
+   uint32_t compressed = 0;
+   uint64_t bytes = 0;
+   // From the first request until the last requested texture became resident
+   double milliseconds = 0.0;
+};
+
+// Texture loaded (or encoded) by TextureCache on the background pool, waiting for upload
+struct DecodedTexture
+{
+   TextureType type = TextureType::DIFFUSE_MAP;
+   std::string name;
+   KtxTexture texture;
+};
+
+// Textures uploaded with a single submission, see TextureStreamer
+struct StreamingBatch
+{
+   VkCommandBuffer transferCommandBuffer = {};
+   VkCommandBuffer graphicsCommandBuffer = {};
+   // Signaled by the transfer submit, waited for by the graphics (ownership acquire) submit
+   VkSemaphore transferDone = {};
+   VkFence fence = {};
+   std::vector< Texture > textures;
+   std::vector< VkBuffer > stagingBuffers;
+};
+
+/*
+ * Loads textures without blocking the caller. Cached textures (see TextureCache) are loaded on
+ * a background thread pool, Update() (called once per frame) then creates the images and
+ * uploads a limited amount of them per frame. Textures come with all of their levels, which are
+ * copied as they are on the dedicated transfer queue (if the device has one) and the ownership
+ * is transferred to the graphics queue.
+ * TextureLibrary hands out the fallback texture in the meantime, textures returned by Update()
+ * are resident and have replaced their placeholders in TextureLibrary.
+ */
+class TextureStreamer
+{
+ public:
+   // Limits the hitch caused by creating and uploading textures within a single frame
+   static constexpr uint64_t MAX_UPLOAD_BYTES_PER_FRAME = uint64_t{64} * 1024 * 1024;
+
+   static void
+   Init();
+
+   static void
+   Shutdown();
+
+   // Textures are streamed only after Init
+   [[nodiscard]] static bool
+   IsEnabled();
+
+   // Start decoding 'textureName', thread safe
+   static void
+   Request(TextureType type, const std::string& textureName);
+
+   // Retire finished uploads and submit newly decoded textures. Returns names of the textures
+   // that became resident (and were swapped in TextureLibrary) since the last call.
+   [[nodiscard]] static std::vector< std::string >
+   Update();
+
+   // True when every requested texture is resident
+   [[nodiscard]] static bool
+   IsIdle();
+
+   [[nodiscard]] static StreamingStats
+   GetStats();
+
+ private:
+   static void
+   Submit(std::vector< DecodedTexture >&& decoded);
+
+   static void
+   RecordUpload(StreamingBatch& batch, const DecodedTexture& decoded);
+
+   static void
+   Retire(StreamingBatch& batch);
+
+   // 'count' requested textures are done, either resident or failed to load
+   static void
+   Finished(uint32_t count, bool resident);
+
+ private:
+   inline static bool m_enabled = false;
+
+   inline static VkCommandPool m_transferCommandPool = {};
+   inline static VkCommandPool m_graphicsCommandPool = {};
+
+   inline static std::deque< StreamingBatch > m_inFlight = {};
+
+   inline static std::mutex m_mutex = {};
+   inline static std::vector< DecodedTexture > m_decoded = {};
+   inline static uint32_t m_pending = 0;
+   inline static StreamingStats m_stats = {};
+   inline static std::chrono::steady_clock::time_point m_start = {};
+
+   // Declared last, so workers are joined before the members they use are destroyed
+   inline static std::unique_ptr< utils::ThreadPool > m_decodePool = {};
+};
+
+} // namespace shady::render
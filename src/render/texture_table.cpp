@@ -0,0 +1,213 @@
+#include "texture_table.hpp"
+#include "common.hpp"
+#include "trace/logger.hpp"
+#include "utils/assert.hpp"
+
+#include <algorithm>
+
+namespace shady::render {
+
+void
+TextureTable::Init()
+{
+   VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+   indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+   VkPhysicalDeviceProperties2 properties{};
+   properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+   properties.pNext = &indexingProperties;
+   vkGetPhysicalDeviceProperties2(Data::vk_physicalDevice, &properties);
+
+   m_capacity = std::min({MAX_TEXTURES,
+                          indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                          indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages});
+
+   // Binding 0 : Textures (gbuffer.frag)
+   VkDescriptorSetLayoutBinding textures{};
+   textures.binding = 0;
+   textures.descriptorCount = m_capacity;
+   textures.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+   textures.pImmutableSamplers = nullptr;
+   textures.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+   // Slots are written after the set was bound by the prerecorded command buffers, which stay
+   // valid. Slots which were never written (or were released) are not sampled.
+   const VkDescriptorBindingFlags bindingFlags =
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+
+   VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+   bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+   bindingFlagsInfo.bindingCount = 1;
+   bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+   VkDescriptorSetLayoutCreateInfo layoutInfo{};
+   layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+   layoutInfo.pNext = &bindingFlagsInfo;
+   layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+   layoutInfo.bindingCount = 1;
+   layoutInfo.pBindings = &textures;
+
+   VK_CHECK(
+      vkCreateDescriptorSetLayout(Data::vk_device, &layoutInfo, nullptr, &m_descriptorSetLayout),
+      "TextureTable: failed to create descriptor set layout!");
+
+   VkDescriptorPoolSize poolSize{};
+   poolSize.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+   poolSize.descriptorCount = m_capacity * MAX_FRAMES_IN_FLIGHT;
+
+   VkDescriptorPoolCreateInfo poolInfo{};
+   poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+   poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+   poolInfo.poolSizeCount = 1;
+   poolInfo.pPoolSizes = &poolSize;
+   poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+
+   VK_CHECK(vkCreateDescriptorPool(Data::vk_device, &poolInfo, nullptr, &m_descriptorPool),
+            "TextureTable: failed to create descriptor pool!");
+
+   std::array< VkDescriptorSetLayout, MAX_FRAMES_IN_FLIGHT > layouts = {};
+   layouts.fill(m_descriptorSetLayout);
+
+   VkDescriptorSetAllocateInfo allocInfo{};
+   allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+   allocInfo.descriptorPool = m_descriptorPool;
+   allocInfo.descriptorSetCount = static_cast< uint32_t >(layouts.size());
+   allocInfo.pSetLayouts = layouts.data();
+
+   VK_CHECK(vkAllocateDescriptorSets(Data::vk_device, &allocInfo, m_descriptorSets.data()),
+            "TextureTable: failed to allocate descriptor sets!");
+
+   trace::Logger::Debug("TextureTable: {} slots", m_capacity);
+}
+
+uint32_t
+TextureTable::Allocate(VkImageView imageView)
+{
+   uint32_t slot = 0;
+   if (!m_freeSlots.empty())
+   {
+      slot = m_freeSlots.back();
+      m_freeSlots.pop_back();
+   }
+   else
+   {
+      slot = static_cast< uint32_t >(m_slots.size());
+      utils::Assert(slot < m_capacity, "TextureTable: out of texture slots!");
+      m_slots.push_back(VK_NULL_HANDLE);
+   }
+
+   m_slots[slot] = imageView;
+   MarkChanged(slot);
+
+   return slot;
+}
+
+void
+TextureTable::Update(uint32_t slot, VkImageView imageView)
+{
+   utils::Assert(m_slots.at(slot) != VK_NULL_HANDLE, "TextureTable: updating a free slot!");
+
+   m_slots[slot] = imageView;
+   MarkChanged(slot);
+}
+
+void
+TextureTable::Release(uint32_t slot)
+{
+   utils::Assert(m_slots.at(slot) != VK_NULL_HANDLE, "TextureTable: releasing a free slot!");
+
+   // Descriptor is left as it is, partially bound slots are fine as long as nothing samples them
+   m_slots[slot] = VK_NULL_HANDLE;
+   m_releasedSlots.emplace_back(slot, m_numFlushes);
+}
+
+void
+TextureTable::Flush(uint32_t frame)
+{
+   ++m_numFlushes;
+
+   // Every frame in flight has been waited for since these were released
+   std::erase_if(m_releasedSlots, [](const auto& released) {
+      if (m_numFlushes < released.second + MAX_FRAMES_IN_FLIGHT)
+      {
+         return false;
+      }
+
+      m_freeSlots.push_back(released.first);
+      return true;
+   });
+
+   auto& pending = m_pendingWrites.at(frame);
+   if (pending.empty())
+   {
+      return;
+   }
+
+   std::sort(pending.begin(), pending.end());
+   pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+
+   std::vector< VkDescriptorImageInfo > imageInfos;
+   std::vector< VkWriteDescriptorSet > descriptorWrites;
+   imageInfos.reserve(pending.size());
+   descriptorWrites.reserve(pending.size());
+
+   for (const auto slot : pending)
+   {
+      // Released before this frame got to it
+      if (m_slots[slot] == VK_NULL_HANDLE)
+      {
+         continue;
+      }
+
+      auto& imageInfo = imageInfos.emplace_back();
+      imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      imageInfo.imageView = m_slots[slot];
+
+      auto& descriptorWrite = descriptorWrites.emplace_back();
+      descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrite.dstSet = m_descriptorSets.at(frame);
+      descriptorWrite.dstBinding = 0;
+      descriptorWrite.dstArrayElement = slot;
+      descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+      descriptorWrite.descriptorCount = 1;
+      descriptorWrite.pImageInfo = &imageInfo;
+   }
+
+   vkUpdateDescriptorSets(Data::vk_device, static_cast< uint32_t >(descriptorWrites.size()),
+                          descriptorWrites.data(), 0, nullptr);
+   pending.clear();
+}
+
+VkDescriptorSetLayout
+TextureTable::GetDescriptorSetLayout()
+{
+   return m_descriptorSetLayout;
+}
+
+VkDescriptorSet
+TextureTable::GetDescriptorSet(uint32_t frame)
+{
+   return m_descriptorSets.at(frame);
+}
+
+uint32_t
+TextureTable::GetCapacity()
+{
+   return m_capacity;
+}
+
+uint32_t
+TextureTable::GetSize()
+{
+   return static_cast< uint32_t >(m_slots.size() - m_freeSlots.size() - m_releasedSlots.size());
+}
+
+void
+TextureTable::MarkChanged(uint32_t slot)
+{
+   for (auto& pending : m_pendingWrites)
+   {
+      pending.push_back(slot);
+   }
+}
+
+} // namespace shady::render
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::render {
+
+/*
+ * Bindless texture table, a single large array of sampled images (descriptor set 1, binding 0
+ * of the deferred pipeline layout) indexed by PerInstanceBuffer::textures. Slots are handed out
+ * from a free list and only entries that changed are written, so loading models or swapping in
+ * streamed textures never recreates descriptor sets or re-records command buffers.
+ *
+ * The binding is PARTIALLY_BOUND (unused slots are never written) and UPDATE_AFTER_BIND, each
+ * frame in flight has its own set which is only written once the GPU is done with that frame.
+ */
+class TextureTable
+{
+ public:
+   // Upper bound of the table's size, the device limits can lower it
+   static constexpr uint32_t MAX_TEXTURES = 4096;
+
+   static void
+   Init();
+
+   // Returns the slot which samples 'imageView' from the next Flush of every frame
+   [[nodiscard]] static uint32_t
+   Allocate(VkImageView imageView);
+
+   // Point 'slot' to a different image (e.g. streamed texture replacing its placeholder)
+   static void
+   Update(uint32_t slot, VkImageView imageView);
+
+   // Slot is reused once none of the frames in flight can sample it
+   static void
+   Release(uint32_t slot);
+
+   // Write descriptors changed since the last Flush of 'frame'. Should only be called once GPU
+   // is done with the previous use of 'frame' resources.
+   static void
+   Flush(uint32_t frame);
+
+   [[nodiscard]] static VkDescriptorSetLayout
+   GetDescriptorSetLayout();
+
+   [[nodiscard]] static VkDescriptorSet
+   GetDescriptorSet(uint32_t frame);
+
+   [[nodiscard]] static uint32_t
+   GetCapacity();
+
+   // Number of allocated slots
+   [[nodiscard]] static uint32_t
+   GetSize();
+
+ private:
+   static void
+   MarkChanged(uint32_t slot);
+
+ private:
+   inline static uint32_t m_capacity = 0;
+
+   inline static VkDescriptorSetLayout m_descriptorSetLayout = {};
+   inline static VkDescriptorPool m_descriptorPool = {};
+   inline static std::array< VkDescriptorSet, MAX_FRAMES_IN_FLIGHT > m_descriptorSets = {};
+
+   // Image view of every slot ever allocated, VK_NULL_HANDLE for released ones
+   inline static std::vector< VkImageView > m_slots = {};
+   inline static std::vector< uint32_t > m_freeSlots = {};
+   // Released slots with the Flush count at which they were released
+   inline static std::vector< std::pair< uint32_t, uint64_t > > m_releasedSlots = {};
+   inline static uint64_t m_numFlushes = 0;
+
+   // Slots whose descriptors are outdated, per frame in flight
+   inline static std::array< std::vector< uint32_t >, MAX_FRAMES_IN_FLIGHT > m_pendingWrites = {};
+};
+
+} // namespace shady::render
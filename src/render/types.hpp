@@ -7,6 +7,19 @@
 
 namespace shady::render {
 
+// Number of frames CPU can record ahead of the GPU. Every resource written by the CPU
+// each frame (uniforms, GUI geometry, command buffers) is duplicated per frame in flight.
+static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+
+// Upper bound of directional light's shadow cascades, each one is a layer of the shadow map
+static constexpr uint32_t MAX_SHADOW_CASCADES = 4;
+
+// Bits of Data::m_meshFlags, must match cull.comp and cluster_cull.comp
+// Mesh can move, its shadow is drawn every frame over the cached shadow map
+static constexpr uint32_t MESH_FLAG_DYNAMIC = 1;
+// Mesh is drawn by its meshlets when cluster culling is enabled
+static constexpr uint32_t MESH_FLAG_MESHLETS = 2;
+
 enum class TextureType : std::uint8_t
 {
    DIFFUSE_MAP = 0,
@@ -20,6 +33,8 @@ struct UniformBufferObject
    glm::mat4 proj = {};
    glm::mat4 view = {};
    glm::mat4 lightView = {};
+   // Light space matrix of every shadow cascade (shadow_cascade.vert)
+   std::array< glm::mat4, MAX_SHADOW_CASCADES > cascadeViewProjection = {};
 };
 
 struct DebugData
@@ -30,10 +45,15 @@ struct DebugData
    float shadowFactor = 0.1f;
 };
 
+// Must match 'PerInstance' in vertex_common.glsl (std430)
 struct PerInstanceBuffer
 {
    glm::mat4 model = {};
    glm::vec4 textures = {};
+   // Model space bounds of the mesh (xyz minimum and extent), packed vertex positions are
+   // quantized within them (see PackedVertex)
+   glm::vec4 positionOffset = {};
+   glm::vec4 positionScale = {};
 };
 
 // DIFFUSE_MAP SPECULAR_MAP NORMAL_MAP
@@ -0,0 +1,75 @@
+#include "vertex.hpp"
+#include "utils/assert.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+
+namespace shady::render {
+
+namespace {
+
+int16_t
+packSnorm(float value)
+{
+   return static_cast< int16_t >(std::round(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+uint16_t
+packUnorm(float value)
+{
+   return static_cast< uint16_t >(std::round(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+// Unit vector mapped onto an octahedron unfolded into [-1, 1]^2 (decoded in vertex_common.glsl)
+std::array< int16_t, 2 >
+packDirection(const glm::vec3& direction)
+{
+   const auto length = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+   if (length == 0.0f)
+   {
+      return {0, 0};
+   }
+
+   auto encoded = glm::vec2(direction) / length;
+   if (direction.z < 0.0f)
+   {
+      const auto signX = encoded.x >= 0.0f ? 1.0f : -1.0f;
+      const auto signY = encoded.y >= 0.0f ? 1.0f : -1.0f;
+      encoded = glm::vec2{(1.0f - std::abs(encoded.y)) * signX,
+                          (1.0f - std::abs(encoded.x)) * signY};
+   }
+
+   return {packSnorm(encoded.x), packSnorm(encoded.y)};
+}
+
+} // namespace
+
+void
+PackVertices(std::span< const Vertex > vertices, const glm::vec3& boundsMin,
+             const glm::vec3& boundsExtent, std::span< PackedVertex > packed)
+{
+   utils::Assert(vertices.size() == packed.size(),
+                 "PackVertices: output has to be as large as the input!");
+
+   // Flat meshes have zero extent along one axis, their positions there are all 'boundsMin'
+   const auto scale = glm::vec3{
+      boundsExtent.x > 0.0f ? 1.0f / boundsExtent.x : 0.0f,
+      boundsExtent.y > 0.0f ? 1.0f / boundsExtent.y : 0.0f,
+      boundsExtent.z > 0.0f ? 1.0f / boundsExtent.z : 0.0f};
+
+   for (size_t idx = 0; idx < vertices.size(); ++idx)
+   {
+      const auto& vertex = vertices[idx];
+      auto& out = packed[idx];
+
+      const auto position = (vertex.m_position - boundsMin) * scale;
+      out.m_position = {packUnorm(position.x), packUnorm(position.y), packUnorm(position.z), 0};
+      out.m_normal = packDirection(vertex.m_normal);
+      out.m_texCoords = {glm::packHalf1x16(vertex.m_texCoords.x),
+                         glm::packHalf1x16(vertex.m_texCoords.y)};
+      out.m_tangent = packDirection(vertex.m_tangent);
+   }
+}
+
+} // namespace shady::render
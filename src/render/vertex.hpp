@@ -1,85 +1,124 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
 #include <glm/glm.hpp>
+#include <span>
 #include <vulkan/vulkan.h>
 
 namespace shady::render {
 
-struct SkyboxVertex
+// Single member of a vertex, members of a layout get consecutive shader locations
+struct VertexAttribute
 {
-   glm::vec3 m_position;
-
-   static auto
-   getBindingDescription()
-   {
-      VkVertexInputBindingDescription bindingDescription{};
-      bindingDescription.binding = 0;
-      bindingDescription.stride = sizeof(SkyboxVertex);
-      bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-      return bindingDescription;
-   }
+   VkFormat format = VK_FORMAT_UNDEFINED;
+   uint32_t offset = 0;
+};
 
-   static auto
-   getAttributeDescriptions()
-   {
-      std::array< VkVertexInputAttributeDescription, 1 > attributeDescriptions{};
+// Specialized for every vertex type, 'ATTRIBUTES' lists its members in shader location order
+template < typename T >
+struct VertexLayout;
 
-      attributeDescriptions[0].binding = 0;
-      attributeDescriptions[0].location = 0;
-      attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-      attributeDescriptions[0].offset = offsetof(SkyboxVertex, m_position);
+struct SkyboxVertex
+{
+   glm::vec3 m_position;
+};
 
-      return attributeDescriptions;
-   }
+template <>
+struct VertexLayout< SkyboxVertex >
+{
+   static constexpr std::array ATTRIBUTES = {
+      VertexAttribute{VK_FORMAT_R32G32B32_SFLOAT, offsetof(SkyboxVertex, m_position)}};
 };
 
+// Full precision vertex, everything on the CPU side (loading, caching, simplification) uses it
 struct Vertex
 {
    glm::vec3 m_position;
    glm::vec3 m_normal;
    glm::vec2 m_texCoords;
    glm::vec3 m_tangent;
+};
 
-   static auto
-   getBindingDescription()
-   {
-      VkVertexInputBindingDescription bindingDescription{};
-      bindingDescription.binding = 0;
-      bindingDescription.stride = sizeof(Vertex);
-      bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+template <>
+struct VertexLayout< Vertex >
+{
+   static constexpr std::array ATTRIBUTES = {
+      VertexAttribute{VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, m_position)},
+      VertexAttribute{VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, m_normal)},
+      VertexAttribute{VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, m_texCoords)},
+      VertexAttribute{VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, m_tangent)}};
+};
 
-      return bindingDescription;
-   }
+/*
+ * Compact form of Vertex. Position is quantized within the bounds of its mesh (see
+ * PerInstanceBuffer::positionOffset), normal and tangent are octahedral encoded and texture
+ * coordinates are half floats. Decoded by the mesh vertex shaders (vertex_common.glsl).
+ */
+struct PackedVertex
+{
+   // [0, 1] within the mesh's bounds, w is unused and keeps the position 8 bytes wide
+   std::array< uint16_t, 4 > m_position;
+   std::array< int16_t, 2 > m_normal;
+   std::array< uint16_t, 2 > m_texCoords;
+   std::array< int16_t, 2 > m_tangent;
+};
 
-   static auto
-   getAttributeDescriptions()
-   {
-      std::array< VkVertexInputAttributeDescription, 4 > attributeDescriptions{};
+template <>
+struct VertexLayout< PackedVertex >
+{
+   static constexpr std::array ATTRIBUTES = {
+      VertexAttribute{VK_FORMAT_R16G16B16A16_UNORM, offsetof(PackedVertex, m_position)},
+      VertexAttribute{VK_FORMAT_R16G16_SNORM, offsetof(PackedVertex, m_normal)},
+      VertexAttribute{VK_FORMAT_R16G16_SFLOAT, offsetof(PackedVertex, m_texCoords)},
+      VertexAttribute{VK_FORMAT_R16G16_SNORM, offsetof(PackedVertex, m_tangent)}};
+};
 
-      attributeDescriptions[0].binding = 0;
-      attributeDescriptions[0].location = 0;
-      attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-      attributeDescriptions[0].offset = offsetof(Vertex, m_position);
+static_assert(sizeof(PackedVertex) == 20);
 
-      attributeDescriptions[1].binding = 0;
-      attributeDescriptions[1].location = 1;
-      attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-      attributeDescriptions[1].offset = offsetof(Vertex, m_normal);
+// Layout of the mesh vertex buffer, selected by SHADY_PACKED_VERTICES (CMake option). Shaders
+// drawing meshes are compiled with matching PACKED_VERTICES define.
+#if SHADY_PACKED_VERTICES
+using GpuVertex = PackedVertex;
+#else
+using GpuVertex = Vertex;
+#endif
 
-      attributeDescriptions[2].binding = 0;
-      attributeDescriptions[2].location = 2;
-      attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-      attributeDescriptions[2].offset = offsetof(Vertex, m_texCoords);
+template < typename T >
+VkVertexInputBindingDescription
+GetBindingDescription(uint32_t binding = 0)
+{
+   VkVertexInputBindingDescription bindingDescription{};
+   bindingDescription.binding = binding;
+   bindingDescription.stride = sizeof(T);
+   bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+   return bindingDescription;
+}
 
-      attributeDescriptions[3].binding = 0;
-      attributeDescriptions[3].location = 3;
-      attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-      attributeDescriptions[3].offset = offsetof(Vertex, m_tangent);
+template < typename T >
+auto
+GetAttributeDescriptions(uint32_t binding = 0)
+{
+   constexpr auto& attributes = VertexLayout< T >::ATTRIBUTES;
 
-      return attributeDescriptions;
+   std::array< VkVertexInputAttributeDescription, attributes.size() > attributeDescriptions{};
+   for (uint32_t location = 0; location < attributes.size(); ++location)
+   {
+      attributeDescriptions[location].binding = binding;
+      attributeDescriptions[location].location = location;
+      attributeDescriptions[location].format = attributes[location].format;
+      attributeDescriptions[location].offset = attributes[location].offset;
    }
-};
+
+   return attributeDescriptions;
+}
+
+// Encodes 'vertices' into 'packed' (of the same size), positions are quantized within the box
+// starting at 'boundsMin' with size 'boundsExtent'
+void
+PackVertices(std::span< const Vertex > vertices, const glm::vec3& boundsMin,
+             const glm::vec3& boundsExtent, std::span< PackedVertex > packed);
 
 } // namespace shady::render
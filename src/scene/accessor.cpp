@@ -0,0 +1,466 @@
+#include "accessor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+// SSE2 is the x86-64 baseline. Wider kernels (AVX) would need runtime CPU dispatch, as the build
+// doesn't target any newer instruction set.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHADY_ACCESSOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace shady::scene {
+
+namespace {
+
+// Elements are converted to floats in blocks, small enough to stay in L1 between the
+// conversion and the transform kernel
+constexpr size_t DECODE_BLOCK_SIZE = 512;
+constexpr uint32_t MAX_COMPONENTS = 4;
+
+AccessorView
+sliceView(const AccessorView& view, size_t first, size_t count)
+{
+   auto slice = view;
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   slice.data = view.data + first * view.stride;
+   slice.count = count;
+   return slice;
+}
+
+bool
+isTightlyPacked(const AccessorView& view)
+{
+   return view.stride == static_cast< size_t >(ComponentSize(view.componentType))
+                           * static_cast< size_t >(view.numComponents);
+}
+
+float
+halfToFloat(uint16_t half)
+{
+   const uint32_t sign = (half & 0x8000U) << 16U;
+   uint32_t exponent = (half >> 10U) & 0x1FU;
+   uint32_t mantissa = half & 0x3FFU;
+
+   uint32_t bits = 0;
+   if (exponent == 0x1FU)
+   {
+      // Inf/NaN
+      bits = sign | 0x7F800000U | (mantissa << 13U);
+   }
+   else if (exponent != 0)
+   {
+      bits = sign | ((exponent + 112U) << 23U) | (mantissa << 13U);
+   }
+   else if (mantissa != 0)
+   {
+      // Denormal, renormalize it
+      exponent = 113U;
+      while ((mantissa & 0x400U) == 0)
+      {
+         mantissa <<= 1U;
+         --exponent;
+      }
+      bits = sign | (exponent << 23U) | ((mantissa & 0x3FFU) << 13U);
+   }
+   else
+   {
+      bits = sign;
+   }
+
+   float value = 0.0f;
+   std::memcpy(&value, &bits, sizeof(value));
+   return value;
+}
+
+template < typename T >
+float
+normalizeInteger(T value)
+{
+   constexpr auto maxValue = static_cast< float >(std::numeric_limits< T >::max());
+
+   // glTF: signed values use max(c / MAX, -1.0)
+   return std::max(static_cast< float >(value) / maxValue, -1.0f);
+}
+
+template < typename T >
+void
+readIntegers(const AccessorView& view, float* out)
+{
+   size_t offset = 0;
+
+#if defined(SHADY_ACCESSOR_SSE2)
+   if constexpr (sizeof(T) <= 2)
+   {
+      // Tightly packed 8/16 bit integers are widened 8 at a time
+      if (isTightlyPacked(view))
+      {
+         const auto total = view.count * view.numComponents;
+         constexpr auto maxValue = static_cast< float >(std::numeric_limits< T >::max());
+         const auto scale = _mm_set1_ps(view.normalized ? 1.0f / maxValue : 1.0f);
+         const auto minValue =
+            _mm_set1_ps(view.normalized && std::is_signed_v< T > ? -1.0f : -FLT_MAX);
+
+         for (; offset + 8 <= total; offset += 8)
+         {
+            __m128i wide = {};
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            const auto* src = view.data + offset * sizeof(T);
+            if constexpr (sizeof(T) == 1)
+            {
+               const auto bytes = _mm_loadl_epi64(reinterpret_cast< const __m128i* >(src));
+               wide = std::is_signed_v< T > ? _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8)
+                                            : _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+            }
+            else
+            {
+               wide = _mm_loadu_si128(reinterpret_cast< const __m128i* >(src));
+            }
+
+            __m128i low = {};
+            __m128i high = {};
+            if constexpr (std::is_signed_v< T >)
+            {
+               low = _mm_srai_epi32(_mm_unpacklo_epi16(wide, wide), 16);
+               high = _mm_srai_epi32(_mm_unpackhi_epi16(wide, wide), 16);
+            }
+            else
+            {
+               low = _mm_unpacklo_epi16(wide, _mm_setzero_si128());
+               high = _mm_unpackhi_epi16(wide, _mm_setzero_si128());
+            }
+
+            // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            _mm_storeu_ps(out + offset,
+                          _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(low), scale), minValue));
+            _mm_storeu_ps(out + offset + 4,
+                          _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(high), scale), minValue));
+            // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+         }
+
+         // Remainder, one component at a time
+         for (; offset < total; ++offset)
+         {
+            T value = {};
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            std::memcpy(&value, view.data + offset * sizeof(T), sizeof(T));
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            out[offset] = view.normalized ? normalizeInteger(value) : static_cast< float >(value);
+         }
+
+         return;
+      }
+   }
+#endif
+
+   for (size_t i = 0; i < view.count; ++i)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto* element = view.data + i * view.stride;
+      for (uint32_t c = 0; c < view.numComponents; ++c)
+      {
+         T value = {};
+         // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+         std::memcpy(&value, element + c * sizeof(T), sizeof(T));
+         // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+         out[offset++] = view.normalized ? normalizeInteger(value) : static_cast< float >(value);
+      }
+   }
+}
+
+/*
+ * Transform kernels. 'in' holds tightly packed vectors (with 'inComponents' floats each),
+ * results are written to 'member' of consecutive vertices.
+ */
+void
+transformPoints(const float* in, uint32_t inComponents, size_t count, const glm::mat4& mat,
+                render::Vertex* out, glm::vec3 render::Vertex::*member)
+{
+#if defined(SHADY_ACCESSOR_SSE2)
+   const auto col0 = _mm_loadu_ps(&mat[0][0]);
+   const auto col1 = _mm_loadu_ps(&mat[1][0]);
+   const auto col2 = _mm_loadu_ps(&mat[2][0]);
+   const auto col3 = _mm_loadu_ps(&mat[3][0]);
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto* src = in + i * inComponents;
+      const auto xy = _mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(src[0])),
+                                 _mm_mul_ps(col1, _mm_set1_ps(src[1])));
+      const auto zw = _mm_add_ps(_mm_mul_ps(col2, _mm_set1_ps(src[2])), col3);
+
+      alignas(16) std::array< float, 4 > result = {};
+      _mm_store_ps(result.data(), _mm_add_ps(xy, zw));
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::memcpy(&(out[i].*member), result.data(), sizeof(glm::vec3));
+   }
+#else
+   for (size_t i = 0; i < count; ++i)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto* src = in + i * inComponents;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      out[i].*member = glm::vec3(mat * glm::vec4(src[0], src[1], src[2], 1.0f));
+   }
+#endif
+}
+
+void
+transformDirections(const float* in, uint32_t inComponents, size_t count, const glm::mat3& mat,
+                    render::Vertex* out, glm::vec3 render::Vertex::*member)
+{
+#if defined(SHADY_ACCESSOR_SSE2)
+   const auto col0 = _mm_setr_ps(mat[0][0], mat[0][1], mat[0][2], 0.0f);
+   const auto col1 = _mm_setr_ps(mat[1][0], mat[1][1], mat[1][2], 0.0f);
+   const auto col2 = _mm_setr_ps(mat[2][0], mat[2][1], mat[2][2], 0.0f);
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto* src = in + i * inComponents;
+      auto dir = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(src[0])),
+                                       _mm_mul_ps(col1, _mm_set1_ps(src[1]))),
+                            _mm_mul_ps(col2, _mm_set1_ps(src[2])));
+
+      // w lane is always zero, so the dot product can include it
+      const auto squared = _mm_mul_ps(dir, dir);
+      const auto pairs =
+         _mm_add_ps(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(2, 3, 0, 1)));
+      const auto lengthSq =
+         _mm_add_ps(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 0, 3, 2)));
+
+      if (_mm_cvtss_f32(lengthSq) > 0.0f)
+      {
+         dir = _mm_div_ps(dir, _mm_sqrt_ps(lengthSq));
+      }
+
+      alignas(16) std::array< float, 4 > result = {};
+      _mm_store_ps(result.data(), dir);
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::memcpy(&(out[i].*member), result.data(), sizeof(glm::vec3));
+   }
+#else
+   for (size_t i = 0; i < count; ++i)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto* src = in + i * inComponents;
+      const auto dir = mat * glm::vec3(src[0], src[1], src[2]);
+      const auto lengthSq = glm::dot(dir, dir);
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      out[i].*member = lengthSq > 0.0f ? dir / std::sqrt(lengthSq) : dir;
+   }
+#endif
+}
+
+// Convert 'view' block by block and hand every converted block to 'kernel'
+template < typename Kernel >
+void
+decodeBlocks(const AccessorView& view, Kernel&& kernel)
+{
+   std::array< float, DECODE_BLOCK_SIZE * MAX_COMPONENTS > scratch = {};
+
+   for (size_t first = 0; first < view.count; first += DECODE_BLOCK_SIZE)
+   {
+      const auto count = std::min(DECODE_BLOCK_SIZE, view.count - first);
+      ReadFloats(sliceView(view, first, count), scratch.data());
+      kernel(scratch.data(), first, count);
+   }
+}
+
+} // namespace
+
+uint32_t
+ComponentSize(ComponentType type)
+{
+   switch (type)
+   {
+      case ComponentType::BYTE:
+      case ComponentType::UNSIGNED_BYTE:
+         return 1;
+      case ComponentType::SHORT:
+      case ComponentType::UNSIGNED_SHORT:
+      case ComponentType::HALF_FLOAT:
+         return 2;
+      case ComponentType::UNSIGNED_INT:
+      case ComponentType::FLOAT:
+         return 4;
+      default:
+         return 0;
+   }
+}
+
+bool
+IsSupportedAttribute(ComponentType type)
+{
+   return ComponentSize(type) != 0 && type != ComponentType::UNSIGNED_INT;
+}
+
+bool
+IsSupportedIndex(ComponentType type)
+{
+   return type == ComponentType::UNSIGNED_BYTE || type == ComponentType::UNSIGNED_SHORT
+          || type == ComponentType::UNSIGNED_INT;
+}
+
+void
+ReadFloats(const AccessorView& view, float* out)
+{
+   switch (view.componentType)
+   {
+      case ComponentType::FLOAT: {
+         const auto elementSize = view.numComponents * sizeof(float);
+         if (isTightlyPacked(view))
+         {
+            std::memcpy(out, view.data, view.count * elementSize);
+            break;
+         }
+
+         for (size_t i = 0; i < view.count; ++i)
+         {
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            std::memcpy(out + i * view.numComponents, view.data + i * view.stride, elementSize);
+         }
+      }
+      break;
+
+      case ComponentType::HALF_FLOAT: {
+         size_t offset = 0;
+         for (size_t i = 0; i < view.count; ++i)
+         {
+            for (uint32_t c = 0; c < view.numComponents; ++c)
+            {
+               uint16_t half = 0;
+               // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+               std::memcpy(&half, view.data + i * view.stride + c * sizeof(uint16_t),
+                           sizeof(half));
+               // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+               out[offset++] = halfToFloat(half);
+            }
+         }
+      }
+      break;
+
+      case ComponentType::BYTE:
+         readIntegers< int8_t >(view, out);
+         break;
+      case ComponentType::UNSIGNED_BYTE:
+         readIntegers< uint8_t >(view, out);
+         break;
+      case ComponentType::SHORT:
+         readIntegers< int16_t >(view, out);
+         break;
+      case ComponentType::UNSIGNED_SHORT:
+         readIntegers< uint16_t >(view, out);
+         break;
+      case ComponentType::UNSIGNED_INT:
+         readIntegers< uint32_t >(view, out);
+         break;
+   }
+}
+
+void
+DecodePositions(const AccessorView& view, const glm::mat4& worldMat,
+                std::span< render::Vertex > vertices)
+{
+   decodeBlocks(view, [&](const float* block, size_t first, size_t count) {
+      transformPoints(block, view.numComponents, count, worldMat, &vertices[first],
+                      &render::Vertex::m_position);
+   });
+}
+
+void
+DecodeNormals(const AccessorView& view, const glm::mat3& normalMat,
+              std::span< render::Vertex > vertices)
+{
+   decodeBlocks(view, [&](const float* block, size_t first, size_t count) {
+      transformDirections(block, view.numComponents, count, normalMat, &vertices[first],
+                          &render::Vertex::m_normal);
+   });
+}
+
+void
+DecodeTangents(const AccessorView& view, const glm::mat3& normalMat,
+               std::span< render::Vertex > vertices)
+{
+   decodeBlocks(view, [&](const float* block, size_t first, size_t count) {
+      transformDirections(block, view.numComponents, count, normalMat, &vertices[first],
+                          &render::Vertex::m_tangent);
+   });
+}
+
+void
+DecodeTexCoords(const AccessorView& view, std::span< render::Vertex > vertices)
+{
+   decodeBlocks(view, [&](const float* block, size_t first, size_t count) {
+      for (size_t i = 0; i < count; ++i)
+      {
+         // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+         std::memcpy(&vertices[first + i].m_texCoords, block + i * view.numComponents,
+                     sizeof(glm::vec2));
+      }
+   });
+}
+
+void
+DecodeIndices(const AccessorView& view, std::span< uint32_t > indices)
+{
+   const auto componentSize = ComponentSize(view.componentType);
+   const auto tightlyPacked = view.stride == componentSize;
+
+   if (view.componentType == ComponentType::UNSIGNED_INT && tightlyPacked)
+   {
+      std::memcpy(indices.data(), view.data, view.count * sizeof(uint32_t));
+      return;
+   }
+
+   size_t i = 0;
+
+#if defined(SHADY_ACCESSOR_SSE2)
+   // Most common case, 16 bit indices widened 8 at a time
+   if (view.componentType == ComponentType::UNSIGNED_SHORT && tightlyPacked)
+   {
+      for (; i + 8 <= view.count; i += 8)
+      {
+         // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+         const auto* src = view.data + i * sizeof(uint16_t);
+         const auto packed = _mm_loadu_si128(reinterpret_cast< const __m128i* >(src));
+         _mm_storeu_si128(reinterpret_cast< __m128i* >(&indices[i]),
+                          _mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+         _mm_storeu_si128(reinterpret_cast< __m128i* >(&indices[i + 4]),
+                          _mm_unpackhi_epi16(packed, _mm_setzero_si128()));
+      }
+   }
+#endif
+
+   for (; i < view.count; ++i)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto* element = view.data + i * view.stride;
+      switch (view.componentType)
+      {
+         case ComponentType::UNSIGNED_BYTE:
+            indices[i] = *element;
+            break;
+         case ComponentType::UNSIGNED_SHORT: {
+            uint16_t value = 0;
+            std::memcpy(&value, element, sizeof(value));
+            indices[i] = value;
+         }
+         break;
+         default: {
+            uint32_t value = 0;
+            std::memcpy(&value, element, sizeof(value));
+            indices[i] = value;
+         }
+      }
+   }
+}
+
+} // namespace shady::scene
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "render/vertex.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <span>
+
+namespace shady::scene {
+
+// Values match the glTF (GL) component type enums
+enum class ComponentType : uint32_t
+{
+   BYTE = 5120,
+   UNSIGNED_BYTE = 5121,
+   SHORT = 5122,
+   UNSIGNED_SHORT = 5123,
+   UNSIGNED_INT = 5125,
+   FLOAT = 5126,
+   // Not part of core glTF, but written by some exporters
+   HALF_FLOAT = 5131
+};
+
+/*
+ * Accessor that's already resolved to raw memory (buffer view lookup, offsets, stride and
+ * bounds checks are done once by the loader). Decoding functions below assume it's valid.
+ */
+struct AccessorView
+{
+   // First element
+   const uint8_t* data = nullptr;
+   size_t count = 0;
+   // Distance (in bytes) between two consecutive elements
+   size_t stride = 0;
+   ComponentType componentType = ComponentType::FLOAT;
+   uint32_t numComponents = 0;
+   // Integer components are mapped to [0, 1] (unsigned) or [-1, 1] (signed) range
+   bool normalized = false;
+};
+
+[[nodiscard]] uint32_t
+ComponentSize(ComponentType type);
+
+// Vertex attributes can be stored as floats, half floats or (normalized) integers.
+// Indices as unsigned non-normalized integers.
+[[nodiscard]] bool
+IsSupportedAttribute(ComponentType type);
+
+[[nodiscard]] bool
+IsSupportedIndex(ComponentType type);
+
+// Convert 'view.count' elements to floats, 'view.numComponents' floats per element
+void
+ReadFloats(const AccessorView& view, float* out);
+
+// Bulk decoders, each of them writes single attribute of 'view.count' vertices.
+// Normals and tangents are transformed by 'normalMat' and normalized (zero vectors stay zero).
+void
+DecodePositions(const AccessorView& view, const glm::mat4& worldMat,
+                std::span< render::Vertex > vertices);
+
+void
+DecodeNormals(const AccessorView& view, const glm::mat3& normalMat,
+              std::span< render::Vertex > vertices);
+
+// Only xyz is used, handedness (w) is not stored in render::Vertex
+void
+DecodeTangents(const AccessorView& view, const glm::mat3& normalMat,
+               std::span< render::Vertex > vertices);
+
+void
+DecodeTexCoords(const AccessorView& view, std::span< render::Vertex > vertices);
+
+void
+DecodeIndices(const AccessorView& view, std::span< uint32_t > indices);
+
+} // namespace shady::scene
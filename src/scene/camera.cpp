@@ -69,6 +69,16 @@ Camera::GetPosition() const
    return position_;
 }
 
+void
+Camera::SetLookAtDirection(const glm::vec3& direction)
+{
+   lookAtDirection_ = glm::normalize(direction);
+   rightVector_ = glm::normalize(glm::cross(lookAtDirection_, worldUp_));
+   upVector_ = glm::normalize(glm::cross(rightVector_, lookAtDirection_));
+
+   UpdateViewMatrix();
+}
+
 const glm::vec3&
 Camera::GetLookAtVec() const
 {
@@ -49,6 +49,9 @@ class Camera
    [[nodiscard]] const glm::vec3&
    GetPosition() const;
 
+   void
+   SetLookAtDirection(const glm::vec3& direction);
+
    [[nodiscard]] const glm::vec3&
    GetLookAtVec() const;
 
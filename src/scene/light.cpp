@@ -1,12 +1,168 @@
 #include "scene/light.hpp"
+#include "scene/camera.hpp"
 #include "trace/logger.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <limits>
 
 namespace shady::scene {
 
+namespace {
+
+// Texels per world unit of the original fixed 400x400 units projection with 4096x4096 lightmap
+constexpr float REFERENCE_TEXELS_PER_UNIT = 4096.0f / 400.0f;
+constexpr uint32_t MIN_LIGHTMAP_SIZE = 512;
+constexpr uint32_t MAX_LIGHTMAP_SIZE = 4096;
+// Far cascades cover large areas where shadows take up less of the screen, so they're rendered
+// at lower resolution (lightmap size shifted right by this)
+constexpr std::array< uint32_t, render::MAX_SHADOW_CASCADES > CASCADE_RESOLUTION_SHIFT = {
+   0, 0, 1, 1};
+// Width of the fitted projection is rounded up to multiple of this (in world units), so the size
+// of lightmap texel only changes when the fitted volume grows/shrinks noticeably
+constexpr float FIT_GRANULARITY = 4.0f;
+// Extra depth range (in world units) in front of and behind the fitted volume
+constexpr float DEPTH_MARGIN = 1.0f;
+// Fitted projection is split into a grid of SNAP_CELLS x SNAP_CELLS cells and its origin is
+// snapped to them, with the fitted volume covering all but one cell in each direction. Projection
+// (and the cached static shadows rendered with it) then only changes when the camera moves far
+// enough to cross a cell, not every time it moves by a texel.
+constexpr float SNAP_CELLS = 8.0f;
+
+struct Bounds
+{
+   glm::vec3 min = glm::vec3(std::numeric_limits< float >::max());
+   glm::vec3 max = glm::vec3(std::numeric_limits< float >::lowest());
+};
+
+using Corners = std::array< glm::vec3, 8 >;
+
+Corners
+boxCorners(const glm::vec3& min, const glm::vec3& max)
+{
+   Corners corners = {};
+   for (uint32_t i = 0; i < corners.size(); ++i)
+   {
+      corners[i] = glm::vec3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y,
+                             (i & 4) ? max.z : min.z);
+   }
+
+   return corners;
+}
+
+// World space corners of the camera frustum's slice between 't0' and 't1' (0 being the near and
+// 1 the far plane). View space depth changes linearly along the frustum's edges.
+Corners
+frustumSlice(const glm::mat4& inverseViewProjection, float t0, float t1)
+{
+   const auto unproject = [&inverseViewProjection](float x, float y, float z) {
+      const auto point = inverseViewProjection * glm::vec4(x, y, z, 1.0f);
+      return glm::vec3(point) / point.w;
+   };
+
+   Corners corners = {};
+   for (uint32_t i = 0; i < 4; ++i)
+   {
+      const auto x = (i & 1) ? 1.0f : -1.0f;
+      const auto y = (i & 2) ? 1.0f : -1.0f;
+      const auto nearCorner = unproject(x, y, -1.0f);
+      const auto farCorner = unproject(x, y, 1.0f);
+
+      corners[i] = glm::mix(nearCorner, farCorner, t0);
+      corners[i + 4] = glm::mix(nearCorner, farCorner, t1);
+   }
+
+   return corners;
+}
+
+Bounds
+transformedBounds(const Corners& corners, const glm::mat4& transform)
+{
+   Bounds bounds = {};
+   for (const auto& corner : corners)
+   {
+      const auto point = glm::vec3(transform * glm::vec4(corner, 1.0f));
+      bounds.min = glm::min(bounds.min, point);
+      bounds.max = glm::max(bounds.max, point);
+   }
+
+   return bounds;
+}
+
+// Largest distance between any two corners, which doesn't change when the corners are rotated
+float
+diameter(const Corners& corners)
+{
+   float result = 0.0f;
+   for (uint32_t i = 0; i < corners.size(); ++i)
+   {
+      for (uint32_t j = i + 1; j < corners.size(); ++j)
+      {
+         result = std::max(result, glm::length(corners[i] - corners[j]));
+      }
+   }
+
+   return result;
+}
+
+float
+extentXY(const Bounds& bounds)
+{
+   return std::max(bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y);
+}
+
+// Intersection of the scene and the (camera's) 'view' in light's view space, where the light
+// looks down -Z axis. Casters between the light and visible receivers have to be kept, even when
+// they're not visible by the camera themselves, so the depth range starts at the scene's side
+// closest to the light. It ends at the farthest side, so that it doesn't change with the camera.
+Bounds
+fitBounds(const Bounds& scene, const Bounds& view)
+{
+   Bounds fitted = {glm::max(scene.min, view.min), glm::min(scene.max, view.max)};
+   fitted.min.z = scene.min.z;
+   fitted.max.z = scene.max.z;
+
+   // Camera doesn't see any part of the scene
+   if (glm::any(glm::greaterThan(fitted.min, fitted.max)))
+   {
+      fitted = scene;
+   }
+
+   return fitted;
+}
+
+// Square orthographic projection covering 'fitted' bounds, at least 'extent' units wide. Size is
+// rounded and the origin is snapped to the grid of SNAP_CELLS. Lightmap sizes are powers of two
+// (at least MIN_LIGHTMAP_SIZE), so every cell is a whole number of texels and camera movement
+// doesn't make shadow edges shimmer.
+glm::mat4
+fitOrthographic(const Bounds& fitted, float extent)
+{
+   const auto fittedSide =
+      std::ceil((extent + FIT_GRANULARITY * 0.5f) / FIT_GRANULARITY) * FIT_GRANULARITY;
+   const auto side = fittedSide * SNAP_CELLS / (SNAP_CELLS - 1.0f);
+   const auto cellSize = side / SNAP_CELLS;
+   const auto center = (glm::vec2(fitted.min) + glm::vec2(fitted.max)) * 0.5f;
+   const auto origin = glm::floor((center - fittedSide * 0.5f) / cellSize) * cellSize;
+
+   return glm::ortho(origin.x, origin.x + side, origin.y, origin.y + side,
+                     -fitted.max.z - DEPTH_MARGIN, -fitted.min.z + DEPTH_MARGIN);
+}
+
+uint32_t
+cascadeResolution(uint32_t lightmapSize, uint32_t cascade)
+{
+   return std::max(lightmapSize >> CASCADE_RESOLUTION_SHIFT.at(cascade),
+                   std::min(lightmapSize, MIN_LIGHTMAP_SIZE));
+}
+
+} // namespace
+
 Light::Light(const glm::vec3& position, const glm::vec3& color, LightType type)
-   : position_(position), color_(color)
+   : type_(type), position_(position), color_(color)
 {
    // auto buffer_type = render::FrameBufferType::SINGLE;
    switch (type)
@@ -33,6 +189,11 @@ Light::Light(const glm::vec3& position, const glm::vec3& color, LightType type)
    upVec_ = glm::vec3(0.0f, 0.0f, 0.5f);
    // m_shadowBuffer->MakeTextureResident();
 
+   for (uint32_t cascade = 0; cascade < cascades_.size(); ++cascade)
+   {
+      cascades_[cascade].resolution = cascadeResolution(shadowTextureWidth_, cascade);
+   }
+
    UpdateViewProjection();
 }
 
@@ -87,12 +248,164 @@ Light::MoveBy(const glm::vec3& moveBy)
    // trace::Logger::Info("Light position {}", position_);
 }
 
+void
+Light::SetSceneBounds(const glm::vec3& min, const glm::vec3& max)
+{
+   sceneMin_ = min;
+   sceneMax_ = max;
+   hasSceneBounds_ = true;
+
+   if (type_ == LightType::DIRECTIONAL_LIGHT)
+   {
+      // Fitted projection never has to cover more than the scene's diameter
+      const auto texels = static_cast< uint32_t >(
+         std::ceil(glm::length(max - min) * REFERENCE_TEXELS_PER_UNIT));
+      const auto size = std::clamp(std::bit_ceil(texels), MIN_LIGHTMAP_SIZE, MAX_LIGHTMAP_SIZE);
+
+      shadowTextureWidth_ = size;
+      shadowTextureHeight_ = size;
+
+      for (uint32_t cascade = 0; cascade < cascades_.size(); ++cascade)
+      {
+         cascades_[cascade].resolution = cascadeResolution(size, cascade);
+      }
+
+      trace::Logger::Info("Light: Lightmap size {}x{} for scene bounds of {} units", size, size,
+                          glm::length(max - min));
+   }
+
+   UpdateViewProjection();
+}
+
+void
+Light::FitToCamera(const Camera& camera)
+{
+   if (type_ != LightType::DIRECTIONAL_LIGHT || !hasSceneBounds_
+       || camera.GetViewProjection() == cameraViewProjection_)
+   {
+      return;
+   }
+
+   cameraViewProjection_ = camera.GetViewProjection();
+   cameraView_ = camera.GetView();
+   UpdateViewProjection();
+}
+
+void
+Light::SetCascades(uint32_t numCascades, float splitLambda)
+{
+   numCascades = std::clamp(numCascades, 1U, render::MAX_SHADOW_CASCADES);
+   splitLambda = std::clamp(splitLambda, 0.0f, 1.0f);
+   if (numCascades == numCascades_ && splitLambda == splitLambda_)
+   {
+      return;
+   }
+
+   numCascades_ = numCascades;
+   splitLambda_ = splitLambda;
+   UpdateViewProjection();
+}
+
+uint32_t
+Light::GetNumCascades() const
+{
+   return numCascades_;
+}
+
+float
+Light::GetSplitLambda() const
+{
+   return splitLambda_;
+}
+
+const std::array< ShadowCascade, render::MAX_SHADOW_CASCADES >&
+Light::GetCascades() const
+{
+   return cascades_;
+}
+
 void
 Light::UpdateViewProjection()
 {
    viewMatrix_ = glm::lookAt(position_, lookAt_, upVec_);
+
+   if (type_ == LightType::DIRECTIONAL_LIGHT && hasSceneBounds_)
+   {
+      FitProjection();
+      FitCascades();
+   }
+
    lightSpaceMatrix_ = projectionMatrix_ * viewMatrix_;
    shadowMatrix_ = biasMatrix_ * lightSpaceMatrix_;
 }
 
+void
+Light::FitProjection()
+{
+   const auto scene = transformedBounds(boxCorners(sceneMin_, sceneMax_), viewMatrix_);
+
+   auto fitted = scene;
+   if (cameraViewProjection_ != glm::mat4(0.0f))
+   {
+      const auto frustum =
+         transformedBounds(frustumSlice(glm::inverse(cameraViewProjection_), 0.0f, 1.0f),
+                           viewMatrix_);
+      fitted = fitBounds(scene, frustum);
+   }
+
+   projectionMatrix_ = fitOrthographic(fitted, extentXY(fitted));
+}
+
+void
+Light::FitCascades()
+{
+   // Cascades are only known once the camera is
+   if (cameraViewProjection_ == glm::mat4(0.0f))
+   {
+      return;
+   }
+
+   const auto sceneCorners = boxCorners(sceneMin_, sceneMax_);
+   const auto scene = transformedBounds(sceneCorners, viewMatrix_);
+   const auto inverseViewProjection = glm::inverse(cameraViewProjection_);
+
+   const auto viewDepth = [this](const glm::vec3& point) {
+      return -(cameraView_ * glm::vec4(point, 1.0f)).z;
+   };
+   const auto nearDepth = viewDepth(frustumSlice(inverseViewProjection, 0.0f, 0.0f)[0]);
+   const auto farDepth = viewDepth(frustumSlice(inverseViewProjection, 1.0f, 1.0f)[0]);
+
+   // Nothing past the scene's farthest point has to be covered
+   auto sceneDepth = nearDepth;
+   for (const auto& corner : sceneCorners)
+   {
+      sceneDepth = std::max(sceneDepth, viewDepth(corner));
+   }
+   const auto shadowDepth = std::min(sceneDepth, farDepth);
+
+   // Practical split scheme, blend of logarithmic and uniform splits
+   auto splitStart = nearDepth;
+   for (uint32_t cascade = 0; cascade < numCascades_; ++cascade)
+   {
+      const auto fraction = static_cast< float >(cascade + 1) / static_cast< float >(numCascades_);
+      const auto logSplit = nearDepth * std::pow(shadowDepth / nearDepth, fraction);
+      const auto uniformSplit = nearDepth + (shadowDepth - nearDepth) * fraction;
+      const auto splitEnd = glm::mix(uniformSplit, logSplit, splitLambda_);
+
+      const auto slice =
+         frustumSlice(inverseViewProjection, (splitStart - nearDepth) / (farDepth - nearDepth),
+                      (splitEnd - nearDepth) / (farDepth - nearDepth));
+      const auto fitted = fitBounds(scene, transformedBounds(slice, viewMatrix_));
+
+      // Based on the slice's diameter, so the size doesn't change when the camera rotates
+      const auto extent = std::min(diameter(slice), extentXY(scene));
+
+      auto& current = cascades_[cascade];
+      current.viewProjection = fitOrthographic(fitted, extent) * viewMatrix_;
+      current.splitDepth = splitEnd;
+
+      splitStart = splitEnd;
+   }
+}
+
 } // namespace shady::scene
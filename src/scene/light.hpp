@@ -1,10 +1,15 @@
 #pragma once
 
+#include "render/types.hpp"
+
+#include <array>
 #include <cstdint>
 #include <glm/gtc/type_ptr.hpp>
 
 namespace shady::scene {
 
+class Camera;
+
 enum class LightType : std::uint8_t
 {
    DIRECTIONAL_LIGHT,
@@ -12,6 +17,16 @@ enum class LightType : std::uint8_t
    SPOTLIGHT
 };
 
+struct ShadowCascade
+{
+   // Light space matrix (OpenGL depth range) covering the cascade's slice of the camera frustum
+   glm::mat4 viewProjection = glm::mat4(1.0f);
+   // View space depth at which the cascade ends
+   float splitDepth = 0.0f;
+   // Rendered into the top-left 'resolution' x 'resolution' part of the cascade's layer
+   uint32_t resolution = 0;
+};
+
 class Light
 {
  public:
@@ -41,11 +56,45 @@ class Light
    void
    MoveBy(const glm::vec3& moveBy);
 
+   // World space bounds of all shadow casters/receivers. For directional light this enables
+   // fitting of the projection (see FitToCamera) and picks the lightmap size, which keeps
+   // the texel density of the original 400x400 units projection rendered at 4096x4096
+   void
+   SetSceneBounds(const glm::vec3& min, const glm::vec3& max);
+
+   // Fit directional light's projection and its shadow cascades to the part of the scene visible
+   // by the camera, extended towards the light so that casters outside of the view still shadow
+   // visible receivers. Cheap to call every frame, projections are only updated when the camera
+   // or the light changed.
+   void
+   FitToCamera(const Camera& camera);
+
+   // 'splitLambda' blends uniform (0) and logarithmic (1) split of the camera frustum
+   void
+   SetCascades(uint32_t numCascades, float splitLambda);
+
+   [[nodiscard]] uint32_t
+   GetNumCascades() const;
+
+   [[nodiscard]] float
+   GetSplitLambda() const;
+
+   // Only the first GetNumCascades() are valid
+   [[nodiscard]] const std::array< ShadowCascade, render::MAX_SHADOW_CASCADES >&
+   GetCascades() const;
+
  private:
    void
    UpdateViewProjection();
 
+   void
+   FitProjection();
+
+   void
+   FitCascades();
+
  private:
+   LightType type_ = LightType::DIRECTIONAL_LIGHT;
    uint32_t shadowTextureWidth_ = 4096;
    uint32_t shadowTextureHeight_ = 4096;
    // std::shared_ptr< render::FrameBuffer > m_shadowBuffer;
@@ -60,6 +109,16 @@ class Light
    glm::mat4 lightSpaceMatrix_ = glm::mat4();
    glm::mat4 biasMatrix_ = glm::mat4();
    glm::mat4 shadowMatrix_ = glm::mat4();
+
+   bool hasSceneBounds_ = false;
+   glm::vec3 sceneMin_ = glm::vec3(0.0f);
+   glm::vec3 sceneMax_ = glm::vec3(0.0f);
+   glm::mat4 cameraViewProjection_ = glm::mat4(0.0f);
+   glm::mat4 cameraView_ = glm::mat4(1.0f);
+
+   uint32_t numCascades_ = render::MAX_SHADOW_CASCADES;
+   float splitLambda_ = 0.8f;
+   std::array< ShadowCascade, render::MAX_SHADOW_CASCADES > cascades_ = {};
 };
 
 } // namespace shady::scene
@@ -1,6 +1,9 @@
 #include "mesh.hpp"
 
 #include "renderer.hpp"
+#include "utils/assert.hpp"
+
+#include <fmt/format.h>
 
 namespace shady::scene {
 
@@ -14,16 +17,52 @@ Mesh::Mesh(const std::string& name, std::vector< render::Vertex >&& vertices,
 {
 }
 
+//NOLINTNEXTLINE
+Mesh::Mesh(const std::string& name, std::span< const render::Vertex > vertices,
+           std::span< const uint32_t > indices, render::TextureMaps&& textures,
+           std::span< const uint32_t > lodIndices, std::vector< render::MeshLod >&& lods)
+   : externalVertices_(vertices),
+     externalIndices_(indices),
+     externalLodIndices_(lodIndices),
+     lods_(std::move(lods)),
+     textures_(std::move(textures)),
+     name_(name)
+{
+}
+
 // void
 // Mesh::AddTexture(const render::TexturePtr& texture)
 //{
 //   //textures_.push_back(texture);
 //}
 
+render::MeshOptimizationStats
+Mesh::Optimize()
+{
+   utils::Assert(externalVertices_.empty() && externalIndices_.empty(),
+                 fmt::format("Mesh {} doesn't own its data and can't be optimized!", name_));
+   return render::OptimizeMesh(vertices_, indices_);
+}
+
 void
-Mesh::Submit()
+Mesh::BuildMeshlets()
 {
-   render::Renderer::MeshLoaded(vertices_, indices_, textures_, modelMat_);
+   meshlets_ = render::BuildMeshlets(GetVertices(), GetIndices());
+}
+
+void
+Mesh::BuildLods()
+{
+   auto chain = render::BuildLodChain(GetVertices(), GetIndices());
+   lodIndices_ = std::move(chain.indices);
+   lods_ = std::move(chain.lods);
+}
+
+void
+Mesh::Submit(bool dynamic)
+{
+   render::Renderer::MeshLoaded(GetVertices(), GetIndices(), textures_, modelMat_, dynamic,
+                                meshlets_, GetLodIndices(), lods_);
 }
 
 void
@@ -31,7 +70,7 @@ Mesh::Draw(const std::string& /*modelName*/, const glm::mat4& /*modelMat*/,
            const glm::vec4& /*tintColor*/)
 {
    // render::Renderer3D::DrawMesh(name_, modelMat, textures_, tintColor);
-   render::Renderer::MeshLoaded(vertices_, indices_, textures_, modelMat_);
+   render::Renderer::MeshLoaded(GetVertices(), GetIndices(), textures_, modelMat_);
 }
 
 void
@@ -55,6 +94,63 @@ Mesh::Translate(const glm::vec3& translateVal)
    RebuildModelMat();
 }
 
+std::span< const render::Vertex >
+Mesh::GetVertices() const
+{
+   if (vertices_.empty())
+   {
+      return externalVertices_;
+   }
+
+   return vertices_;
+}
+
+std::span< const uint32_t >
+Mesh::GetIndices() const
+{
+   if (indices_.empty())
+   {
+      return externalIndices_;
+   }
+
+   return indices_;
+}
+
+std::span< const uint32_t >
+Mesh::GetLodIndices() const
+{
+   if (lodIndices_.empty())
+   {
+      return externalLodIndices_;
+   }
+
+   return lodIndices_;
+}
+
+std::span< const render::MeshLod >
+Mesh::GetLods() const
+{
+   return lods_;
+}
+
+const std::string&
+Mesh::GetName() const
+{
+   return name_;
+}
+
+const render::TextureMaps&
+Mesh::GetTextures() const
+{
+   return textures_;
+}
+
+std::span< const render::Meshlet >
+Mesh::GetMeshlets() const
+{
+   return meshlets_;
+}
+
 void
 Mesh::RebuildModelMat()
 {
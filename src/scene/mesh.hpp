@@ -1,9 +1,13 @@
 #pragma once
 
+#include "mesh_lod.hpp"
+#include "mesh_optimizer.hpp"
+#include "meshlet.hpp"
 #include "types.hpp"
 #include "vertex.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <span>
 #include <vector>
 
 namespace shady::scene {
@@ -15,11 +19,31 @@ class Mesh
    Mesh(const std::string& name, std::vector< render::Vertex >&& vertices,
         std::vector< uint32_t >&& indices, render::TextureMaps&& textures);
 
+   // Non-owning mesh, 'vertices' and 'indices' (e.g. memory mapped MeshCache) have to outlive it.
+   // 'lodIndices' holds the simplified levels described by 'lods'.
+   Mesh(const std::string& name, std::span< const render::Vertex > vertices,
+        std::span< const uint32_t > indices, render::TextureMaps&& textures,
+        std::span< const uint32_t > lodIndices = {}, std::vector< render::MeshLod >&& lods = {});
+
    /*void
    AddTexture(const render::TexturePtr& texture);*/
 
+   // Welds duplicate vertices and reorders triangles and vertices for the vertex cache, overdraw
+   // and vertex fetch (see OptimizeMesh). Only meshes owning their data can be optimized, it has
+   // to be done before building meshlets and levels of detail.
+   render::MeshOptimizationStats
+   Optimize();
+
+   // Splits the mesh into meshlets, which are submitted along with it (cluster culling)
+   void
+   BuildMeshlets();
+
+   // Builds simplified levels of detail, which are submitted along with the mesh
    void
-   Submit();
+   BuildLods();
+
+   void
+   Submit(bool dynamic = false);
 
    void
    Draw(const std::string& modelName, const glm::mat4& modelMat, const glm::vec4& tintColor);
@@ -33,6 +57,32 @@ class Mesh
    void
    Translate(const glm::vec3& translateVal);
 
+   [[nodiscard]] std::span< const render::Vertex >
+   GetVertices() const;
+
+   // Full detail level
+   [[nodiscard]] std::span< const uint32_t >
+   GetIndices() const;
+
+   // Indices of the simplified levels, ranges of 'GetLods' point into it
+   [[nodiscard]] std::span< const uint32_t >
+   GetLodIndices() const;
+
+   // Simplified levels, from the most detailed one. Empty unless BuildLods was called (or the
+   // mesh was loaded from cache).
+   [[nodiscard]] std::span< const render::MeshLod >
+   GetLods() const;
+
+   [[nodiscard]] const std::string&
+   GetName() const;
+
+   [[nodiscard]] const render::TextureMaps&
+   GetTextures() const;
+
+   // Empty unless BuildMeshlets was called
+   [[nodiscard]] std::span< const render::Meshlet >
+   GetMeshlets() const;
+
  private:
    void
    RebuildModelMat();
@@ -46,8 +96,16 @@ class Mesh
 
    std::vector< render::Vertex > vertices_;
    std::vector< uint32_t > indices_;
+   // Used instead of 'vertices_' and 'indices_' when mesh doesn't own its data
+   std::span< const render::Vertex > externalVertices_;
+   std::span< const uint32_t > externalIndices_;
+   std::vector< uint32_t > lodIndices_;
+   std::span< const uint32_t > externalLodIndices_;
+   std::vector< render::MeshLod > lods_;
    // render::TexturePtrVec m_textures = {};
    render::TextureMaps textures_;
+   // In the mesh's local space
+   std::vector< render::Meshlet > meshlets_;
    std::string name_ = "dummyMeshName";
 };
 
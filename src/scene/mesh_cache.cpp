@@ -0,0 +1,466 @@
+#include "mesh_cache.hpp"
+#include "trace/logger.hpp"
+#include "utils/atomic_file.hpp"
+#include "utils/file_manager.hpp"
+#include "utils/hash.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fmt/format.h>
+#include <fstream>
+#include <functional>
+#include <nlohmann/json.hpp>
+#include <type_traits>
+
+namespace shady::scene {
+
+namespace {
+
+// "SHMC" in little endian
+constexpr uint32_t MESH_CACHE_MAGIC = 0x434D4853;
+// Version of the layout below
+constexpr uint32_t MESH_CACHE_FORMAT_VERSION = 2;
+constexpr uint64_t MESH_CACHE_STREAM_ALIGNMENT = 16;
+
+struct MeshCacheStringRef
+{
+   uint32_t offset = 0;
+   uint32_t length = 0;
+};
+
+struct MeshCacheHeader
+{
+   uint32_t magic = MESH_CACHE_MAGIC;
+   uint32_t formatVersion = MESH_CACHE_FORMAT_VERSION;
+   uint32_t loaderVersion = MeshCache::LOADER_VERSION;
+   uint32_t vertexSize = sizeof(render::Vertex);
+   uint64_t sourceHash = 0;
+   uint64_t fileSize = 0;
+   uint32_t numMeshes = 0;
+   uint32_t numTextures = 0;
+   uint64_t numVertices = 0;
+   uint64_t numIndices = 0;
+   uint64_t stringsOffset = 0;
+   uint64_t stringsSize = 0;
+   uint64_t verticesOffset = 0;
+   uint64_t indicesOffset = 0;
+};
+
+struct MeshCacheMeshRecord
+{
+   VkDrawIndexedIndirectCommand range = {};
+   uint32_t vertexCount = 0;
+   MeshCacheStringRef name = {};
+   std::array< MeshCacheStringRef, 3 > textures = {};
+   // Simplified levels, their indices follow 'range'
+   uint32_t numLods = 0;
+   uint32_t lodIndexCount = 0;
+   std::array< render::MeshLod, render::MAX_MESH_LODS - 1 > lods = {};
+};
+
+struct MeshCacheTextureRecord
+{
+   MeshCacheStringRef name = {};
+   uint32_t type = 0;
+};
+
+static_assert(std::is_trivially_copyable_v< render::Vertex >);
+static_assert(sizeof(MeshCacheHeader) == 88);
+static_assert(std::is_trivially_copyable_v< render::MeshLod >);
+static_assert(sizeof(MeshCacheMeshRecord) == 112);
+static_assert(sizeof(MeshCacheTextureRecord) == 12);
+
+constexpr uint64_t
+alignCacheOffset(uint64_t offset)
+{
+   return (offset + MESH_CACHE_STREAM_ALIGNMENT - 1) & ~(MESH_CACHE_STREAM_ALIGNMENT - 1);
+}
+
+// Appends 'str' to 'strings' table and returns reference to it
+MeshCacheStringRef
+addCacheString(std::string& strings, std::string_view str)
+{
+   const MeshCacheStringRef ref = {static_cast< uint32_t >(strings.size()),
+                                   static_cast< uint32_t >(str.size())};
+   strings.append(str);
+   return ref;
+}
+
+// Percent-decoded glTF 'uri' (glTF requires URIs of external files to be RFC 3986 encoded)
+std::string
+decodeUri(std::string_view uri)
+{
+   const auto hexValue = [](char digit) -> int32_t {
+      if (digit >= '0' && digit <= '9')
+      {
+         return digit - '0';
+      }
+      if (digit >= 'a' && digit <= 'f')
+      {
+         return digit - 'a' + 10;
+      }
+      if (digit >= 'A' && digit <= 'F')
+      {
+         return digit - 'A' + 10;
+      }
+      return -1;
+   };
+
+   std::string result;
+   result.reserve(uri.size());
+   for (size_t i = 0; i < uri.size(); ++i)
+   {
+      if (uri[i] == '%' && i + 2 < uri.size() && hexValue(uri[i + 1]) >= 0
+          && hexValue(uri[i + 2]) >= 0)
+      {
+         result.push_back(static_cast< char >(hexValue(uri[i + 1]) * 16 + hexValue(uri[i + 2])));
+         i += 2;
+      }
+      else
+      {
+         result.push_back(uri[i]);
+      }
+   }
+
+   return result;
+}
+
+// Files of the external buffers referenced by .gltf file, in the order they're declared.
+// Embedded (data URI) buffers are part of the .gltf file itself.
+std::vector< std::filesystem::path >
+getExternalBuffers(const std::filesystem::path& gltfPath)
+{
+   std::ifstream file(gltfPath);
+   const auto document = nlohmann::json::parse(file, nullptr, false);
+   if (document.is_discarded() || !document.is_object())
+   {
+      // Loading the model reports the error
+      return {};
+   }
+
+   std::vector< std::filesystem::path > buffers;
+   const auto bufferArray = document.find("buffers");
+   if (bufferArray == document.end() || !bufferArray->is_array())
+   {
+      return buffers;
+   }
+
+   for (const auto& buffer : *bufferArray)
+   {
+      const auto uri = buffer.find("uri");
+      if (uri == buffer.end() || !uri->is_string())
+      {
+         continue;
+      }
+
+      const auto& value = uri->get_ref< const std::string& >();
+      if (!value.starts_with("data:"))
+      {
+         buffers.push_back(gltfPath.parent_path() / decodeUri(value));
+      }
+   }
+
+   return buffers;
+}
+
+} // namespace
+
+uint64_t
+MeshCache::HashSource(const std::filesystem::path& sourcePath)
+{
+   auto hash = utils::HashFile(sourcePath, LOADER_VERSION);
+
+   if (sourcePath.extension() == ".gltf")
+   {
+      for (const auto& buffer : getExternalBuffers(sourcePath))
+      {
+         hash = utils::HashFile(buffer, hash);
+      }
+   }
+
+   return hash;
+}
+
+std::filesystem::path
+MeshCache::GetCachePath(const std::filesystem::path& sourcePath)
+{
+   // Path hash keeps models with the same file name (but different directories) apart
+   const auto absolutePath = std::filesystem::absolute(sourcePath).generic_string();
+   const auto pathHash = std::hash< std::string >{}(absolutePath);
+
+   return utils::FileManager::CACHE_DIR
+          / fmt::format("{}-{:016x}.meshcache", sourcePath.stem().string(), pathHash);
+}
+
+std::optional< MeshCache >
+MeshCache::Load(const std::filesystem::path& sourcePath, uint64_t sourceHash)
+{
+   const auto cachePath = GetCachePath(sourcePath);
+   auto file = utils::MappedFile::Open(cachePath);
+   if (!file)
+   {
+      trace::Logger::Debug("MeshCache: no cache for {}", sourcePath.string());
+      return std::nullopt;
+   }
+
+   const auto* data = file->GetData();
+   const auto size = file->GetSize();
+
+   MeshCacheHeader header = {};
+   if (size < sizeof(header))
+   {
+      trace::Logger::Warn("MeshCache: {} is truncated", cachePath.string());
+      return std::nullopt;
+   }
+   std::memcpy(&header, data, sizeof(header));
+
+   if (header.magic != MESH_CACHE_MAGIC || header.formatVersion != MESH_CACHE_FORMAT_VERSION
+       || header.loaderVersion != LOADER_VERSION || header.vertexSize != sizeof(render::Vertex)
+       || header.sourceHash != sourceHash)
+   {
+      trace::Logger::Debug("MeshCache: {} is stale", cachePath.string());
+      return std::nullopt;
+   }
+
+   const auto recordsSize = header.numMeshes * sizeof(MeshCacheMeshRecord)
+                            + header.numTextures * sizeof(MeshCacheTextureRecord);
+   // Every value is checked against the file size first, so the sums below can't overflow
+   const auto valid =
+      header.fileSize == size && header.numMeshes <= size / sizeof(MeshCacheMeshRecord)
+      && header.numTextures <= size / sizeof(MeshCacheTextureRecord)
+      && header.numVertices <= size / sizeof(render::Vertex)
+      && header.numIndices <= size / sizeof(uint32_t) && header.stringsOffset <= size
+      && header.stringsSize <= size && header.verticesOffset <= size
+      && header.indicesOffset <= size && sizeof(header) + recordsSize <= header.stringsOffset
+      && header.stringsOffset + header.stringsSize <= header.verticesOffset
+      && header.verticesOffset % MESH_CACHE_STREAM_ALIGNMENT == 0
+      && header.verticesOffset + header.numVertices * sizeof(render::Vertex)
+            <= header.indicesOffset
+      && header.indicesOffset % MESH_CACHE_STREAM_ALIGNMENT == 0
+      && header.indicesOffset + header.numIndices * sizeof(uint32_t) <= size;
+   if (!valid)
+   {
+      trace::Logger::Warn("MeshCache: {} is corrupted", cachePath.string());
+      return std::nullopt;
+   }
+
+   // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   const auto* strings = reinterpret_cast< const char* >(data + header.stringsOffset);
+   bool stringsValid = true;
+   const auto toString = [strings, &header, &stringsValid](const MeshCacheStringRef& ref) {
+      if (static_cast< uint64_t >(ref.offset) + ref.length > header.stringsSize)
+      {
+         stringsValid = false;
+         return std::string{};
+      }
+      return std::string(strings + ref.offset, ref.length);
+   };
+
+   MeshCache cache;
+
+   const auto* indices = reinterpret_cast< const uint32_t* >(data + header.indicesOffset);
+   const auto* records = data + sizeof(header);
+   cache.meshes_.reserve(header.numMeshes);
+   for (uint32_t i = 0; i < header.numMeshes; ++i)
+   {
+      MeshCacheMeshRecord record = {};
+      std::memcpy(&record, records + i * sizeof(record), sizeof(record));
+
+      const auto lodsValid =
+         record.numLods < render::MAX_MESH_LODS
+         && std::all_of(record.lods.begin(), record.lods.begin() + record.numLods,
+                        [&record](const render::MeshLod& lod) {
+                           return static_cast< uint64_t >(lod.firstIndex) + lod.indexCount
+                                  <= record.lodIndexCount;
+                        });
+      const auto inBounds =
+         static_cast< uint64_t >(record.range.firstIndex) + record.range.indexCount
+               + record.lodIndexCount
+            <= header.numIndices
+         && lodsValid && record.range.vertexOffset >= 0
+         && static_cast< uint64_t >(record.range.vertexOffset) + record.vertexCount
+               <= header.numVertices;
+      // Indices (of every level) are relative to the mesh's first vertex, out of range ones
+      // would make the GPU read vertices of other meshes or past the end of the vertex buffer
+      const auto indicesValid =
+         inBounds
+         && std::all_of(indices + record.range.firstIndex,
+                        indices + record.range.firstIndex + record.range.indexCount
+                           + record.lodIndexCount,
+                        [&record](uint32_t index) { return index < record.vertexCount; });
+      if (!indicesValid)
+      {
+         trace::Logger::Warn("MeshCache: {} is corrupted", cachePath.string());
+         return std::nullopt;
+      }
+
+      CachedMesh mesh;
+      mesh.name = toString(record.name);
+      for (size_t slot = 0; slot < mesh.textures.size(); ++slot)
+      {
+         mesh.textures[slot] = toString(record.textures[slot]);
+      }
+      mesh.range = record.range;
+      mesh.vertexCount = record.vertexCount;
+      mesh.lods.assign(record.lods.begin(), record.lods.begin() + record.numLods);
+      mesh.lodIndexCount = record.lodIndexCount;
+      cache.meshes_.push_back(std::move(mesh));
+   }
+
+   const auto* textureRecords = records + header.numMeshes * sizeof(MeshCacheMeshRecord);
+   cache.textures_.reserve(header.numTextures);
+   for (uint32_t i = 0; i < header.numTextures; ++i)
+   {
+      MeshCacheTextureRecord record = {};
+      std::memcpy(&record, textureRecords + i * sizeof(record), sizeof(record));
+      cache.textures_.push_back(
+         {toString(record.name), static_cast< render::TextureType >(record.type)});
+   }
+
+   if (!stringsValid)
+   {
+      trace::Logger::Warn("MeshCache: {} is corrupted", cachePath.string());
+      return std::nullopt;
+   }
+
+   // Both streams are aligned within the (page aligned) mapping, so they can be used in place
+   cache.vertices_ = reinterpret_cast< const render::Vertex* >(data + header.verticesOffset);
+   cache.indices_ = indices;
+   // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+   cache.file_ = std::move(*file);
+
+   trace::Logger::Debug("MeshCache: loaded {} ({} meshes, {} vertices, {} indices)",
+                        cachePath.string(), header.numMeshes, header.numVertices,
+                        header.numIndices);
+   return cache;
+}
+
+void
+MeshCache::Write(const std::filesystem::path& sourcePath, uint64_t sourceHash,
+                 std::span< const Mesh > meshes, std::span< const TextureRef > textures)
+{
+   MeshCacheHeader header = {};
+   header.sourceHash = sourceHash;
+   header.numMeshes = static_cast< uint32_t >(meshes.size());
+   header.numTextures = static_cast< uint32_t >(textures.size());
+
+   std::string strings;
+   std::vector< MeshCacheMeshRecord > meshRecords;
+   meshRecords.reserve(meshes.size());
+   for (const auto& mesh : meshes)
+   {
+      const auto vertices = mesh.GetVertices();
+      const auto indices = mesh.GetIndices();
+      const auto lods = mesh.GetLods().first(
+         std::min< size_t >(mesh.GetLods().size(), render::MAX_MESH_LODS - 1));
+
+      MeshCacheMeshRecord record = {};
+      record.range.firstIndex = static_cast< uint32_t >(header.numIndices);
+      record.range.indexCount = static_cast< uint32_t >(indices.size());
+      record.range.instanceCount = 1;
+      record.range.vertexOffset = static_cast< int32_t >(header.numVertices);
+      record.vertexCount = static_cast< uint32_t >(vertices.size());
+      record.name = addCacheString(strings, mesh.GetName());
+      for (size_t slot = 0; slot < record.textures.size(); ++slot)
+      {
+         record.textures[slot] = addCacheString(strings, mesh.GetTextures()[slot]);
+      }
+      record.numLods = static_cast< uint32_t >(lods.size());
+      record.lodIndexCount = static_cast< uint32_t >(mesh.GetLodIndices().size());
+      std::copy(lods.begin(), lods.end(), record.lods.begin());
+      meshRecords.push_back(record);
+
+      header.numVertices += vertices.size();
+      header.numIndices += indices.size() + mesh.GetLodIndices().size();
+   }
+
+   std::vector< MeshCacheTextureRecord > textureRecords;
+   textureRecords.reserve(textures.size());
+   for (const auto& texture : textures)
+   {
+      textureRecords.push_back(
+         {addCacheString(strings, texture.name), static_cast< uint32_t >(texture.type)});
+   }
+
+   header.stringsOffset = sizeof(header) + meshRecords.size() * sizeof(MeshCacheMeshRecord)
+                          + textureRecords.size() * sizeof(MeshCacheTextureRecord);
+   header.stringsSize = strings.size();
+   header.verticesOffset = alignCacheOffset(header.stringsOffset + header.stringsSize);
+   header.indicesOffset =
+      alignCacheOffset(header.verticesOffset + header.numVertices * sizeof(render::Vertex));
+   header.fileSize = header.indicesOffset + header.numIndices * sizeof(uint32_t);
+
+   const auto cachePath = GetCachePath(sourcePath);
+   const auto written = utils::WriteFileAtomic(cachePath, [&](std::ostream& stream) {
+      const auto writeBytes = [&stream](const void* bytes, size_t numBytes) {
+         stream.write(static_cast< const char* >(bytes), static_cast< std::streamsize >(numBytes));
+      };
+      const auto padTo = [&stream, &writeBytes](uint64_t offset) {
+         const std::array< char, MESH_CACHE_STREAM_ALIGNMENT > zeros = {};
+         writeBytes(zeros.data(), offset - static_cast< uint64_t >(stream.tellp()));
+      };
+
+      writeBytes(&header, sizeof(header));
+      writeBytes(meshRecords.data(), meshRecords.size() * sizeof(MeshCacheMeshRecord));
+      writeBytes(textureRecords.data(), textureRecords.size() * sizeof(MeshCacheTextureRecord));
+      writeBytes(strings.data(), strings.size());
+
+      padTo(header.verticesOffset);
+      for (const auto& mesh : meshes)
+      {
+         writeBytes(mesh.GetVertices().data(), mesh.GetVertices().size_bytes());
+      }
+
+      padTo(header.indicesOffset);
+      for (const auto& mesh : meshes)
+      {
+         writeBytes(mesh.GetIndices().data(), mesh.GetIndices().size_bytes());
+         writeBytes(mesh.GetLodIndices().data(), mesh.GetLodIndices().size_bytes());
+      }
+
+      return true;
+   });
+   if (!written)
+   {
+      return;
+   }
+
+   trace::Logger::Debug("MeshCache: written {} ({} bytes)", cachePath.string(), header.fileSize);
+}
+
+const std::vector< MeshCache::CachedMesh >&
+MeshCache::GetMeshes() const
+{
+   return meshes_;
+}
+
+const std::vector< MeshCache::TextureRef >&
+MeshCache::GetTextures() const
+{
+   return textures_;
+}
+
+std::span< const render::Vertex >
+MeshCache::GetVertices(const CachedMesh& mesh) const
+{
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   return {vertices_ + mesh.range.vertexOffset, mesh.vertexCount};
+}
+
+std::span< const uint32_t >
+MeshCache::GetIndices(const CachedMesh& mesh) const
+{
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   return {indices_ + mesh.range.firstIndex, mesh.range.indexCount};
+}
+
+std::span< const uint32_t >
+MeshCache::GetLodIndices(const CachedMesh& mesh) const
+{
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   return {indices_ + mesh.range.firstIndex + mesh.range.indexCount, mesh.lodIndexCount};
+}
+
+} // namespace shady::scene
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "render/mesh_lod.hpp"
+#include "render/types.hpp"
+#include "render/vertex.hpp"
+#include "utils/mapped_file.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace shady::scene {
+
+/*
+ * Binary cache of a decoded model. It's stored next to the other caches in
+ * FileManager::CACHE_DIR and is laid out so that vertex and index streams can be used
+ * directly from the memory mapped file:
+ *
+ *   Header | MeshRecord[numMeshes] | TextureRecord[numTextures] | strings
+ *          | Vertex[numVertices] (16 byte aligned) | uint32_t[numIndices] (16 byte aligned)
+ *
+ * Indices of mesh's simplified levels of detail directly follow its full detail indices.
+ *
+ * Cache is only valid for the same source file content (hash), the same loader version
+ * and the same render::Vertex layout, otherwise it's ignored and rebuilt.
+ */
+class MeshCache
+{
+ public:
+   // Has to be bumped whenever the loader changes the decoded geometry
+   static constexpr uint32_t LOADER_VERSION = 3;
+
+   // Texture used by the model, in order of creation
+   struct TextureRef
+   {
+      std::string name;
+      render::TextureType type = render::TextureType::DIFFUSE_MAP;
+   };
+
+   struct CachedMesh
+   {
+      std::string name;
+      render::TextureMaps textures = {};
+      // Index range (and base vertex) of this mesh within the cached streams
+      VkDrawIndexedIndirectCommand range = {};
+      uint32_t vertexCount = 0;
+      // Simplified levels, relative to the end of 'range'
+      std::vector< render::MeshLod > lods = {};
+      uint32_t lodIndexCount = 0;
+   };
+
+ public:
+   // Hash of the source file content. For .gltf files the external buffers it references are
+   // hashed as well, since the geometry is stored there.
+   [[nodiscard]] static uint64_t
+   HashSource(const std::filesystem::path& sourcePath);
+
+   // Returns std::nullopt if there's no cache for 'sourcePath' or it's stale/corrupted (including
+   // index ranges or indices out of bounds)
+   [[nodiscard]] static std::optional< MeshCache >
+   Load(const std::filesystem::path& sourcePath, uint64_t sourceHash);
+
+   // Failing to write the cache is not an error, model will just be decoded next time
+   static void
+   Write(const std::filesystem::path& sourcePath, uint64_t sourceHash,
+         std::span< const Mesh > meshes, std::span< const TextureRef > textures);
+
+   [[nodiscard]] const std::vector< CachedMesh >&
+   GetMeshes() const;
+
+   [[nodiscard]] const std::vector< TextureRef >&
+   GetTextures() const;
+
+   // Views into the mapped file, valid as long as this object is alive
+   [[nodiscard]] std::span< const render::Vertex >
+   GetVertices(const CachedMesh& mesh) const;
+
+   [[nodiscard]] std::span< const uint32_t >
+   GetIndices(const CachedMesh& mesh) const;
+
+   [[nodiscard]] std::span< const uint32_t >
+   GetLodIndices(const CachedMesh& mesh) const;
+
+ private:
+   [[nodiscard]] static std::filesystem::path
+   GetCachePath(const std::filesystem::path& sourcePath);
+
+ private:
+   utils::MappedFile file_;
+   std::vector< CachedMesh > meshes_;
+   std::vector< TextureRef > textures_;
+   const render::Vertex* vertices_ = nullptr;
+   const uint32_t* indices_ = nullptr;
+};
+
+} // namespace shady::scene
@@ -1,14 +1,17 @@
 #include "model.hpp"
+#include "accessor.hpp"
+#include "mesh_cache.hpp"
 #include "render/texture.hpp"
 #include "render/vertex.hpp"
 #include "trace/logger.hpp"
 #include "utils/assert.hpp"
+#include "utils/thread_pool.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
-#include <functional>
 #include <limits>
 #include <string_view>
-#include <stdexcept>
 #include <utility>
 #include <vector>
 #include <glm/gtc/quaternion.hpp>
@@ -55,10 +58,31 @@ namespace shady::scene {
 void
 Model::LoadModel(const std::string& file)
 {
+   using Clock = std::chrono::steady_clock;
+   const auto elapsedMs = [](Clock::time_point start) {
+      return std::chrono::duration< double, std::milli >(Clock::now() - start).count();
+   };
+
+   auto stageStart = Clock::now();
+   name_ = file;
+
+   // Cache is keyed by the content of the source, so edited models are decoded again
+   const auto sourceHash = MeshCache::HashSource(file);
+   if (auto cache = MeshCache::Load(file, sourceHash); cache)
+   {
+      loadTimings_.parse = elapsedMs(stageStart);
+      LoadFromCache(std::move(*cache));
+      return;
+   }
+
    tinygltf::Model model;
    tinygltf::TinyGLTF loader;
    std::string err, warn;
 
+   // Images are loaded by TextureLibrary (by their uri), decoding them here would be wasted work
+   loader.SetImageLoader([](tinygltf::Image*, const int, std::string*, std::string*, int, int,
+                            const unsigned char*, int, void*) { return true; },
+                         nullptr);
 
    const bool ok = (file.ends_with(".glb") ? loader.LoadBinaryFromFile(&model, &err, &warn, file)
                                            : loader.LoadASCIIFromFile(&model, &err, &warn, file));
@@ -68,7 +92,7 @@ Model::LoadModel(const std::string& file)
       trace::Logger::Warn("tinygltf load warning: {}", warn);
    }
 
-   name_ = file;
+   loadTimings_.parse = elapsedMs(stageStart);
 
    auto checkedIndex = [](int idx, size_t containerSize, std::string_view name) -> size_t {
       utils::Assert(idx >= 0, fmt::format("glTF {} index is negative: {}", name, idx));
@@ -90,7 +114,11 @@ Model::LoadModel(const std::string& file)
       const render::Texture* mr{};
    };
 
+   stageStart = Clock::now();
+
    std::vector< MaterialGPU > gpuMaterials(model.materials.size());
+   // Textures in the order they were requested, so the cached load creates them the same way
+   std::vector< MeshCache::TextureRef > textureRefs;
 
    auto texOf = [&](int idx, render::TextureType type) -> const render::Texture* {
       if (idx < 0)
@@ -102,7 +130,14 @@ Model::LoadModel(const std::string& file)
       const auto imgIdx = checkedIndex(tex.source, model.images.size(), "image");
       const auto& img = model.images[imgIdx];
       std::string id = img.uri.empty() ? ("embed_" + std::to_string(imgIdx)) : img.uri;
-      
+
+      const auto recorded = std::find_if(textureRefs.begin(), textureRefs.end(),
+                                         [&id](const auto& ref) { return ref.name == id; });
+      if (recorded == textureRefs.end())
+      {
+         textureRefs.push_back({id, type});
+      }
+
       render::TextureLibrary::CreateTexture(type, id);
       return &render::TextureLibrary::GetTexture(id);
    };
@@ -117,61 +152,53 @@ Model::LoadModel(const std::string& file)
       gpuMaterials[i].normal = texOf(m.normalTexture.index, render::TextureType::NORMAL_MAP);
    }
 
-   auto fetch = [&](const tinygltf::Accessor& acc, const tinygltf::Model& m) -> const uint8_t* {
-      const auto viewIdx = checkedIndex(acc.bufferView, m.bufferViews.size(), "bufferView");
-      const auto& view = m.bufferViews[viewIdx];
-      const auto bufferIdx = checkedIndex(view.buffer, m.buffers.size(), "buffer");
-      const auto& buffer = m.buffers[bufferIdx];
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-      return buffer.data.data() + view.byteOffset + acc.byteOffset;
-   };
+   loadTimings_.texture = elapsedMs(stageStart);
+   stageStart = Clock::now();
 
-   auto readVec2 = [&](const tinygltf::Accessor& acc, size_t idx) -> glm::vec2 {
-      utils::Assert(acc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT
-                       && acc.type == TINYGLTF_TYPE_VEC2,
-                    "Unsupported accessor format for VEC2");
+   // Accessor is resolved (and validated) once, decoders then stream through the whole range
+   auto resolveAccessor = [&](const tinygltf::Accessor& acc, int expectedType,
+                              std::string_view name) -> AccessorView {
+      utils::Assert(acc.type == expectedType,
+                    fmt::format("Unsupported accessor type {} for {}", acc.type, name));
 
       const auto viewIdx = checkedIndex(acc.bufferView, model.bufferViews.size(), "bufferView");
       const auto& view = model.bufferViews[viewIdx];
-      const auto* basePtr = fetch(acc, model);
-      const auto strideSigned = acc.ByteStride(view);
-      utils::Assert(strideSigned > 0, "Invalid byte stride for VEC2 accessor");
-      const auto stride = static_cast< size_t >(strideSigned);
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-      const auto* elemPtr = basePtr + (idx * stride);
-      return *reinterpret_cast< const glm::vec2* >(elemPtr);
-   };
-
-   auto readVec3 = [&](const tinygltf::Accessor& acc, size_t idx) -> glm::vec3 {
-      utils::Assert(acc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT
-                       && acc.type == TINYGLTF_TYPE_VEC3,
-                    "Unsupported accessor format for VEC3");
+      const auto bufferIdx = checkedIndex(view.buffer, model.buffers.size(), "buffer");
+      const auto& buffer = model.buffers[bufferIdx];
 
-      const auto viewIdx = checkedIndex(acc.bufferView, model.bufferViews.size(), "bufferView");
-      const auto& view = model.bufferViews[viewIdx];
-      const auto* basePtr = fetch(acc, model);
       const auto strideSigned = acc.ByteStride(view);
-      utils::Assert(strideSigned > 0, "Invalid byte stride for VEC3 accessor");
-      const auto stride = static_cast< size_t >(strideSigned);
+      utils::Assert(strideSigned > 0, fmt::format("Invalid byte stride for {} accessor", name));
+
+      AccessorView result;
+      result.count = acc.count;
+      result.stride = static_cast< size_t >(strideSigned);
+      result.componentType = static_cast< ComponentType >(acc.componentType);
+      result.numComponents = static_cast< uint32_t >(
+         tinygltf::GetNumComponentsInType(static_cast< uint32_t >(acc.type)));
+      result.normalized = acc.normalized;
+
+      const auto offset = view.byteOffset + acc.byteOffset;
+      const auto elementSize =
+         static_cast< size_t >(ComponentSize(result.componentType)) * result.numComponents;
+      utils::Assert(acc.count == 0
+                       || offset + (acc.count - 1) * result.stride + elementSize
+                             <= buffer.data.size(),
+                    fmt::format("{} accessor is out of buffer bounds", name));
+
       // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-      const auto* elemPtr = basePtr + (idx * stride);
-      return *reinterpret_cast< const glm::vec3* >(elemPtr);
+      result.data = buffer.data.data() + offset;
+      return result;
    };
 
-   auto readVec4 = [&](const tinygltf::Accessor& acc, size_t idx) -> glm::vec4 {
-      utils::Assert(acc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT
-                       && acc.type == TINYGLTF_TYPE_VEC4,
-                    "Unsupported accessor format for VEC4");
+   auto resolveAttribute = [&](const tinygltf::Accessor& acc, int expectedType, size_t numVertices,
+                               std::string_view name) -> AccessorView {
+      utils::Assert(IsSupportedAttribute(static_cast< ComponentType >(acc.componentType)),
+                    fmt::format("Unsupported component type {} for {}", acc.componentType, name));
+      utils::Assert(acc.count == numVertices,
+                    fmt::format("{} count {} doesn't match POSITION count {}", name, acc.count,
+                                numVertices));
 
-      const auto viewIdx = checkedIndex(acc.bufferView, model.bufferViews.size(), "bufferView");
-      const auto& view = model.bufferViews[viewIdx];
-      const auto* basePtr = fetch(acc, model);
-      const auto strideSigned = acc.ByteStride(view);
-      utils::Assert(strideSigned > 0, "Invalid byte stride for VEC4 accessor");
-      const auto stride = static_cast< size_t >(strideSigned);
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-      const auto* elemPtr = basePtr + (idx * stride);
-      return *reinterpret_cast< const glm::vec4* >(elemPtr);
+      return resolveAccessor(acc, expectedType, name);
    };
 
    auto nodeLocalMat = [](const tinygltf::Node& node) {
@@ -214,21 +241,19 @@ Model::LoadModel(const std::string& file)
       return local;
    };
 
-   auto processPrimitive = [&](const tinygltf::Primitive& prim, const glm::mat4& worldMat,
-                               const std::string& meshName) {
-      if (prim.mode != TINYGLTF_MODE_TRIANGLES)
-      {
-         trace::Logger::Warn("Skipping primitive in mesh {}: only TRIANGLES are supported",
-                             meshName);
-         return;
-      }
+   // Primitive to decode, collected in scene traversal order
+   struct PrimitiveJob
+   {
+      const tinygltf::Primitive* prim{};
+      const std::string* meshName{};
+      glm::mat4 worldMat{};
+   };
 
+   // Runs on the thread pool, so it should only read the glTF model
+   auto decodePrimitive = [&](const PrimitiveJob& job) -> Mesh {
+      const auto& prim = *job.prim;
+      const auto& worldMat = job.worldMat;
       const auto posIt = prim.attributes.find("POSITION");
-      if (posIt == prim.attributes.end())
-      {
-         trace::Logger::Warn("Skipping primitive in mesh {}: no POSITION attribute", meshName);
-         return;
-      }
 
       render::TextureMaps texts = {};
       texts[0] = "196.png";
@@ -271,45 +296,29 @@ Model::LoadModel(const std::string& file)
          tanAcc = &model.accessors[tanAccessorIdx];
       }
 
+      // Value-initialized, so missing attributes stay zero
       std::vector< render::Vertex > vertices(posAcc.count);
       const glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(worldMat)));
 
-      for (size_t i = 0; i < posAcc.count; ++i)
-      {
-         render::Vertex v{};
-
-         const auto localPos = readVec3(posAcc, i);
-         v.m_position = glm::vec3(worldMat * glm::vec4(localPos, 1.0F));
-
-         if (nrmAcc != nullptr)
-         {
-            v.m_normal = glm::normalize(normalMat * readVec3(*nrmAcc, i));
-         }
-         else
-         {
-            v.m_normal = glm::vec3(0.0F);
-         }
+      DecodePositions(resolveAttribute(posAcc, TINYGLTF_TYPE_VEC3, posAcc.count, "POSITION"),
+                      worldMat, vertices);
 
-         if (uvAcc != nullptr)
-         {
-            v.m_texCoords = readVec2(*uvAcc, i);
-         }
-         else
-         {
-            v.m_texCoords = glm::vec2(0.0F);
-         }
+      if (nrmAcc != nullptr)
+      {
+         DecodeNormals(resolveAttribute(*nrmAcc, TINYGLTF_TYPE_VEC3, posAcc.count, "NORMAL"),
+                       normalMat, vertices);
+      }
 
-         if (tanAcc != nullptr)
-         {
-            const auto tangent = readVec4(*tanAcc, i);
-            v.m_tangent = glm::normalize(normalMat * glm::vec3(tangent));
-         }
-         else
-         {
-            v.m_tangent = glm::vec3(0.0F);
-         }
+      if (uvAcc != nullptr)
+      {
+         DecodeTexCoords(
+            resolveAttribute(*uvAcc, TINYGLTF_TYPE_VEC2, posAcc.count, "TEXCOORD_0"), vertices);
+      }
 
-         vertices[i] = v;
+      if (tanAcc != nullptr)
+      {
+         DecodeTangents(resolveAttribute(*tanAcc, TINYGLTF_TYPE_VEC4, posAcc.count, "TANGENT"),
+                        normalMat, vertices);
       }
 
       std::vector< uint32_t > indices;
@@ -318,42 +327,11 @@ Model::LoadModel(const std::string& file)
          const auto idxAccessorIdx =
             checkedIndex(prim.indices, model.accessors.size(), "indices accessor");
          const auto& idxAcc = model.accessors[idxAccessorIdx];
-         const auto idxViewIdx =
-            checkedIndex(idxAcc.bufferView, model.bufferViews.size(), "indices bufferView");
-         const auto& idxView = model.bufferViews[idxViewIdx];
-         const auto* idxPtr = fetch(idxAcc, model);
-         const auto componentSize = tinygltf::GetComponentSizeInBytes(
-            static_cast< uint32_t >(idxAcc.componentType));
-         utils::Assert(componentSize > 0, "Invalid component size for index accessor");
-
-         const auto rawStride = idxAcc.ByteStride(idxView);
-         if (rawStride != 0)
-         {
-            utils::Assert(rawStride > 0, "Invalid byte stride for index accessor");
-         }
-         const auto stride =
-            rawStride == 0 ? static_cast< size_t >(componentSize) : static_cast< size_t >(rawStride);
+         utils::Assert(IsSupportedIndex(static_cast< ComponentType >(idxAcc.componentType)),
+                       fmt::format("Unsupported index type in mesh {}", *job.meshName));
 
          indices.resize(idxAcc.count);
-         for (size_t i = 0; i < idxAcc.count; ++i)
-         {
-            // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-            const auto* elemPtr = idxPtr + (i * stride);
-            switch (idxAcc.componentType)
-            {
-               case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                  indices[i] = *reinterpret_cast< const uint8_t* >(elemPtr);
-                  break;
-               case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                  indices[i] = *reinterpret_cast< const uint16_t* >(elemPtr);
-                  break;
-               case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                  indices[i] = *reinterpret_cast< const uint32_t* >(elemPtr);
-                  break;
-               default:
-                  throw std::runtime_error("unsupported index type");
-            }
-         }
+         DecodeIndices(resolveAccessor(idxAcc, TINYGLTF_TYPE_SCALAR, "indices"), indices);
       }
       else
       {
@@ -364,13 +342,20 @@ Model::LoadModel(const std::string& file)
          }
       }
 
-      numVertices_ += static_cast< uint32_t >(vertices.size());
-      numIndices_ += static_cast< uint32_t >(indices.size());
-      meshes_.emplace_back(meshName, std::move(vertices), std::move(indices), std::move(texts));
+      return {*job.meshName, std::move(vertices), std::move(indices), std::move(texts)};
    };
 
-   std::function< void(int, const glm::mat4&) > processNode =
-      [&](int nodeIndex, const glm::mat4& parentMat) {
+   std::vector< PrimitiveJob > jobs;
+
+   // Depth-first (pre-order) traversal, so the meshes end up in the same order as with recursion
+   auto processNode = [&](int rootIndex) {
+      std::vector< std::pair< int, glm::mat4 > > stack = {{rootIndex, glm::mat4(1.0F)}};
+
+      while (!stack.empty())
+      {
+         const auto [nodeIndex, parentMat] = stack.back();
+         stack.pop_back();
+
          const auto nodeIdx = checkedIndex(nodeIndex, model.nodes.size(), "node");
          const auto& node = model.nodes[nodeIdx];
          const auto worldMat = parentMat * nodeLocalMat(node);
@@ -381,16 +366,31 @@ Model::LoadModel(const std::string& file)
             const auto& mesh = model.meshes[meshIdx];
             for (const auto& prim : mesh.primitives)
             {
-               processPrimitive(prim, worldMat, mesh.name);
+               if (prim.mode != TINYGLTF_MODE_TRIANGLES)
+               {
+                  trace::Logger::Warn(
+                     "Skipping primitive in mesh {}: only TRIANGLES are supported", mesh.name);
+                  continue;
+               }
+
+               if (prim.attributes.find("POSITION") == prim.attributes.end())
+               {
+                  trace::Logger::Warn("Skipping primitive in mesh {}: no POSITION attribute",
+                                      mesh.name);
+                  continue;
+               }
+
+               jobs.push_back({&prim, &mesh.name, worldMat});
             }
             trace::Logger::Debug("Loaded mesh {} from node {}", mesh.name, node.name);
          }
 
-         for (const auto childNode : node.children)
+         for (auto child = node.children.rbegin(); child != node.children.rend(); ++child)
          {
-            processNode(childNode, worldMat);
+            stack.emplace_back(*child, worldMat);
          }
-      };
+      }
+   };
 
    int sceneIndex = model.defaultScene;
    if (sceneIndex < 0)
@@ -403,7 +403,7 @@ Model::LoadModel(const std::string& file)
       const auto& scene = model.scenes[static_cast< size_t >(sceneIndex)];
       for (const auto rootNode : scene.nodes)
       {
-         processNode(rootNode, glm::mat4(1.0F));
+         processNode(rootNode);
       }
    }
    else
@@ -425,10 +425,73 @@ Model::LoadModel(const std::string& file)
       {
          if (!isChild[i])
          {
-            processNode(checkedInt(i, "node"), glm::mat4(1.0F));
+            processNode(checkedInt(i, "node"));
          }
       }
    }
+
+   // Primitives are independent of each other, every one of them is decoded into its own slot
+   // and merged afterwards, so the order of meshes doesn't depend on the scheduling. Meshes are
+   // optimized and their levels of detail are built right away, so both end up in the cache.
+   std::vector< Mesh > decoded(jobs.size());
+   std::vector< render::MeshOptimizationStats > optimizationStats(jobs.size());
+   auto& threadPool = utils::ThreadPool::GetShared();
+   threadPool.ParallelFor(jobs.size(), [&](size_t idx) {
+      decoded[idx] = decodePrimitive(jobs[idx]);
+      optimizationStats[idx] = decoded[idx].Optimize();
+      decoded[idx].BuildLods();
+   });
+
+   meshes_.reserve(meshes_.size() + decoded.size());
+   for (size_t idx = 0; idx < decoded.size(); ++idx)
+   {
+      auto& mesh = decoded[idx];
+      numVertices_ += static_cast< uint32_t >(mesh.GetVertices().size());
+      numIndices_ += static_cast< uint32_t >(mesh.GetIndices().size());
+      meshes_.push_back(std::move(mesh));
+      optimizationStats_ += optimizationStats[idx];
+   }
+
+   loadTimings_.decode = elapsedMs(stageStart);
+   trace::Logger::Debug("Decoded {} primitives on {} threads in {:.2f}ms", jobs.size(),
+                        threadPool.GetNumThreads(), loadTimings_.decode);
+   trace::Logger::Info("Vertex cache of {}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}", file,
+                       optimizationStats_.before.GetAcmr(), optimizationStats_.after.GetAcmr(),
+                       optimizationStats_.before.GetAtvr(), optimizationStats_.after.GetAtvr());
+
+   MeshCache::Write(file, sourceHash, meshes_, textureRefs);
+}
+
+void
+Model::LoadFromCache(MeshCache&& cache)
+{
+   using Clock = std::chrono::steady_clock;
+   const auto stageStart = Clock::now();
+
+   for (const auto& texture : cache.GetTextures())
+   {
+      render::TextureLibrary::CreateTexture(texture.type, texture.name);
+   }
+
+   loadTimings_.texture =
+      std::chrono::duration< double, std::milli >(Clock::now() - stageStart).count();
+
+   meshes_.reserve(meshes_.size() + cache.GetMeshes().size());
+   for (const auto& mesh : cache.GetMeshes())
+   {
+      auto textures = mesh.textures;
+      auto lods = mesh.lods;
+      meshes_.emplace_back(mesh.name, cache.GetVertices(mesh), cache.GetIndices(mesh),
+                           std::move(textures), cache.GetLodIndices(mesh), std::move(lods));
+
+      numVertices_ += mesh.vertexCount;
+      numIndices_ += mesh.range.indexCount;
+   }
+
+   // Views point into the mapping, which doesn't move along with the cache object
+   cache_ = std::move(cache);
+
+   trace::Logger::Debug("Loaded {} meshes of {} from cache", meshes_.size(), name_);
 }
 
 Model::Model(const std::string& path)
@@ -468,12 +531,38 @@ Model::RotateModel(const glm::vec3& rotate, float angle)
    }
 }
 
+void
+Model::SetDynamic(bool dynamic)
+{
+   dynamic_ = dynamic;
+}
+
+void
+Model::BuildMeshlets()
+{
+   const auto start = std::chrono::steady_clock::now();
+
+   auto& threadPool = utils::ThreadPool::GetShared();
+   threadPool.ParallelFor(meshes_.size(), [this](size_t idx) { meshes_[idx].BuildMeshlets(); });
+
+   size_t numMeshlets = 0;
+   for (const auto& mesh : meshes_)
+   {
+      numMeshlets += mesh.GetMeshlets().size();
+   }
+
+   loadTimings_.meshlets =
+      std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - start).count();
+   trace::Logger::Debug("Built {} meshlets of {} in {:.2f}ms", numMeshlets, name_,
+                        loadTimings_.meshlets);
+}
+
 void
 Model::Submit()
 {
    for (auto& mesh : meshes_)
    {
-      mesh.Submit();
+      mesh.Submit(dynamic_);
    }
 }
 
@@ -492,6 +581,18 @@ Model::GetMeshes()
    return meshes_;
 }
 
+const LoadTimings&
+Model::GetLoadTimings() const
+{
+   return loadTimings_;
+}
+
+const render::MeshOptimizationStats&
+Model::GetOptimizationStats() const
+{
+   return optimizationStats_;
+}
+
 void
 Model::ProcessNode(void*, const void*)
 {
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
 #include "render/types.hpp"
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -12,6 +14,21 @@
 
 namespace shady::scene {
 
+// Time (in milliseconds) spent in each stage of loading a model
+struct LoadTimings
+{
+   // Reading and parsing glTF file (JSON and binary buffers), or mapping the MeshCache
+   double parse = 0.0;
+   // Decoding vertices and indices of all primitives and building their levels of detail
+   double decode = 0.0;
+   // Loading material textures (image decoding and GPU upload)
+   double texture = 0.0;
+   // Splitting the meshes into meshlets, zero when they're not built
+   double meshlets = 0.0;
+   // Handing the meshes over to Renderer, their GPU buffers are only created and uploaded by
+   // Renderer::CreateRenderPipeline (see Renderer::GetGeometryUploadTime)
+   double submit = 0.0;
+};
 
 class Model
 {
@@ -28,6 +45,14 @@ class Model
    void
    RotateModel(const glm::vec3& rotate, float angle);
 
+   // Dynamic models can move after being submitted, their shadows are not cached
+   void
+   SetDynamic(bool dynamic);
+
+   // Has to be called before Submit, meshlets are not part of the MeshCache
+   void
+   BuildMeshlets();
+
    void
    Submit();
 
@@ -37,6 +62,15 @@ class Model
    [[nodiscard]] std::vector< Mesh >&
    GetMeshes();
 
+   // 'submit' is not known by the model and is left at zero
+   [[nodiscard]] const LoadTimings&
+   GetLoadTimings() const;
+
+   // Vertex cache statistics of all meshes before and after they were optimized, empty when
+   // the model was loaded from the MeshCache (its meshes are already optimized)
+   [[nodiscard]] const render::MeshOptimizationStats&
+   GetOptimizationStats() const;
+
    [[nodiscard]] static std::unique_ptr< Model >
    CreatePlane();
 
@@ -53,10 +87,18 @@ class Model
    void
    LoadModel(const std::string& path);
 
+   // Meshes reference vertices and indices stored in 'cache', which is kept alive by the model
+   void
+   LoadFromCache(MeshCache&& cache);
+
  private:
    std::vector< Mesh > meshes_;
    uint32_t numVertices_ = 0;
    uint32_t numIndices_ = 0;
+   LoadTimings loadTimings_ = {};
+   render::MeshOptimizationStats optimizationStats_ = {};
+   std::optional< MeshCache > cache_ = std::nullopt;
+   bool dynamic_ = false;
 
    std::string name_ = "DefaultName";
 };
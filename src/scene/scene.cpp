@@ -2,8 +2,10 @@
 #include "render/renderer.hpp"
 #include "scene/perspective_camera.hpp"
 #include "time/scoped_timer.hpp"
+#include "trace/logger.hpp"
 #include "utils/file_manager.hpp"
 
+#include <chrono>
 #include <fmt/format.h>
 
 
@@ -30,23 +32,75 @@ Scene::GetLight()
 
 void Scene::Render(int32_t /*windowWidth*/, int32_t /*windowHeight*/)
 {
+   render::Renderer::BeginFrame();
+   m_light->FitToCamera(*m_camera);
    render::Renderer::UpdateUniformBuffer(m_camera.get(), m_light.get());
    render::Renderer::Draw();
 }
 
+const LoadTimings&
+Scene::GetLoadTimings() const
+{
+   return m_loadTimings;
+}
+
+const render::MeshOptimizationStats&
+Scene::GetOptimizationStats() const
+{
+   return m_optimizationStats;
+}
+
 void
 Scene::LoadDefault()
 {
-   const time::ScopedTimer loadScope("Scene::LoadDefault");
+   Load((utils::FileManager::MODELS_DIR / "new_sponza" / "NewSponza_Main_glTF_003.gltf").string());
+}
+
+void
+Scene::SetMeshletsEnabled(bool enabled)
+{
+   m_meshletsEnabled = enabled;
+}
+
+void
+Scene::Load(const std::string& modelPath)
+{
+   const time::ScopedTimer loadScope(fmt::format("Scene::Load({})", modelPath));
 
-   AddModel((utils::FileManager::MODELS_DIR / "new_sponza" / "NewSponza_Main_glTF_003.gltf").string());
+   AddModel(modelPath);
+   if (m_meshletsEnabled)
+   {
+      m_models.back()->BuildMeshlets();
+   }
 
+   auto timings = m_models.back()->GetLoadTimings();
+
+   const auto submitStart = std::chrono::steady_clock::now();
    m_models.back()->Submit();
+   timings.submit =
+      std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - submitStart)
+         .count();
+
+   m_loadTimings.parse += timings.parse;
+   m_loadTimings.decode += timings.decode;
+   m_loadTimings.texture += timings.texture;
+   m_loadTimings.meshlets += timings.meshlets;
+   m_loadTimings.submit += timings.submit;
+   m_optimizationStats += m_models.back()->GetOptimizationStats();
+
+   trace::Logger::Info(
+      "Loaded {} parse: {:.2f}ms decode: {:.2f}ms texture: {:.2f}ms meshlets: {:.2f}ms "
+      "submit: {:.2f}ms",
+      modelPath, timings.parse, timings.decode, timings.texture, timings.meshlets, timings.submit);
 
    m_light =
       std::make_unique< scene::Light >(glm::vec3(0.0f, 150.0f, 0.0f), glm::vec3(1.0f, 0.8f, 0.7f),
                                        scene::LightType::DIRECTIONAL_LIGHT);
 
+   const auto [sceneMin, sceneMax] = render::Renderer::GetSceneBounds();
+   m_light->SetSceneBounds(sceneMin, sceneMax);
+   render::Renderer::ConfigureShadows(*m_light);
+
    m_camera = std::make_unique< scene::PerspectiveCamera >(70.0f, 16.0f / 9.0f, 0.1f, 500.0f,
                                                            glm::vec3(0.0f, 20.0f, 0.0f));
 }
@@ -28,11 +28,30 @@ class Scene
    void
    LoadDefault();
 
+   void
+   Load(const std::string& modelPath);
+
+   // Whether models loaded afterwards are split into meshlets (cluster culling), on by default
+   void
+   SetMeshletsEnabled(bool enabled);
+
+   // Accumulated over all loaded models. GPU buffers are created later (by
+   // Renderer::CreateRenderPipeline), so they're not part of 'submit'
+   [[nodiscard]] const LoadTimings&
+   GetLoadTimings() const;
+
+   // Accumulated over all models decoded from glTF (cached ones are not included)
+   [[nodiscard]] const render::MeshOptimizationStats&
+   GetOptimizationStats() const;
+
  private:
    // Skybox m_skybox;
    std::unique_ptr< Camera > m_camera;
    std::vector< std::unique_ptr< Model > > m_models;
    std::unique_ptr< Light > m_light;
+   LoadTimings m_loadTimings = {};
+   render::MeshOptimizationStats m_optimizationStats = {};
+   bool m_meshletsEnabled = true;
 };
 
 } // namespace shady::scene
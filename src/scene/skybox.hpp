@@ -1,7 +1,9 @@
 #pragma once
 
 #include "render/buffer.hpp"
+#include "render/types.hpp"
 
+#include <array>
 #include <glm/glm.hpp>
 #include <string_view>
 #include <vulkan/vulkan.h>
@@ -33,21 +35,27 @@ class Skybox
    LoadCubeMap(std::string_view skyboxName);
 
    /*
-    *  Draw commands for 'commandBuffer'
+    *  Draw commands for 'commandBuffer', using resources of given frame in flight
     */
    void
-   Draw(VkCommandBuffer commandBuffer);
+   Draw(VkCommandBuffer commandBuffer, uint32_t frame);
 
    /*
-    *  Update uniform buffer (SkyboxUBO)
+    *  Update uniform buffer (SkyboxUBO) of given frame in flight
     */
    void
-   UpdateBuffers(const scene::Camera* camera);
+   UpdateBuffers(const scene::Camera* camera, uint32_t frame);
 
  private:
+   // Creates the pipeline layout and the pipeline, which is registered for hot reloading
    void
    CreatePipeline();
 
+   // Safe to call from any thread once the pipeline layout exists,
+   // VK_NULL_HANDLE when the shaders or the pipeline can't be created (the error is logged)
+   [[nodiscard]] VkPipeline
+   BuildPipeline() const;
+
    void
    CreateDescriptorSet();
 
@@ -61,7 +69,7 @@ class Skybox
    VkPipeline m_pipeline = {};
    VkPipelineLayout m_pipelineLayout = {};
    VkDescriptorSetLayout m_descriptorSetLayout = {};
-   VkDescriptorSet m_descriptorSet = {};
+   std::array< VkDescriptorSet, render::MAX_FRAMES_IN_FLIGHT > m_descriptorSets = {};
    VkDescriptorPool m_descriptorPool = {};
 
    VkImage m_image = {};
@@ -71,7 +79,7 @@ class Skybox
 
    render::Buffer m_vertexBuffer = {};
    render::Buffer m_indexBuffer = {};
-   render::Buffer m_uniformBuffer = {};
+   std::array< render::Buffer, render::MAX_FRAMES_IN_FLIGHT > m_uniformBuffers = {};
 };
 
 } // namespace shady::scene
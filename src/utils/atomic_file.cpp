@@ -0,0 +1,48 @@
+#include "atomic_file.hpp"
+#include "trace/logger.hpp"
+
+#include <fstream>
+#include <system_error>
+
+namespace shady::utils {
+
+bool
+WriteFileAtomic(const std::filesystem::path& path,
+                const std::function< bool(std::ostream&) >& write)
+{
+   std::error_code error;
+   std::filesystem::create_directories(path.parent_path(), error);
+
+   auto tempPath = path;
+   tempPath += ".tmp";
+
+   {
+      std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+      if (!stream.is_open())
+      {
+         trace::Logger::Warn("WriteFileAtomic: can't create {}", tempPath.string());
+         return false;
+      }
+
+      if (!write(stream) || !stream.good())
+      {
+         trace::Logger::Warn("WriteFileAtomic: failed to write {}", tempPath.string());
+         stream.close();
+         std::filesystem::remove(tempPath, error);
+         return false;
+      }
+   }
+
+   std::filesystem::rename(tempPath, path, error);
+   if (error)
+   {
+      trace::Logger::Warn("WriteFileAtomic: can't rename {} to {}: {}", tempPath.string(),
+                          path.string(), error.message());
+      std::filesystem::remove(tempPath, error);
+      return false;
+   }
+
+   return true;
+}
+
+} // namespace shady::utils
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <ostream>
+
+namespace shady::utils {
+
+/*
+ * Writes 'path' through 'write', which gets a binary stream of a temporary file next to it
+ * ('path' + ".tmp"). The temporary file then replaces 'path' with a rename, so whoever reads it
+ * (another thread, or the next run after the application was killed in the middle of writing)
+ * sees either the previous or the complete new file, never a partially written one. Parent
+ * directories are created as needed.
+ *
+ * Returns false when the file can't be created, 'write' returns false or the stream fails. The
+ * reason is logged, the temporary file is removed and 'path' is left untouched.
+ */
+[[nodiscard]] bool
+WriteFileAtomic(const std::filesystem::path& path,
+                const std::function< bool(std::ostream&) >& write);
+
+} // namespace shady::utils
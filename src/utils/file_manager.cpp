@@ -83,7 +83,8 @@ FileManager::ReadTexture(std::string_view fileName, bool flipVertical)
    int h{};
    int n{};
 
-   stbi_set_flip_vertically_on_load(flipVertical);
+   // Textures are decoded on multiple threads, global flag would race
+   stbi_set_flip_vertically_on_load_thread(static_cast< int >(flipVertical));
 
    render::ImageHandleType textureData(stbi_load(pathToImage.c_str(), &w, &h, &n, force_channels),
                                        stbi_image_free);
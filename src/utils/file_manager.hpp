@@ -33,6 +33,8 @@ class FileManager
    static inline const std::filesystem::path SHADERS_DIR = ASSETS_DIR / "shaders";
    static inline const std::filesystem::path MODELS_DIR = ASSETS_DIR / "models";
    static inline const std::filesystem::path FONTS_DIR = ASSETS_DIR / "fonts";
+   // Generated data (e.g. decoded meshes), safe to delete
+   static inline const std::filesystem::path CACHE_DIR = ROOT_DIR / "cache";
 //NOLINTEND
 
  public:
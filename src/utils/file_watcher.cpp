@@ -0,0 +1,130 @@
+#include "file_watcher.hpp"
+#include "trace/logger.hpp"
+
+#include <algorithm>
+#include <system_error>
+
+#if defined(__linux__)
+#include <array>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace shady::utils {
+
+#if defined(__linux__)
+
+FileWatcher::~FileWatcher()
+{
+   if (fd_ >= 0)
+   {
+      close(fd_);
+   }
+}
+
+bool
+FileWatcher::Watch(const std::filesystem::path& directory)
+{
+   if (fd_ < 0)
+   {
+      fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (fd_ < 0)
+      {
+         trace::Logger::Warn("FileWatcher: inotify_init1 failed: {}", std::strerror(errno));
+         return false;
+      }
+   }
+
+   std::vector< std::filesystem::path > directories = {directory};
+   std::error_code error;
+   for (const auto& entry : std::filesystem::recursive_directory_iterator(directory, error))
+   {
+      if (entry.is_directory())
+      {
+         directories.push_back(entry.path());
+      }
+   }
+
+   // Only finished writes, so a file is never reported while it's still being written
+   constexpr uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+   for (const auto& path : directories)
+   {
+      const auto wd = inotify_add_watch(fd_, path.c_str(), mask);
+      if (wd < 0)
+      {
+         trace::Logger::Warn("FileWatcher: can't watch {}: {}", path.string(),
+                             std::strerror(errno));
+         return false;
+      }
+      directories_[wd] = path;
+   }
+
+   return true;
+}
+
+std::vector< std::filesystem::path >
+FileWatcher::Poll()
+{
+   std::vector< std::filesystem::path > changed;
+   if (fd_ < 0)
+   {
+      return changed;
+   }
+
+   alignas(inotify_event) std::array< char, 4096 > buffer = {};
+   while (true)
+   {
+      const auto length = read(fd_, buffer.data(), buffer.size());
+      if (length <= 0)
+      {
+         // EAGAIN, nothing else to read
+         break;
+      }
+
+      for (size_t offset = 0; offset < static_cast< size_t >(length);)
+      {
+         inotify_event event = {};
+         std::memcpy(&event, buffer.data() + offset, sizeof(event));
+
+         const auto directory = directories_.find(event.wd);
+         if (event.len > 0 && directory != directories_.end())
+         {
+            // Name is null terminated (and padded) within 'len' bytes
+            const auto* name = buffer.data() + offset + sizeof(event);
+            auto path = directory->second / name;
+            if (std::find(changed.begin(), changed.end(), path) == changed.end())
+            {
+               changed.push_back(std::move(path));
+            }
+         }
+
+         offset += sizeof(event) + event.len;
+      }
+   }
+
+   return changed;
+}
+
+#else
+
+FileWatcher::~FileWatcher() = default;
+
+bool
+FileWatcher::Watch(const std::filesystem::path& directory)
+{
+   trace::Logger::Warn("FileWatcher: not supported on this platform, {} won't be watched",
+                       directory.string());
+   return false;
+}
+
+std::vector< std::filesystem::path >
+FileWatcher::Poll()
+{
+   return {};
+}
+
+#endif
+
+} // namespace shady::utils
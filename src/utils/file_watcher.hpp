@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+namespace shady::utils {
+
+/*
+ * Reports files written or moved into watched directories (inotify). Doesn't block, so it can be
+ * polled every frame. Only implemented on Linux, elsewhere Watch fails and nothing is reported.
+ */
+class FileWatcher
+{
+ public:
+   FileWatcher() = default;
+   ~FileWatcher();
+
+   FileWatcher(const FileWatcher&) = delete;
+   FileWatcher& operator=(const FileWatcher&) = delete;
+   FileWatcher(FileWatcher&&) = delete;
+   FileWatcher& operator=(FileWatcher&&) = delete;
+
+   // Watch 'directory' and its subdirectories (only the ones that exist at the time of the call)
+   bool
+   Watch(const std::filesystem::path& directory);
+
+   // Files changed since the last call, each one is listed once
+   [[nodiscard]] std::vector< std::filesystem::path >
+   Poll();
+
+ private:
+   int fd_ = -1;
+   // Watch descriptor -> watched directory
+   std::unordered_map< int, std::filesystem::path > directories_;
+};
+
+} // namespace shady::utils
@@ -0,0 +1,48 @@
+#include "hash.hpp"
+#include "mapped_file.hpp"
+
+#include <cstring>
+
+namespace shady::utils {
+
+uint64_t
+HashBytes(const uint8_t* data, size_t size, uint64_t seed)
+{
+   constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+   constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+   const auto mix = [](uint64_t value) {
+      value ^= value >> 33;
+      value *= prime2;
+      value ^= value >> 29;
+      return value;
+   };
+
+   auto hash = seed ^ (size * prime1);
+
+   size_t offset = 0;
+   for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+   {
+      uint64_t word = 0;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::memcpy(&word, data + offset, sizeof(word));
+      hash = (hash ^ mix(word * prime1)) * prime1;
+      hash = (hash << 27) | (hash >> 37);
+   }
+
+   uint64_t tail = 0;
+   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+   std::memcpy(&tail, data + offset, size - offset);
+   hash = (hash ^ mix(tail * prime1)) * prime1;
+
+   return mix(hash);
+}
+
+uint64_t
+HashFile(const std::filesystem::path& path, uint64_t seed)
+{
+   const auto file = MappedFile::Open(path);
+   return file ? HashBytes(file->GetData(), file->GetSize(), seed) : seed;
+}
+
+} // namespace shady::utils
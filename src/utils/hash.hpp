@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace shady::utils {
+
+// 64-bit multiply-xorshift hash, consumes 8 bytes per step. Not cryptographic, only meant for
+// detecting changes of cached data's sources.
+[[nodiscard]] uint64_t
+HashBytes(const uint8_t* data, size_t size, uint64_t seed);
+
+// Hash of the file's contents, 'seed' when it doesn't exist or is empty
+[[nodiscard]] uint64_t
+HashFile(const std::filesystem::path& path, uint64_t seed);
+
+} // namespace shady::utils
@@ -0,0 +1,157 @@
+#include "mapped_file.hpp"
+
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace shady::utils {
+
+MappedFile::~MappedFile()
+{
+   Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+   : data_(std::exchange(other.data_, nullptr)),
+     size_(std::exchange(other.size_, 0))
+#if defined(_WIN32)
+     ,
+     fileHandle_(std::exchange(other.fileHandle_, nullptr)),
+     mappingHandle_(std::exchange(other.mappingHandle_, nullptr))
+#endif
+{
+}
+
+MappedFile&
+MappedFile::operator=(MappedFile&& other) noexcept
+{
+   if (this != &other)
+   {
+      Close();
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+#if defined(_WIN32)
+      fileHandle_ = std::exchange(other.fileHandle_, nullptr);
+      mappingHandle_ = std::exchange(other.mappingHandle_, nullptr);
+#endif
+   }
+
+   return *this;
+}
+
+std::optional< MappedFile >
+MappedFile::Open(const std::filesystem::path& path)
+{
+   MappedFile file;
+
+#if defined(_WIN32)
+   file.fileHandle_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (file.fileHandle_ == INVALID_HANDLE_VALUE)
+   {
+      file.fileHandle_ = nullptr;
+      return std::nullopt;
+   }
+
+   LARGE_INTEGER size = {};
+   if (!GetFileSizeEx(file.fileHandle_, &size) || size.QuadPart == 0)
+   {
+      return std::nullopt;
+   }
+   file.size_ = static_cast< size_t >(size.QuadPart);
+
+   file.mappingHandle_ =
+      CreateFileMappingW(file.fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+   if (file.mappingHandle_ == nullptr)
+   {
+      return std::nullopt;
+   }
+
+   file.data_ =
+      static_cast< const uint8_t* >(MapViewOfFile(file.mappingHandle_, FILE_MAP_READ, 0, 0, 0));
+#else
+   const auto fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0)
+   {
+      return std::nullopt;
+   }
+
+   struct stat fileStat = {};
+   if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+   {
+      close(fd);
+      return std::nullopt;
+   }
+   file.size_ = static_cast< size_t >(fileStat.st_size);
+
+   auto* mapping = mmap(nullptr, file.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+   // Mapping keeps its own reference to the file
+   close(fd);
+
+   if (mapping == MAP_FAILED)
+   {
+      return std::nullopt;
+   }
+
+   file.data_ = static_cast< const uint8_t* >(mapping);
+#endif
+
+   if (file.data_ == nullptr)
+   {
+      return std::nullopt;
+   }
+
+   return file;
+}
+
+const uint8_t*
+MappedFile::GetData() const
+{
+   return data_;
+}
+
+size_t
+MappedFile::GetSize() const
+{
+   return size_;
+}
+
+void
+MappedFile::Close()
+{
+#if defined(_WIN32)
+   if (data_ != nullptr)
+   {
+      UnmapViewOfFile(data_);
+   }
+   if (mappingHandle_ != nullptr)
+   {
+      CloseHandle(mappingHandle_);
+   }
+   if (fileHandle_ != nullptr)
+   {
+      CloseHandle(fileHandle_);
+   }
+   mappingHandle_ = nullptr;
+   fileHandle_ = nullptr;
+#else
+   if (data_ != nullptr)
+   {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+      munmap(const_cast< uint8_t* >(data_), size_);
+   }
+#endif
+
+   data_ = nullptr;
+   size_ = 0;
+}
+
+} // namespace shady::utils
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+namespace shady::utils {
+
+/*
+ * Read-only memory mapped file. Mapping is released when the object is destroyed,
+ * so every pointer obtained from GetData() has to be dropped before that.
+ */
+class MappedFile
+{
+ public:
+   MappedFile() = default;
+   ~MappedFile();
+
+   MappedFile(const MappedFile&) = delete;
+   MappedFile& operator=(const MappedFile&) = delete;
+   MappedFile(MappedFile&& other) noexcept;
+   MappedFile& operator=(MappedFile&& other) noexcept;
+
+   // Returns std::nullopt when the file doesn't exist, is empty or can't be mapped
+   [[nodiscard]] static std::optional< MappedFile >
+   Open(const std::filesystem::path& path);
+
+   [[nodiscard]] const uint8_t*
+   GetData() const;
+
+   [[nodiscard]] size_t
+   GetSize() const;
+
+ private:
+   void
+   Close();
+
+ private:
+   const uint8_t* data_ = nullptr;
+   size_t size_ = 0;
+#if defined(_WIN32)
+   void* fileHandle_ = nullptr;
+   void* mappingHandle_ = nullptr;
+#endif
+};
+
+} // namespace shady::utils
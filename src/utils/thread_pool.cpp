@@ -0,0 +1,235 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace shady::utils {
+
+namespace {
+
+// Chunks of a single ParallelFor call, shared with the tasks that help executing them
+struct ParallelForState
+{
+   const std::function< void(size_t) >* task = nullptr;
+   size_t count = 0;
+   size_t numChunks = 0;
+   std::atomic< size_t > nextChunk = 0;
+   std::atomic< size_t > finishedChunks = 0;
+   std::mutex mutex;
+   std::condition_variable doneCondition;
+};
+
+// Execute chunks nobody has claimed yet, tasks that come too late return right away
+void
+runChunks(ParallelForState& state)
+{
+   for (auto chunk = state.nextChunk++; chunk < state.numChunks; chunk = state.nextChunk++)
+   {
+      const auto begin = state.count * chunk / state.numChunks;
+      const auto end = state.count * (chunk + 1) / state.numChunks;
+      for (auto idx = begin; idx < end; ++idx)
+      {
+         (*state.task)(idx);
+      }
+
+      if (++state.finishedChunks == state.numChunks)
+      {
+         {
+            const std::lock_guard< std::mutex > lock(state.mutex);
+         }
+         state.doneCondition.notify_all();
+      }
+   }
+}
+
+} // namespace
+
+ThreadPool::ThreadPool(uint32_t numWorkers)
+{
+   // Last queue belongs to the thread calling Wait()
+   for (uint32_t i = 0; i < numWorkers + 1; ++i)
+   {
+      queues_.push_back(std::make_unique< WorkQueue >());
+   }
+
+   workers_.reserve(numWorkers);
+   for (uint32_t i = 0; i < numWorkers; ++i)
+   {
+      workers_.emplace_back([this, i] { WorkerLoop(i); });
+   }
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      const std::lock_guard< std::mutex > lock(wakeMutex_);
+      stop_ = true;
+   }
+   wakeCondition_.notify_all();
+
+   for (auto& worker : workers_)
+   {
+      worker.join();
+   }
+}
+
+void
+ThreadPool::Submit(Task&& task)
+{
+   const auto queueIdx = nextQueue_++ % static_cast< uint32_t >(queues_.size());
+
+   // Counted before it's visible to the workers, so Wait() can't miss it
+   ++pendingTasks_;
+
+   {
+      const std::lock_guard< std::mutex > lock(queues_[queueIdx]->mutex);
+      queues_[queueIdx]->tasks.push_back(std::move(task));
+   }
+
+   {
+      // Empty critical section prevents lost wake ups between the check and the wait in workers
+      const std::lock_guard< std::mutex > lock(wakeMutex_);
+   }
+   wakeCondition_.notify_one();
+}
+
+void
+ThreadPool::Wait()
+{
+   const auto queueIdx = static_cast< uint32_t >(queues_.size() - 1);
+
+   Task task;
+   while (pendingTasks_ > 0)
+   {
+      if (PopTask(queueIdx, task))
+      {
+         RunTask(task);
+      }
+      else
+      {
+         // Remaining tasks are already being executed by the workers
+         std::unique_lock< std::mutex > lock(wakeMutex_);
+         doneCondition_.wait(lock, [this] { return pendingTasks_ == 0; });
+      }
+   }
+}
+
+void
+ThreadPool::ParallelFor(size_t count, const std::function< void(size_t) >& task)
+{
+   if (count == 0)
+   {
+      return;
+   }
+
+   // Few chunks per thread keep the scheduling overhead low, while still letting threads that
+   // finished early take the remaining work
+   auto state = std::make_shared< ParallelForState >();
+   state->task = &task;
+   state->count = count;
+   state->numChunks = std::min< size_t >(count, static_cast< size_t >(GetNumThreads()) * 4);
+
+   // Calling thread executes chunks as well, so helpers are only needed for the rest. Helpers
+   // claim chunks from the shared state, which outlives this call if they run late.
+   const auto numHelpers = std::min(state->numChunks - 1, workers_.size());
+   for (size_t helper = 0; helper < numHelpers; ++helper)
+   {
+      Submit([state] { runChunks(*state); });
+   }
+
+   // Completion is tracked per call, so the caller never waits for unrelated tasks. When it's
+   // called from a task and every worker is busy, it simply executes all the chunks itself.
+   runChunks(*state);
+
+   std::unique_lock< std::mutex > lock(state->mutex);
+   state->doneCondition.wait(lock,
+                             [&state] { return state->finishedChunks == state->numChunks; });
+}
+
+uint32_t
+ThreadPool::GetNumThreads() const
+{
+   return static_cast< uint32_t >(workers_.size() + 1);
+}
+
+ThreadPool&
+ThreadPool::GetShared()
+{
+   static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1U) - 1);
+   return pool;
+}
+
+void
+ThreadPool::WorkerLoop(uint32_t queueIdx)
+{
+   Task task;
+   while (true)
+   {
+      if (PopTask(queueIdx, task))
+      {
+         RunTask(task);
+         continue;
+      }
+
+      std::unique_lock< std::mutex > lock(wakeMutex_);
+      if (stop_)
+      {
+         return;
+      }
+
+      // Tasks that are pending but not yet picked up by anyone mean there's work to steal
+      wakeCondition_.wait(lock, [this] {
+         return stop_
+                || std::any_of(queues_.begin(), queues_.end(), [](const auto& queue) {
+                      const std::lock_guard< std::mutex > queueLock(queue->mutex);
+                      return !queue->tasks.empty();
+                   });
+      });
+   }
+}
+
+bool
+ThreadPool::PopTask(uint32_t queueIdx, Task& task)
+{
+   {
+      auto& own = *queues_[queueIdx];
+      const std::lock_guard< std::mutex > lock(own.mutex);
+      if (!own.tasks.empty())
+      {
+         task = std::move(own.tasks.back());
+         own.tasks.pop_back();
+         return true;
+      }
+   }
+
+   const auto numQueues = static_cast< uint32_t >(queues_.size());
+   for (uint32_t offset = 1; offset < numQueues; ++offset)
+   {
+      auto& victim = *queues_[(queueIdx + offset) % numQueues];
+      const std::lock_guard< std::mutex > lock(victim.mutex);
+      if (!victim.tasks.empty())
+      {
+         task = std::move(victim.tasks.front());
+         victim.tasks.pop_front();
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void
+ThreadPool::RunTask(Task& task)
+{
+   task();
+   task = nullptr;
+
+   if (--pendingTasks_ == 0)
+   {
+      {
+         const std::lock_guard< std::mutex > lock(wakeMutex_);
+      }
+      doneCondition_.notify_all();
+   }
+}
+
+} // namespace shady::utils
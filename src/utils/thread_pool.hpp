@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace shady::utils {
+
+/*
+ * Work-stealing thread pool. Every worker owns a task queue, it takes tasks from the back of
+ * its own queue and steals from the front of the others' when it runs out of work.
+ * Thread calling Wait() helps with executing tasks until all of them are finished.
+ * ParallelFor() only waits for its own chunks, so it can be called from within a task.
+ */
+class ThreadPool
+{
+ public:
+   using Task = std::function< void() >;
+
+   // 'numWorkers' doesn't include the thread calling Wait()
+   explicit ThreadPool(uint32_t numWorkers);
+   ~ThreadPool();
+
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool(ThreadPool&&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+   ThreadPool& operator=(ThreadPool&&) = delete;
+
+   void
+   Submit(Task&& task);
+
+   // Block until every submitted task has finished, must not be called from within a task
+   void
+   Wait();
+
+   // Call 'task(idx)' for every idx in [0, count) and wait for all of them. Calling thread
+   // executes chunks too, tasks submitted by others aren't waited for.
+   void
+   ParallelFor(size_t count, const std::function< void(size_t) >& task);
+
+   // Number of threads executing tasks (workers + thread calling Wait)
+   [[nodiscard]] uint32_t
+   GetNumThreads() const;
+
+   // Pool shared by the whole application, sized after the number of hardware threads
+   [[nodiscard]] static ThreadPool&
+   GetShared();
+
+ private:
+   struct WorkQueue
+   {
+      std::mutex mutex;
+      std::deque< Task > tasks;
+   };
+
+   void
+   WorkerLoop(uint32_t queueIdx);
+
+   // Pop from the back of 'queueIdx' queue or steal from the front of the other ones
+   [[nodiscard]] bool
+   PopTask(uint32_t queueIdx, Task& task);
+
+   void
+   RunTask(Task& task);
+
+ private:
+   // One queue per worker and one for the thread calling Wait()
+   std::vector< std::unique_ptr< WorkQueue > > queues_;
+   std::vector< std::thread > workers_;
+
+   std::mutex wakeMutex_;
+   std::condition_variable wakeCondition_;
+   std::condition_variable doneCondition_;
+
+   std::atomic< size_t > pendingTasks_ = 0;
+   std::atomic< uint32_t > nextQueue_ = 0;
+   bool stop_ = false;
+};
+
+} // namespace shady::utils